@@ -0,0 +1,28 @@
+#version 450
+
+// Depth pre-pass. Reads only the position, and computes gl_Position the same way as tri_mesh.vert
+// so the shading pass can test against it with EQUAL.
+layout (location = 0) in vec3 vPosition;
+
+layout (set = 0, binding = 0) uniform CameraBuffer{
+    mat4 view;
+    mat4 proj;
+    mat4 viewproj;
+} cameraData;
+
+struct ObjectData {
+    mat4 model;
+};
+
+layout (std140, set = 1, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+invariant gl_Position;
+
+void main()
+{
+    mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+    mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
+    gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+}
@@ -0,0 +1,148 @@
+#version 450
+
+// Shader input
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec2 texCoord;
+layout (location = 2) in vec3 worldPos;
+layout (location = 3) in vec3 worldNormal;
+layout (location = 4) in float viewDepth;
+
+// Output write
+layout (location=0) out vec4 outFragColor;
+
+layout (set=0, binding=1) uniform SceneData{
+    vec4 fogColor;
+    vec4 fogDistances;
+    vec4 ambientColor; // w scales the ambient term
+    vec4 sunlightDirection;
+    vec4 sunlightColor; // w is the intensity
+    vec4 clusterScale; // Pixels per froxel in x and y, then the depth slice scale and bias
+    uvec4 clusterGrid; // Froxels in x, y and z, and the most lights one froxel holds
+    mat4 shadowMatrices[4]; // World space to the clip space of each cascade
+    vec4 cascadeSplits; // View depth where each cascade ends
+    vec4 cascadeTexelSizes; // World space size of a shadow map texel in each cascade
+} sceneData;
+
+struct PointLight {
+    vec4 positionRadius;
+    vec4 colorIntensity;
+};
+
+layout (std430, set=0, binding=2) readonly buffer LightBuffer {
+    PointLight lights[];
+};
+layout (std430, set=0, binding=3) readonly buffer ClusterCountBuffer {
+    uint clusterCounts[];
+};
+layout (std430, set=0, binding=4) readonly buffer ClusterLightBuffer {
+    uint clusterLights[];
+};
+
+layout (set=0, binding=5) uniform sampler2DArrayShadow shadowMap;
+
+// How much of the sun reaches this fragment, from the cascade its view depth falls in
+float sunShadow(vec3 normal) {
+    uint cascade = 0;
+    while (cascade < 4 && viewDepth > sceneData.cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == 4) {
+        return 1.0;
+    }
+    // Offsetting along the normal by about a texel keeps flat surfaces from shadowing themselves
+    vec3 position = worldPos + normal * sceneData.cascadeTexelSizes[cascade] * 1.5;
+    vec4 coord = sceneData.shadowMatrices[cascade] * vec4(position, 1.0);
+    vec2 uv = coord.xy * 0.5 + 0.5;
+    // 3x3 taps, each one a bilinear 2x2 comparison
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            lit += texture(shadowMap, vec4(uv + vec2(x, y) * texel, float(cascade), coord.z));
+        }
+    }
+    return lit / 9.0;
+}
+
+// Sum of the point lights in the froxel this fragment falls in
+vec3 pointLighting(vec3 normal) {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / sceneData.clusterScale.xy), sceneData.clusterGrid.xy - 1);
+    float slice = log(max(viewDepth, 1e-4)) * sceneData.clusterScale.z + sceneData.clusterScale.w;
+    uint z = uint(clamp(slice, 0.0, float(sceneData.clusterGrid.z - 1)));
+    uint cluster = (z * sceneData.clusterGrid.y + tile.y) * sceneData.clusterGrid.x + tile.x;
+
+    vec3 result = vec3(0.0);
+    uint count = clusterCounts[cluster];
+    for (uint i = 0; i < count; i++) {
+        PointLight light = lights[clusterLights[cluster * sceneData.clusterGrid.w + i]];
+        vec3 toLight = light.positionRadius.xyz - worldPos;
+        float dist = length(toLight);
+        // Inverse square falloff, windowed so it reaches zero at the radius and the froxel lists can stay short
+        float window = clamp(1.0 - pow(dist / light.positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (dist * dist + 1.0);
+        float ndotl = max(dot(normal, toLight / max(dist, 1e-4)), 0.0);
+        result += light.colorIntensity.xyz * light.colorIntensity.w * attenuation * ndotl;
+    }
+    return result;
+}
+
+// Material features, one per bit of the material's feature mask in vk_pipeline.h. Each pipeline is built with its
+// material's features, so the code of every feature that's off is compiled away.
+layout (constant_id = 0) const bool TEXTURED = false; // Base color from tex1 instead of the vertex color
+layout (constant_id = 1) const bool ATLAS_TILES = false; // Greedy merged voxel faces, see atlasCoord
+layout (constant_id = 2) const bool SHADOWS = false;
+layout (constant_id = 3) const bool POINT_LIGHTS = false;
+layout (constant_id = 4) const bool FOG = false;
+layout (constant_id = 5) const bool GLOW = false; // The base color shows through unlit as well, over a tinted ambient
+
+layout(set = 2, binding = 0) uniform sampler2D tex1;
+
+// Greedy merged voxel quads span several blocks but have one atlas tile. inColor holds the tile's corner and width,
+// and texCoord counts blocks across the quad, so the tile repeats once per block. Tiles are square in texels, which
+// gives their height. Triangles that couldn't be turned into blocks get a zero color from VoxelWorld::voxelize,
+// so a zero width means texCoord is sampled as is.
+vec2 atlasCoord(out vec2 ddx, out vec2 ddy) {
+    if (inColor.z <= 0.0) {
+        ddx = dFdx(texCoord);
+        ddy = dFdy(texCoord);
+        return texCoord;
+    }
+    vec2 atlasSize = vec2(textureSize(tex1, 0));
+    vec2 tileSize = inColor.z * vec2(1.0, atlasSize.x / atlasSize.y);
+    // Gradients of the unwrapped coordinate, since fract jumps at every block edge and would pick the smallest mip there
+    ddx = dFdx(texCoord) * tileSize;
+    ddy = dFdy(texCoord) * tileSize;
+    return inColor.xy + fract(texCoord) * tileSize;
+}
+
+vec3 baseColor() {
+    if (!TEXTURED) {
+        return inColor;
+    }
+    if (ATLAS_TILES) {
+        vec2 ddx;
+        vec2 ddy;
+        vec2 uv = atlasCoord(ddx, ddy);
+        return textureGrad(tex1, uv, ddx, ddy).xyz;
+    }
+    return texture(tex1, texCoord).xyz;
+}
+
+void main() {
+    vec3 normal = normalize(worldNormal);
+    vec3 light = sceneData.sunlightColor.xyz * sceneData.sunlightColor.w * max(dot(normal, -sceneData.sunlightDirection.xyz), 0.0);
+    if (SHADOWS) {
+        light *= sunShadow(normal);
+    }
+    if (POINT_LIGHTS) {
+        light += pointLighting(normal);
+    }
+    vec3 base = baseColor();
+    vec3 color = GLOW ? base + sceneData.ambientColor.xyz + base * light : base * (sceneData.ambientColor.w + light);
+    if (FOG) {
+        // Linear from the start distance to the end distance, and the fog color's alpha is the most it covers
+        float fog = clamp((viewDepth - sceneData.fogDistances.x) / max(sceneData.fogDistances.y - sceneData.fogDistances.x, 1e-4), 0.0, 1.0);
+        color = mix(color, sceneData.fogColor.xyz, fog * sceneData.fogColor.w);
+    }
+    outFragColor = vec4(color, 1.0f);
+}
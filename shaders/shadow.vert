@@ -0,0 +1,22 @@
+#version 450
+
+// Shadow cascades. Reads only the position and transforms it straight into the cascade's clip space.
+layout (location = 0) in vec3 vPosition;
+
+struct ObjectData {
+    mat4 model;
+};
+
+layout (std140, set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+layout (push_constant) uniform constants {
+    mat4 viewProj; // Of the cascade being rendered
+} PushConstants;
+
+void main()
+{
+    mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
+    gl_Position = PushConstants.viewProj * modelMatrix * vec4(vPosition, 1.0f);
+}
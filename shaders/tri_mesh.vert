@@ -7,6 +7,9 @@ layout (location = 3) in vec2 vTexCoord;
 
 layout (location = 0) out vec3 outColor;
 layout (location = 1) out vec2 texCoord;
+layout (location = 2) out vec3 worldPos;
+layout (location = 3) out vec3 worldNormal;
+layout (location = 4) out float viewDepth;
 
 layout (set = 0, binding = 0) uniform CameraBuffer{
     mat4 view;
@@ -28,6 +31,9 @@ layout(push_constant) uniform constants {
     mat4 render_matrix;
 } PushConstants;
 
+// Must match depth_only.vert exactly, or the EQUAL depth test after the pre-pass drops fragments
+invariant gl_Position;
+
 void main()
 {
     mat4 modelMatrix = objectBuffer.objects[gl_InstanceIndex].model;
@@ -35,4 +41,8 @@ void main()
 	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
 	outColor = vColor;
     texCoord = vTexCoord;
+    vec4 world = modelMatrix * vec4(vPosition, 1.0f);
+    worldPos = world.xyz;
+    worldNormal = mat3(modelMatrix) * vNormal;
+    viewDepth = -(cameraData.view * world).z;
 }
@@ -0,0 +1,566 @@
+#include <vk_bc.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // Bits are packed from the least significant bit of the first byte, as in the BC7 spec
+    struct BitReader {
+        const uint8_t* data;
+        uint32_t position{0};
+
+        uint32_t read(uint32_t count) {
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < count; i++, position++) {
+                value |= ((data[position >> 3] >> (position & 7)) & 1u) << i;
+            }
+            return value;
+        }
+    };
+
+    struct BitWriter {
+        uint8_t* data;
+        uint32_t position{0};
+
+        void write(uint32_t value, uint32_t count) {
+            for (uint32_t i = 0; i < count; i++, position++) {
+                data[position >> 3] |= ((value >> i) & 1u) << (position & 7);
+            }
+        }
+    };
+
+    struct Bc7Mode {
+        uint8_t subsets;
+        uint8_t partition_bits;
+        uint8_t rotation_bits;
+        uint8_t index_selection_bits;
+        uint8_t color_bits;
+        uint8_t alpha_bits;
+        uint8_t endpoint_pbits; // One p-bit per endpoint
+        uint8_t shared_pbits; // One p-bit per subset
+        uint8_t index_bits;
+        uint8_t index_bits2; // Separate alpha (or color, with index selection) indices
+    };
+
+    const Bc7Mode bc7_modes[8] = {
+        {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+        {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+        {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+        {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+        {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+        {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+        {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+        {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+    };
+
+    // Two-subset partitions. Bit i is set when pixel i belongs to the second subset.
+    const uint16_t bc7_partitions2[64] = {
+        0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+        0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+        0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+        0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+        0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+        0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+        0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+        0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+    };
+
+    // Pixel whose index drops its top bit in the second subset
+    const uint8_t bc7_anchors2[64] = {
+        15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15,
+        15,  2,  8,  2,  2,  8,  8, 15,
+         2,  8,  2,  2,  8,  8,  2,  2,
+        15, 15,  6,  8,  2,  8, 15, 15,
+         2,  8,  2,  2,  2, 15, 15,  6,
+         6,  2,  6,  8, 15, 15,  2,  2,
+        15, 15, 15, 15, 15,  2,  2, 15,
+    };
+
+    const uint8_t bc7_weights2[4] = {0, 21, 43, 64};
+    const uint8_t bc7_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+    const uint8_t bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    const uint8_t* bc7_weights(uint32_t index_bits) {
+        return index_bits == 2 ? bc7_weights2 : (index_bits == 3 ? bc7_weights3 : bc7_weights4);
+    }
+
+    uint8_t bc7_interpolate(uint8_t e0, uint8_t e1, uint8_t weight) {
+        return static_cast<uint8_t>(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+    }
+
+    void unpack_565(uint16_t color, uint8_t* rgba) {
+        uint8_t r = (color >> 11) & 31;
+        uint8_t g = (color >> 5) & 63;
+        uint8_t b = color & 31;
+        rgba[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        rgba[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        rgba[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+        rgba[3] = 255;
+    }
+
+    uint16_t pack_565(const float* rgb) {
+        auto quantize = [](float v, int max) { return static_cast<uint16_t>(std::clamp(static_cast<int>(std::lround(v * max / 255.0f)), 0, max)); };
+        return static_cast<uint16_t>((quantize(rgb[0], 31) << 11) | (quantize(rgb[1], 63) << 5) | quantize(rgb[2], 31));
+    }
+
+    uint32_t distance_squared(const uint8_t* a, const uint8_t* b, int channels) {
+        uint32_t sum = 0;
+        for (int c = 0; c < channels; c++) {
+            int d = a[c] - b[c];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    // Fits a line through the block's pixels along the principal axis of their covariance, and returns
+    // the points where the outermost pixels project onto it
+    void fit_line(const uint8_t* rgba, int channels, float* low, float* high) {
+        float mean[4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < channels; c++) {
+                mean[c] += rgba[i * 4 + c] / 16.0f;
+            }
+        }
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++) {
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++) {
+                    covariance[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+                }
+            }
+        }
+        // A few rounds of power iteration are plenty to find the dominant axis. Starting from the channel with the
+        // largest variance keeps the first step from landing on zero, which a fixed seed does when it's orthogonal to
+        // the axis, like {1, 1, 1} against a red to green edge.
+        int widest = 0;
+        for (int c = 1; c < channels; c++) {
+            if (covariance[c][c] > covariance[widest][widest]) {
+                widest = c;
+            }
+        }
+        float axis[4] = {};
+        axis[widest] = 1.0f;
+        bool degenerate = false;
+        for (int iteration = 0; iteration < 8; iteration++) {
+            float next[4] = {};
+            float length = 0.0f;
+            for (int a = 0; a < channels; a++) {
+                for (int b = 0; b < channels; b++) {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length += next[a] * next[a];
+            }
+            length = std::sqrt(length);
+            if (length < 1e-6f) {
+                degenerate = true;
+                break;
+            }
+            for (int c = 0; c < channels; c++) {
+                axis[c] = next[c] / length;
+            }
+        }
+        if (degenerate) {
+            // No axis to project on, so take the pixels at either end of the widest channel. When every pixel is the same color, that's the color.
+            int lowest = 0;
+            int highest = 0;
+            for (int i = 1; i < 16; i++) {
+                lowest = rgba[i * 4 + widest] < rgba[lowest * 4 + widest] ? i : lowest;
+                highest = rgba[i * 4 + widest] > rgba[highest * 4 + widest] ? i : highest;
+            }
+            for (int c = 0; c < channels; c++) {
+                low[c] = rgba[lowest * 4 + c];
+                high[c] = rgba[highest * 4 + c];
+            }
+            return;
+        }
+        float t_min = 0.0f;
+        float t_max = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float t = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+            }
+            t_min = std::min(t_min, t);
+            t_max = std::max(t_max, t);
+        }
+        for (int c = 0; c < channels; c++) {
+            low[c] = std::clamp(mean[c] + axis[c] * t_min, 0.0f, 255.0f);
+            high[c] = std::clamp(mean[c] + axis[c] * t_max, 0.0f, 255.0f);
+        }
+    }
+
+    // BC1 color block. BC3 always reads it as four colors, BC1 switches to three colors plus transparent when color0 <= color1.
+    void decode_color_block(const uint8_t* block, uint8_t* rgba, bool allow_transparent) {
+        uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+        uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+        uint8_t palette[4][4];
+        unpack_565(color0, palette[0]);
+        unpack_565(color1, palette[1]);
+        bool four_colors = color0 > color1 || !allow_transparent;
+        for (int c = 0; c < 3; c++) {
+            if (four_colors) {
+                palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+                palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+            } else {
+                palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c] + 1) / 2);
+                palette[3][c] = 0;
+            }
+        }
+        palette[2][3] = 255;
+        palette[3][3] = four_colors ? 255 : 0;
+        uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+        for (int i = 0; i < 16; i++) {
+            memcpy(rgba + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+        }
+    }
+
+    void encode_color_block(const uint8_t* rgba, uint8_t* block, bool allow_transparent) {
+        bool has_transparent = false;
+        if (allow_transparent) {
+            for (int i = 0; i < 16; i++) {
+                has_transparent = has_transparent || rgba[i * 4 + 3] < 128;
+            }
+        }
+        float low[3];
+        float high[3];
+        fit_line(rgba, 3, low, high);
+        uint16_t color0 = pack_565(high);
+        uint16_t color1 = pack_565(low);
+        // The order of the endpoints picks the BC1 mode: color0 > color1 is four colors, otherwise three plus transparent
+        if ((color0 < color1) != has_transparent) {
+            std::swap(color0, color1);
+        }
+        // Equal endpoints decode in three color mode even for an opaque block, where entry 3 would be transparent black.
+        // The first three entries are then all the same color, so those are the only ones to pick from.
+        bool three_colors = allow_transparent && color0 <= color1;
+        block[0] = color0 & 0xFF;
+        block[1] = color0 >> 8;
+        block[2] = color1 & 0xFF;
+        block[3] = color1 >> 8;
+
+        // Decode the palette the same way a GPU will, then pick the closest entry for every pixel
+        memset(block + 4, 0, 4);
+        uint8_t palette[4 * 4];
+        uint8_t decoded[16 * 4];
+        for (int i = 0; i < 4; i++) {
+            block[4] = static_cast<uint8_t>(i * 0x55); // The first four pixels use entry i
+            decode_color_block(block, decoded, allow_transparent);
+            memcpy(palette + i * 4, decoded, 4);
+        }
+        uint32_t indices = 0;
+        for (int i = 0; i < 16; i++) {
+            const uint8_t* pixel = rgba + i * 4;
+            uint32_t best = 0;
+            if (has_transparent && pixel[3] < 128) {
+                best = 3;
+            } else {
+                uint32_t best_error = UINT32_MAX;
+                for (uint32_t p = 0; p < (three_colors ? 3u : 4u); p++) {
+                    uint32_t error = distance_squared(pixel, palette + p * 4, 3);
+                    if (error < best_error) {
+                        best_error = error;
+                        best = p;
+                    }
+                }
+            }
+            indices |= best << (2 * i);
+        }
+        block[4] = indices & 0xFF;
+        block[5] = (indices >> 8) & 0xFF;
+        block[6] = (indices >> 16) & 0xFF;
+        block[7] = indices >> 24;
+    }
+
+    void alpha_palette(uint8_t alpha0, uint8_t alpha1, uint8_t* palette) {
+        palette[0] = alpha0;
+        palette[1] = alpha1;
+        if (alpha0 > alpha1) {
+            for (int i = 2; i < 8; i++) {
+                palette[i] = static_cast<uint8_t>(((8 - i) * alpha0 + (i - 1) * alpha1 + 3) / 7);
+            }
+        } else {
+            for (int i = 2; i < 6; i++) {
+                palette[i] = static_cast<uint8_t>(((6 - i) * alpha0 + (i - 1) * alpha1 + 2) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+}
+
+uint32_t bc::block_size(Format format) {
+    return format == Format::BC1 ? 8 : 16;
+}
+
+size_t bc::image_size(Format format, uint32_t width, uint32_t height) {
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+void bc::decode_bc1(const uint8_t* block, uint8_t* rgba) {
+    decode_color_block(block, rgba, true);
+}
+
+void bc::decode_bc3(const uint8_t* block, uint8_t* rgba) {
+    decode_color_block(block + 8, rgba, false);
+    uint8_t palette[8];
+    alpha_palette(block[0], block[1], palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+    }
+    for (int i = 0; i < 16; i++) {
+        rgba[i * 4 + 3] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+bool bc::decode_bc7(const uint8_t* block, uint8_t* rgba) {
+    uint32_t mode = 0;
+    while (mode < 8 && !((block[0] >> mode) & 1)) {
+        mode++;
+    }
+    if (mode == 8) {
+        memset(rgba, 0, 64); // Reserved mode, decodes to transparent black
+        return true;
+    }
+    const Bc7Mode& m = bc7_modes[mode];
+    if (m.subsets == 3) {
+        return false;
+    }
+    BitReader reader{block};
+    reader.read(mode + 1);
+    uint32_t partition = reader.read(m.partition_bits);
+    uint32_t rotation = reader.read(m.rotation_bits);
+    uint32_t index_selection = reader.read(m.index_selection_bits);
+
+    uint32_t endpoint_count = m.subsets * 2;
+    uint8_t endpoints[4][4];
+    for (int c = 0; c < 3; c++) {
+        for (uint32_t e = 0; e < endpoint_count; e++) {
+            endpoints[e][c] = static_cast<uint8_t>(reader.read(m.color_bits));
+        }
+    }
+    for (uint32_t e = 0; e < endpoint_count; e++) {
+        endpoints[e][3] = static_cast<uint8_t>(reader.read(m.alpha_bits));
+    }
+    uint32_t pbits[4] = {};
+    for (uint32_t e = 0; e < endpoint_count && m.endpoint_pbits; e++) {
+        pbits[e] = reader.read(1);
+    }
+    for (uint32_t s = 0; s < m.subsets && m.shared_pbits; s++) {
+        pbits[s * 2] = pbits[s * 2 + 1] = reader.read(1);
+    }
+    bool has_pbits = m.endpoint_pbits || m.shared_pbits;
+    // Append the p-bit, then replicate the top bits to expand each endpoint to 8 bits
+    for (uint32_t e = 0; e < endpoint_count; e++) {
+        for (int c = 0; c < 4; c++) {
+            uint32_t bits = c < 3 ? m.color_bits : m.alpha_bits;
+            if (bits == 0) {
+                endpoints[e][c] = 255;
+                continue;
+            }
+            uint32_t value = endpoints[e][c];
+            if (has_pbits) {
+                value = (value << 1) | pbits[e];
+                bits++;
+            }
+            value <<= 8 - bits;
+            endpoints[e][c] = static_cast<uint8_t>(value | (value >> bits));
+        }
+    }
+
+    uint32_t anchor2 = m.subsets == 2 ? bc7_anchors2[partition] : 0;
+    uint8_t indices[16];
+    uint8_t indices2[16] = {};
+    for (uint32_t i = 0; i < 16; i++) {
+        bool anchor = i == 0 || (m.subsets == 2 && i == anchor2);
+        indices[i] = static_cast<uint8_t>(reader.read(m.index_bits - (anchor ? 1 : 0)));
+    }
+    for (uint32_t i = 0; i < 16 && m.index_bits2; i++) {
+        indices2[i] = static_cast<uint8_t>(reader.read(m.index_bits2 - (i == 0 ? 1 : 0)));
+    }
+
+    for (uint32_t i = 0; i < 16; i++) {
+        uint32_t subset = m.subsets == 2 ? (bc7_partitions2[partition] >> i) & 1 : 0;
+        const uint8_t* e0 = endpoints[subset * 2];
+        const uint8_t* e1 = endpoints[subset * 2 + 1];
+        uint8_t color_weight = bc7_weights(m.index_bits)[indices[i]];
+        uint8_t alpha_weight = color_weight;
+        if (m.index_bits2) {
+            alpha_weight = bc7_weights(m.index_bits2)[indices2[i]];
+            // Index selection swaps which set of indices drives color and which drives alpha
+            if (index_selection) {
+                std::swap(color_weight, alpha_weight);
+            }
+        }
+        uint8_t* pixel = rgba + i * 4;
+        for (int c = 0; c < 3; c++) {
+            pixel[c] = bc7_interpolate(e0[c], e1[c], color_weight);
+        }
+        pixel[3] = bc7_interpolate(e0[3], e1[3], alpha_weight);
+        if (rotation > 0) {
+            std::swap(pixel[3], pixel[rotation - 1]);
+        }
+    }
+    return true;
+}
+
+void bc::encode_bc1(const uint8_t* rgba, uint8_t* block) {
+    encode_color_block(rgba, block, true);
+}
+
+void bc::encode_bc3(const uint8_t* rgba, uint8_t* block) {
+    uint8_t alpha_min = 255;
+    uint8_t alpha_max = 0;
+    for (int i = 0; i < 16; i++) {
+        alpha_min = std::min(alpha_min, rgba[i * 4 + 3]);
+        alpha_max = std::max(alpha_max, rgba[i * 4 + 3]);
+    }
+    // alpha0 > alpha1 selects the eight value ramp
+    block[0] = alpha_max;
+    block[1] = alpha_min;
+    uint8_t palette[8];
+    alpha_palette(alpha_max, alpha_min, palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 16 && alpha_max != alpha_min; i++) {
+        uint64_t best = 0;
+        int best_error = 256;
+        for (int p = 0; p < 8; p++) {
+            int error = std::abs(rgba[i * 4 + 3] - palette[p]);
+            if (error < best_error) {
+                best_error = error;
+                best = p;
+            }
+        }
+        indices |= best << (3 * i);
+    }
+    for (int i = 0; i < 6; i++) {
+        block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+    }
+    encode_color_block(rgba, block + 8, false);
+}
+
+// Mode 6 is a single subset with 7-bit RGBA endpoints, a p-bit per endpoint and 4-bit indices,
+// which handles smooth color and alpha well without any partition search
+void bc::encode_bc7(const uint8_t* rgba, uint8_t* block) {
+    float low[4];
+    float high[4];
+    fit_line(rgba, 4, low, high);
+
+    // Each endpoint is 7 bits per channel plus a p-bit shared by its channels. Try both p-bits and keep the closer one.
+    uint8_t quantized[2][4];
+    uint32_t pbits[2];
+    uint8_t endpoints[2][4];
+    const float* targets[2] = {low, high};
+    for (int e = 0; e < 2; e++) {
+        float best_error = INFINITY;
+        for (uint32_t p = 0; p < 2; p++) {
+            if (p == 0 && targets[e][3] >= 255.0f) {
+                continue; // Only a set p-bit reaches 255, and opaque alpha has to stay exact
+            }
+            float error = 0.0f;
+            uint8_t q[4];
+            for (int c = 0; c < 4; c++) {
+                q[c] = static_cast<uint8_t>(std::clamp(static_cast<int>(std::lround((targets[e][c] - p) / 2.0f)), 0, 127));
+                float d = targets[e][c] - static_cast<float>((q[c] << 1) | p);
+                error += d * d;
+            }
+            if (error < best_error) {
+                best_error = error;
+                pbits[e] = p;
+                memcpy(quantized[e], q, 4);
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            endpoints[e][c] = static_cast<uint8_t>((quantized[e][c] << 1) | pbits[e]);
+        }
+    }
+
+    uint8_t palette[16][4];
+    for (int w = 0; w < 16; w++) {
+        for (int c = 0; c < 4; c++) {
+            palette[w][c] = bc7_interpolate(endpoints[0][c], endpoints[1][c], bc7_weights4[w]);
+        }
+    }
+    uint8_t indices[16];
+    for (int i = 0; i < 16; i++) {
+        uint32_t best_error = UINT32_MAX;
+        for (uint8_t w = 0; w < 16; w++) {
+            uint32_t error = distance_squared(rgba + i * 4, palette[w], 4);
+            if (error < best_error) {
+                best_error = error;
+                indices[i] = w;
+            }
+        }
+    }
+    // The first pixel's index only has 3 bits, so its top bit must be clear. Swapping the endpoints flips every index.
+    if (indices[0] & 8) {
+        std::swap(quantized[0], quantized[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (uint8_t& index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    memset(block, 0, 16);
+    BitWriter writer{block};
+    writer.write(1u << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(quantized[0][c], 7);
+        writer.write(quantized[1][c], 7);
+    }
+    writer.write(pbits[0], 1);
+    writer.write(pbits[1], 1);
+    for (int i = 0; i < 16; i++) {
+        writer.write(indices[i], i == 0 ? 3 : 4);
+    }
+}
+
+std::vector<uint8_t> bc::encode_image(Format format, const uint8_t* rgba, uint32_t width, uint32_t height) {
+    std::vector<uint8_t> blocks(image_size(format, width, height));
+    uint8_t* out = blocks.data();
+    uint8_t pixels[64];
+    for (uint32_t by = 0; by < height; by += 4) {
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            for (uint32_t y = 0; y < 4; y++) {
+                for (uint32_t x = 0; x < 4; x++) {
+                    uint32_t sx = std::min(bx + x, width - 1);
+                    uint32_t sy = std::min(by + y, height - 1);
+                    memcpy(pixels + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+                }
+            }
+            switch (format) {
+            case Format::BC1: encode_bc1(pixels, out); break;
+            case Format::BC3: encode_bc3(pixels, out); break;
+            case Format::BC7: encode_bc7(pixels, out); break;
+            }
+            out += block_size(format);
+        }
+    }
+    return blocks;
+}
+
+bool bc::decode_image(Format format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba) {
+    uint8_t pixels[64];
+    for (uint32_t by = 0; by < height; by += 4) {
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            switch (format) {
+            case Format::BC1: decode_bc1(blocks, pixels); break;
+            case Format::BC3: decode_bc3(blocks, pixels); break;
+            case Format::BC7:
+                if (!decode_bc7(blocks, pixels)) {
+                    return false;
+                }
+                break;
+            }
+            blocks += block_size(format);
+            for (uint32_t y = 0; y < 4 && by + y < height; y++) {
+                for (uint32_t x = 0; x < 4 && bx + x < width; x++) {
+                    memcpy(rgba + ((static_cast<size_t>(by + y)) * width + bx + x) * 4, pixels + (y * 4 + x) * 4, 4);
+                }
+            }
+        }
+    }
+    return true;
+}
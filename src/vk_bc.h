@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Block compression codecs. A block covers 4x4 pixels, and pixels are RGBA8 stored row by row.
+// The decoders are the fallback for GPUs without BC support, the encoders are used by the offline texture converter.
+namespace bc {
+    enum class Format {
+        BC1, // 8 bytes per block. RGB with 1-bit alpha
+        BC3, // 16 bytes per block. BC1 color plus an interpolated alpha block
+        BC7, // 16 bytes per block. Highest quality RGBA
+    };
+
+    uint32_t block_size(Format format);
+    size_t image_size(Format format, uint32_t width, uint32_t height);
+
+    void decode_bc1(const uint8_t* block, uint8_t* rgba);
+    void decode_bc3(const uint8_t* block, uint8_t* rgba);
+    bool decode_bc7(const uint8_t* block, uint8_t* rgba); // Three-subset blocks (modes 0 and 2) aren't supported and return false
+
+    void encode_bc1(const uint8_t* rgba, uint8_t* block);
+    void encode_bc3(const uint8_t* rgba, uint8_t* block);
+    void encode_bc7(const uint8_t* rgba, uint8_t* block); // Always writes mode 6
+
+    // Whole images. Sizes don't need to be multiples of 4: edge blocks repeat the last row/column when encoding
+    // and drop the pixels outside the image when decoding.
+    std::vector<uint8_t> encode_image(Format format, const uint8_t* rgba, uint32_t width, uint32_t height);
+    bool decode_image(Format format, const uint8_t* blocks, uint32_t width, uint32_t height, uint8_t* rgba);
+}
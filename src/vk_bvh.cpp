@@ -0,0 +1,473 @@
+#include <vk_bvh.h>
+
+#include <random>
+
+namespace {
+    constexpr uint32_t BIN_COUNT = 12;
+    // Below this depth the build splits at the best SAH plane. Past it, it splits at the median, which caps the depth for the query stacks.
+    constexpr uint32_t MAX_SAH_DEPTH = 48;
+}
+
+Frustum Frustum::from_matrix(const glm::mat4& viewproj, bool zero_to_one_depth) {
+    auto row = [&](int i) { return glm::vec4(viewproj[0][i], viewproj[1][i], viewproj[2][i], viewproj[3][i]); };
+    Frustum frustum;
+    frustum.planes[0] = row(3) + row(0); // Left
+    frustum.planes[1] = row(3) - row(0); // Right
+    frustum.planes[2] = row(3) + row(1); // Bottom
+    frustum.planes[3] = row(3) - row(1); // Top
+    frustum.planes[4] = zero_to_one_depth ? row(2) : row(3) + row(2); // Near
+    frustum.planes[5] = row(3) - row(2); // Far
+    for (glm::vec4& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+uint32_t AabbTree::allocate_node() {
+    if (!free_nodes.empty()) {
+        uint32_t node = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[node] = Node{};
+        return node;
+    }
+    nodes.push_back(Node{});
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void AabbTree::free_node(uint32_t node) {
+    nodes[node].height = -1;
+    free_nodes.push_back(node);
+}
+
+void AabbTree::clear() {
+    nodes.clear();
+    free_nodes.clear();
+    root = INVALID;
+    leaf_count = 0;
+}
+
+ProxyId AabbTree::insert(const Aabb& box, uint32_t user_data) {
+    uint32_t leaf = allocate_node();
+    nodes[leaf].box = Aabb{box.min - glm::vec3(margin), box.max + glm::vec3(margin)};
+    nodes[leaf].user_data = user_data;
+    insert_leaf(leaf);
+    leaf_count++;
+    return leaf;
+}
+
+void AabbTree::remove(ProxyId proxy) {
+    remove_leaf(proxy);
+    free_node(proxy);
+    leaf_count--;
+}
+
+bool AabbTree::move(ProxyId proxy, const Aabb& box, glm::vec3 displacement) {
+    if (nodes[proxy].box.contains(box)) {
+        return false;
+    }
+    remove_leaf(proxy);
+    Aabb fat{box.min - glm::vec3(margin), box.max + glm::vec3(margin)};
+    // Stretch the box along the motion, so steady movement doesn't reinsert every frame
+    glm::vec3 ahead = displacement * displacement_scale;
+    fat.min += glm::min(ahead, glm::vec3(0.0f));
+    fat.max += glm::max(ahead, glm::vec3(0.0f));
+    nodes[proxy].box = fat;
+    insert_leaf(proxy);
+    return true;
+}
+
+// Walks down to the sibling whose merge costs the least surface area, counting the growth of every ancestor on the way
+void AabbTree::insert_leaf(uint32_t leaf) {
+    if (root == INVALID) {
+        root = leaf;
+        nodes[leaf].parent = INVALID;
+        return;
+    }
+    Aabb leaf_box = nodes[leaf].box;
+    uint32_t index = root;
+    while (!nodes[index].leaf()) {
+        const Node& node = nodes[index];
+        float area = node.box.surface_area();
+        float combined_area = Aabb::merge(node.box, leaf_box).surface_area();
+        float cost = 2.0f * combined_area; // Of making a new parent for this node and the leaf
+        float inheritance = 2.0f * (combined_area - area); // Of going further down, since this node grows either way
+        float child_costs[2];
+        for (int i = 0; i < 2; i++) {
+            const Node& child = nodes[node.children[i]];
+            float merged = Aabb::merge(leaf_box, child.box).surface_area();
+            child_costs[i] = (child.leaf() ? merged : merged - child.box.surface_area()) + inheritance;
+        }
+        if (cost < child_costs[0] && cost < child_costs[1]) {
+            break;
+        }
+        index = child_costs[0] < child_costs[1] ? node.children[0] : node.children[1];
+    }
+
+    uint32_t sibling = index;
+    uint32_t old_parent = nodes[sibling].parent;
+    uint32_t new_parent = allocate_node();
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].box = Aabb::merge(leaf_box, nodes[sibling].box);
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].children[0] = sibling;
+    nodes[new_parent].children[1] = leaf;
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+    if (old_parent == INVALID) {
+        root = new_parent;
+    } else {
+        Node& parent = nodes[old_parent];
+        parent.children[parent.children[0] == sibling ? 0 : 1] = new_parent;
+    }
+    refit_from(old_parent);
+}
+
+void AabbTree::remove_leaf(uint32_t leaf) {
+    if (leaf == root) {
+        root = INVALID;
+        return;
+    }
+    uint32_t parent = nodes[leaf].parent;
+    uint32_t grandparent = nodes[parent].parent;
+    uint32_t sibling = nodes[parent].children[0] == leaf ? nodes[parent].children[1] : nodes[parent].children[0];
+    free_node(parent);
+    nodes[sibling].parent = grandparent;
+    if (grandparent == INVALID) {
+        root = sibling;
+        return;
+    }
+    Node& node = nodes[grandparent];
+    node.children[node.children[0] == parent ? 0 : 1] = sibling;
+    refit_from(grandparent);
+}
+
+void AabbTree::refit_from(uint32_t index) {
+    while (index != INVALID) {
+        index = balance(index);
+        Node& node = nodes[index];
+        const Node& left = nodes[node.children[0]];
+        const Node& right = nodes[node.children[1]];
+        node.height = 1 + std::max(left.height, right.height);
+        node.box = Aabb::merge(left.box, right.box);
+        index = node.parent;
+    }
+}
+
+uint32_t AabbTree::balance(uint32_t a) {
+    Node& node_a = nodes[a];
+    if (node_a.leaf() || node_a.height < 2) {
+        return a;
+    }
+    uint32_t b = node_a.children[0];
+    uint32_t c = node_a.children[1];
+    int32_t difference = nodes[c].height - nodes[b].height;
+    if (difference >= -1 && difference <= 1) {
+        return a;
+    }
+
+    // The taller child takes a's place, and a keeps the other child plus the shorter of the taller child's children
+    bool right_taller = difference > 1;
+    uint32_t up = right_taller ? c : b;
+    uint32_t stays = right_taller ? b : c;
+    Node& node_up = nodes[up];
+    uint32_t f = node_up.children[0];
+    uint32_t g = node_up.children[1];
+
+    node_up.children[0] = a;
+    node_up.parent = node_a.parent;
+    node_a.parent = up;
+    if (node_up.parent == INVALID) {
+        root = up;
+    } else {
+        Node& parent = nodes[node_up.parent];
+        parent.children[parent.children[0] == a ? 0 : 1] = up;
+    }
+
+    uint32_t taller = nodes[f].height > nodes[g].height ? f : g;
+    uint32_t shorter = taller == f ? g : f;
+    node_up.children[1] = taller;
+    node_a.children[right_taller ? 1 : 0] = shorter;
+    nodes[shorter].parent = a;
+    node_a.box = Aabb::merge(nodes[stays].box, nodes[shorter].box);
+    node_a.height = 1 + std::max(nodes[stays].height, nodes[shorter].height);
+    node_up.box = Aabb::merge(node_a.box, nodes[taller].box);
+    node_up.height = 1 + std::max(node_a.height, nodes[taller].height);
+    return up;
+}
+
+void AabbTree::build(std::span<const Item> items, std::vector<ProxyId>& proxies) {
+    clear();
+    nodes.reserve(items.size() * 2);
+    proxies.resize(items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        uint32_t leaf = allocate_node();
+        nodes[leaf].box = items[i].box;
+        nodes[leaf].user_data = items[i].user_data;
+        proxies[i] = leaf;
+    }
+    leaf_count = items.size();
+    if (items.empty()) {
+        return;
+    }
+    std::vector<uint32_t> leaves(proxies.begin(), proxies.end());
+    root = build_range(leaves, 0, static_cast<uint32_t>(leaves.size()), 0);
+    nodes[root].parent = INVALID;
+}
+
+// Bins the centroids along the longest axis and splits at the bin boundary with the lowest area * count on both sides
+uint32_t AabbTree::build_range(std::vector<uint32_t>& leaves, uint32_t begin, uint32_t end, uint32_t depth) {
+    if (end - begin == 1) {
+        return leaves[begin];
+    }
+    Aabb centroid_bounds;
+    for (uint32_t i = begin; i < end; i++) {
+        centroid_bounds.grow(nodes[leaves[i]].box.center());
+    }
+    glm::vec3 size = centroid_bounds.max - centroid_bounds.min;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    uint32_t split = begin + (end - begin) / 2;
+    bool median = true;
+
+    if (depth < MAX_SAH_DEPTH && size[axis] > 0.0f) {
+        float scale = BIN_COUNT / size[axis];
+        auto bin_of = [&](uint32_t leaf) {
+            return std::min(static_cast<uint32_t>((nodes[leaf].box.center()[axis] - centroid_bounds.min[axis]) * scale), BIN_COUNT - 1);
+        };
+        Aabb bin_boxes[BIN_COUNT];
+        uint32_t bin_counts[BIN_COUNT]{};
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t bin = bin_of(leaves[i]);
+            bin_boxes[bin].grow(nodes[leaves[i]].box);
+            bin_counts[bin]++;
+        }
+        // Cost of everything right of each boundary, swept from the right
+        float right_costs[BIN_COUNT]{};
+        Aabb right_box;
+        uint32_t right_count = 0;
+        for (uint32_t bin = BIN_COUNT - 1; bin > 0; bin--) {
+            right_box.grow(bin_boxes[bin]);
+            right_count += bin_counts[bin];
+            right_costs[bin] = right_count > 0 ? right_box.surface_area() * right_count : 0.0f;
+        }
+        float best_cost = std::numeric_limits<float>::max();
+        uint32_t best_boundary = 0;
+        Aabb left_box;
+        uint32_t left_count = 0;
+        for (uint32_t boundary = 1; boundary < BIN_COUNT; boundary++) {
+            left_box.grow(bin_boxes[boundary - 1]);
+            left_count += bin_counts[boundary - 1];
+            if (left_count == 0 || left_count == end - begin) {
+                continue;
+            }
+            float cost = left_box.surface_area() * left_count + right_costs[boundary];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_boundary = boundary;
+            }
+        }
+        if (best_boundary > 0) {
+            auto middle = std::partition(leaves.begin() + begin, leaves.begin() + end, [&](uint32_t leaf) { return bin_of(leaf) < best_boundary; });
+            split = static_cast<uint32_t>(middle - leaves.begin());
+            median = false;
+        }
+    }
+    if (median) {
+        std::nth_element(leaves.begin() + begin, leaves.begin() + split, leaves.begin() + end,
+            [&](uint32_t a, uint32_t b) { return nodes[a].box.center()[axis] < nodes[b].box.center()[axis]; });
+    }
+
+    uint32_t left = build_range(leaves, begin, split, depth + 1);
+    uint32_t right = build_range(leaves, split, end, depth + 1);
+    uint32_t node = allocate_node();
+    nodes[node].children[0] = left;
+    nodes[node].children[1] = right;
+    nodes[node].box = Aabb::merge(nodes[left].box, nodes[right].box);
+    nodes[node].height = 1 + std::max(nodes[left].height, nodes[right].height);
+    nodes[left].parent = node;
+    nodes[right].parent = node;
+    return node;
+}
+
+float AabbTree::total_cost() const {
+    if (root == INVALID) {
+        return 0.0f;
+    }
+    float internal_area = 0.0f;
+    for (const Node& node : nodes) {
+        if (node.height > 0) {
+            internal_area += node.box.surface_area();
+        }
+    }
+    return internal_area / nodes[root].box.surface_area();
+}
+
+namespace {
+    template <typename F>
+    double time_ms(F&& function) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+BvhBenchmark run_bvh_benchmark(uint32_t object_count) {
+    constexpr uint32_t FRUSTUM_QUERIES = 64;
+    constexpr uint32_t RAY_QUERIES = 256;
+    constexpr uint32_t OVERLAP_QUERIES = 256;
+    BvhBenchmark result;
+    result.object_count = object_count;
+
+    // Same density at every count, about one object per 64 cubic units
+    float world_size = std::cbrt(static_cast<float>(object_count)) * 4.0f;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> position(0.0f, world_size);
+    std::uniform_real_distribution<float> half_size(0.25f, 1.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    auto random_direction = [&]() {
+        glm::vec3 direction;
+        do {
+            direction = glm::vec3(unit(rng), unit(rng), unit(rng));
+        } while (glm::dot(direction, direction) < 0.01f || glm::dot(direction, direction) > 1.0f);
+        return glm::normalize(direction);
+    };
+
+    std::vector<AabbTree::Item> items(object_count);
+    for (uint32_t i = 0; i < object_count; i++) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        glm::vec3 extent(half_size(rng), half_size(rng), half_size(rng));
+        items[i] = AabbTree::Item{Aabb{center - extent, center + extent}, i};
+    }
+
+    AabbTree tree;
+    std::vector<ProxyId> proxies;
+    result.build_ms = time_ms([&]() { tree.build(items, proxies); });
+
+    AabbTree dynamic_tree;
+    std::vector<ProxyId> dynamic_proxies(object_count);
+    result.insert_ms = time_ms([&]() {
+        for (uint32_t i = 0; i < object_count; i++) {
+            dynamic_proxies[i] = dynamic_tree.insert(items[i].box, i);
+        }
+    });
+    std::vector<glm::vec3> moves(object_count / 10);
+    for (glm::vec3& move : moves) {
+        move = random_direction() * (0.05f + 0.45f * (unit(rng) * 0.5f + 0.5f));
+    }
+    result.move_ms = time_ms([&]() {
+        for (uint32_t i = 0; i < moves.size(); i++) {
+            const Aabb& box = items[i * 10].box;
+            dynamic_tree.move(dynamic_proxies[i * 10], Aabb{box.min + moves[i], box.max + moves[i]}, moves[i]);
+        }
+    });
+
+    // The dynamic tree answers with the fattened boxes, so it's checked against those, and they must still hold the moved objects
+    std::vector<AabbTree::Item> fat_items(object_count);
+    for (uint32_t i = 0; i < object_count; i++) {
+        Aabb box = items[i].box;
+        if (i % 10 == 0 && i / 10 < moves.size()) {
+            box = Aabb{box.min + moves[i / 10], box.max + moves[i / 10]};
+        }
+        fat_items[i] = AabbTree::Item{dynamic_tree.fat_box(dynamic_proxies[i]), i};
+        result.results_match = result.results_match && fat_items[i].box.contains(box);
+    }
+
+    // Times the static tree against brute force, then checks the dynamic tree query by query, untimed
+    auto time_queries = [&](uint32_t count, auto&& tree_query, auto&& brute_query, double* out) {
+        uint64_t tree_found = 0;
+        uint64_t brute_found = 0;
+        out[0] = time_ms([&]() {
+            for (uint32_t q = 0; q < count; q++) {
+                tree_found += tree_query(tree, q);
+            }
+        }) * 1000.0 / count;
+        out[1] = time_ms([&]() {
+            for (uint32_t q = 0; q < count; q++) {
+                brute_found += brute_query(items, q);
+            }
+        }) * 1000.0 / count;
+        result.results_match = result.results_match && tree_found == brute_found;
+        for (uint32_t q = 0; q < count && result.results_match; q++) {
+            result.results_match = tree_query(dynamic_tree, q) == brute_query(fat_items, q);
+        }
+    };
+
+    std::vector<Frustum> frustums(FRUSTUM_QUERIES);
+    glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(70.0f), 16.0f / 9.0f, 0.1f, world_size * 0.5f);
+    for (Frustum& frustum : frustums) {
+        glm::vec3 eye(position(rng), position(rng), position(rng));
+        glm::vec3 forward = random_direction();
+        glm::vec3 up = std::abs(forward.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        frustum = Frustum::from_matrix(projection * glm::lookAt(eye, eye + forward, up));
+    }
+    time_queries(FRUSTUM_QUERIES, [&](const AabbTree& queried, uint32_t q) {
+        uint64_t found = 0;
+        queried.query_frustum(frustums[q], [&](uint32_t) { found++; });
+        return found;
+    }, [&](const std::vector<AabbTree::Item>& boxes, uint32_t q) {
+        uint64_t found = 0;
+        for (const AabbTree::Item& item : boxes) {
+            glm::vec3 center = item.box.center();
+            glm::vec3 extent = item.box.extent();
+            bool outside = false;
+            for (const glm::vec4& plane : frustums[q].planes) {
+                if (glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.0f) {
+                    outside = true;
+                    break;
+                }
+            }
+            found += outside ? 0 : 1;
+        }
+        return found;
+    }, result.frustum_us);
+
+    // Distance to the nearest box each ray enters
+    std::vector<std::pair<glm::vec3, glm::vec3>> rays(RAY_QUERIES);
+    for (auto& ray : rays) {
+        ray = {glm::vec3(position(rng), position(rng), position(rng)), random_direction()};
+    }
+    auto entry = [](const Aabb& box, glm::vec3 origin, glm::vec3 inverse) {
+        glm::vec3 t0 = (box.min - origin) * inverse;
+        glm::vec3 t1 = (box.max - origin) * inverse;
+        float enter = std::max({glm::min(t0, t1).x, glm::min(t0, t1).y, glm::min(t0, t1).z, 0.0f});
+        float exit = std::min({glm::max(t0, t1).x, glm::max(t0, t1).y, glm::max(t0, t1).z});
+        return enter <= exit ? enter : std::numeric_limits<float>::max();
+    };
+    time_queries(RAY_QUERIES, [&](const AabbTree& queried, uint32_t q) {
+        float nearest = world_size;
+        queried.raycast(rays[q].first, rays[q].second, world_size, [&](uint32_t, float distance) {
+            nearest = std::min(nearest, distance);
+            return nearest;
+        });
+        return static_cast<uint64_t>(nearest * 1024.0f);
+    }, [&](const std::vector<AabbTree::Item>& boxes, uint32_t q) {
+        float nearest = world_size;
+        glm::vec3 inverse = 1.0f / rays[q].second;
+        for (const AabbTree::Item& item : boxes) {
+            nearest = std::min(nearest, entry(item.box, rays[q].first, inverse));
+        }
+        return static_cast<uint64_t>(nearest * 1024.0f);
+    }, result.ray_us);
+
+    std::vector<Aabb> regions(OVERLAP_QUERIES);
+    for (Aabb& region : regions) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        region = Aabb{center - glm::vec3(4.0f), center + glm::vec3(4.0f)};
+    }
+    time_queries(OVERLAP_QUERIES, [&](const AabbTree& queried, uint32_t q) {
+        uint64_t found = 0;
+        queried.query_overlap(regions[q], [&](uint32_t) { found++; });
+        return found;
+    }, [&](const std::vector<AabbTree::Item>& boxes, uint32_t q) {
+        uint64_t found = 0;
+        for (const AabbTree::Item& item : boxes) {
+            found += item.box.overlaps(regions[q]) ? 1 : 0;
+        }
+        return found;
+    }, result.overlap_us);
+
+    std::cout << "BVH benchmark, " << object_count << " objects: build " << result.build_ms << " ms (cost " << tree.total_cost() << ", height " << tree.height()
+              << "), insert " << result.insert_ms << " ms (height " << dynamic_tree.height() << "), move " << result.move_ms << " ms. Per query in us, tree/brute force: frustum "
+              << result.frustum_us[0] << "/" << result.frustum_us[1] << ", ray " << result.ray_us[0] << "/" << result.ray_us[1] << ", overlap "
+              << result.overlap_us[0] << "/" << result.overlap_us[1] << (result.results_match ? "" : " (results differ)") << std::endl;
+    return result;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <limits>
+
+struct Aabb {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+    float surface_area() const {
+        glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    bool contains(const Aabb& other) const { return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max)); }
+    bool overlaps(const Aabb& other) const { return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::greaterThanEqual(max, other.min)); }
+    void grow(const Aabb& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+    void grow(glm::vec3 point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    static Aabb merge(const Aabb& a, const Aabb& b) { return Aabb{glm::min(a.min, b.min), glm::max(a.max, b.max)}; }
+    static Aabb from_sphere(glm::vec3 center, float radius) { return Aabb{center - glm::vec3(radius), center + glm::vec3(radius)}; }
+};
+
+// Six planes with inward normals, as (normal, distance), so a point is inside when dot(normal, p) + distance >= 0 for all of them
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Clip space depth from 0 to 1, as Vulkan and the *_ZO projections have it. glm::perspective gives -1 to 1, so pass false for that.
+    static Frustum from_matrix(const glm::mat4& viewproj, bool zero_to_one_depth = true);
+};
+
+using ProxyId = uint32_t;
+constexpr ProxyId INVALID_PROXY = ~0u;
+
+// Dynamic AABB tree over objects identified by a user value, like an entity index.
+// A binned SAH build gives the best tree for objects that don't move. Objects inserted one by one go next to the sibling
+// that grows the tree's surface area the least, and rotations keep it balanced. Inserted boxes are fattened, so an object
+// that moves a little stays inside its box and costs nothing. Proxies are node indices and stay valid until removed.
+class AabbTree {
+public:
+    struct Item {
+        Aabb box;
+        uint32_t user_data;
+    };
+
+    float margin{0.2f}; // Added on every side of inserted boxes
+    float displacement_scale{2.0f}; // How far ahead of a moving object its box is stretched, in frames of its displacement
+
+    // Replaces the whole tree. Boxes are used as given, and proxies[i] is the proxy of items[i].
+    void build(std::span<const Item> items, std::vector<ProxyId>& proxies);
+    ProxyId insert(const Aabb& box, uint32_t user_data);
+    void remove(ProxyId proxy);
+    // Reinserts the object when it left its fattened box, and returns whether it did
+    bool move(ProxyId proxy, const Aabb& box, glm::vec3 displacement = glm::vec3(0.0f));
+    void clear();
+
+    const Aabb& fat_box(ProxyId proxy) const { return nodes[proxy].box; }
+    uint32_t user_data(ProxyId proxy) const { return nodes[proxy].user_data; }
+    size_t proxy_count() const { return leaf_count; }
+    uint32_t height() const { return root == INVALID ? 0 : static_cast<uint32_t>(nodes[root].height); }
+    float total_cost() const; // Sum of the internal nodes' surface areas over the root's, lower traverses faster
+
+    // Calls function(user_data) for every object whose box overlaps the query
+    template <typename F>
+    void query_overlap(const Aabb& box, F&& function) const;
+    // Calls function(user_data) for every object whose box is at least partly inside
+    template <typename F>
+    void query_frustum(const Frustum& frustum, F&& function) const;
+    // Calls function(user_data, entry_distance) for every object whose box the ray enters before max_distance, roughly front to back.
+    // The function returns the new max distance: max_distance to carry on, the hit distance to only look closer, 0 to stop.
+    template <typename F>
+    void raycast(glm::vec3 origin, glm::vec3 direction, float max_distance, F&& function) const;
+
+private:
+    static constexpr uint32_t INVALID = ~0u;
+    static constexpr uint32_t INSIDE_BIT = 1u << 31; // On a stack entry, the whole subtree is inside the frustum
+    static constexpr uint32_t MAX_STACK = 256; // Insertion keeps the tree balanced, and the build bounds its own depth
+
+    struct Node {
+        Aabb box;
+        uint32_t parent{INVALID};
+        uint32_t children[2]{INVALID, INVALID};
+        uint32_t user_data{0};
+        int32_t height{0}; // 0 for leaves, -1 for free nodes
+        bool leaf() const { return children[0] == INVALID; }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    uint32_t root{INVALID};
+    size_t leaf_count{0};
+
+    uint32_t allocate_node();
+    void free_node(uint32_t node);
+    void insert_leaf(uint32_t leaf);
+    void remove_leaf(uint32_t leaf);
+    uint32_t balance(uint32_t node); // Rotates a grandchild up when one side is two levels taller, returns the subtree's new root
+    void refit_from(uint32_t node); // Balances and refits the ancestors, starting at node
+    uint32_t build_range(std::vector<uint32_t>& leaves, uint32_t begin, uint32_t end, uint32_t depth);
+};
+
+template <typename F>
+void AabbTree::query_overlap(const Aabb& box, F&& function) const {
+    if (root == INVALID) {
+        return;
+    }
+    uint32_t stack[MAX_STACK];
+    uint32_t top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (!node.box.overlaps(box)) {
+            continue;
+        }
+        if (node.leaf()) {
+            function(node.user_data);
+        } else {
+            stack[top++] = node.children[0];
+            stack[top++] = node.children[1];
+        }
+    }
+}
+
+template <typename F>
+void AabbTree::query_frustum(const Frustum& frustum, F&& function) const {
+    if (root == INVALID) {
+        return;
+    }
+    uint32_t stack[MAX_STACK];
+    uint32_t top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        uint32_t entry = stack[--top];
+        bool inside = (entry & INSIDE_BIT) != 0;
+        const Node& node = nodes[entry & ~INSIDE_BIT];
+        if (!inside) {
+            // Distance of the box's center from each plane against how far the box reaches towards it
+            glm::vec3 center = node.box.center();
+            glm::vec3 extent = node.box.extent();
+            bool outside = false;
+            inside = true;
+            for (const glm::vec4& plane : frustum.planes) {
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if (distance + reach < 0.0f) {
+                    outside = true;
+                    break;
+                }
+                inside = inside && distance - reach >= 0.0f;
+            }
+            if (outside) {
+                continue;
+            }
+        }
+        if (node.leaf()) {
+            function(node.user_data);
+        } else {
+            uint32_t flag = inside ? INSIDE_BIT : 0;
+            stack[top++] = node.children[0] | flag;
+            stack[top++] = node.children[1] | flag;
+        }
+    }
+}
+
+template <typename F>
+void AabbTree::raycast(glm::vec3 origin, glm::vec3 direction, float max_distance, F&& function) const {
+    if (root == INVALID) {
+        return;
+    }
+    glm::vec3 inverse = 1.0f / direction; // Infinities for axis-aligned rays work out in the slab test
+    auto entry_distance = [&](const Aabb& box) {
+        glm::vec3 t0 = (box.min - origin) * inverse;
+        glm::vec3 t1 = (box.max - origin) * inverse;
+        glm::vec3 near = glm::min(t0, t1);
+        glm::vec3 far = glm::max(t0, t1);
+        float enter = std::max({near.x, near.y, near.z, 0.0f});
+        float exit = std::min({far.x, far.y, far.z});
+        return enter <= exit ? enter : std::numeric_limits<float>::max();
+    };
+    uint32_t stack[MAX_STACK];
+    uint32_t top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        float enter = entry_distance(node.box);
+        if (enter > max_distance) {
+            continue;
+        }
+        if (node.leaf()) {
+            max_distance = std::min(max_distance, static_cast<float>(function(node.user_data, enter)));
+            if (max_distance <= 0.0f) {
+                return;
+            }
+            continue;
+        }
+        // The nearer child goes on top, so hits are usually found front to back and clip the rest early
+        uint32_t first = node.children[0];
+        uint32_t second = node.children[1];
+        if (entry_distance(nodes[first].box) > entry_distance(nodes[second].box)) {
+            std::swap(first, second);
+        }
+        stack[top++] = second;
+        stack[top++] = first;
+    }
+}
+
+// Times the same queries with the tree and with a loop over every box
+struct BvhBenchmark {
+    uint32_t object_count{0};
+    double build_ms{0}; // SAH build of every object
+    double insert_ms{0}; // Inserting every object one at a time
+    double move_ms{0}; // A tenth of the objects moving a short way
+    double frustum_us[2]{0, 0}; // Per query, tree then brute force
+    double ray_us[2]{0, 0};
+    double overlap_us[2]{0, 0};
+    bool results_match{true}; // The SAH tree, and the dynamic tree after the moves, found the same objects as brute force
+};
+
+BvhBenchmark run_bvh_benchmark(uint32_t object_count);
@@ -0,0 +1,364 @@
+#include <vk_culling.h>
+
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_pipeline.h>
+#include <vk_texture.h>
+
+namespace {
+    // Matches the push constants of cull.comp
+    struct CullPushConstants {
+        glm::mat4 view;
+        glm::vec4 frustum; // Normals of the side planes in view space, as (x, z) for left/right and (y, z) for top/bottom
+        glm::vec4 projection; // P00, P11, P22, P32
+        glm::vec2 pyramid_size;
+        float znear;
+        uint32_t draw_count;
+        uint32_t command_offset; // In commands
+        uint32_t count_offset; // In draw counts
+        uint32_t flags;
+    };
+
+    // Matches the push constants of depth_reduce.comp
+    struct ReducePushConstants {
+        glm::vec2 out_size;
+        glm::vec2 uv_scale; // Part of the source image that is read
+    };
+
+    constexpr uint32_t cull_flag_occlusion = 1;
+    constexpr uint32_t cull_flag_late = 2;
+    constexpr uint32_t cull_flag_cone = 4;
+
+    uint32_t previous_power_of_two(uint32_t value) {
+        uint32_t result = 1;
+        while (result * 2 <= value) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access, VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access) {
+        VkMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+        barrier.srcStageMask = src_stage;
+        barrier.srcAccessMask = src_access;
+        barrier.dstStageMask = dst_stage;
+        barrier.dstAccessMask = dst_access;
+        VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .memoryBarrierCount = 1, .pMemoryBarriers = &barrier};
+        vkCmdPipelineBarrier2(cmd, &depinfo);
+    }
+}
+
+void OcclusionCuller::init(VulkanEngine* engine) {
+    static_assert(std::extent_v<decltype(frames)> == MAX_FRAMES_IN_FLIGHT);
+    this->engine = engine;
+    VkDevice device = engine->device;
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Draws
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Indirect commands
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Visibility
+    builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Stats
+    builder.add_binding(4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT); // Depth pyramid
+    builder.add_binding(5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Draw counts
+    cull_set_layout = builder.build(engine->descriptor_layout_cache);
+    builder.clear();
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT);
+    reduce_set_layout = builder.build(engine->descriptor_layout_cache);
+
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+    };
+    descriptors.init(device, 4, sizes);
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> pyramid_sizes = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+    };
+    pyramid_descriptors.init(device, 16, pyramid_sizes);
+
+    VkPushConstantRange cull_range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants)};
+    VkPipelineLayoutCreateInfo plci{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .setLayoutCount = 1,
+        .pSetLayouts = &cull_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &cull_range,
+    };
+    VK_CHECK(vkCreatePipelineLayout(device, &plci, nullptr, &cull_pipeline_layout));
+    VkPushConstantRange reduce_range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReducePushConstants)};
+    plci.pSetLayouts = &reduce_set_layout;
+    plci.pPushConstantRanges = &reduce_range;
+    VK_CHECK(vkCreatePipelineLayout(device, &plci, nullptr, &reduce_pipeline_layout));
+    cull_pipeline = vkutil::create_compute_pipeline(device, "../shaders/cull.comp.spv", cull_pipeline_layout);
+    reduce_pipeline = vkutil::create_compute_pipeline(device, "../shaders/depth_reduce.comp.spv", reduce_pipeline_layout);
+
+    // Linear filtering over a 2x2 footprint, reduced with max, gives the farthest depth a texel of the next level covers
+    VkSamplerReductionModeCreateInfo reduction_info{.sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO};
+    reduction_info.reductionMode = VK_SAMPLER_REDUCTION_MODE_MAX;
+    VkSamplerCreateInfo si = vkinit::sampler_create_info(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    si.pNext = &reduction_info;
+    si.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    si.maxLod = VK_LOD_CLAMP_NONE;
+    reduction_sampler = engine->sampler_cache.get_sampler(si);
+
+    indirect_buffer = engine->create_buffer(2 * MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                            VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Other);
+    count_buffer = engine->create_buffer(2 * MAX_BATCHES * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                         VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Other);
+    visibility_buffer = engine->create_buffer(MAX_DRAWS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Other);
+    // Nothing was visible before the first frame, so it is all drawn by the late phase
+    engine->immediate_submit([=, this](VkCommandBuffer cmd) {
+        vkCmdFillBuffer(cmd, visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+    });
+
+    for (FrameResources& frame : frames) {
+        frame.draw_buffer = engine->create_buffer(MAX_DRAWS * sizeof(GPUDrawData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
+        frame.stats_buffer = engine->create_buffer(sizeof(GPUCullStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                   VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Other);
+        frame.cull_set = descriptors.allocate(device, cull_set_layout);
+        VkDescriptorBufferInfo draw_info{frame.draw_buffer.buffer, 0, VK_WHOLE_SIZE};
+        VkDescriptorBufferInfo command_info{indirect_buffer.buffer, 0, VK_WHOLE_SIZE};
+        VkDescriptorBufferInfo visibility_info{visibility_buffer.buffer, 0, VK_WHOLE_SIZE};
+        VkDescriptorBufferInfo stats_info{frame.stats_buffer.buffer, 0, VK_WHOLE_SIZE};
+        VkDescriptorBufferInfo count_info{count_buffer.buffer, 0, VK_WHOLE_SIZE};
+        VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.cull_set, &draw_info, 0),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.cull_set, &command_info, 1),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.cull_set, &visibility_info, 2),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.cull_set, &stats_info, 3),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.cull_set, &count_info, 5),
+        };
+        vkUpdateDescriptorSets(device, 5, writes, 0, nullptr);
+    }
+}
+
+void OcclusionCuller::cleanup() {
+    VkDevice device = engine->device;
+    destroy_pyramid();
+    for (FrameResources& frame : frames) {
+        engine->destroy_buffer(frame.draw_buffer);
+        engine->destroy_buffer(frame.stats_buffer);
+    }
+    engine->destroy_buffer(indirect_buffer);
+    engine->destroy_buffer(count_buffer);
+    engine->destroy_buffer(visibility_buffer);
+    descriptors.destroy_pools(device);
+    pyramid_descriptors.destroy_pools(device);
+    vkDestroyPipeline(device, cull_pipeline, nullptr);
+    vkDestroyPipeline(device, reduce_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, cull_pipeline_layout, nullptr);
+    vkDestroyPipelineLayout(device, reduce_pipeline_layout, nullptr);
+}
+
+void OcclusionCuller::destroy_pyramid() {
+    if (pyramid_view == VK_NULL_HANDLE) {
+        return;
+    }
+    for (VkImageView view : pyramid_mip_views) {
+        vkDestroyImageView(engine->device, view, nullptr);
+    }
+    pyramid_mip_views.clear();
+    pyramid_sets.clear();
+    vkDestroyImageView(engine->device, pyramid_view, nullptr);
+    pyramid_view = VK_NULL_HANDLE;
+    engine->destroy_image(pyramid);
+    pyramid = {};
+}
+
+// Power of two sizes make each level exactly half the one above, so a 2x2 footprint covers it without gaps
+void OcclusionCuller::create_pyramid(VkImageView depth_view, VkExtent2D depth_extent) {
+    VkDevice device = engine->device;
+    destroy_pyramid();
+    pyramid_descriptors.clear_pools(device);
+    this->depth_extent = depth_extent;
+
+    VkExtent3D extent{previous_power_of_two(depth_extent.width), previous_power_of_two(depth_extent.height), 1};
+    uint32_t levels = vkutil::mip_level_count(VkExtent2D{extent.width, extent.height});
+    VkImageCreateInfo ici = vkinit::image_create_info(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent);
+    ici.mipLevels = levels;
+    pyramid = engine->create_image(ici, MemoryCategory::RenderTargets);
+
+    VkImageViewCreateInfo ivci = vkinit::imageview_create_info(pyramid.format, pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+    ivci.subresourceRange.levelCount = levels;
+    VK_CHECK(vkCreateImageView(device, &ivci, nullptr, &pyramid_view));
+    ivci.subresourceRange.levelCount = 1;
+    for (uint32_t level = 0; level < levels; level++) {
+        ivci.subresourceRange.baseMipLevel = level;
+        VkImageView view;
+        VK_CHECK(vkCreateImageView(device, &ivci, nullptr, &view));
+        pyramid_mip_views.push_back(view);
+    }
+
+    for (uint32_t level = 0; level < levels; level++) {
+        VkDescriptorSet set = pyramid_descriptors.allocate(device, reduce_set_layout);
+        VkDescriptorImageInfo out_info{VK_NULL_HANDLE, pyramid_mip_views[level], VK_IMAGE_LAYOUT_GENERAL};
+        // Mips are written and then read in GENERAL. The depth image is read the way the render graph leaves it.
+        VkDescriptorImageInfo in_info = level == 0 ? VkDescriptorImageInfo{reduction_sampler, depth_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}
+                                                   : VkDescriptorImageInfo{reduction_sampler, pyramid_mip_views[level - 1], VK_IMAGE_LAYOUT_GENERAL};
+        VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, set, &out_info, 0),
+            vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set, &in_info, 1),
+        };
+        vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+        pyramid_sets.push_back(set);
+    }
+
+    VkDescriptorImageInfo pyramid_info{reduction_sampler, pyramid_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    for (FrameResources& frame : frames) {
+        VkWriteDescriptorSet write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame.cull_set, &pyramid_info, 4);
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    }
+}
+
+void OcclusionCuller::prepare(const std::vector<RenderObject>& renderables) {
+    FrameResources& frame = frames[engine->current_frame_index()];
+    batches.clear();
+    void* data;
+    vmaMapMemory(engine->allocator, frame.draw_buffer.allocation, &data);
+    GPUDrawData* draws = static_cast<GPUDrawData*>(data);
+    uint32_t count = 0;
+    uint64_t triangles = 0;
+    dropped_meshlets = 0;
+    for (uint32_t i = 0; i < renderables.size(); i++) {
+        const RenderObject& object = renderables[i];
+        if (batches.empty() || batches.back().material != object.material || batches.back().mesh != object.mesh) {
+            if (batches.size() == MAX_BATCHES) {
+                dropped_meshlets += static_cast<uint32_t>(object.mesh->meshlets.size());
+                continue; // Objects that share the last batch's material and mesh still fit
+            }
+            batches.push_back(DrawBatch{object.material, object.mesh, count, 0});
+        }
+        uint32_t batch = static_cast<uint32_t>(batches.size()) - 1;
+        glm::mat3 axes = glm::mat3(object.transform_matrix);
+        float scale = std::max({glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2])});
+        for (const Meshlet& meshlet : object.mesh->meshlets) {
+            if (count == MAX_DRAWS) {
+                dropped_meshlets++;
+                continue;
+            }
+            glm::vec3 center = glm::vec3(object.transform_matrix * glm::vec4(meshlet.bounds_center, 1.0f));
+            // Rotation and uniform scale keep the cone's angle. A zero axis stays zero, so the cone still never culls.
+            glm::vec3 axis = axes * meshlet.cone_axis;
+            float length = glm::length(axis);
+            axis = length > 0.0f ? axis / length : axis;
+            GPUDrawData& draw = draws[count];
+            draw.sphere = glm::vec4(center, meshlet.bounds_radius * scale);
+            draw.cone = object.material->cone_culling ? glm::vec4(axis, meshlet.cone_cutoff) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            draw.first_index = meshlet.first_index;
+            draw.index_count = meshlet.index_count;
+            draw.object_index = i;
+            draw.batch = batch;
+            draw.batch_first_draw = batches.back().first_draw;
+            batches.back().draw_count++;
+            triangles += meshlet.index_count / 3;
+            count++;
+        }
+    }
+    vmaUnmapMemory(engine->allocator, frame.draw_buffer.allocation);
+    frame.draw_count = count;
+    frame.triangle_count = triangles;
+    if (dropped_meshlets > 0 && !overflow_reported) {
+        std::cout << "Culling dropped " << dropped_meshlets << " meshlets past " << MAX_DRAWS << " draws or " << MAX_BATCHES << " batches" << std::endl;
+        overflow_reported = true;
+    }
+}
+
+void OcclusionCuller::cull(VkCommandBuffer cmd, bool late) {
+    FrameResources& frame = frames[engine->current_frame_index()];
+    if (!late) {
+        // The last frame's draws may still be reading the counts
+        memory_barrier(cmd, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        vkCmdFillBuffer(cmd, frame.stats_buffer.buffer, 0, sizeof(GPUCullStats), 0);
+        vkCmdFillBuffer(cmd, count_buffer.buffer, 0, VK_WHOLE_SIZE, 0); // Both phases
+        // The last frame's draws may still be reading the commands, its late phase wrote the visibility, and the fills have to land first
+        memory_barrier(cmd, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                       VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        frame.stats_pending = true;
+    }
+
+    // Symmetric frustum, so each pair of side planes is one normal with the sign of x or y flipped
+    const glm::mat4& proj = engine->camera_data.proj;
+    float p00 = proj[0][0];
+    float p11 = std::abs(proj[1][1]); // The Vulkan Y flip only mirrors the planes
+    glm::vec2 plane_x = glm::normalize(glm::vec2(p00, 1.0f));
+    glm::vec2 plane_y = glm::normalize(glm::vec2(p11, 1.0f));
+
+    CullPushConstants constants;
+    constants.view = engine->camera_data.view;
+    constants.frustum = glm::vec4(plane_x, plane_y);
+    constants.projection = glm::vec4(p00, p11, proj[2][2], proj[3][2]);
+    constants.pyramid_size = glm::vec2(pyramid.extent.width, pyramid.extent.height);
+    constants.znear = engine->camera_near;
+    constants.draw_count = frame.draw_count;
+    constants.command_offset = late ? MAX_DRAWS : 0;
+    constants.count_offset = late ? MAX_BATCHES : 0;
+    constants.flags = (occlusion_enabled ? cull_flag_occlusion : 0) | (late ? cull_flag_late : 0) | (cone_culling_enabled ? cull_flag_cone : 0);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &frame.cull_set, 0, nullptr);
+    vkCmdPushConstants(cmd, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &constants);
+    vkCmdDispatch(cmd, (frame.draw_count + 63) / 64, 1, 1);
+
+    // The stats are read on the host once the late phase's frame has finished
+    memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_HOST_BIT,
+                   VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_HOST_READ_BIT);
+}
+
+void OcclusionCuller::build_pyramid(VkCommandBuffer cmd, VkExtent2D draw_extent) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline);
+    for (uint32_t level = 0; level < pyramid_sets.size(); level++) {
+        uint32_t width = std::max(1u, pyramid.extent.width >> level);
+        uint32_t height = std::max(1u, pyramid.extent.height >> level);
+        ReducePushConstants constants;
+        constants.out_size = glm::vec2(width, height);
+        // Level 0 only covers the part of the depth image dynamic resolution rendered to
+        constants.uv_scale = level == 0 ? glm::vec2(float(draw_extent.width) / depth_extent.width, float(draw_extent.height) / depth_extent.height) : glm::vec2(1.0f);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline_layout, 0, 1, &pyramid_sets[level], 0, nullptr);
+        vkCmdPushConstants(cmd, reduce_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReducePushConstants), &constants);
+        vkCmdDispatch(cmd, (width + 15) / 16, (height + 15) / 16, 1);
+
+        // The next level samples this one
+        VkImageMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = pyramid.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier.subresourceRange.baseMipLevel = level;
+        barrier.subresourceRange.levelCount = 1;
+        VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &barrier};
+        vkCmdPipelineBarrier2(cmd, &depinfo);
+    }
+}
+
+void OcclusionCuller::read_stats(uint32_t frame_index) {
+    FrameResources& frame = frames[frame_index];
+    if (!frame.stats_pending) {
+        return;
+    }
+    void* data;
+    vmaMapMemory(engine->allocator, frame.stats_buffer.allocation, &data);
+    memcpy(&stats, data, sizeof(GPUCullStats));
+    vmaUnmapMemory(engine->allocator, frame.stats_buffer.allocation);
+    draw_count = frame.draw_count;
+    triangle_count = frame.triangle_count;
+    frame.stats_pending = false;
+}
+
+VkDeviceSize OcclusionCuller::command_offset(bool late, uint32_t draw) const {
+    return ((late ? MAX_DRAWS : 0) + draw) * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+VkDeviceSize OcclusionCuller::count_offset(bool late, uint32_t batch) const {
+    return ((late ? MAX_BATCHES : 0) + batch) * sizeof(uint32_t);
+}
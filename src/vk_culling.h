@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_descriptors.h>
+
+class VulkanEngine;
+struct RenderObject;
+struct Material;
+struct Mesh;
+
+// One culling unit, a meshlet of a render object. Matches DrawData in cull.comp.
+struct GPUDrawData {
+    glm::vec4 sphere; // World space center and radius
+    glm::vec4 cone; // World space axis and cutoff of the normal cone
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t object_index; // Index into the object buffer, passed to the vertex shader as firstInstance
+    uint32_t batch; // Whose draw count the meshlet adds to when it survives
+    uint32_t batch_first_draw; // Where the batch's commands start
+    uint32_t pad[3];
+};
+
+// Counters written by cull.comp and read back once the frame's fence has signaled
+struct GPUCullStats {
+    uint32_t frustum_culled;
+    uint32_t backface_culled; // Every triangle faces away from the camera
+    uint32_t occlusion_culled;
+    uint32_t drawn_early; // Visible last frame, drawn before the depth pyramid
+    uint32_t drawn_late; // Became visible this frame
+    uint32_t triangles_drawn;
+};
+
+// Consecutive draws that share a material and mesh, so they go out in one indirect draw call.
+// The draws that survive culling are packed at the front of the batch's commands, and the GPU writes how many there are.
+struct DrawBatch {
+    Material* material;
+    Mesh* mesh;
+    uint32_t first_draw;
+    uint32_t draw_count;
+};
+
+// Two-phase meshlet culling on the GPU. The early phase draws whatever was visible last frame, and a depth pyramid
+// is built from the result. The late phase tests every meshlet against the pyramid, draws the ones that just became visible,
+// and keeps the visibility for the next frame. Frustum and normal cone tests run in both phases.
+class OcclusionCuller {
+public:
+    static constexpr uint32_t MAX_DRAWS = 65536;
+    static constexpr uint32_t MAX_BATCHES = 1024;
+
+    void init(VulkanEngine* engine);
+    void cleanup();
+    void create_pyramid(VkImageView depth_view, VkExtent2D depth_extent); // Whenever the depth image is recreated. The GPU must be idle.
+    void prepare(const std::vector<RenderObject>& renderables); // Builds this frame's draws and batches
+    void cull(VkCommandBuffer cmd, bool late);
+    void build_pyramid(VkCommandBuffer cmd, VkExtent2D draw_extent); // Reduces the depth of the early phase
+    void read_stats(uint32_t frame_index); // Once that frame's fence has signaled
+    VkDeviceSize command_offset(bool late, uint32_t draw) const; // Where a draw's command is in the indirect buffer
+    VkDeviceSize count_offset(bool late, uint32_t batch) const; // Where a batch's draw count is in the count buffer
+
+    bool occlusion_enabled{true}; // Frustum culling always runs, this only switches the depth pyramid test
+    // Skips meshlets that face away from the camera, for materials with cone_culling set. The pipelines draw both sides,
+    // so this is the only backface culling there is, and it's off by default to keep drawing everything they draw.
+    bool cone_culling_enabled{false};
+
+    std::vector<DrawBatch> batches;
+    AllocatedBuffer indirect_buffer; // Early phase commands, then late phase commands, MAX_DRAWS each
+    AllocatedBuffer count_buffer; // Draw count of each batch, early phase then late phase
+    AllocatedImage pyramid{};
+    VkImageView pyramid_view{VK_NULL_HANDLE};
+
+    // Stats from the last frame read back
+    GPUCullStats stats{};
+    uint32_t draw_count{0};
+    uint64_t triangle_count{0};
+    // Meshlets that didn't fit in MAX_DRAWS, or whose object needed a batch past MAX_BATCHES, in the last prepare.
+    // They aren't drawn at all. The first frame that drops any also logs it.
+    uint32_t dropped_meshlets{0};
+    bool overflow_reported{false};
+
+private:
+    struct FrameResources {
+        AllocatedBuffer draw_buffer;
+        AllocatedBuffer stats_buffer;
+        VkDescriptorSet cull_set;
+        uint32_t draw_count{0};
+        uint64_t triangle_count{0};
+        bool stats_pending{false};
+    };
+
+    VulkanEngine* engine{nullptr};
+    FrameResources frames[4]; // One per frame in flight
+    AllocatedBuffer visibility_buffer; // One flag per draw, carried over from the last late phase
+    std::vector<VkImageView> pyramid_mip_views;
+    std::vector<VkDescriptorSet> pyramid_sets; // One per mip, reading the level above (or the depth image)
+    VkExtent2D depth_extent{};
+    VkSampler reduction_sampler; // Returns the farthest depth under its footprint instead of filtering
+    DescriptorAllocatorGrowable descriptors;
+    DescriptorAllocatorGrowable pyramid_descriptors; // Reset whenever the pyramid is recreated
+    VkDescriptorSetLayout cull_set_layout;
+    VkDescriptorSetLayout reduce_set_layout;
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipelineLayout reduce_pipeline_layout;
+    VkPipeline cull_pipeline;
+    VkPipeline reduce_pipeline;
+
+    void destroy_pyramid();
+};
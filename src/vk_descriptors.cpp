@@ -1,5 +1,7 @@
 #include <vk_descriptors.h>
 
+#include <algorithm>
+
 void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags shader_stages) {
     VkDescriptorSetLayoutBinding newbind{};
     newbind.binding = binding;
@@ -25,6 +27,142 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device) {
     VK_CHECK(vkCreateDescriptorSetLayout(device, &dslci, nullptr, &set));
     return set;
 }
+VkDescriptorSetLayout DescriptorLayoutBuilder::build(DescriptorLayoutCache& cache) {
+    VkDescriptorSetLayoutCreateInfo dslci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .bindingCount = (uint32_t)bindings.size(),
+        .pBindings = bindings.data(),
+    };
+    return cache.create_descriptor_layout(&dslci);
+}
+
+// Mixes a value into a running hash (same constant boost::hash_combine uses)
+static void hash_combine(size_t& seed, size_t value) {
+    seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+void DescriptorLayoutCache::init(VkDevice new_device) {
+    device = new_device;
+}
+void DescriptorLayoutCache::cleanup() {
+    for (auto& pair : layout_cache) {
+        vkDestroyDescriptorSetLayout(device, pair.second, nullptr);
+    }
+    layout_cache.clear();
+    for (VkDescriptorSetLayout layout : uncached_layouts) {
+        vkDestroyDescriptorSetLayout(device, layout, nullptr);
+    }
+    uncached_layouts.clear();
+}
+VkDescriptorSetLayout DescriptorLayoutCache::create_descriptor_layout(VkDescriptorSetLayoutCreateInfo* info) {
+    VkDescriptorSetLayout layout;
+    // Binding flags and other extension structs aren't part of the key, so don't risk handing back the wrong layout
+    if (info->pNext != nullptr) {
+        misses++;
+        VK_CHECK(vkCreateDescriptorSetLayout(device, info, nullptr, &layout));
+        uncached_layouts.push_back(layout);
+        return layout;
+    }
+    DescriptorLayoutInfo layout_info;
+    layout_info.flags = info->flags;
+    layout_info.bindings.reserve(info->bindingCount);
+    for (uint32_t i = 0; i < info->bindingCount; i++) {
+        layout_info.bindings.push_back(info->pBindings[i]);
+    }
+    // Sort so that the same bindings added in a different order still hit the cache
+    std::sort(layout_info.bindings.begin(), layout_info.bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+        return a.binding < b.binding;
+    });
+
+    auto it = layout_cache.find(layout_info);
+    if (it != layout_cache.end()) {
+        hits++;
+        return (*it).second;
+    }
+    misses++;
+    VK_CHECK(vkCreateDescriptorSetLayout(device, info, nullptr, &layout));
+    layout_cache[layout_info] = layout;
+    return layout;
+}
+bool DescriptorLayoutCache::DescriptorLayoutInfo::operator==(const DescriptorLayoutInfo& other) const {
+    if (flags != other.flags || bindings.size() != other.bindings.size()) {
+        return false;
+    }
+    // Bindings are sorted, so they can be compared in order
+    for (size_t i = 0; i < bindings.size(); i++) {
+        const VkDescriptorSetLayoutBinding& a = bindings[i];
+        const VkDescriptorSetLayoutBinding& b = other.bindings[i];
+        if (a.binding != b.binding || a.descriptorType != b.descriptorType || a.descriptorCount != b.descriptorCount ||
+            a.stageFlags != b.stageFlags || a.pImmutableSamplers != b.pImmutableSamplers) {
+            return false;
+        }
+    }
+    return true;
+}
+size_t DescriptorLayoutCache::DescriptorLayoutInfo::hash() const {
+    size_t result = std::hash<size_t>()(bindings.size());
+    hash_combine(result, flags);
+    for (const VkDescriptorSetLayoutBinding& b : bindings) {
+        // Pack the small binding fields into a single word before hashing
+        size_t binding_hash = b.binding | (size_t(b.descriptorType) << 8) | (size_t(b.descriptorCount) << 16) | (size_t(b.stageFlags) << 32);
+        hash_combine(result, std::hash<size_t>()(binding_hash));
+        hash_combine(result, std::hash<const void*>()(b.pImmutableSamplers));
+    }
+    return result;
+}
+
+void SamplerCache::init(VkDevice new_device) {
+    device = new_device;
+}
+void SamplerCache::cleanup() {
+    for (auto& pair : sampler_cache) {
+        vkDestroySampler(device, pair.second, nullptr);
+    }
+    sampler_cache.clear();
+    for (VkSampler sampler : uncached_samplers) {
+        vkDestroySampler(device, sampler, nullptr);
+    }
+    uncached_samplers.clear();
+}
+VkSampler SamplerCache::get_sampler(const VkSamplerCreateInfo& info) {
+    VkSampler sampler;
+    if (info.pNext != nullptr) {
+        misses++;
+        VK_CHECK(vkCreateSampler(device, &info, nullptr, &sampler));
+        uncached_samplers.push_back(sampler);
+        return sampler;
+    }
+    auto it = sampler_cache.find(info);
+    if (it != sampler_cache.end()) {
+        hits++;
+        return (*it).second;
+    }
+    misses++;
+    VK_CHECK(vkCreateSampler(device, &info, nullptr, &sampler));
+    sampler_cache[info] = sampler;
+    return sampler;
+}
+size_t SamplerCache::SamplerInfoHash::operator()(const VkSamplerCreateInfo& k) const {
+    size_t result = std::hash<uint32_t>()(k.flags);
+    hash_combine(result, k.magFilter | (k.minFilter << 4) | (k.mipmapMode << 8));
+    hash_combine(result, k.addressModeU | (k.addressModeV << 8) | (k.addressModeW << 16));
+    hash_combine(result, std::hash<float>()(k.mipLodBias));
+    hash_combine(result, k.anisotropyEnable | (k.compareEnable << 1) | (k.unnormalizedCoordinates << 2));
+    hash_combine(result, std::hash<float>()(k.maxAnisotropy));
+    hash_combine(result, k.compareOp | (k.borderColor << 8));
+    hash_combine(result, std::hash<float>()(k.minLod));
+    hash_combine(result, std::hash<float>()(k.maxLod));
+    return result;
+}
+bool SamplerCache::SamplerInfoEqual::operator()(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b) const {
+    return a.flags == b.flags && a.magFilter == b.magFilter && a.minFilter == b.minFilter && a.mipmapMode == b.mipmapMode &&
+        a.addressModeU == b.addressModeU && a.addressModeV == b.addressModeV && a.addressModeW == b.addressModeW &&
+        a.mipLodBias == b.mipLodBias && a.anisotropyEnable == b.anisotropyEnable && a.maxAnisotropy == b.maxAnisotropy &&
+        a.compareEnable == b.compareEnable && a.compareOp == b.compareOp && a.minLod == b.minLod && a.maxLod == b.maxLod &&
+        a.borderColor == b.borderColor && a.unnormalizedCoordinates == b.unnormalizedCoordinates;
+}
 
 
 void DescriptorAllocator::init_pool(VkDevice device, uint32_t max_sets, std::span<PoolSizeRatio> pool_ratios) {
@@ -65,3 +203,92 @@ VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLa
     return ds;
 }
 
+// Pools grow by 50% each time one fills up, capped so a single pool doesn't get unreasonably large
+constexpr float DESCRIPTOR_POOL_GROWTH = 1.5f;
+constexpr uint32_t MAX_SETS_PER_POOL = 4092;
+
+void DescriptorAllocatorGrowable::init(VkDevice device, uint32_t initial_sets, std::span<PoolSizeRatio> pool_ratios) {
+    ratios.clear();
+    for (PoolSizeRatio ratio : pool_ratios) {
+        ratios.push_back(ratio);
+    }
+    VkDescriptorPool new_pool = create_pool(device, initial_sets, pool_ratios);
+    sets_per_pool = std::min(uint32_t(initial_sets * DESCRIPTOR_POOL_GROWTH), MAX_SETS_PER_POOL);
+    ready_pools.push_back(new_pool);
+}
+// Resetting a pool frees every set allocated from it, so all of the full pools become ready again
+void DescriptorAllocatorGrowable::clear_pools(VkDevice device) {
+    for (VkDescriptorPool pool : ready_pools) {
+        vkResetDescriptorPool(device, pool, 0);
+    }
+    for (VkDescriptorPool pool : full_pools) {
+        vkResetDescriptorPool(device, pool, 0);
+        ready_pools.push_back(pool);
+    }
+    full_pools.clear();
+}
+void DescriptorAllocatorGrowable::destroy_pools(VkDevice device) {
+    for (VkDescriptorPool pool : ready_pools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    ready_pools.clear();
+    for (VkDescriptorPool pool : full_pools) {
+        vkDestroyDescriptorPool(device, pool, nullptr);
+    }
+    full_pools.clear();
+}
+VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext) {
+    VkDescriptorPool pool_to_use = get_pool(device);
+    VkDescriptorSetAllocateInfo dsai = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .pNext = pNext,
+        .descriptorPool = pool_to_use,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout
+    };
+    VkDescriptorSet ds;
+    VkResult result = vkAllocateDescriptorSets(device, &dsai, &ds);
+    // The pool is exhausted, so retire it and try once more with a fresh pool
+    if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
+        full_pools.push_back(pool_to_use);
+        pool_to_use = get_pool(device);
+        dsai.descriptorPool = pool_to_use;
+        VK_CHECK(vkAllocateDescriptorSets(device, &dsai, &ds));
+    } else {
+        VK_CHECK(result);
+    }
+    ready_pools.push_back(pool_to_use);
+    return ds;
+}
+// Takes a ready pool off the back of the list, or creates a bigger one if none are left
+VkDescriptorPool DescriptorAllocatorGrowable::get_pool(VkDevice device) {
+    VkDescriptorPool new_pool;
+    if (!ready_pools.empty()) {
+        new_pool = ready_pools.back();
+        ready_pools.pop_back();
+    } else {
+        new_pool = create_pool(device, sets_per_pool, ratios);
+        sets_per_pool = std::min(uint32_t(sets_per_pool * DESCRIPTOR_POOL_GROWTH), MAX_SETS_PER_POOL);
+    }
+    return new_pool;
+}
+VkDescriptorPool DescriptorAllocatorGrowable::create_pool(VkDevice device, uint32_t set_count, std::span<PoolSizeRatio> pool_ratios) {
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+    for (PoolSizeRatio ratio : pool_ratios) {
+        pool_sizes.push_back(VkDescriptorPoolSize{
+            .type = ratio.type,
+            .descriptorCount = std::max(uint32_t(ratio.ratio * set_count), 1u)
+        });
+    }
+    VkDescriptorPoolCreateInfo dpci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .maxSets = set_count,
+        .poolSizeCount = (uint32_t)pool_sizes.size(),
+        .pPoolSizes = pool_sizes.data()
+    };
+    VkDescriptorPool new_pool;
+    VK_CHECK(vkCreateDescriptorPool(device, &dpci, nullptr, &new_pool));
+    return new_pool;
+}
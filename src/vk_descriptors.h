@@ -2,12 +2,70 @@
 
 #include <vk_types.h>
 
+struct DescriptorLayoutCache;
+
 struct DescriptorLayoutBuilder {
     std::vector<VkDescriptorSetLayoutBinding> bindings;
 
     void add_binding(uint32_t binding, VkDescriptorType type, VkShaderStageFlags shader_stages);
     void clear();
     VkDescriptorSetLayout build(VkDevice device);
+    VkDescriptorSetLayout build(DescriptorLayoutCache& cache); // Returns a cached layout if an identical one was already built
+};
+
+// Hashes binding lists so identical descriptor set layouts are only created once. The cache owns every layout it returns.
+struct DescriptorLayoutCache {
+public:
+    void init(VkDevice device);
+    void cleanup();
+
+    VkDescriptorSetLayout create_descriptor_layout(VkDescriptorSetLayoutCreateInfo* info);
+
+    struct DescriptorLayoutInfo {
+        std::vector<VkDescriptorSetLayoutBinding> bindings; // Sorted by binding number
+        VkDescriptorSetLayoutCreateFlags flags;
+
+        bool operator==(const DescriptorLayoutInfo& other) const;
+        size_t hash() const;
+    };
+
+    uint32_t hits{0};
+    uint32_t misses{0};
+    size_t size() const { return layout_cache.size() + uncached_layouts.size(); }
+
+private:
+    struct DescriptorLayoutHash {
+        size_t operator()(const DescriptorLayoutInfo& k) const { return k.hash(); }
+    };
+
+    std::unordered_map<DescriptorLayoutInfo, VkDescriptorSetLayout, DescriptorLayoutHash> layout_cache;
+    std::vector<VkDescriptorSetLayout> uncached_layouts; // Layouts with extension structs can't be keyed, but are still owned here
+    VkDevice device;
+};
+
+// Same idea as the layout cache, but keyed on the whole VkSamplerCreateInfo
+struct SamplerCache {
+public:
+    void init(VkDevice device);
+    void cleanup();
+
+    VkSampler get_sampler(const VkSamplerCreateInfo& info);
+
+    uint32_t hits{0};
+    uint32_t misses{0};
+    size_t size() const { return sampler_cache.size() + uncached_samplers.size(); }
+
+private:
+    struct SamplerInfoHash {
+        size_t operator()(const VkSamplerCreateInfo& k) const;
+    };
+    struct SamplerInfoEqual {
+        bool operator()(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b) const;
+    };
+
+    std::unordered_map<VkSamplerCreateInfo, VkSampler, SamplerInfoHash, SamplerInfoEqual> sampler_cache;
+    std::vector<VkSampler> uncached_samplers;
+    VkDevice device;
 };
 
 struct DescriptorAllocator {
@@ -23,4 +81,29 @@ struct DescriptorAllocator {
     void destroy_pool(VkDevice device);
 
     VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout);
-};
\ No newline at end of file
+};
+
+// Keeps lists of full and ready pools. When the current pool runs out a new one is created with more sets than the last,
+// so allocation cost stays constant no matter how many descriptor sets are requested.
+struct DescriptorAllocatorGrowable {
+public:
+    struct PoolSizeRatio {
+        VkDescriptorType type;
+        float ratio;
+    };
+
+    void init(VkDevice device, uint32_t initial_sets, std::span<PoolSizeRatio> pool_ratios);
+    void clear_pools(VkDevice device); // Resets every pool so all sets can be reallocated. Used for per-frame allocators
+    void destroy_pools(VkDevice device);
+
+    VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext = nullptr);
+
+private:
+    VkDescriptorPool get_pool(VkDevice device);
+    VkDescriptorPool create_pool(VkDevice device, uint32_t set_count, std::span<PoolSizeRatio> pool_ratios);
+
+    std::vector<PoolSizeRatio> ratios;
+    std::vector<VkDescriptorPool> full_pools; // Pools that have returned an out of memory error
+    std::vector<VkDescriptorPool> ready_pools; // Pools that can still be allocated from
+    uint32_t sets_per_pool;
+};
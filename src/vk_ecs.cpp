@@ -0,0 +1,234 @@
+#include <vk_ecs.h>
+
+#include <memory>
+#include <mutex>
+#include <random>
+
+namespace ecs_detail {
+    namespace {
+        std::mutex registration_mutex;
+        std::vector<uint32_t> sizes;
+    }
+
+    ComponentId register_component(uint32_t size) {
+        std::lock_guard<std::mutex> lock(registration_mutex);
+        if (sizes.size() == MAX_COMPONENTS) {
+            std::cout << "Too many component types, the limit is " << MAX_COMPONENTS << std::endl;
+            abort();
+        }
+        sizes.push_back(size);
+        return static_cast<ComponentId>(sizes.size() - 1);
+    }
+
+    uint32_t component_size(ComponentId id) {
+        std::lock_guard<std::mutex> lock(registration_mutex);
+        return sizes[id];
+    }
+}
+
+EntityRegistry::EntityRegistry() {
+    find_or_create_archetype(0); // Entities without components
+}
+
+Entity EntityRegistry::create() {
+    Entity entity = allocate_entity();
+    append_row(0, entity);
+    return entity;
+}
+
+void EntityRegistry::destroy(Entity entity) {
+    if (!alive(entity)) {
+        return;
+    }
+    Record& record = records[entity.index];
+    remove_row(record.archetype, record.row);
+    record.archetype = INVALID;
+    record.generation++;
+    free_indices.push_back(entity.index);
+    version++;
+}
+
+uint32_t EntityRegistry::find_or_create_archetype(ComponentMask mask) {
+    auto it = archetype_lookup.find(mask);
+    if (it != archetype_lookup.end()) {
+        return it->second;
+    }
+    Archetype archetype;
+    archetype.mask = mask;
+    std::fill(std::begin(archetype.column_index), std::end(archetype.column_index), int8_t(-1));
+    for (ComponentId id = 0; id < MAX_COMPONENTS; id++) {
+        if (mask & (ComponentMask(1) << id)) {
+            archetype.column_index[id] = static_cast<int8_t>(archetype.components.size());
+            archetype.components.push_back(id);
+            archetype.component_sizes.push_back(ecs_detail::component_size(id));
+        }
+    }
+    archetype.columns.resize(archetype.components.size());
+    uint32_t index = static_cast<uint32_t>(archetypes.size());
+    archetypes.push_back(std::move(archetype));
+    archetype_lookup[mask] = index;
+    return index;
+}
+
+uint32_t EntityRegistry::neighbor(uint32_t archetype, ComponentId component, bool add) {
+    auto& edges = add ? archetypes[archetype].add_edges : archetypes[archetype].remove_edges;
+    auto it = edges.find(component);
+    if (it != edges.end()) {
+        return it->second;
+    }
+    ComponentMask mask = archetypes[archetype].mask ^ (ComponentMask(1) << component);
+    uint32_t target = find_or_create_archetype(mask); // May move the archetypes, so edges is looked up again
+    (add ? archetypes[archetype].add_edges : archetypes[archetype].remove_edges)[component] = target;
+    return target;
+}
+
+Entity EntityRegistry::allocate_entity() {
+    uint32_t index;
+    if (!free_indices.empty()) {
+        index = free_indices.back();
+        free_indices.pop_back();
+    } else {
+        index = static_cast<uint32_t>(records.size());
+        records.push_back(Record{});
+    }
+    return Entity{index, records[index].generation};
+}
+
+uint32_t EntityRegistry::append_row(uint32_t archetype_index, Entity entity) {
+    Archetype& archetype = archetypes[archetype_index];
+    uint32_t row = archetype.size();
+    archetype.entities.push_back(entity);
+    for (size_t column = 0; column < archetype.columns.size(); column++) {
+        archetype.columns[column].resize(archetype.columns[column].size() + archetype.component_sizes[column]);
+    }
+    records[entity.index].archetype = archetype_index;
+    records[entity.index].row = row;
+    version++;
+    return row;
+}
+
+void EntityRegistry::move_entity(Entity entity, uint32_t target_index) {
+    Record& record = records[entity.index];
+    uint32_t source_index = record.archetype;
+    uint32_t source_row = record.row;
+    uint32_t target_row = append_row(target_index, entity);
+    Archetype& source = archetypes[source_index];
+    Archetype& target = archetypes[target_index];
+    for (size_t column = 0; column < target.components.size(); column++) {
+        int source_column = source.column_index[target.components[column]];
+        if (source_column >= 0) {
+            std::memcpy(target.at(column, target_row), source.at(source_column, source_row), target.component_sizes[column]);
+        }
+    }
+    remove_row(source_index, source_row);
+    // append_row pointed the record at the new row, and remove_row only touches the entity that fills the gap
+}
+
+void EntityRegistry::remove_row(uint32_t archetype_index, uint32_t row) {
+    Archetype& archetype = archetypes[archetype_index];
+    uint32_t last = archetype.size() - 1;
+    if (row != last) {
+        for (size_t column = 0; column < archetype.columns.size(); column++) {
+            std::memcpy(archetype.at(column, row), archetype.at(column, last), archetype.component_sizes[column]);
+        }
+        Entity moved = archetype.entities[last];
+        archetype.entities[row] = moved;
+        records[moved.index].row = row;
+    }
+    archetype.entities.pop_back();
+    for (size_t column = 0; column < archetype.columns.size(); column++) {
+        archetype.columns[column].resize(archetype.columns[column].size() - archetype.component_sizes[column]);
+    }
+    version++;
+}
+
+namespace {
+    struct BenchPosition {
+        glm::vec3 value;
+    };
+    struct BenchVelocity {
+        glm::vec3 value;
+    };
+    struct BenchTag {
+        uint32_t value;
+    };
+
+    // What an entity looks like as a standalone heap object, with a few other fields around the ones the update needs
+    struct BenchObject {
+        glm::mat4 transform;
+        glm::vec3 position;
+        glm::vec3 velocity;
+        void* mesh;
+        void* material;
+    };
+
+    template <typename F>
+    double time_ns_per(uint32_t count, F&& function) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / std::max(count, 1u);
+    }
+}
+
+EcsBenchmark run_ecs_benchmark(uint32_t entity_count) {
+    EcsBenchmark result;
+    result.entity_count = entity_count;
+    const float dt = 1.0f / 60.0f;
+    float checksum = 0.0f; // Keeps the loops from being optimized away
+
+    EntityRegistry registry;
+    std::vector<Entity> entities(entity_count);
+    result.create_ns = time_ns_per(entity_count, [&]() {
+        for (uint32_t i = 0; i < entity_count; i++) {
+            entities[i] = registry.create(BenchPosition{glm::vec3(float(i))}, BenchVelocity{glm::vec3(1.0f)});
+        }
+    });
+    result.iterate_ns = time_ns_per(entity_count, [&]() {
+        registry.each<BenchPosition, BenchVelocity>([&](Entity, BenchPosition& position, const BenchVelocity& velocity) {
+            position.value += velocity.value * dt;
+        });
+    });
+    registry.each<BenchPosition>([&](Entity, BenchPosition& position) { checksum += position.value.x; });
+
+    // Each object is its own allocation, visited in a shuffled order the way pointers into a hash map are
+    std::vector<std::unique_ptr<BenchObject>> objects(entity_count);
+    for (uint32_t i = 0; i < entity_count; i++) {
+        objects[i] = std::make_unique<BenchObject>(BenchObject{glm::mat4(1.0f), glm::vec3(float(i)), glm::vec3(1.0f), nullptr, nullptr});
+    }
+    std::vector<BenchObject*> pointers(entity_count);
+    for (uint32_t i = 0; i < entity_count; i++) {
+        pointers[i] = objects[i].get();
+    }
+    std::shuffle(pointers.begin(), pointers.end(), std::mt19937(42));
+    result.iterate_pointer_ns = time_ns_per(entity_count, [&]() {
+        for (BenchObject* object : pointers) {
+            object->position += object->velocity * dt;
+        }
+    });
+    for (BenchObject* object : pointers) {
+        checksum += object->position.x;
+    }
+
+    // Structural changes on every other entity, so both archetypes stay populated
+    uint32_t half = entity_count / 2;
+    result.add_component_ns = time_ns_per(half, [&]() {
+        for (uint32_t i = 0; i < entity_count; i += 2) {
+            registry.add(entities[i], BenchTag{i});
+        }
+    });
+    result.remove_component_ns = time_ns_per(half, [&]() {
+        for (uint32_t i = 0; i < entity_count; i += 2) {
+            registry.remove<BenchTag>(entities[i]);
+        }
+    });
+    result.destroy_ns = time_ns_per(entity_count, [&]() {
+        for (Entity entity : entities) {
+            registry.destroy(entity);
+        }
+    });
+
+    std::cout << "ECS benchmark, " << entity_count << " entities (ns per entity): create " << result.create_ns << ", iterate " << result.iterate_ns
+              << " (pointers " << result.iterate_pointer_ns << "), add " << result.add_component_ns << ", remove " << result.remove_component_ns
+              << ", destroy " << result.destroy_ns << " [" << checksum << "]" << std::endl;
+    return result;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+// Entities are an index into the registry plus a generation. Destroying an entity bumps the generation,
+// so stale copies of the id stop resolving instead of silently pointing at whatever reuses the slot.
+struct Entity {
+    uint32_t index{~0u};
+    uint32_t generation{0};
+    bool operator==(const Entity&) const = default;
+};
+constexpr Entity NULL_ENTITY{};
+
+using ComponentId = uint32_t;
+using ComponentMask = uint64_t; // One bit per component type
+constexpr uint32_t MAX_COMPONENTS = 64;
+
+namespace ecs_detail {
+    ComponentId register_component(uint32_t size);
+    uint32_t component_size(ComponentId id);
+}
+
+// Ids are handed out the first time a type is used. Components are moved between archetypes with memcpy.
+template <typename T>
+ComponentId component_id() {
+    static_assert(std::is_trivially_copyable_v<T>, "Components must be trivially copyable");
+    static const ComponentId id = ecs_detail::register_component(sizeof(T));
+    return id;
+}
+
+template <typename... Ts>
+ComponentMask component_mask() {
+    return ((ComponentMask(1) << component_id<Ts>()) | ... | ComponentMask(0));
+}
+
+// Every entity with exactly the same set of components. Each component is one tightly packed array, and row i
+// of every array belongs to entities[i], so a query walks memory front to back.
+struct Archetype {
+    ComponentMask mask{0};
+    std::vector<ComponentId> components;
+    std::vector<std::vector<uint8_t>> columns; // Parallel to components
+    std::vector<uint32_t> component_sizes;
+    std::vector<Entity> entities;
+    int8_t column_index[MAX_COMPONENTS]; // -1 for components the archetype doesn't have
+    // Archetypes reached by adding or removing one component, found once and then remembered
+    std::unordered_map<ComponentId, uint32_t> add_edges;
+    std::unordered_map<ComponentId, uint32_t> remove_edges;
+
+    uint32_t size() const { return static_cast<uint32_t>(entities.size()); }
+    void* at(uint32_t column, uint32_t row) { return columns[column].data() + size_t(row) * component_sizes[column]; }
+    template <typename T>
+    T* column() { return reinterpret_cast<T*>(columns[column_index[component_id<T>()]].data()); }
+};
+
+// Archetype-based entity storage. Adding or removing a component moves the entity's row to another archetype,
+// so structural changes cost a copy of the entity, while iterating stays a linear walk over arrays.
+class EntityRegistry {
+public:
+    struct Location {
+        uint32_t archetype;
+        uint32_t row;
+    };
+
+    EntityRegistry();
+
+    Entity create(); // With no components
+    template <typename... Ts>
+    Entity create(const Ts&... components);
+    void destroy(Entity entity);
+    bool alive(Entity entity) const { return entity.index < records.size() && records[entity.index].generation == entity.generation && records[entity.index].archetype != INVALID; }
+    Entity entity(uint32_t index) const { return Entity{index, records[index].generation}; } // The live entity in a slot
+    Location location(Entity entity) const { return Location{records[entity.index].archetype, records[entity.index].row}; }
+
+    // Dead or stale entities have no components. Adding or removing on one does nothing.
+    template <typename T>
+    void add(Entity entity, const T& component); // Overwrites the component if the entity already has one
+    template <typename T>
+    void remove(Entity entity);
+    template <typename T>
+    bool has(Entity entity) const { return alive(entity) && (archetypes[records[entity.index].archetype].mask & component_mask<T>()) != 0; }
+    template <typename T>
+    T* get(Entity entity); // nullptr if the entity doesn't have the component, or isn't alive
+
+    // Calls function(Entity, Ts&...) for every entity that has all of Ts. No structural changes while it runs.
+    template <typename... Ts, typename F>
+    void each(F&& function);
+
+    size_t entity_count() const { return records.size() - free_indices.size(); }
+    size_t archetype_count() const { return archetypes.size(); }
+    size_t capacity() const { return records.size(); } // Highest entity index plus one
+    // Bumped by every structural change, so users can tell whether a layout they derived from the archetypes still holds
+    uint64_t structure_version() const { return version; }
+
+private:
+    static constexpr uint32_t INVALID = ~0u;
+
+    struct Record {
+        uint32_t archetype{INVALID};
+        uint32_t row{0};
+        uint32_t generation{0};
+    };
+
+    std::vector<Record> records;
+    std::vector<uint32_t> free_indices;
+    std::vector<Archetype> archetypes;
+    std::unordered_map<ComponentMask, uint32_t> archetype_lookup;
+    uint64_t version{0};
+
+    uint32_t find_or_create_archetype(ComponentMask mask);
+    uint32_t neighbor(uint32_t archetype, ComponentId component, bool add); // Follows or creates an edge
+    Entity allocate_entity();
+    uint32_t append_row(uint32_t archetype, Entity entity); // Grows every column by one uninitialized row
+    void move_entity(Entity entity, uint32_t target); // Copies the components both archetypes have
+    void remove_row(uint32_t archetype, uint32_t row); // Moves the last row into the gap
+};
+
+template <typename... Ts>
+Entity EntityRegistry::create(const Ts&... components) {
+    Entity entity = allocate_entity();
+    uint32_t archetype = find_or_create_archetype(component_mask<Ts...>());
+    uint32_t row = append_row(archetype, entity);
+    Archetype& target = archetypes[archetype];
+    (std::memcpy(target.at(target.column_index[component_id<Ts>()], row), &components, sizeof(Ts)), ...);
+    return entity;
+}
+
+template <typename T>
+void EntityRegistry::add(Entity entity, const T& component) {
+    if (!alive(entity)) {
+        return;
+    }
+    ComponentId id = component_id<T>();
+    Record& record = records[entity.index];
+    if (!(archetypes[record.archetype].mask & (ComponentMask(1) << id))) {
+        move_entity(entity, neighbor(record.archetype, id, true));
+    }
+    Archetype& archetype = archetypes[record.archetype];
+    std::memcpy(archetype.at(archetype.column_index[id], record.row), &component, sizeof(T));
+}
+
+template <typename T>
+void EntityRegistry::remove(Entity entity) {
+    if (!alive(entity)) {
+        return;
+    }
+    ComponentId id = component_id<T>();
+    Record& record = records[entity.index];
+    if (archetypes[record.archetype].mask & (ComponentMask(1) << id)) {
+        move_entity(entity, neighbor(record.archetype, id, false));
+    }
+}
+
+template <typename T>
+T* EntityRegistry::get(Entity entity) {
+    if (!alive(entity)) {
+        return nullptr;
+    }
+    const Record& record = records[entity.index];
+    Archetype& archetype = archetypes[record.archetype];
+    int column = archetype.column_index[component_id<T>()];
+    return column < 0 ? nullptr : reinterpret_cast<T*>(archetype.at(column, record.row));
+}
+
+template <typename... Ts, typename F>
+void EntityRegistry::each(F&& function) {
+    ComponentMask mask = component_mask<Ts...>();
+    for (Archetype& archetype : archetypes) {
+        if ((archetype.mask & mask) != mask || archetype.entities.empty()) {
+            continue;
+        }
+        std::tuple<Ts*...> columns{archetype.template column<Ts>()...};
+        const Entity* entities = archetype.entities.data();
+        for (uint32_t row = 0, count = archetype.size(); row < count; row++) {
+            function(entities[row], std::get<Ts*>(columns)[row]...);
+        }
+    }
+}
+
+// Timings of the same workloads with the registry and with a vector of individually allocated objects, per entity
+struct EcsBenchmark {
+    uint32_t entity_count{0};
+    double create_ns{0};
+    double iterate_ns{0};
+    double iterate_pointer_ns{0}; // The same update through shuffled heap pointers, like the old render objects
+    double add_component_ns{0};
+    double remove_component_ns{0};
+    double destroy_ns{0};
+};
+
+EcsBenchmark run_ecs_benchmark(uint32_t entity_count);
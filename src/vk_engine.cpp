@@ -21,6 +21,7 @@
 #include <fstream>
 #include <thread>
 #include <chrono>
+#include <bit>
 
 VulkanEngine* loaded_engine = nullptr;
 
@@ -52,7 +53,16 @@ void VulkanEngine::init() {
 	allocator_info.physicalDevice = chosenGPU;
 	allocator_info.device = device;
 	allocator_info.instance = instance;
+	allocator_info.vulkanApiVersion = VK_API_VERSION_1_3;
+	if (memory_budget_supported) {
+		allocator_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
 	vmaCreateAllocator(&allocator_info, &allocator);
+	memory.init(allocator, chosenGPU, memory_budget_supported);
+	memory_pools.init(allocator);
+	main_deletion_queue.push_function([this]() { memory_pools.cleanup(); }); // First in, so it runs after every pooled allocation is gone
+	jobs.init();
+	main_deletion_queue.push_function([this]() { jobs.cleanup(); });
 
 	init_swapchain();
 	init_commands();
@@ -60,12 +70,30 @@ void VulkanEngine::init() {
 	// init_framebuffers();
 	init_sync();
 	init_descriptors();
+	init_async_compute();
+	// The graph builds the depth pyramid from the depth image it owns, so the culler has to exist first
+	occlusion_culler.init(this);
+	main_deletion_queue.push_function([this]() { occlusion_culler.cleanup(); });
+	lighting.init(this);
+	main_deletion_queue.push_function([this]() { lighting.cleanup(); });
+	shadows.init(this);
+	main_deletion_queue.push_function([this]() { shadows.cleanup(); });
+	init_render_graph();
 	init_pipelines();
 	init_imgui();
 
+	texture_streamer.init(this);
+	main_deletion_queue.push_function([this]() { texture_streamer.cleanup(); });
+	// Dropping texture mips is the cheapest way to give memory back
+	memory.add_pressure_callback([this](VkDeviceSize wanted) { return texture_streamer.release(wanted); });
+	chunk_streamer.init(this);
+	main_deletion_queue.push_function([this]() { chunk_streamer.cleanup(); });
+	memory.add_pressure_callback([this](VkDeviceSize wanted) { return chunk_streamer.release(wanted); });
 	load_images();
 	load_meshes();
 	init_scene();
+	// Startup assets are drawn on the first frame, so don't start rendering until they are on the GPU
+	wait_for_uploads();
 	//everything went fine
 	isInitialized = true;
 }
@@ -101,10 +129,18 @@ void VulkanEngine::init_vulkan() {
 	VkPhysicalDeviceVulkan12Features features12{};
 	features12.bufferDeviceAddress = true; // Allows use of GPU pointers without binding buffers
 	features12.descriptorIndexing = true; // Allows use of bindless textures
+	features12.timelineSemaphore = true; // Lets uploads signal an increasing value instead of needing a semaphore per submit
+	features12.samplerFilterMinmax = true; // Max reduction sampler for building the depth pyramid
+	features12.drawIndirectCount = true; // Culling writes how many meshlets of each batch survived
+	// Culling writes the indirect commands, and firstInstance carries the object index
+	VkPhysicalDeviceFeatures features10{};
+	features10.multiDrawIndirect = true;
+	features10.drawIndirectFirstInstance = true;
 	// Obtain and select physical devices
 	vkb::PhysicalDeviceSelector phys_device_selector(vkb_instance); // constructs phys. device selector with a vkb instance
 	auto phys_device_selector_return = phys_device_selector
 		.set_minimum_version(1,3)
+		.set_required_features(features10)
 		.set_required_features_12(features12)
 		.set_required_features_13(features13)
 		.set_surface(surface)
@@ -114,6 +150,16 @@ void VulkanEngine::init_vulkan() {
 		abort();
 	}
 	vkb::PhysicalDevice vkb_physical_device = phys_device_selector_return.value();
+	// BC texture formats are optional, so enable them only where the GPU has them
+	VkPhysicalDeviceFeatures supported_features;
+	vkGetPhysicalDeviceFeatures(vkb_physical_device.physical_device, &supported_features);
+	texture_compression_bc = supported_features.textureCompressionBC;
+	vkb_physical_device.features.textureCompressionBC = supported_features.textureCompressionBC;
+	// Pipeline statistics only feed the depth pre-pass numbers, so they are optional too
+	pipeline_statistics_supported = supported_features.pipelineStatisticsQuery;
+	vkb_physical_device.features.pipelineStatisticsQuery = supported_features.pipelineStatisticsQuery;
+	// Real heap budgets, including what other processes use, instead of VMA's estimate
+	memory_budget_supported = vkb_physical_device.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 	// Build logical device
 	vkb::DeviceBuilder device_builder(vkb_physical_device);
 	VkPhysicalDeviceShaderDrawParameterFeatures shader_draw_parameter_features = {};
@@ -131,6 +177,31 @@ void VulkanEngine::init_vulkan() {
 	// Get the graphics queue using vkbootstrap
 	graphics_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
 	graphics_queue_family = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
+	// Prefer a transfer-only family (DMA engine), then any family without graphics, then fall back to the graphics queue (e.g. lavapipe)
+	auto transfer_family_return = vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer);
+	if (!transfer_family_return) {
+		transfer_family_return = vkb_device.get_queue_index(vkb::QueueType::transfer);
+	}
+	if (transfer_family_return) {
+		transfer_queue_family = transfer_family_return.value();
+		vkGetDeviceQueue(device, transfer_queue_family, 0, &transfer_queue);
+	} else {
+		transfer_queue_family = graphics_queue_family;
+		transfer_queue = graphics_queue;
+	}
+	std::cout << "Uploads will use queue family " << transfer_queue_family << (has_dedicated_transfer_queue() ? " (dedicated transfer)" : " (graphics)") << std::endl;
+	// Async compute needs a compute family without graphics so it can run alongside rendering. Otherwise everything stays on one queue.
+	auto compute_family_return = vkb_device.get_queue_index(vkb::QueueType::compute);
+	if (compute_family_return) {
+		compute_queue_family = compute_family_return.value();
+		vkGetDeviceQueue(device, compute_queue_family, 0, &compute_queue);
+	} else {
+		compute_queue_family = graphics_queue_family;
+		compute_queue = graphics_queue;
+	}
+	// Not every compute family can write timestamps, and without them the overlap can't be measured
+	compute_timestamps_supported = vkb_device.queue_families[compute_queue_family].timestampValidBits > 0;
+	std::cout << "Async compute will use queue family " << compute_queue_family << (compute_queue_family != graphics_queue_family ? " (separate compute)" : " (graphics)") << std::endl;
 	// // Get physical device properties
 	gpu_properties = vkb_device.physical_device.properties;
 	// Print out the minimum buffer alignment offset value: RTX 3080 offset is 64 bytes
@@ -138,30 +209,7 @@ void VulkanEngine::init_vulkan() {
 }
 // Initialize swapchain structures
 void VulkanEngine::init_swapchain() {
-	vkb::SwapchainBuilder swapchain_builder(chosenGPU,device,surface);
-
-	swapchain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
-	// VkFormat swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
-	VkColorSpaceKHR swapchain_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-
-	auto swapchain_builder_return = swapchain_builder
-		// .use_default_format_selection()
-		.set_desired_format(VkSurfaceFormatKHR{.format = swapchain_image_format, .colorSpace = swapchain_color_space})
-		.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
-		.set_desired_extent(windowExtent.width,windowExtent.height)
-		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
-		.build();
-	if (!swapchain_builder_return) { // Verify swap chain was built
-		std::cerr << "Failed to build swapchain. Error: " << swapchain_builder_return.error().message() << std::endl;
-		abort();
-	}
-	vkb::Swapchain vkb_swapchain = swapchain_builder_return.value();
-	// Store swapchain and related values
-	swapchain = vkb_swapchain.swapchain;
-	swapchain_images = vkb_swapchain.get_images().value();
-	swapchain_image_views = vkb_swapchain.get_image_views().value();
-	swapchain_extent.height = windowExtent.height;
-	swapchain_extent.width = windowExtent.width;
+	create_swapchain();
 	
 	// Initialize the draw image
 	VkExtent3D draw_image_extent = {
@@ -171,20 +219,6 @@ void VulkanEngine::init_swapchain() {
 	};
 	draw_image.format = VK_FORMAT_R16G16B16A16_SFLOAT; // Hardcoding the format for now.
 	draw_image.extent = draw_image_extent;
-	VkImageUsageFlags draw_image_usages{};
-	draw_image_usages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-	draw_image_usages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-	draw_image_usages |= VK_IMAGE_USAGE_STORAGE_BIT;
-	draw_image_usages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-	VkImageCreateInfo rimginfo = vkinit::image_create_info(draw_image.format, draw_image_usages, draw_image.extent);
-	// We want to allocate the draw image from local gpu memory
-	VmaAllocationCreateInfo rimgallocinfo{};
-	rimgallocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	rimgallocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	vmaCreateImage(allocator, &rimginfo, &rimgallocinfo, &draw_image.image, &draw_image.allocation, nullptr);
-	// Build the draw image view
-	VkImageViewCreateInfo rviewinfo = vkinit::imageview_create_info(draw_image.format, draw_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
-	VK_CHECK(vkCreateImageView(device, &rviewinfo, nullptr, &draw_image.imageview));
 
 	// Depth image will match window extent
 	VkExtent3D depthimage_extent = {
@@ -194,56 +228,104 @@ void VulkanEngine::init_swapchain() {
 	};
 	depth_image.format = VK_FORMAT_D32_SFLOAT; // Hardcoding depth format to 32 bit float
 	depth_image.extent = depthimage_extent;
-	VkImageCreateInfo dimage_info = vkinit::image_create_info(depth_image.format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depth_image.extent);
-	// We want to allocate the depth image from local GPU memory
-	VmaAllocationCreateInfo dimage_allocationinfo = {};
-	dimage_allocationinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	dimage_allocationinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	// Allocate and create the image
-	vmaCreateImage(allocator, &dimage_info, &dimage_allocationinfo, &depth_image.image, &depth_image.allocation, nullptr);
-	// Build the depth image view
-	VkImageViewCreateInfo dimageview_info=vkinit::imageview_create_info(depth_image.format, depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-	VK_CHECK(vkCreateImageView(device, &dimageview_info, nullptr, &depth_image.imageview));
+	// The draw and depth images themselves are created by the render graph
 
-	main_deletion_queue.push_function([=, this](){
-		vkDestroyImageView(device, draw_image.imageview, nullptr);
-		vmaDestroyImage(allocator, draw_image.image, draw_image.allocation);
-		vkDestroyImageView(device, depth_image.imageview, nullptr);
-		vmaDestroyImage(allocator, depth_image.image, depth_image.allocation);
+	// Reads the members at cleanup time, since the swapchain may have been recreated since
+	main_deletion_queue.push_function([this](){
 		vkDestroySwapchainKHR(device, swapchain, nullptr);
 		for (int i = 0; i < swapchain_image_views.size(); i++) {
 			vkDestroyImageView(device, swapchain_image_views[i], nullptr);
 		}
 	});
 }
+void VulkanEngine::create_swapchain(VkSwapchainKHR old_swapchain) {
+	vkb::SwapchainBuilder swapchain_builder(chosenGPU,device,surface);
+
+	swapchain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+	// VkFormat swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+	VkColorSpaceKHR swapchain_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+	present_mode = choose_present_mode(preferred_present_mode);
+
+	auto swapchain_builder_return = swapchain_builder
+		// .use_default_format_selection()
+		.set_desired_format(VkSurfaceFormatKHR{.format = swapchain_image_format, .colorSpace = swapchain_color_space})
+		.set_desired_present_mode(present_mode)
+		.set_desired_extent(windowExtent.width,windowExtent.height)
+		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+		.set_old_swapchain(old_swapchain)
+		.build();
+	if (!swapchain_builder_return) { // Verify swap chain was built
+		std::cerr << "Failed to build swapchain. Error: " << swapchain_builder_return.error().message() << std::endl;
+		abort();
+	}
+	vkb::Swapchain vkb_swapchain = swapchain_builder_return.value();
+	// Store swapchain and related values
+	swapchain = vkb_swapchain.swapchain;
+	swapchain_images = vkb_swapchain.get_images().value();
+	swapchain_image_views = vkb_swapchain.get_image_views().value();
+	swapchain_extent.height = windowExtent.height;
+	swapchain_extent.width = windowExtent.width;
+	std::cout << "Swapchain present mode: " << string_VkPresentModeKHR(present_mode) << std::endl;
+}
+// Only called between frames, once the device is idle
+void VulkanEngine::recreate_swapchain() {
+	VkSwapchainKHR old_swapchain = swapchain;
+	std::vector<VkImageView> old_image_views = swapchain_image_views;
+	create_swapchain(old_swapchain);
+	for (VkImageView view : old_image_views) {
+		vkDestroyImageView(device, view, nullptr);
+	}
+	vkDestroySwapchainKHR(device, old_swapchain, nullptr);
+	swapchain_dirty = false;
+}
+VkPresentModeKHR VulkanEngine::choose_present_mode(VkPresentModeKHR preferred) {
+	uint32_t mode_count = 0;
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(chosenGPU, surface, &mode_count, nullptr));
+	std::vector<VkPresentModeKHR> available(mode_count);
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(chosenGPU, surface, &mode_count, available.data()));
+
+	// Fall back to the mode with the closest latency behaviour. FIFO is the only mode every driver has to support.
+	std::vector<VkPresentModeKHR> chain = {preferred};
+	if (preferred == VK_PRESENT_MODE_MAILBOX_KHR) {
+		chain.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+	} else if (preferred == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+		chain.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+	}
+	chain.push_back(VK_PRESENT_MODE_FIFO_KHR);
+	for (VkPresentModeKHR mode : chain) {
+		if (std::find(available.begin(), available.end(), mode) != available.end()) {
+			return mode;
+		}
+	}
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
 // Initialize command pool and command buffers
 void VulkanEngine::init_commands() {
 	// No longer using vkbootstrap here
 	// Fill command buffer allocateInfo struct
 	VkCommandPoolCreateInfo cmd_pool_createinfo = vkinit::command_pool_create_info(graphics_queue_family, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-	for (int i = 0; i < FRAME_OVERLAP; i++) {
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		VK_CHECK(vkCreateCommandPool(device, &cmd_pool_createinfo, nullptr, &frames[i].command_pool));
 		VkCommandBufferAllocateInfo cmd_alloc_info = vkinit::command_buffer_allocate_info(frames[i].command_pool, 1);
 		VK_CHECK(vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].command_buffer));
 		// Push deletion function to the deletion queue
 		main_deletion_queue.push_function([=, this](){vkDestroyCommandPool(device, frames[i].command_pool, nullptr);});
 	}
-	// GPU memory uplead command structures
-	VkCommandPoolCreateInfo upload_command_pool_info = vkinit::command_pool_create_info(graphics_queue_family);
-	VK_CHECK(vkCreateCommandPool(device, &upload_command_pool_info, nullptr, &upload_context.command_pool));
-	// Allocate the default command buffer for the instant commands
-	VkCommandBufferAllocateInfo cmd_allocinfo = vkinit::command_buffer_allocate_info(upload_context.command_pool, 1);
-	VK_CHECK(vkAllocateCommandBuffers(device, &cmd_allocinfo, &upload_context.command_buffer));
-	main_deletion_queue.push_function([=, this](){vkDestroyCommandPool(device, upload_context.command_pool, nullptr);});
+	// GPU memory upload command structures. Each upload allocates its own short-lived command buffer from this pool
+	VkCommandPoolCreateInfo transfer_command_pool_info = vkinit::command_pool_create_info(transfer_queue_family, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	VK_CHECK(vkCreateCommandPool(device, &transfer_command_pool_info, nullptr, &transfer_context.command_pool));
+	main_deletion_queue.push_function([=, this](){vkDestroyCommandPool(device, transfer_context.command_pool, nullptr);});
 
+	VkCommandPoolCreateInfo upload_command_pool_info = vkinit::command_pool_create_info(graphics_queue_family);
 	VK_CHECK(vkCreateCommandPool(device, &upload_command_pool_info, nullptr, &imm_context.command_pool));
-	cmd_allocinfo = vkinit::command_buffer_allocate_info(imm_context.command_pool, 1);
+	// Allocate the default command buffer for the instant commands
+	VkCommandBufferAllocateInfo cmd_allocinfo = vkinit::command_buffer_allocate_info(imm_context.command_pool, 1);
 	VK_CHECK(vkAllocateCommandBuffers(device, &cmd_allocinfo, &imm_context.command_buffer));
 	main_deletion_queue.push_function([=, this](){vkDestroyCommandPool(device, imm_context.command_pool, nullptr);});
 }
 // Returns the FrameData of the current frame that is ready to be prepared by the CPU
 FrameData& VulkanEngine::get_current_frame() {
-	return frames[frameNumber % FRAME_OVERLAP];
+	return frames[current_frame_index()];
 }
 // Initialize a default renderpass
 // void VulkanEngine::init_default_renderpass() {
@@ -342,14 +424,23 @@ void VulkanEngine::init_sync() {
 	VkSemaphoreCreateInfo semaphore_info = vkinit::semaphore_create_info();
 
 	VkFenceCreateInfo upload_fence_info = vkinit::fence_create_info();
-	VK_CHECK(vkCreateFence(device, &upload_fence_info, nullptr, &upload_context.upload_fence));
 	VK_CHECK(vkCreateFence(device, &upload_fence_info, nullptr, &imm_context.upload_fence));
+	// Timeline semaphore counting finished uploads
+	VkSemaphoreTypeCreateInfo timeline_info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.pNext = nullptr,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
+	};
+	VkSemaphoreCreateInfo timeline_semaphore_info = vkinit::semaphore_create_info();
+	timeline_semaphore_info.pNext = &timeline_info;
+	VK_CHECK(vkCreateSemaphore(device, &timeline_semaphore_info, nullptr, &transfer_context.timeline_semaphore));
 	main_deletion_queue.push_function([=, this](){
-			vkDestroyFence(device, upload_context.upload_fence, nullptr);
 			vkDestroyFence(device, imm_context.upload_fence, nullptr);
+			vkDestroySemaphore(device, transfer_context.timeline_semaphore, nullptr);
 		});
 
-	for (int i = 0; i < FRAME_OVERLAP; i++) {
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 		VK_CHECK(vkCreateFence(device, &fence_info, nullptr, &frames[i].render_fence));
 		// Both semaphores use the same create info
 		VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &frames[i].render_semaphore));
@@ -363,29 +454,12 @@ void VulkanEngine::init_sync() {
 }
 // Initialize rendering pipeline structures
 void VulkanEngine::init_graphics_pipelines() {
-	VkShaderModule meshFragShader;
-	vkutil::load_shader_module("../shaders/default_lit.frag.spv", device, &meshFragShader);
-	// if (!vkutil::load_shader_module("../shaders/default_lit.frag.spv", device, &meshFragShader)) {
-	// 	std::cout << "Error building the colored mesh shader module!" << std::endl;
-	// } else {
-	// 	std::cout << "Fragment shader successfully loaded!" << std::endl;
-	// }
-	VkShaderModule meshVertShader;
-	vkutil::load_shader_module("../shaders/tri_mesh.vert.spv", device, &meshVertShader);
-	// if (!vkutil::load_shader_module("../shaders/tri_mesh.vert.spv", device, &meshVertShader)) {
-	// 	std::cout << "Error when building the triangle mesh vertex shader module!" << std::endl;
-	// } else {
-	// 	std::cout << "Triangle mesh vertex shader successfully loaded!" << std::endl;
-	// }
-	VkShaderModule texturedMeshShader;
-	vkutil::load_shader_module("../shaders/texture_lit.frag.spv", device, &texturedMeshShader);
-	// if (!vkutil::load_shader_module("../shaders/texture_lit.frag.spv", device, &texturedMeshShader)) {
-	// 	std::cout << "Error when building the textured fragment shader module!" << std::endl;
-	// } else {
-	// 	std::cout << "Textured fragment shader successfully loaded!" << std::endl;
-	// }
+	// Kept until cleanup, since material permutations are built whenever something first draws with them
+	vkutil::load_shader_module("../shaders/tri_mesh.vert.spv", device, &mesh_vertex_shader);
+	vkutil::load_shader_module("../shaders/mesh_lit.frag.spv", device, &mesh_fragment_shader);
+	pipeline_cache.init(device);
 
-	// ::::::::::::::::::::::::: Building Mesh Triangle Pipeline :::::::::::::::::::::::::
+	// ::::::::::::::::::::::::: Building Mesh Pipeline Layouts :::::::::::::::::::::::::
 
 	// Build pipeline layout which controls inputs and outputs of the shader
 	VkPipelineLayoutCreateInfo mesh_pipeline_layout_info = vkinit::pipeline_layout_create_info();
@@ -405,60 +479,54 @@ void VulkanEngine::init_graphics_pipelines() {
 
 	VK_CHECK(vkCreatePipelineLayout(device, &mesh_pipeline_layout_info, nullptr, &mesh_pipeline_layout));
 
-	PipelineBuilder pipeline_builder;
+	// Materials add the texture set. The shader declares it whatever the features are, so untextured materials use this layout too.
+	VkPipelineLayoutCreateInfo material_pipeline_layout_info = mesh_pipeline_layout_info; // Start from the normal mesh layout
+	VkDescriptorSetLayout material_set_layouts[] = {global_set_layout, object_set_layout, single_texture_set_layout};
+	material_pipeline_layout_info.setLayoutCount = 3;
+	material_pipeline_layout_info.pSetLayouts = material_set_layouts;
+	VK_CHECK(vkCreatePipelineLayout(device, &material_pipeline_layout_info, nullptr, &material_pipeline_layout));
 
-	// Pipeline layout
+	// ::::::::::::::::::::::::: Materials :::::::::::::::::::::::::
+
+	// Only feature masks for now. Their pipelines are built on first draw, and shared with any material with the same features.
+	create_material(MATERIAL_GLOW | MATERIAL_SHADOWS | MATERIAL_POINT_LIGHTS, "default_mesh"_sid);
+	create_material(MATERIAL_TEXTURED | MATERIAL_SHADOWS | MATERIAL_POINT_LIGHTS, "textured_mesh"_sid);
+	create_material(MATERIAL_TEXTURED | MATERIAL_ATLAS_TILES | MATERIAL_SHADOWS | MATERIAL_POINT_LIGHTS, "voxel_mesh"_sid);
+
+	// ::::::::::::::::::::::::: Building Depth Pre-Pass Pipeline :::::::::::::::::::::::::
+
+	// The pre-pass only reads positions and has nothing to shade. Every material's layout starts with the
+	// same global and object sets, so it can use the plain mesh layout.
+	PipelineBuilder pipeline_builder;
 	pipeline_builder.pipeline_layout = mesh_pipeline_layout;
-	// Vertex input controls how to read vertices from vertex buffers !!!!!DELETE LATER!!!!
 	pipeline_builder.vertex_input_info = vkinit::vertex_input_state_create_info();
-
-	pipeline_builder.set_shaders(meshVertShader, meshFragShader);
+	VkShaderModule depthVertShader;
+	vkutil::load_shader_module("../shaders/depth_only.vert.spv", device, &depthVertShader);
+	pipeline_builder.set_vertex_shader_only(depthVertShader);
 	pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
 	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
 	pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
 	pipeline_builder.set_multisampling_none();
 	pipeline_builder.disable_blending();
 	pipeline_builder.depth_stencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
-	
-	pipeline_builder.set_color_attachment_format(draw_image.format);
+	pipeline_builder.disable_color_attachment();
 	pipeline_builder.set_depth_format(depth_image.format);
-
-	// Vertex buffer description !!!!!DELETE LATER!!!!!
-	VertexInputDescription vertex_description = Vertex::get_vertex_description();
-	pipeline_builder.vertex_input_info.vertexAttributeDescriptionCount = vertex_description.attributes.size();
-	pipeline_builder.vertex_input_info.pVertexAttributeDescriptions = vertex_description.attributes.data();
-	pipeline_builder.vertex_input_info.vertexBindingDescriptionCount = vertex_description.bindings.size();
-	pipeline_builder.vertex_input_info.pVertexBindingDescriptions = vertex_description.bindings.data();
-
-	// Build the mesh pipeline
-	mesh_pipeline = pipeline_builder.build_pipeline(device);
-	create_material(mesh_pipeline, mesh_pipeline_layout, "default_mesh");
-
-	// ::::::::::::::::::::::::: Building Textured Drawing Pipeline :::::::::::::::::::::::::
-
-	// Create pipeline layout for the textured mesh pipeline that will have 3 descriptor sets
-	VkPipelineLayoutCreateInfo textured_pipeline_layout_info = mesh_pipeline_layout_info; // Start from the normal mesh layout
-	VkDescriptorSetLayout textured_set_layouts[] = {global_set_layout, object_set_layout, single_texture_set_layout};
-	textured_pipeline_layout_info.setLayoutCount = 3;
-	textured_pipeline_layout_info.pSetLayouts = textured_set_layouts;
-	VkPipelineLayout textured_pipeline_layout;
-	VK_CHECK(vkCreatePipelineLayout(device, &textured_pipeline_layout_info, nullptr, &textured_pipeline_layout));
-
-	pipeline_builder.set_shaders(meshVertShader, texturedMeshShader);
-	pipeline_builder.pipeline_layout = textured_pipeline_layout;
-
-	VkPipeline tex_pipeline = pipeline_builder.build_pipeline(device);
-	create_material(tex_pipeline, textured_pipeline_layout, "textured_mesh");
+	VertexInputDescription position_description = Vertex::get_position_description();
+	pipeline_builder.vertex_input_info.vertexAttributeDescriptionCount = position_description.attributes.size();
+	pipeline_builder.vertex_input_info.pVertexAttributeDescriptions = position_description.attributes.data();
+	pipeline_builder.vertex_input_info.vertexBindingDescriptionCount = position_description.bindings.size();
+	pipeline_builder.vertex_input_info.pVertexBindingDescriptions = position_description.bindings.data();
+	depth_prepass_pipeline = pipeline_builder.build_pipeline(device);
 
 	// Destroy all shader modules outside of the deletion queue
-	vkDestroyShaderModule(device, meshFragShader, nullptr);
-	vkDestroyShaderModule(device, meshVertShader, nullptr);
-	vkDestroyShaderModule(device, texturedMeshShader, nullptr);
+	vkDestroyShaderModule(device, depthVertShader, nullptr);
 	main_deletion_queue.push_function([=, this](){
+		pipeline_cache.cleanup();
+		vkDestroyShaderModule(device, mesh_vertex_shader, nullptr);
+		vkDestroyShaderModule(device, mesh_fragment_shader, nullptr);
 		vkDestroyPipelineLayout(device, mesh_pipeline_layout, nullptr);
-		vkDestroyPipeline(device, mesh_pipeline, nullptr);
-		vkDestroyPipelineLayout(device, textured_pipeline_layout, nullptr);
-		vkDestroyPipeline(device, tex_pipeline, nullptr);
+		vkDestroyPipelineLayout(device, material_pipeline_layout, nullptr);
+		vkDestroyPipeline(device, depth_prepass_pipeline, nullptr);
 	});
 }
 void VulkanEngine::init_compute_pipelines() {
@@ -533,6 +601,93 @@ void VulkanEngine::init_compute_pipelines() {
 		vkDestroyPipeline(device, sky.pipeline, nullptr);
 	});
 }
+// Per-frame command buffers, background images and timestamp queries for running compute work on a separate queue
+void VulkanEngine::init_async_compute() {
+	VkSemaphoreTypeCreateInfo timeline_info{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.pNext = nullptr,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
+	};
+	VkSemaphoreCreateInfo timeline_semaphore_info = vkinit::semaphore_create_info();
+	timeline_semaphore_info.pNext = &timeline_info;
+	VK_CHECK(vkCreateSemaphore(device, &timeline_semaphore_info, nullptr, &compute_timeline_semaphore));
+	main_deletion_queue.push_function([=, this](){vkDestroySemaphore(device, compute_timeline_semaphore, nullptr);});
+
+	bool separate_compute = compute_queue_family != graphics_queue_family;
+	uint32_t queue_families[] = {graphics_queue_family, compute_queue_family};
+	VkCommandPoolCreateInfo compute_pool_info = vkinit::command_pool_create_info(compute_queue_family, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		// Queries 0 and 1 bracket the graphics work, 2 and 3 the compute work
+		VkQueryPoolCreateInfo qpci{
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = 4,
+		};
+		VK_CHECK(vkCreateQueryPool(device, &qpci, nullptr, &frames[i].timestamp_pool));
+		main_deletion_queue.push_function([=, this](){vkDestroyQueryPool(device, frames[i].timestamp_pool, nullptr);});
+		if (pipeline_statistics_supported) {
+			// One query per culling phase's geometry pass
+			VkQueryPoolCreateInfo statistics_info{
+				.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+				.pNext = nullptr,
+				.flags = 0,
+				.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+				.queryCount = 2,
+				.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+					VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+			};
+			VK_CHECK(vkCreateQueryPool(device, &statistics_info, nullptr, &frames[i].statistics_pool));
+			main_deletion_queue.push_function([=, this](){vkDestroyQueryPool(device, frames[i].statistics_pool, nullptr);});
+		}
+
+		if (!separate_compute) {
+			continue; // The background is drawn straight into the draw image on the graphics queue instead
+		}
+		VK_CHECK(vkCreateCommandPool(device, &compute_pool_info, nullptr, &frames[i].compute_command_pool));
+		VkCommandBufferAllocateInfo cmd_alloc_info = vkinit::command_buffer_allocate_info(frames[i].compute_command_pool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(device, &cmd_alloc_info, &frames[i].compute_command_buffer));
+
+		// Each frame gets its own background image, so the compute queue never writes one the graphics queue may still be reading.
+		// Concurrent sharing avoids ownership transfers between the two families every frame.
+		AllocatedImage& background = frames[i].background_image;
+		background.format = draw_image.format;
+		background.extent = draw_image.extent;
+		VkImageCreateInfo bimg_info = vkinit::image_create_info(background.format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, background.extent);
+		bimg_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bimg_info.queueFamilyIndexCount = 2;
+		bimg_info.pQueueFamilyIndices = queue_families;
+		VmaAllocationCreateInfo bimg_allocinfo{};
+		bimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+		bimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK(vmaCreateImage(allocator, &bimg_info, &bimg_allocinfo, &background.image, &background.allocation, nullptr));
+		memory.track(background.allocation, MemoryCategory::RenderTargets);
+		VkImageViewCreateInfo bview_info = vkinit::imageview_create_info(background.format, background.image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(device, &bview_info, nullptr, &background.imageview));
+
+		frames[i].background_descriptor = compute_descriptor_allocator.allocate(device, draw_image_descriptor_layout);
+		VkDescriptorImageInfo dii{};
+		dii.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		dii.imageView = background.imageview;
+		VkWriteDescriptorSet background_write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, frames[i].background_descriptor, &dii, 0);
+		vkUpdateDescriptorSets(device, 1, &background_write, 0, nullptr);
+
+		main_deletion_queue.push_function([=, this](){
+			vkDestroyCommandPool(device, frames[i].compute_command_pool, nullptr);
+			vkDestroyImageView(device, frames[i].background_image.imageview, nullptr);
+			destroy_image(frames[i].background_image);
+		});
+	}
+}
+void VulkanEngine::init_render_graph() {
+	render_graph.init(device, allocator, &memory);
+	build_render_graph(use_async_compute());
+	main_deletion_queue.push_function([&]() {
+		render_graph.reset();
+	});
+}
 void VulkanEngine::init_pipelines() {
 	init_compute_pipelines();
 	init_graphics_pipelines(); 
@@ -562,85 +717,164 @@ void VulkanEngine::load_meshes() {
 	koenigsegg_mesh.load_from_obj(filename.c_str()); // Load monkey
 	upload_mesh(koenigsegg_mesh);
 
-	Mesh lost_empire;
-	lost_empire.load_from_obj("../assets/lost_empire.obj");
-	upload_mesh(lost_empire);
+	// The lost empire is split into chunks and streamed in around the camera, see init_scene
 
 	// Mesh ironman;
 	// ironman.load_from_obj("../../../Test/OBJ_Files/IronMan.obj");
 	// upload_mesh(ironman);
 
-	// Copy the meshes to the unordered list and delete them (later)
-	meshes["monkey"] = monkey_mesh;
-	meshes["koenigsegg"] = koenigsegg_mesh;
-	meshes["triangle"] = triangle_mesh;
-	meshes["lost empire"] = lost_empire;
+	// Move the meshes into the pool and delete them (later)
+	meshes.add(std::move(monkey_mesh), "monkey"_sid);
+	meshes.add(std::move(koenigsegg_mesh), "koenigsegg"_sid);
+	meshes.add(std::move(triangle_mesh), "triangle"_sid);
+	// Defragmentation can move the buffers, so free whatever each mesh holds by the time of cleanup
+	main_deletion_queue.push_function([this]() {
+		for (Mesh& mesh : meshes) {
+			destroy_buffer(mesh.vertex_buffer);
+		}
+	});
 }
 // Loads all the images and textures from files
 void VulkanEngine::load_images() {
+	// Bound for materials without a texture of their own
+	const uint8_t white[4] = {255, 255, 255, 255};
+	Texture white_texture;
+	white_texture.image = vkutil::upload_image(*this, VK_FORMAT_R8G8B8A8_UNORM, VkExtent3D{1, 1, 1}, 1, {std::span<const uint8_t>(white, 4)});
+	VkImageViewCreateInfo white_ivci = vkinit::imageview_create_info(white_texture.image.format, white_texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VK_CHECK(vkCreateImageView(device, &white_ivci, nullptr, &white_texture.image_view));
+	loaded_textures.add(white_texture, "white"_sid);
+	main_deletion_queue.push_function([=, this](){
+		vkDestroyImageView(device, white_texture.image_view, nullptr);
+		destroy_image(white_texture.image);
+	});
+
+	// The block compressed version made by the texture converter carries its whole mip chain, so it can be streamed.
+	// Only its small levels are loaded here.
+	ktx::Texture empire_source;
+	if (ktx::read_file("../assets/lost_empire-RGBA.ktx2", empire_source) && vkutil::make_sampleable(*this, empire_source)) {
+		texture_streamer.add_texture("empire_diffuse", std::move(empire_source));
+		return;
+	}
+	// Otherwise fall back to the PNG, which stays fully resident
 	Texture lost_empire;
 	vkutil::load_image_from_file(*this, "../assets/lost_empire-RGBA.png", lost_empire.image);
-	VkImageViewCreateInfo ivci = vkinit::imageview_create_info(VK_FORMAT_R8G8B8A8_SRGB, lost_empire.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VkImageViewCreateInfo ivci = vkinit::imageview_create_info(lost_empire.image.format, lost_empire.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	ivci.subresourceRange.levelCount = lost_empire.image.mip_levels; // The view covers the whole mip chain
 	VK_CHECK(vkCreateImageView(device, &ivci, nullptr, &lost_empire.image_view));
-	loaded_textures["empire_diffuse"] = lost_empire;
+	loaded_textures.add(lost_empire, "empire_diffuse"_sid);
 
 	main_deletion_queue.push_function([=, this](){
 		vkDestroyImageView(device, lost_empire.image_view, nullptr);
 	});
 }
 // Allocates CPU side buffer, fills it, then sends it to GPU memory
-void VulkanEngine::upload_mesh(Mesh& mesh) {
-	const size_t buffer_size = mesh.vertices.size() * sizeof(Vertex);
+void VulkanEngine::upload_mesh(Mesh& mesh, std::function<void()>&& on_uploaded) {
+	// Welds and reorders the geometry, so it has to happen before it is copied. Streamed meshes come in with it done.
+	if (mesh.indices.empty()) {
+		mesh.build_meshlets();
+	}
+	mesh.index_offset = mesh.vertices.size() * sizeof(Vertex);
+	const size_t buffer_size = mesh.buffer_size();
 	// Allocate the CPU-side staging buffer
-	AllocatedBuffer staging_buffer = create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+	AllocatedBuffer staging_buffer = create_buffer(buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
 	
 	// Staging buffer is allocated, so now put vertex data inside of it.
 	void* data;
 	vmaMapMemory(allocator, staging_buffer.allocation, &data); // Map the data to a point in the allocation.
-	memcpy(data, mesh.vertices.data(), buffer_size);
+	memcpy(data, mesh.vertices.data(), mesh.index_offset);
+	memcpy(static_cast<char*>(data) + mesh.index_offset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
 	vmaUnmapMemory(allocator, staging_buffer.allocation); // This doesn't have to be unmapped, but unmapping tells the driver we are done sending data
 
 	// Now create the GPU-side buffer
-	mesh.vertex_buffer = create_buffer(buffer_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+	mesh.vertex_buffer = create_buffer(buffer_size, MESH_BUFFER_USAGE, VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Meshes);
+	AllocatedBuffer vertex_buffer = mesh.vertex_buffer;
+	// The barrier that hands the buffer from the transfer family to the graphics family. Both queues record a copy of it.
+	VkBufferMemoryBarrier2 ownership_barrier{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+		.pNext = nullptr,
+		.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+		.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+		.dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+		.dstAccessMask = VK_ACCESS_2_NONE,
+		.srcQueueFamilyIndex = transfer_queue_family,
+		.dstQueueFamilyIndex = graphics_queue_family,
+		.buffer = vertex_buffer.buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE,
+	};
+	bool dedicated = has_dedicated_transfer_queue();
 	// Buffers created, time to copy
-	immediate_submit([=, this](VkCommandBuffer cmd) {
+	upload_submit([=](VkCommandBuffer cmd) {
 		VkBufferCopy copy;
 		copy.dstOffset = 0;
 		copy.srcOffset = 0;
 		copy.size = buffer_size;
-		vkCmdCopyBuffer(cmd, staging_buffer.buffer, mesh.vertex_buffer.buffer, 1, &copy);
-	});
-	// Buffer copied, clean up
-	main_deletion_queue.push_function([=, this](){
-		vmaDestroyBuffer(allocator, mesh.vertex_buffer.buffer, mesh.vertex_buffer.allocation);
-	});
-	vmaDestroyBuffer(allocator, staging_buffer.buffer, staging_buffer.allocation); // We can instantly destroy this to free up the CPU memory
+		vkCmdCopyBuffer(cmd, staging_buffer.buffer, vertex_buffer.buffer, 1, &copy);
+		// Release ownership. On a single queue family the timeline semaphore wait already makes the copy visible.
+		if (dedicated) {
+			VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &ownership_barrier};
+			vkCmdPipelineBarrier2(cmd, &depinfo);
+		}
+	}, [=](VkCommandBuffer cmd) {
+		// Acquire ownership on the graphics queue before the buffer is read as vertex and index input
+		VkBufferMemoryBarrier2 acquire_barrier = ownership_barrier;
+		acquire_barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+		acquire_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+		acquire_barrier.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT;
+		acquire_barrier.dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT;
+		VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .bufferMemoryBarrierCount = 1, .pBufferMemoryBarriers = &acquire_barrier};
+		vkCmdPipelineBarrier2(cmd, &depinfo);
+	}, [=, this, on_uploaded = std::move(on_uploaded)]() {
+		destroy_buffer(staging_buffer); // Copy is done, so the CPU-side memory can go
+		if (on_uploaded) {
+			on_uploaded();
+		}
+	}, vertex_buffer.allocation);
 }
-// Adds material to the unordered_map of materials
-Material* VulkanEngine::create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name) {
+// Adds material to the pool of materials
+MaterialHandle VulkanEngine::create_material(uint32_t features, StringId name) {
 	Material mat;
-	mat.pipeline = pipeline;
-	mat.pipeline_layout = layout;
-	materials[name] = mat;
-	return &materials[name];
+	mat.features = features;
+	mat.pipeline_layout = material_pipeline_layout;
+	return materials.add(mat, name);
 }
-Material* VulkanEngine::get_material(const std::string& name) {
-	auto it = materials.find(name);
-	if (it == materials.end()) {
-		return nullptr;
-	} else {
-		return &(*it).second;
-	}
+// The old permutation stays in the cache, so frames in flight can keep drawing with it
+void VulkanEngine::set_material_features(Material& material, uint32_t features) {
+	material.features = features;
+	material.pipeline = VK_NULL_HANDLE;
+	material.equal_depth_pipeline = VK_NULL_HANDLE;
 }
-Mesh* VulkanEngine::get_mesh(const std::string& name) {
-	auto it = meshes.find(name);
-	if (it == meshes.end()) {
-		return nullptr;
+VkPipeline VulkanEngine::get_material_pipeline(Material& material, bool equal_depth) {
+	VkPipeline& pipeline = equal_depth ? material.equal_depth_pipeline : material.pipeline;
+	if (pipeline != VK_NULL_HANDLE) {
+		return pipeline;
+	}
+	PipelineBuilder pipeline_builder;
+	pipeline_builder.pipeline_layout = material.pipeline_layout;
+	pipeline_builder.vertex_input_info = vkinit::vertex_input_state_create_info();
+	pipeline_builder.set_shaders(mesh_vertex_shader, mesh_fragment_shader);
+	pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+	pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipeline_builder.set_multisampling_none();
+	pipeline_builder.disable_blending();
+	if (equal_depth) {
+		// After the pre-pass depth is already final, so only the fragment that wrote it passes
+		pipeline_builder.depth_stencil = vkinit::depth_stencil_create_info(true, false, VK_COMPARE_OP_EQUAL);
 	} else {
-		return &(*it).second;
+		pipeline_builder.depth_stencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
 	}
+	pipeline_builder.set_color_attachment_format(draw_image.format);
+	pipeline_builder.set_depth_format(depth_image.format);
+	VertexInputDescription vertex_description = Vertex::get_vertex_description();
+	pipeline_builder.vertex_input_info.vertexAttributeDescriptionCount = vertex_description.attributes.size();
+	pipeline_builder.vertex_input_info.pVertexAttributeDescriptions = vertex_description.attributes.data();
+	pipeline_builder.vertex_input_info.vertexBindingDescriptionCount = vertex_description.bindings.size();
+	pipeline_builder.vertex_input_info.pVertexBindingDescriptions = vertex_description.bindings.data();
+	pipeline = pipeline_cache.get(pipeline_builder, material.features);
+	return pipeline;
 }
-AllocatedBuffer VulkanEngine::create_buffer(size_t alloc_size, VkBufferUsageFlags usage_flags, VmaMemoryUsage memory_usage) {
+AllocatedBuffer VulkanEngine::create_buffer(size_t alloc_size, VkBufferUsageFlags usage_flags, VmaMemoryUsage memory_usage, MemoryCategory category) {
 	VkBufferCreateInfo bufinfo={}; // Buffer info
 	bufinfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufinfo.pNext = nullptr;
@@ -648,10 +882,46 @@ AllocatedBuffer VulkanEngine::create_buffer(size_t alloc_size, VkBufferUsageFlag
 	bufinfo.usage = usage_flags;
 	VmaAllocationCreateInfo allocinfo={}; // Vma allocation info
 	allocinfo.usage = memory_usage;
+	allocinfo.pool = memory_pools.get(category, alloc_size);
 	AllocatedBuffer new_buffer; // Buffer struct
-	VK_CHECK(vmaCreateBuffer(allocator, &bufinfo, &allocinfo, &new_buffer.buffer, &new_buffer.allocation, nullptr));
+	VkResult result = vmaCreateBuffer(allocator, &bufinfo, &allocinfo, &new_buffer.buffer, &new_buffer.allocation, nullptr);
+	if (result != VK_SUCCESS && allocinfo.pool != VK_NULL_HANDLE) {
+		// The pool is full (the staging ring can't grow), so fall back to the default pools
+		allocinfo.pool = VK_NULL_HANDLE;
+		result = vmaCreateBuffer(allocator, &bufinfo, &allocinfo, &new_buffer.buffer, &new_buffer.allocation, nullptr);
+	}
+	VK_CHECK(result);
+	memory.track(new_buffer.allocation, category);
 	return new_buffer;
 }
+AllocatedImage VulkanEngine::create_image(const VkImageCreateInfo& image_info, MemoryCategory category) {
+	AllocatedImage new_image;
+	new_image.extent = image_info.extent;
+	new_image.format = image_info.format;
+	new_image.mip_levels = image_info.mipLevels;
+	VmaAllocationCreateInfo allocinfo{};
+	allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	// Image requirements aren't known before the image exists, so estimate with the uncompressed size
+	VkDeviceSize estimate = VkDeviceSize(image_info.extent.width) * image_info.extent.height * 4;
+	allocinfo.pool = memory_pools.get(category, estimate);
+	VkResult result = vmaCreateImage(allocator, &image_info, &allocinfo, &new_image.image, &new_image.allocation, nullptr);
+	if (result != VK_SUCCESS && allocinfo.pool != VK_NULL_HANDLE) {
+		// Some formats need a memory type the pool wasn't made for
+		allocinfo.pool = VK_NULL_HANDLE;
+		result = vmaCreateImage(allocator, &image_info, &allocinfo, &new_image.image, &new_image.allocation, nullptr);
+	}
+	VK_CHECK(result);
+	memory.track(new_image.allocation, category);
+	return new_image;
+}
+void VulkanEngine::destroy_buffer(const AllocatedBuffer& buffer) {
+	memory.untrack(buffer.allocation);
+	vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+}
+void VulkanEngine::destroy_image(const AllocatedImage& image) {
+	memory.untrack(image.allocation);
+	vmaDestroyImage(allocator, image.image, image.allocation);
+}
 // Pad uniform buffer data to fit the alignment requirements
 size_t VulkanEngine::pad_uniform_buffer_size(size_t original_size) {
 	// Calculate required alignment based on minimum device offset alignment
@@ -680,6 +950,175 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& f
 	VK_CHECK(vkQueueSubmit2(graphics_queue, 1, &submit, imm_context.upload_fence));
 	vkWaitForFences(device, 1, &imm_context.upload_fence, true, 9999999999);
 }
+void VulkanEngine::upload_submit(std::function<void(VkCommandBuffer cmd)>&& record, std::function<void(VkCommandBuffer cmd)>&& acquire, std::function<void()>&& on_complete, VmaAllocation destination) {
+	PendingUpload upload;
+	VkCommandBufferAllocateInfo cmd_allocinfo = vkinit::command_buffer_allocate_info(transfer_context.command_pool, 1);
+	VK_CHECK(vkAllocateCommandBuffers(device, &cmd_allocinfo, &upload.command_buffer));
+
+	VkCommandBuffer cmd = upload.command_buffer;
+	VkCommandBufferBeginInfo begininfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(cmd, &begininfo));
+	record(cmd);
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	upload.timeline_value = ++transfer_context.submitted_value;
+	// Acquire barriers are only valid when ownership was actually released by another family
+	if (has_dedicated_transfer_queue()) {
+		upload.acquire = std::move(acquire);
+	}
+	upload.on_complete = std::move(on_complete);
+	upload.destination = destination;
+
+	VkCommandBufferSubmitInfo cmdinf = vkinit::command_buffer_submit_info(cmd);
+	VkSemaphoreSubmitInfo siginf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, transfer_context.timeline_semaphore);
+	siginf.value = upload.timeline_value;
+	VkSubmitInfo2 submit = vkinit::submit_info(&cmdinf, &siginf, nullptr);
+	VK_CHECK(vkQueueSubmit2(transfer_queue, 1, &submit, VK_NULL_HANDLE));
+	transfer_context.in_flight.push_back(std::move(upload));
+}
+void VulkanEngine::wait_for_uploads() {
+	VkSemaphoreWaitInfo swi{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &transfer_context.timeline_semaphore,
+		.pValues = &transfer_context.submitted_value,
+	};
+	VK_CHECK(vkWaitSemaphores(device, &swi, UINT64_MAX));
+}
+// Only uploads that have already finished are handed over, so the frame never stalls waiting on the transfer queue
+uint64_t VulkanEngine::acquire_uploads(VkCommandBuffer cmd) {
+	uint64_t completed_value;
+	VK_CHECK(vkGetSemaphoreCounterValue(device, transfer_context.timeline_semaphore, &completed_value));
+	uint64_t wait_value = 0;
+	while (!transfer_context.in_flight.empty() && transfer_context.in_flight.front().timeline_value <= completed_value) {
+		PendingUpload& upload = transfer_context.in_flight.front();
+		if (upload.acquire) {
+			upload.acquire(cmd);
+		}
+		if (upload.on_complete) {
+			upload.on_complete();
+		}
+		vkFreeCommandBuffers(device, transfer_context.command_pool, 1, &upload.command_buffer);
+		wait_value = upload.timeline_value;
+		transfer_context.in_flight.pop_front();
+	}
+	return wait_value;
+}
+void VulkanEngine::finish_uploads() {
+	for (PendingUpload& upload : transfer_context.in_flight) {
+		if (upload.on_complete) {
+			upload.on_complete();
+		}
+	}
+	transfer_context.in_flight.clear(); // Command buffers are freed along with the pool
+}
+void VulkanEngine::update_defragmentation(VkCommandBuffer cmd) {
+	VmaPool pool = memory_pools.get(MemoryCategory::Meshes);
+	if (defragmentation.pass_in_flight || pool == VK_NULL_HANDLE) {
+		return;
+	}
+	if (defragmentation.context == VK_NULL_HANDLE) {
+		if (!defragmentation.enabled || frameNumber - defragmentation.last_check_frame < static_cast<int>(defragmentation.check_interval)) {
+			return;
+		}
+		defragmentation.last_check_frame = frameNumber;
+		// Only worth it when compacting could free at least one whole block
+		VmaDetailedStatistics stats;
+		vmaCalculatePoolStatistics(allocator, pool, &stats);
+		if (stats.statistics.blockBytes - stats.statistics.allocationBytes < memory_pools.block_size(MemoryCategory::Meshes)) {
+			return;
+		}
+		VmaDefragmentationInfo info{};
+		info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+		info.pool = pool;
+		info.maxBytesPerPass = defragmentation.max_bytes_per_pass;
+		info.maxAllocationsPerPass = defragmentation.max_moves_per_pass;
+		VK_CHECK(vmaBeginDefragmentation(allocator, &info, &defragmentation.context));
+		defragmentation.runs++;
+	}
+	if (vmaBeginDefragmentationPass(allocator, defragmentation.context, &defragmentation.pass) == VK_SUCCESS) {
+		end_defragmentation(); // Nothing left to move
+		return;
+	}
+
+	// Frames in flight may still read the old buffers, which is fine since the copies only read them too.
+	// Uploads acquired earlier in this command buffer chain through the vertex input stages, and have to be visible to the copies.
+	VkMemoryBarrier2 before_copy{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+	before_copy.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT;
+	before_copy.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	before_copy.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+	VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .memoryBarrierCount = 1, .pMemoryBarriers = &before_copy};
+	vkCmdPipelineBarrier2(cmd, &depinfo);
+
+	std::vector<VkBuffer> old_buffers;
+	for (uint32_t i = 0; i < defragmentation.pass.moveCount; i++) {
+		VmaDefragmentationMove& move = defragmentation.pass.pMoves[i];
+		Mesh* mesh = nullptr;
+		for (Mesh& candidate : meshes) {
+			if (candidate.vertex_buffer.allocation == move.srcAllocation) {
+				mesh = &candidate;
+				break;
+			}
+		}
+		if (!mesh) {
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE; // Not a buffer we know how to recreate
+			continue;
+		}
+		// The transfer queue may still be writing it, and its ownership barriers name the current buffer.
+		// Streaming keeps uploading during a run, so this is checked for every pass rather than once at the start.
+		bool uploading = false;
+		for (const PendingUpload& upload : transfer_context.in_flight) {
+			uploading = uploading || upload.destination == move.srcAllocation;
+		}
+		if (uploading) {
+			move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+			continue;
+		}
+		VkBufferCreateInfo bufinfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+		bufinfo.size = mesh->buffer_size();
+		bufinfo.usage = MESH_BUFFER_USAGE;
+		VkBuffer new_buffer;
+		VK_CHECK(vkCreateBuffer(device, &bufinfo, nullptr, &new_buffer));
+		VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, new_buffer));
+		VkBufferCopy copy{0, 0, bufinfo.size};
+		vkCmdCopyBuffer(cmd, mesh->vertex_buffer.buffer, new_buffer, 1, &copy);
+		// Draws recorded from here on use the new buffer. The allocation handle stays the same once the pass ends.
+		old_buffers.push_back(mesh->vertex_buffer.buffer);
+		mesh->vertex_buffer.buffer = new_buffer;
+		defragmentation.moves++;
+		defragmentation.bytes_moved += bufinfo.size;
+	}
+
+	VkMemoryBarrier2 after_copy{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+	after_copy.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+	after_copy.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+	after_copy.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT;
+	after_copy.dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT;
+	depinfo.pMemoryBarriers = &after_copy;
+	vkCmdPipelineBarrier2(cmd, &depinfo);
+
+	// Once this frame is done, so are the copies and every earlier frame that drew from the old buffers
+	defragmentation.pass_in_flight = true;
+	get_current_frame().deletion_queue.push_function([this, old_buffers]() {
+		for (VkBuffer buffer : old_buffers) {
+			vkDestroyBuffer(device, buffer, nullptr);
+		}
+		defragmentation.pass_in_flight = false;
+		if (vmaEndDefragmentationPass(allocator, defragmentation.context, &defragmentation.pass) == VK_SUCCESS) {
+			end_defragmentation();
+		}
+	});
+}
+void VulkanEngine::end_defragmentation() {
+	if (defragmentation.context == VK_NULL_HANDLE) {
+		return;
+	}
+	vmaEndDefragmentation(allocator, defragmentation.context, nullptr);
+	defragmentation.context = VK_NULL_HANDLE;
+	defragmentation.pass = {};
+}
 void VulkanEngine::init_imgui() {
 	// Create the descriptor pool for IMGUI
 	VkDescriptorPoolSize pool_sizes[] = {
@@ -742,19 +1181,26 @@ void VulkanEngine::init_imgui() {
 }
 // Initialize descriptor sets and related objects
 void VulkanEngine::init_descriptors() {
-	// Create a descriptor pool that will hold 10 uniform buffers (10 is arbitrary for now)
-	std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
-		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
-		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10},
-		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10} // Descriptor for combined sampler and image
+	// Ratios of descriptors per set. The allocator starts with pools of 10 sets and grows them as materials are added
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4}, // Object buffer, and the lights and froxel lists of the global set
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2} // Material textures, and the shadow map in the global set
+	};
+	// Per-frame sets are thrown away every frame, so these pools see a lot more traffic
+	std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frame_sizes = {
+		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
+		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4}
 	};
 	// BEING USED FOR COMPUTE SHADER
 	std::vector<DescriptorAllocator::PoolSizeRatio> compute_sizes = {
 		{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1}
 	};
 
-	global_descriptor_allocator.init_pool(device, 10, sizes);
+	global_descriptor_allocator.init(device, 10, sizes);
 	compute_descriptor_allocator.init_pool(device, 10, compute_sizes);
 
 	// VkDescriptorPoolCreateInfo pool_info={};
@@ -766,52 +1212,52 @@ void VulkanEngine::init_descriptors() {
 	// pool_info.pPoolSizes = sizes.data();
 	// vkCreateDescriptorPool(device, &pool_info, nullptr, &descriptor_pool);
 
+	// Layouts and samplers all come from the caches, so identical ones are only created once
+	descriptor_layout_cache.init(device);
+	sampler_cache.init(device);
+
 	// Initialize global descriptor set layouts
 	DescriptorLayoutBuilder builder;
 	builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT); // binding for camera uniform buffer
 	builder.add_binding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT); // binding for scene parameter uniform buffer
-	global_set_layout = builder.build(device);
+	// Point lights and the per-froxel light lists. Written by ClusteredLighting::init
+	builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	builder.add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT);
+	builder.add_binding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT); // Shadow cascades. Written by ShadowCascades::init
+	global_set_layout = builder.build(descriptor_layout_cache);
 
 	builder.clear();
 	builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT);
-	draw_image_descriptor_layout = builder.build(device);
+	draw_image_descriptor_layout = builder.build(descriptor_layout_cache);
 
 	// Initialize Storage Buffer layouts
 	builder.clear();
 	builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT);
-	object_set_layout = builder.build(device);
+	object_set_layout = builder.build(descriptor_layout_cache);
 	
 	// Texture descriptor set layout
 	builder.clear();
 	builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT);
-	single_texture_set_layout = builder.build(device);
+	single_texture_set_layout = builder.build(descriptor_layout_cache);
 
 	main_deletion_queue.push_function([&]() {
-		vkDestroyDescriptorSetLayout(device, object_set_layout, nullptr);
-		vkDestroyDescriptorSetLayout(device, global_set_layout, nullptr);
-		vkDestroyDescriptorSetLayout(device, single_texture_set_layout, nullptr);
-		vkDestroyDescriptorSetLayout(device, draw_image_descriptor_layout, nullptr);
-		global_descriptor_allocator.destroy_pool(device);
+		descriptor_layout_cache.cleanup();
+		sampler_cache.cleanup();
+		global_descriptor_allocator.destroy_pools(device);
 		compute_descriptor_allocator.destroy_pool(device);
 	});
 
-	// Allocate the descriptor set for the compute shader test render
+	// Allocate the descriptor set for the compute shader test render. It is written once the render graph has created the draw image.
 	draw_image_descriptor_set = compute_descriptor_allocator.allocate(device, draw_image_descriptor_layout);
-	VkDescriptorImageInfo dii{};
-	dii.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-	dii.imageView = draw_image.imageview;
-	VkWriteDescriptorSet draw_image_write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, draw_image_descriptor_set, &dii, 0);
-	vkUpdateDescriptorSets(device, 1, &draw_image_write, 0, nullptr);
 
 	// Because of alignment, we need to increase the size of the buffer so that it fits 2 padded GPUSceneData structs
-	const size_t scene_param_buffer_size = FRAME_OVERLAP * pad_uniform_buffer_size(sizeof(GPUSceneData));
-	scene_parameter_buffer = create_buffer(scene_param_buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	const size_t scene_param_buffer_size = MAX_FRAMES_IN_FLIGHT * pad_uniform_buffer_size(sizeof(GPUSceneData));
+	scene_parameter_buffer = create_buffer(scene_param_buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
 	// Create and allocate the uniform buffers for the camera matricies
-	for (int i = 0; i < FRAME_OVERLAP; i++) {
-		frames[i].camera_buffer = create_buffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-		
-		const int MAX_OBJECTS = 10000;
-		frames[i].object_buffer = create_buffer(sizeof(GPUObjectData) * MAX_OBJECTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+		frames[i].camera_buffer = create_buffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
+
 
 		// Allocate descriptor set via the descriptor pool and descriptor layout
 		frames[i].global_descriptor = global_descriptor_allocator.allocate(device, global_set_layout);
@@ -831,34 +1277,38 @@ void VulkanEngine::init_descriptors() {
 		// scene_info.offset = pad_uniform_buffer_size(sizeof(GPUSceneData)) * i;
 		scene_info.range = sizeof(GPUSceneData);
 		VkWriteDescriptorSet scene_write = vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, frames[i].global_descriptor, &scene_info, 1);
-		// Make the object descriptor point to the object buffer
-		VkDescriptorBufferInfo object_info={};
-		object_info.buffer = frames[i].object_buffer.buffer;
-		object_info.offset = 0;
-		object_info.range = sizeof(GPUObjectData) * MAX_OBJECTS;
-		VkWriteDescriptorSet object_write = vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frames[i].object_descriptor, &object_info, 0);
 
-		VkWriteDescriptorSet set_writes[] = {camera_write, scene_write, object_write};
-		vkUpdateDescriptorSets(device, 3, set_writes, 0, nullptr);
+		VkWriteDescriptorSet set_writes[] = {camera_write, scene_write};
+		vkUpdateDescriptorSets(device, 2, set_writes, 0, nullptr);
+		// Starting size. Grows once the entities need more.
+		resize_object_buffer(frames[i], 10000);
 
 		
+		frames[i].frame_descriptors.init(device, 1000, frame_sizes);
+		
 		main_deletion_queue.push_function([&, i]() {
-			vmaDestroyBuffer(allocator, frames[i].camera_buffer.buffer, frames[i].camera_buffer.allocation);
-			vmaDestroyBuffer(allocator, frames[i].object_buffer.buffer, frames[i].object_buffer.allocation);
+			frames[i].frame_descriptors.destroy_pools(device);
+			destroy_buffer(frames[i].camera_buffer);
+			destroy_buffer(frames[i].object_buffer);
 		});
 	}
-	main_deletion_queue.push_function([&]() {vmaDestroyBuffer(allocator, scene_parameter_buffer.buffer, scene_parameter_buffer.allocation);});
+	main_deletion_queue.push_function([&]() {destroy_buffer(scene_parameter_buffer);});
 }
 // Destroyer function
 void VulkanEngine::cleanup() {
 	if (isInitialized) {
 
 		// Make sure GPU has finished using the objects we are about to delete
-		for (int i = 0; i < FRAME_OVERLAP; i++) {
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
 			vkWaitForFences(device, 1, &frames[i].render_fence, true, 1000000000);
 		}
 		
 		vkDeviceWaitIdle(device);
+		finish_uploads();
+		for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+			frames[i].deletion_queue.flush(); // Whatever the last frames retired
+		}
+		end_defragmentation(); // Before the mesh buffers it may be moving are freed
 		main_deletion_queue.flush();
 		
 		// These are special, so we don't add them to the deletion queue
@@ -900,137 +1350,366 @@ void VulkanEngine::init_scene() {
 	// 		renderables.push_back(tri);
 	// 	}
 	// }
-	RenderObject map;
-	map.mesh = get_mesh("lost empire");
-	map.material = get_material("textured_mesh");
-	map.transform_matrix = glm::translate(glm::vec3{ 5,-10,0 });
-	renderables.push_back(map);
+	scene_root = scene_graph.create_node(INVALID_NODE);
+	// The map is a block world exported one face at a time, so it's rebuilt from voxels with far fewer triangles
+	MaterialHandle map_material = materials.find("voxel_mesh"_sid);
+	if (!chunk_streamer.load_world("../assets/lost_empire.obj", map_material, glm::vec3{ 5,-10,0 }, true)) {
+		std::cout << "Failed to load the world" << std::endl;
+	}
+	// Chunks near the camera stream in over the first frames
+	chunk_streamer.update(camera_position);
+	// Scatter the lights through the map's bounding box
+	glm::vec3 map_center = chunk_streamer.world_bounds().center();
+	glm::vec3 map_extent = chunk_streamer.world_bounds().extent() * 0.6f;
+	lighting.spawn_lights(ClusteredLighting::MAX_LIGHTS, map_center - map_extent, map_center + map_extent);
 
 	// Create sampler
 	VkSamplerCreateInfo si = vkinit::sampler_create_info(VK_FILTER_NEAREST);
-	VkSampler blocky_sampler;
-	VK_CHECK(vkCreateSampler(device, &si, nullptr, &blocky_sampler));
-
-	main_deletion_queue.push_function([=, this](){
-		vkDestroySampler(device, blocky_sampler, nullptr);
-	});
-
-	Material* textured_material = get_material("textured_mesh");
-	textured_material->texture_set = global_descriptor_allocator.allocate(device, single_texture_set_layout);
-	// Write to the descriptor set so it points to the texture
-	VkDescriptorImageInfo image_buffer_info;
-	image_buffer_info.sampler = blocky_sampler;
-	image_buffer_info.imageView = loaded_textures["empire_diffuse"].image_view;
-	image_buffer_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textured_material->texture_set, &image_buffer_info, 0);
-	vkUpdateDescriptorSets(device, 1, &texture1, 0, nullptr);
+	// Keep the blocky look up close, but blend between mips in the distance
+	si.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	si.maxLod = VK_LOD_CLAMP_NONE;
+	VkSampler blocky_sampler = sampler_cache.get_sampler(si);
+
+	default_texture_set = global_descriptor_allocator.allocate(device, single_texture_set_layout);
+	VkDescriptorImageInfo white_info;
+	white_info.sampler = blocky_sampler;
+	white_info.imageView = loaded_textures.get(loaded_textures.find("white"_sid))->image_view;
+	white_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	VkWriteDescriptorSet white_write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, default_texture_set, &white_info, 0);
+	vkUpdateDescriptorSets(device, 1, &white_write, 0, nullptr);
+
+	// Both map materials sample the same atlas
+	for (MaterialHandle handle : {materials.find("textured_mesh"_sid), map_material}) {
+		Material* textured_material = materials.get(handle);
+		textured_material->texture_sampler = blocky_sampler;
+		textured_material->streamed_texture = texture_streamer.find("empire_diffuse");
+		if (textured_material->streamed_texture < 0) {
+			textured_material->texture_set = global_descriptor_allocator.allocate(device, single_texture_set_layout);
+			// Write to the descriptor set so it points to the texture
+			VkDescriptorImageInfo image_buffer_info;
+			image_buffer_info.sampler = blocky_sampler;
+			image_buffer_info.imageView = loaded_textures.get(loaded_textures.find("empire_diffuse"_sid))->image_view;
+			image_buffer_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			VkWriteDescriptorSet texture1 = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textured_material->texture_set, &image_buffer_info, 0);
+			vkUpdateDescriptorSets(device, 1, &texture1, 0, nullptr);
+		}
+	}
 
 	// Will sort here when the scene gets complex and it will actually make a difference
 }
-// Renders each object in the RenderObject list. This is actually a pretty decent system. The renderables list can be sorted
-// to minimize how many pipeline bindings are needed. Rendering the same object many times with different push constants is pretty fast,
-// since push constants are accessable by both CPU and GPU memory and don't have to be sent or re-bound.
-void VulkanEngine::draw_objects(VkCommandBuffer cmd, RenderObject* first, int count) {
-	float zoom = 1.0f;
+void VulkanEngine::update_camera() {
 	glm::vec3 up = {0.0f, 1.0f, 0.0f};
-	glm::vec3 camPos = {0.0f, 6.0f, 10.0f}; // camera position
-	glm::mat4 view = glm::lookAt(camPos / zoom, glm::vec3{0,6,0}, up);
-	glm::vec3 lookAt = glm::vec3(0,10.0f,0) - camPos;
-	glm::vec3 right = glm::cross(lookAt,up);
-	up = glm::cross(right, lookAt);
+	glm::vec3 forward = {std::sin(camera_yaw) * std::cos(camera_pitch), std::sin(camera_pitch), -std::cos(camera_yaw) * std::cos(camera_pitch)};
+	glm::vec3 right = glm::normalize(glm::cross(forward, up));
+	if (!ImGui::GetIO().WantCaptureKeyboard) {
+		const Uint8* keys = SDL_GetKeyboardState(nullptr);
+		glm::vec3 move{0.0f};
+		move += forward * float(keys[SDL_SCANCODE_W] - keys[SDL_SCANCODE_S]);
+		move += right * float(keys[SDL_SCANCODE_D] - keys[SDL_SCANCODE_A]);
+		move += up * float(keys[SDL_SCANCODE_E] - keys[SDL_SCANCODE_Q]);
+		// Last frame's length, capped so a long stall doesn't throw the camera across the world
+		float dt = std::min(frame_pacer.cpu_frame_ms / 1000.0f, 0.1f);
+		float speed = camera_speed * (keys[SDL_SCANCODE_LSHIFT] ? 4.0f : 1.0f);
+		if (glm::dot(move, move) > 0.0f) {
+			camera_position += glm::normalize(move) * speed * dt;
+		}
+	}
+	glm::mat4 view = glm::lookAt(camera_position, camera_position + forward, up);
 	// glm::mat4 view = glm::translate(glm::mat4(1.0f), camPos);
 	// Camera projection matrix
-	glm::mat4 projection = glm::perspective(glm::radians(70.0f), (float)windowExtent.width/(float)windowExtent.height, 0.1f, 200.0f);
+	glm::mat4 projection = glm::perspective(camera_fov, (float)windowExtent.width/(float)windowExtent.height, camera_near, camera_far);
 	projection[1][1] *= -1;
 	// Fill camera data struct
-	GPUCameraData cam_data;
-	cam_data.proj = projection;
-	cam_data.view = view;
-	cam_data.viewproj = projection * view;
-	// Then copy it to the buffer that is pointed to by the descriptor set
+	camera_data.proj = projection;
+	camera_data.view = view;
+	camera_data.viewproj = projection * view;
+}
+// Picks the mip whose texels come closest to one per pixel at the nearest point of each object's bounding sphere.
+// An object the camera is inside of gets level 0.
+void VulkanEngine::update_texture_streaming() {
+	float pixels_per_unit_at_unit_distance = draw_extent.height / (2.0f * std::tan(camera_fov * 0.5f));
+	for (RenderObject& object : renderables) {
+		int texture = object.material->streamed_texture;
+		if (texture < 0) {
+			continue;
+		}
+		glm::vec3 center = glm::vec3(object.transform_matrix * glm::vec4(object.mesh->bounds_center, 1.0f));
+		float scale = std::max({glm::length(glm::vec3(object.transform_matrix[0])), glm::length(glm::vec3(object.transform_matrix[1])), glm::length(glm::vec3(object.transform_matrix[2]))});
+		float distance = std::max(glm::length(center - camera_position) - object.mesh->bounds_radius * scale, 0.1f);
+		float pixels_per_unit = pixels_per_unit_at_unit_distance / distance;
+		const ktx::Texture& source = texture_streamer.textures[texture].source;
+		float texels_per_unit = std::max(source.width, source.height) * object.mesh->uv_density / scale;
+		float level = std::floor(std::log2(std::max(texels_per_unit / pixels_per_unit, 1.0f)));
+		texture_streamer.request(texture, static_cast<uint32_t>(level), frameNumber);
+	}
+	texture_streamer.update(frameNumber);
+}
+void VulkanEngine::update_transforms() {
+	float angle = frameNumber / 120.f;
+	for (int i = 0; i < std::min<int>(moving_test_roots, hierarchy_test_roots.size()); i++) {
+		scene_graph.set_rotation(hierarchy_test_roots[i], glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+	}
+	scene_graph.update(jobs);
+	for (Entity entity : scene_graph.changed_payloads()) {
+		if (!registry.alive(entity)) {
+			continue; // Destroyed while still attached to its node
+		}
+		WorldTransform* transform = registry.get<WorldTransform>(entity);
+		TransformNode* node = registry.get<TransformNode>(entity);
+		if (!transform || !node) {
+			continue;
+		}
+		const glm::mat4& world = scene_graph.world_matrix(node->node);
+		glm::vec3 displacement = glm::vec3(world[3] - transform->matrix[3]);
+		transform->matrix = world;
+		moved_entities.push_back(entity);
+		if (SpatialProxy* proxy = registry.get<SpatialProxy>(entity)) {
+			spatial_tree.move(proxy->proxy, world_bounds(registry.get<MeshRenderer>(entity)->mesh, transform->matrix), displacement);
+		}
+	}
+}
+Aabb VulkanEngine::world_bounds(MeshHandle mesh, const glm::mat4& transform) {
+	const Mesh* source = meshes.get(mesh);
+	if (!source) {
+		return Aabb::from_sphere(glm::vec3(transform[3]), 0.0f);
+	}
+	float scale = std::max({glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))});
+	return Aabb::from_sphere(glm::vec3(transform * glm::vec4(source->bounds_center, 1.0f)), source->bounds_radius * scale);
+}
+// One linear pass over the archetypes that have both components. The packets come out grouped by archetype,
+// and keep their order until an entity is created, destroyed or changes archetype.
+void VulkanEngine::extract_renderables() {
+	renderables.clear();
+	entity_packets.resize(registry.capacity());
+	registry.each<MeshRenderer, WorldTransform>([&](Entity entity, const MeshRenderer& renderer, const WorldTransform& transform) {
+		Mesh* mesh = meshes.get(renderer.mesh);
+		Material* material = materials.get(renderer.material);
+		if (!mesh || !material) {
+			entity_packets[entity.index] = ~0u; // The asset was removed, so there is nothing to draw
+			return;
+		}
+		entity_packets[entity.index] = static_cast<uint32_t>(renderables.size());
+		renderables.push_back(RenderObject{mesh, material, transform.matrix});
+	});
+
+	// A new layout moves packets around, so every slot's object buffer has to be rewritten
+	if (registry.structure_version() != extracted_structure_version) {
+		extracted_structure_version = registry.structure_version();
+		for (FrameData& frame : frames) {
+			frame.all_objects_dirty = true;
+			frame.dirty_objects.clear();
+		}
+	} else {
+		for (Entity entity : moved_entities) {
+			if (!registry.has<MeshRenderer>(entity) || entity_packets[entity.index] == ~0u) {
+				continue;
+			}
+			for (FrameData& frame : frames) {
+				frame.dirty_objects.push_back(entity_packets[entity.index]);
+			}
+		}
+	}
+	moved_entities.clear();
+	// Slots that aren't in use keep collecting, so give up on the list once it would cost as much as a full copy
+	for (FrameData& frame : frames) {
+		if (frame.dirty_objects.size() > renderables.size()) {
+			frame.all_objects_dirty = true;
+			frame.dirty_objects.clear();
+		}
+	}
+}
+void VulkanEngine::upload_frame_data() {
+	// Copy the camera to the buffer that is pointed to by the descriptor set
 	void* data;
 	vmaMapMemory(allocator, get_current_frame().camera_buffer.allocation, &data);
-	memcpy(data, &cam_data, sizeof(GPUCameraData));
+	memcpy(data, &camera_data, sizeof(GPUCameraData));
 	vmaUnmapMemory(allocator, get_current_frame().camera_buffer.allocation);
 
 	// Map the scene parameter data
 	float framed = (frameNumber / 120.f);
-	scene_parameters.ambient_color = {sin(framed), 0, cos(framed), 1};
+	scene_parameters.ambient_color = {sin(framed), 0, cos(framed), ambient_strength};
+	scene_parameters.fog_color = fog_color;
+	scene_parameters.fog_distances = {fog_distances.x, fog_distances.y, 0.0f, 0.0f};
+	scene_parameters.sunlight_direction = glm::vec4(glm::normalize(glm::vec3(-0.3f, -1.0f, -0.2f)), 0.0f);
+	scene_parameters.sunlight_color = {1.0f, 0.95f, 0.85f, 0.7f};
+	shadows.update(renderables, glm::vec3(scene_parameters.sunlight_direction));
+	for (uint32_t i = 0; i < ShadowCascades::CASCADE_COUNT; i++) {
+		scene_parameters.shadow_matrices[i] = shadows.shadow_matrix(i);
+	}
+	scene_parameters.cascade_splits = shadows.split_distances();
+	scene_parameters.cascade_texel_sizes = shadows.texel_sizes();
+	glm::vec2 slices = lighting.slice_scale_bias(camera_near, camera_far);
+	scene_parameters.cluster_scale = {float(draw_extent.width) / ClusteredLighting::GRID_X, float(draw_extent.height) / ClusteredLighting::GRID_Y, slices.x, slices.y};
+	scene_parameters.cluster_grid = {ClusteredLighting::GRID_X, ClusteredLighting::GRID_Y, ClusteredLighting::GRID_Z, ClusteredLighting::MAX_LIGHTS_PER_CLUSTER};
+	lighting.update(frameNumber / 60.f);
 	char* scene_data;
 	vmaMapMemory(allocator, scene_parameter_buffer.allocation, (void**)&scene_data);
-	int frameIndex = frameNumber % FRAME_OVERLAP;
+	int frameIndex = current_frame_index();
 	scene_data += pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
 	memcpy(scene_data, &scene_parameters, sizeof(GPUSceneData));
 	vmaUnmapMemory(allocator,scene_parameter_buffer.allocation);
 
+	// The registry has no upper bound, so the object buffer follows the packet count
+	FrameData& frame = get_current_frame();
+	if (renderables.size() > frame.object_capacity) {
+		resize_object_buffer(frame, std::bit_ceil(static_cast<uint32_t>(renderables.size())));
+	}
 	void* object_data;
 	vmaMapMemory(allocator, get_current_frame().object_buffer.allocation, &object_data);
 	GPUObjectData* objectSSBO = (GPUObjectData*)object_data; // Cast the void* pointer to a complex type pointer and we can insert into it normally
-	for (int i = 0; i < count; i++) {
-		RenderObject& object = first[i];
-		objectSSBO[i].modelMatrix = object.transform_matrix;
+	// Each slot has its own buffer, so only what moved since this slot was last used is copied
+	if (frame.all_objects_dirty) {
+		for (size_t i = 0; i < renderables.size(); i++) {
+			objectSSBO[i].modelMatrix = renderables[i].transform_matrix;
+		}
+	} else {
+		for (uint32_t i : frame.dirty_objects) {
+			objectSSBO[i].modelMatrix = renderables[i].transform_matrix;
+		}
 	}
+	frame.all_objects_dirty = false;
+	frame.dirty_objects.clear();
 	vmaUnmapMemory(allocator, get_current_frame().object_buffer.allocation);
 
+	// The culling passes read this frame's draws
+	occlusion_culler.prepare(renderables);
+}
+// The slot's last frame has finished by the time it records again, so its old buffer can go right away
+void VulkanEngine::resize_object_buffer(FrameData& frame, uint32_t capacity) {
+	if (frame.object_capacity > 0) {
+		destroy_buffer(frame.object_buffer);
+	}
+	frame.object_buffer = create_buffer(sizeof(GPUObjectData) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
+	frame.object_capacity = capacity;
+	frame.all_objects_dirty = true;
+	frame.dirty_objects.clear();
+	// Make the object descriptor point to the object buffer
+	VkDescriptorBufferInfo object_info={};
+	object_info.buffer = frame.object_buffer.buffer;
+	object_info.offset = 0;
+	object_info.range = sizeof(GPUObjectData) * capacity;
+	VkWriteDescriptorSet object_write = vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, frame.object_descriptor, &object_info, 0);
+	vkUpdateDescriptorSets(device, 1, &object_write, 0, nullptr);
+}
+// Each batch is one indirect draw over the meshlets of consecutive objects that share a material and mesh.
+// Culling packs the surviving meshlets' commands and writes their count. firstInstance is the object index the vertex shader reads through gl_InstanceIndex.
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, bool late, GeometryPass pass) {
+	int frameIndex = current_frame_index();
 	Mesh* lastmesh = nullptr;
 	Material* lastmat = nullptr;
-	for (int i = 0; i < count; i++) {
-		RenderObject& object = first[i];
+	for (uint32_t b = 0; b < occlusion_culler.batches.size(); b++) {
+		const DrawBatch& batch = occlusion_culler.batches[b];
+		Material* material = batch.material;
 		// Only bind a new pipeline if the new material is different from the last one
-		if (object.material != lastmat) {
-			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline);
+		if (material != lastmat) {
+			VkPipeline pipeline = pass == GeometryPass::DepthOnly ? depth_prepass_pipeline : get_material_pipeline(*material, pass == GeometryPass::ShadedEqual);
+			if (pipeline == VK_NULL_HANDLE) {
+				lastmat = nullptr; // The permutation failed to build, which was reported then. Its batches aren't drawn.
+				continue;
+			}
+			VkPipelineLayout layout = pass == GeometryPass::DepthOnly ? mesh_pipeline_layout : material->pipeline_layout;
+			vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
 			// Set dynamic viewport and scissor 
 			VkViewport viewport{};
 			viewport.x = 0.0f;
 			viewport.y = 0.0f;
-			viewport.height = windowExtent.height;
-			viewport.width = windowExtent.width;
+			viewport.height = draw_extent.height;
+			viewport.width = draw_extent.width;
 			viewport.minDepth = 0.0f;
 			viewport.maxDepth = 1.0f;
 			vkCmdSetViewport(cmd, 0, 1, &viewport);
 
 			VkRect2D scissor{};
 			scissor.offset = {0,0};
-			scissor.extent = windowExtent;
+			scissor.extent = draw_extent;
 			vkCmdSetScissor(cmd, 0, 1, &scissor);
 
-			lastmat = object.material;
+			lastmat = material;
 			uint32_t uniform_offset = pad_uniform_buffer_size(sizeof(GPUSceneData)) * frameIndex;
 			// Bind descriptor sets when changing the pipeline
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline_layout, 0, 1, &get_current_frame().global_descriptor, 1, &uniform_offset);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &get_current_frame().global_descriptor, 1, &uniform_offset);
 			// Bind object data descriptor
-			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline_layout, 1, 1, &get_current_frame().object_descriptor, 0, nullptr);
-			if (object.material->texture_set != VK_NULL_HANDLE) {
-				// Bind texture descriptor
-				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, object.material->pipeline_layout, 2, 1, &object.material->texture_set, 0, nullptr);
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &get_current_frame().object_descriptor, 0, nullptr);
+			if (material->streamed_texture >= 0 && pass != GeometryPass::DepthOnly && material->texture_set_view != texture_streamer.get_view(material->streamed_texture)) {
+				// A different chain became resident. Frames in flight may still read the old set, so it only becomes a spare once this
+				// frame is done, like the old chain itself. Chains only swap between frames, so the late phase never lands here.
+				if (material->texture_set != VK_NULL_HANDLE) {
+					VkDescriptorSet old_set = material->texture_set;
+					get_current_frame().deletion_queue.push_function([this, old_set]() { spare_texture_sets.push_back(old_set); });
+				}
+				if (spare_texture_sets.empty()) {
+					material->texture_set = global_descriptor_allocator.allocate(device, single_texture_set_layout);
+				} else {
+					material->texture_set = spare_texture_sets.back();
+					spare_texture_sets.pop_back();
+				}
+				material->texture_set_view = texture_streamer.get_view(material->streamed_texture);
+				VkDescriptorImageInfo image_info;
+				image_info.sampler = material->texture_sampler;
+				image_info.imageView = material->texture_set_view;
+				image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				VkWriteDescriptorSet texture_write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, material->texture_set, &image_info, 0);
+				vkUpdateDescriptorSets(device, 1, &texture_write, 0, nullptr);
+			}
+			if (pass != GeometryPass::DepthOnly) {
+				// Bind texture descriptor. Set 2 is always statically used, so untextured materials and streamed ones whose
+				// base levels haven't landed yet get the white texture rather than whatever the last material left bound.
+				VkDescriptorSet texture_set = material->texture_set != VK_NULL_HANDLE ? material->texture_set : default_texture_set;
+				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline_layout, 2, 1, &texture_set, 0, nullptr);
 			}
 		}
-		glm::mat4 model = object.transform_matrix;
-
-		MeshPushConstants constants;
-		constants.render_matrix = model;
-		// Upload push constants to the GPU
-		vkCmdPushConstants(cmd, object.material->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
 		// Only bind the mesh if it's different from the previous one
-		if (object.mesh != lastmesh) {
+		if (batch.mesh != lastmesh) {
 			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(cmd, 0, 1, &object.mesh->vertex_buffer.buffer, &offset);
-			lastmesh = object.mesh;
+			vkCmdBindVertexBuffers(cmd, 0, 1, &batch.mesh->vertex_buffer.buffer, &offset);
+			vkCmdBindIndexBuffer(cmd, batch.mesh->vertex_buffer.buffer, batch.mesh->index_offset, VK_INDEX_TYPE_UINT32);
+			lastmesh = batch.mesh;
 		}
-		vkCmdDraw(cmd, object.mesh->vertices.size(), 1, 0, i); // This index i allows us to use the gl_BaseInstance in the shader
+		vkCmdDrawIndexedIndirectCount(cmd, occlusion_culler.indirect_buffer.buffer, occlusion_culler.command_offset(late, batch.first_draw),
+			occlusion_culler.count_buffer.buffer, occlusion_culler.count_offset(late, b), batch.draw_count, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+void VulkanEngine::draw_geometry(VkCommandBuffer cmd, bool late) {
+	FrameData& frame = get_current_frame();
+	if (pipeline_statistics_supported) {
+		vkCmdBeginQuery(cmd, frame.statistics_pool, late ? 1 : 0, 0);
+	}
+	// Since we no longer have a renderpass with color and depth attachments in it, we need to specify them here.
+	// The color attachment is loaded so the background stays underneath the geometry.
+	// The late phase also loads the depth of the early phase.
+	VkClearValue depth_clear;
+	depth_clear.depthStencil.depth = 1.0f;
+	VkRenderingAttachmentInfoKHR color_attachment_info = vkinit::attachment_info(draw_image.imageview, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkRenderingAttachmentInfoKHR depth_attachment_info = vkinit::attachment_info(depth_image.imageview, late ? nullptr : &depth_clear, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL_KHR);
+
+	GeometryPass shading = GeometryPass::Shaded;
+	if (depth_prepass_enabled) {
+		// Depth only, so there is no color attachment at all. The shading pass then loads the finished depth.
+		VkRenderingInfoKHR depth_info = vkinit::rendering_info(draw_extent, 0, nullptr, &depth_attachment_info);
+		vkCmdBeginRendering(cmd, &depth_info);
+		draw_objects(cmd, late, GeometryPass::DepthOnly);
+		vkCmdEndRendering(cmd);
+		depth_attachment_info = vkinit::attachment_info(depth_image.imageview, nullptr, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL_KHR);
+		shading = GeometryPass::ShadedEqual;
+	}
+
+	// The VkRenderingInfoKHR struct contains information that used to be located in the renderpass and framebuffers.
+	VkRenderingInfoKHR render_info = vkinit::rendering_info(draw_extent, 1, &color_attachment_info, &depth_attachment_info);
+	vkCmdBeginRendering(cmd, &render_info); // Analogous to BeginRenderpass
+	draw_objects(cmd, late, shading);
+	vkCmdEndRendering(cmd); // EndRenderpass
+
+	if (pipeline_statistics_supported) {
+		vkCmdEndQuery(cmd, frame.statistics_pool, late ? 1 : 0);
+		frame.statistics_written = true;
 	}
-	// Model rotation
-	// glm::mat4 model = glm::rotate(glm::mat4{1.0f}, glm::radians(frameNumber * 1.2f), glm::vec3(0,1,0));
-	// glm::mat4 mesh_matrix = projection * view * model; // Final mesh matrix
 }
-void VulkanEngine::draw_background(VkCommandBuffer cmd, VkClearValue* clear) {
+void VulkanEngine::draw_background(VkCommandBuffer cmd, VkDescriptorSet target_set) {
 	// VkClearColorValue clearcolor{};
 	// float flash = abs(sin(frameNumber / 120.f));
 	// clearcolor = {{0.0f, 0.0f, 0.0f, 1.0f}};
 	// std::cout << clearcolor.float32[0] << " " << clearcolor.float32[1] << " " << clearcolor.float32[2] << " " << clearcolor.float32[3] << std::endl;
-	clear->color = {0.f, 0.f, 0.f, 1.f};
-	clear->depthStencil.depth = 1.0f;
 	// // Subresource Range specifies properties like mip levels and layers for an image.
 	// VkImageSubresourceRange clear_range = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
 	// vkCmdClearColorImage(cmd, draw_image.image, VK_IMAGE_LAYOUT_GENERAL, &clear->color, 1, &clear_range);
@@ -1039,15 +1718,154 @@ void VulkanEngine::draw_background(VkCommandBuffer cmd, VkClearValue* clear) {
 	ComputeEffect& effect = background_effects[current_background_effect];
 
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
-	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, gradient_pipeline_layout, 0, 1, &draw_image_descriptor_set, 0, nullptr);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, gradient_pipeline_layout, 0, 1, &target_set, 0, nullptr);
 
 	vkCmdPushConstants(cmd, gradient_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
 	
 	// Executes the compute pipeline dispatch.
 	vkCmdDispatch(cmd, std::ceil(draw_extent.width / 16.0), std::ceil(draw_extent.height / 16.0), 1);
 }
+uint64_t VulkanEngine::submit_background_compute() {
+	FrameData& frame = get_current_frame();
+	VkCommandBuffer cmd = frame.compute_command_buffer;
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+	VkCommandBufferBeginInfo cmd_begininfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begininfo));
+	if (compute_timestamps_supported) {
+		vkCmdResetQueryPool(cmd, frame.timestamp_pool, 2, 2);
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestamp_pool, 2);
+	}
+	// The graphics queue finished reading this image before the frame's fence signaled, so its old contents can be discarded
+	vkutil::transition_image(cmd, frame.background_image.image, vkutil::ImageUsage::Undefined, vkutil::ImageUsage::ComputeWrite);
+	draw_background(cmd, frame.background_descriptor);
+	if (compute_timestamps_supported) {
+		vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.timestamp_pool, 3);
+		frame.compute_timestamps_written = true;
+	}
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	VkCommandBufferSubmitInfo cmdinf = vkinit::command_buffer_submit_info(cmd);
+	VkSemaphoreSubmitInfo siginf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, compute_timeline_semaphore);
+	siginf.value = ++compute_timeline_value;
+	VkSubmitInfo2 subinf = vkinit::submit_info(&cmdinf, &siginf, nullptr);
+	VK_CHECK(vkQueueSubmit2(compute_queue, 1, &subinf, VK_NULL_HANDLE));
+	return compute_timeline_value;
+}
+// The frame's fence has signaled, and the graphics submit waited on the compute submit, so every query written is available
+bool VulkanEngine::read_queue_timings(FrameData& frame) {
+	const double ns_to_ms = gpu_properties.limits.timestampPeriod / 1000000.0;
+	uint64_t timestamps[4];
+	if (!frame.graphics_timestamps_written ||
+		vkGetQueryPoolResults(device, frame.timestamp_pool, 0, 2, 2 * sizeof(uint64_t), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+		return false;
+	}
+	queue_timings.graphics_ms = float((timestamps[1] - timestamps[0]) * ns_to_ms);
+	if (frame.compute_timestamps_written &&
+		vkGetQueryPoolResults(device, frame.timestamp_pool, 2, 2, 2 * sizeof(uint64_t), &timestamps[2], sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		queue_timings.compute_ms = float((timestamps[3] - timestamps[2]) * ns_to_ms);
+		// Timestamps from different queues share a timebase, so the intervals can be intersected directly
+		uint64_t overlap_start = std::max(timestamps[2], queue_timings.last_graphics_start);
+		uint64_t overlap_end = std::min(timestamps[3], queue_timings.last_graphics_end);
+		queue_timings.overlap_ms = overlap_end > overlap_start ? float((overlap_end - overlap_start) * ns_to_ms) : 0.0f;
+		frame.compute_timestamps_written = false;
+	} else {
+		queue_timings.compute_ms = 0.0f;
+		queue_timings.overlap_ms = 0.0f;
+	}
+	queue_timings.last_graphics_start = timestamps[0];
+	queue_timings.last_graphics_end = timestamps[1];
+	return true;
+}
+// Sums the early and late geometry passes of a frame whose fence has signaled
+void VulkanEngine::read_pipeline_statistics(FrameData& frame) {
+	if (!frame.statistics_written) {
+		return;
+	}
+	uint64_t results[2][4];
+	if (vkGetQueryPoolResults(device, frame.statistics_pool, 0, 2, sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+		// Results come in the order of the statistic bits
+		pipeline_statistics.input_primitives = results[0][0] + results[1][0];
+		pipeline_statistics.vertex_invocations = results[0][1] + results[1][1];
+		pipeline_statistics.clipping_primitives = results[0][2] + results[1][2];
+		pipeline_statistics.fragment_invocations = results[0][3] + results[1][3];
+	}
+	frame.statistics_written = false;
+}
+void VulkanEngine::build_render_graph(bool async_background) {
+	render_graph.reset();
+	render_graph_async = async_background;
+
+	VkImageUsageFlags draw_image_usages{};
+	draw_image_usages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	draw_image_usages |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	draw_image_usages |= VK_IMAGE_USAGE_STORAGE_BIT;
+	draw_image_usages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	rg_draw_image = render_graph.create_image("draw", {draw_image.format, draw_image.extent, draw_image_usages});
+	rg_depth_image = render_graph.create_image("depth", {depth_image.format, depth_image.extent, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT});
+	// The swapchain image was last drawn to by ImGui. Waiting on that stage also chains onto the present semaphore wait.
+	rg_swapchain_image = render_graph.import_image("swapchain", vkutil::ImageUsage::ColorAttachment, vkutil::ImageUsage::Present, true);
+
+	if (async_background) {
+		// The compute queue already wrote this frame's background, so just copy it into the draw image
+		rg_background_image = render_graph.import_image("background", vkutil::ImageUsage::ComputeWrite, vkutil::ImageUsage::Undefined);
+		render_graph.add_pass("background copy", {{rg_background_image, vkutil::ImageUsage::TransferSrc}, {rg_draw_image, vkutil::ImageUsage::TransferDst}},
+			[this](VkCommandBuffer cmd) {
+				vkutil::copy_image_to_image(cmd, render_graph.get_image(rg_background_image), draw_extent, render_graph.get_image(rg_draw_image), draw_extent);
+			});
+	} else {
+		// Single queue fallback: run the effect straight into the draw image
+		render_graph.add_pass("background", {{rg_draw_image, vkutil::ImageUsage::ComputeWrite}},
+			[this](VkCommandBuffer cmd) { draw_background(cmd, draw_image_descriptor_set); });
+	}
+
+	// Two-phase occlusion culling. What was visible last frame is drawn first, and its depth becomes the pyramid
+	// that the late phase tests everything else against.
+	// The pyramid is owned by the culler and rebuilt every frame, so nothing it held last frame is kept
+	rg_depth_pyramid = render_graph.import_image("depth pyramid", vkutil::ImageUsage::ComputeSampled, vkutil::ImageUsage::Undefined, true);
+	// The cascades persist between frames, since the far ones are only redrawn now and then
+	rg_shadow_map = render_graph.import_image("shadow map", vkutil::ImageUsage::Sampled, vkutil::ImageUsage::Sampled);
+	render_graph.add_pass("shadows", {{rg_shadow_map, vkutil::ImageUsage::DepthAttachment}}, [this](VkCommandBuffer cmd) { shadows.render(cmd); });
+	render_graph.add_pass("light culling", {}, [this](VkCommandBuffer cmd) { lighting.cull(cmd); }, true);
+	render_graph.add_pass("cull early", {}, [this](VkCommandBuffer cmd) { occlusion_culler.cull(cmd, false); }, true);
+	render_graph.add_pass("geometry early", {{rg_draw_image, vkutil::ImageUsage::ColorAttachment}, {rg_depth_image, vkutil::ImageUsage::DepthAttachment}, {rg_shadow_map, vkutil::ImageUsage::Sampled}},
+		[this](VkCommandBuffer cmd) { draw_geometry(cmd, false); });
+	render_graph.add_pass("depth pyramid", {{rg_depth_image, vkutil::ImageUsage::ComputeSampled}, {rg_depth_pyramid, vkutil::ImageUsage::ComputeWrite}},
+		[this](VkCommandBuffer cmd) { occlusion_culler.build_pyramid(cmd, draw_extent); });
+	render_graph.add_pass("cull late", {{rg_depth_pyramid, vkutil::ImageUsage::ComputeSampled}},
+		[this](VkCommandBuffer cmd) { occlusion_culler.cull(cmd, true); }, true);
+	render_graph.add_pass("geometry late", {{rg_draw_image, vkutil::ImageUsage::ColorAttachment}, {rg_depth_image, vkutil::ImageUsage::DepthAttachment}, {rg_shadow_map, vkutil::ImageUsage::Sampled}},
+		[this](VkCommandBuffer cmd) { draw_geometry(cmd, true); });
+
+	render_graph.add_pass("present blit", {{rg_draw_image, vkutil::ImageUsage::TransferSrc}, {rg_swapchain_image, vkutil::ImageUsage::TransferDst}},
+		[this](VkCommandBuffer cmd) {
+			vkutil::copy_image_to_image(cmd, render_graph.get_image(rg_draw_image), draw_extent, render_graph.get_image(rg_swapchain_image), swapchain_extent);
+		});
+
+	render_graph.add_pass("imgui", {{rg_swapchain_image, vkutil::ImageUsage::ColorAttachment}},
+		[this](VkCommandBuffer cmd) { draw_imgui(cmd, render_graph.get_image_view(rg_swapchain_image)); });
+
+	render_graph.compile();
+
+	// The rest of the engine still refers to the draw and depth images directly. Their memory belongs to the graph.
+	draw_image.image = render_graph.get_image(rg_draw_image);
+	draw_image.imageview = render_graph.get_image_view(rg_draw_image);
+	draw_image.allocation = VK_NULL_HANDLE;
+	depth_image.image = render_graph.get_image(rg_depth_image);
+	depth_image.imageview = render_graph.get_image_view(rg_depth_image);
+	depth_image.allocation = VK_NULL_HANDLE;
+	// The depth image may have moved, so the pyramid and the sets that read it are made again
+	occlusion_culler.create_pyramid(depth_image.imageview, {depth_image.extent.width, depth_image.extent.height});
+	render_graph.set_imported_image(rg_depth_pyramid, occlusion_culler.pyramid.image, occlusion_culler.pyramid_view);
+	render_graph.set_imported_image(rg_shadow_map, shadows.map.image, shadows.map_view);
+
+	VkDescriptorImageInfo dii{};
+	dii.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	dii.imageView = draw_image.imageview;
+	VkWriteDescriptorSet draw_image_write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, draw_image_descriptor_set, &dii, 0);
+	vkUpdateDescriptorSets(device, 1, &draw_image_write, 0, nullptr);
+}
 void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView target_imageview) {
-	VkRenderingAttachmentInfoKHR colorAttachInfo = vkinit::attachment_info(target_imageview, nullptr, VK_IMAGE_LAYOUT_GENERAL);
+	VkRenderingAttachmentInfoKHR colorAttachInfo = vkinit::attachment_info(target_imageview, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 	VkRenderingInfoKHR renderinfo = vkinit::rendering_info(swapchain_extent, 1, &colorAttachInfo, nullptr);
 	vkCmdBeginRendering(cmd, &renderinfo);
 
@@ -1057,75 +1875,121 @@ void VulkanEngine::draw_imgui(VkCommandBuffer cmd, VkImageView target_imageview)
 }
 // Draw to framebuffer each window
 void VulkanEngine::draw() {
-	// First, wait for the last frame to render
-	VK_CHECK(vkWaitForFences(device, 1, &get_current_frame().render_fence, true, 1000000000));
-	get_current_frame().deletion_queue.flush(); // Delete all objects from the last rendered frame.
-	VK_CHECK(vkResetFences(device, 1, &get_current_frame().render_fence));
+	using clock = std::chrono::steady_clock;
+	auto to_ms = [](clock::duration d) { return std::chrono::duration<float, std::milli>(d).count(); };
+	apply_frame_settings();
+	FrameData& frame = get_current_frame();
+	// First, wait for the last frame to render. If the fence has already signaled, the GPU has been waiting on the CPU.
+	clock::time_point wait_start = clock::now();
+	bool gpu_was_idle = vkGetFenceStatus(device, frame.render_fence) == VK_SUCCESS;
+	VK_CHECK(vkWaitForFences(device, 1, &frame.render_fence, true, UINT64_MAX));
+	clock::time_point wait_end = clock::now();
+	frame_pacer.fence_wait_ms = to_ms(wait_end - wait_start);
+	frame_pacer.gpu_bound = !gpu_was_idle;
+	if (read_queue_timings(frame)) {
+		dynamic_resolution.update(queue_timings.graphics_ms);
+	}
+	if (frame.submitted) {
+		// When we had to wait, the fence just signaled. Otherwise the GPU started on the frame as soon as it was
+		// submitted, so its own timestamps say when it finished.
+		frame_pacer.latency_ms = gpu_was_idle ? to_ms(frame.submit_time - frame.input_time) + queue_timings.graphics_ms : to_ms(wait_end - frame.input_time);
+	}
+	occlusion_culler.read_stats(current_frame_index());
+	read_pipeline_statistics(frame);
+	frame.deletion_queue.flush(); // Delete all objects from the last rendered frame.
+	frame.frame_descriptors.clear_pools(device); // The GPU is done with last use of this frame's descriptor sets
 	// Request image from the swapchain
 	uint32_t swapchain_image_index;
-	VK_CHECK(vkAcquireNextImageKHR(device, swapchain, 1000000000, get_current_frame().present_semaphore, nullptr, &swapchain_image_index));
+	clock::time_point acquire_start = clock::now();
+	VkResult acquire_result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, frame.present_semaphore, nullptr, &swapchain_image_index);
+	frame_pacer.acquire_wait_ms = to_ms(clock::now() - acquire_start);
+	if (acquire_result == VK_ERROR_OUT_OF_DATE_KHR) {
+		swapchain_dirty = true; // The fence is still signaled, so the next frame can reuse this slot
+		return;
+	}
+	if (acquire_result != VK_SUBOPTIMAL_KHR) {
+		VK_CHECK(acquire_result);
+	}
+	VK_CHECK(vkResetFences(device, 1, &frame.render_fence));
+
+	// Render to a scaled region of the draw image. The present blit stretches it back to the swapchain size.
+	draw_extent.width = std::max(1u, static_cast<uint32_t>(draw_image.extent.width * dynamic_resolution.scale));
+	draw_extent.height = std::max(1u, static_cast<uint32_t>(draw_image.extent.height * dynamic_resolution.scale));
+
+	update_camera();
+	// Heap budgets first, so streaming sees the current headroom and pressure has been relieved.
+	// Relieving it can unload chunks, which has to happen before the draw packets are extracted.
+	memory.update(static_cast<uint32_t>(frameNumber));
+	chunk_streamer.update(camera_position);
+	update_transforms();
+	extract_renderables();
+	// Loads started here are swapped in by acquire_uploads in a later frame
+	update_texture_streaming();
+	upload_frame_data();
+
+	// The background goes to the compute queue first, so it runs while the previous frame is still rasterizing
+	bool async_background = use_async_compute();
+	if (async_background != render_graph_async) {
+		// Switching the background path changes the passes, so rebuild the graph once nothing is using its images
+		VK_CHECK(vkDeviceWaitIdle(device));
+		build_render_graph(async_background);
+	}
+	uint64_t compute_wait_value = 0;
+	if (async_background) {
+		compute_wait_value = submit_background_compute();
+	}
 
-	VkCommandBuffer cmd = get_current_frame().command_buffer; // Get the next command buffer
+	VkCommandBuffer cmd = frame.command_buffer; // Get the next command buffer
 	VK_CHECK(vkResetCommandBuffer(cmd, 0)); // Now reset it
 	// Begin command buffer recording
-
-	draw_extent.height = draw_image.extent.height;
-	draw_extent.width = draw_image.extent.width;
-
 	VkCommandBufferBeginInfo cmd_begininfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begininfo));
+	vkCmdResetQueryPool(cmd, frame.timestamp_pool, 0, 2);
+	if (pipeline_statistics_supported) {
+		vkCmdResetQueryPool(cmd, frame.statistics_pool, 0, 2);
+	}
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestamp_pool, 0);
 
-	// Transition the swapchain image to a writable format
-	vkutil::transition_image(cmd, draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-
-	VkClearValue clear;
-	draw_background(cmd, &clear);
-	
-	// Since we no longer have a renderpass with color and depth attachments in it, we need to specify them here.
-	VkRenderingAttachmentInfoKHR color_attachment_info = vkinit::attachment_info(draw_image.imageview, &clear, VK_IMAGE_LAYOUT_GENERAL);
-	VkRenderingAttachmentInfoKHR depth_attachment_info = vkinit::attachment_info(depth_image.imageview, &clear, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL_KHR);
-
-	// Now fill the VkRenderingInfoKHR struct with the attachment info.
-	// The VkRenderingInfoKHR struct contains information that used to be located in the renderpass and framebuffers.
-	VkRenderingInfoKHR render_info = vkinit::rendering_info(windowExtent, 1, &color_attachment_info, &depth_attachment_info);
-	render_info.pColorAttachments = &color_attachment_info;
-	render_info.pDepthAttachment = &depth_attachment_info;
-
-	// The renderpass used to automatically transition image layouts, but with dynamic rendering we need to do it manually.
-	// vkutil::transition_image(cmd, depth_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-	vkutil::transition_image(cmd, draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	
-	vkCmdBeginRendering(cmd, &render_info); // Analogous to BeginRenderpass
-
-	// RENDER HERE
-	draw_objects(cmd, renderables.data(), renderables.size());
-
-	// End render pass
-	vkCmdEndRendering(cmd); // EndRenderpass
-
-	// Must transition image to a present-ready format to present
-	vkutil::transition_image(cmd, draw_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	// vkutil::transition_image(cmd, draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	vkutil::transition_image(cmd, swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-	vkutil::copy_image_to_image(cmd, draw_image.image, draw_extent, swapchain_images[swapchain_image_index], swapchain_extent);
-
-	vkutil::transition_image(cmd, swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-	draw_imgui(cmd, swapchain_image_views[swapchain_image_index]);
+	// Take ownership of anything the transfer queue finished since last frame
+	uint64_t upload_wait_value = acquire_uploads(cmd);
+	update_defragmentation(cmd);
 
-	vkutil::transition_image(cmd, swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	// The graph records every pass along with the barriers between them
+	render_graph.set_imported_image(rg_swapchain_image, swapchain_images[swapchain_image_index], swapchain_image_views[swapchain_image_index]);
+	if (async_background) {
+		render_graph.set_imported_image(rg_background_image, frame.background_image.image, frame.background_image.imageview);
+	}
+	render_graph.execute(cmd);
 
+	vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.timestamp_pool, 1);
+	frame.graphics_timestamps_written = true;
 	// vkCmdEndRenderPass(cmd); // Finishes rendering and transitions image to what we specified
 	VK_CHECK(vkEndCommandBuffer(cmd)); // Can't add any more commands, but can now submit to the queue
 	
 	// Submit command buffer
 	VkCommandBufferSubmitInfo cmdinf = vkinit::command_buffer_submit_info(cmd);
-	VkSemaphoreSubmitInfo waitinf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame().present_semaphore);
-	VkSemaphoreSubmitInfo siginf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame().render_semaphore);
+	VkSemaphoreSubmitInfo waitinf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, frame.present_semaphore);
+	VkSemaphoreSubmitInfo siginf = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.render_semaphore);
 	VkSubmitInfo2 subinf = vkinit::submit_info(&cmdinf, &siginf, &waitinf);
+	VkSemaphoreSubmitInfo wait_infos[3] = {waitinf};
+	uint32_t wait_count = 1;
+	// Wait on the upload timeline when new uploads were acquired. The value has already been reached, so this never blocks.
+	if (upload_wait_value > 0) {
+		wait_infos[wait_count] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, transfer_context.timeline_semaphore);
+		wait_infos[wait_count++].value = upload_wait_value;
+	}
+	// Waits at the compute stage so that it chains with the barrier that hands the background image over to the copy
+	if (compute_wait_value > 0) {
+		wait_infos[wait_count] = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, compute_timeline_semaphore);
+		wait_infos[wait_count++].value = compute_wait_value;
+	}
+	subinf.waitSemaphoreInfoCount = wait_count;
+	subinf.pWaitSemaphoreInfos = wait_infos;
 	
-	VK_CHECK(vkQueueSubmit2(graphics_queue, 1, &subinf, get_current_frame().render_fence));
+	VK_CHECK(vkQueueSubmit2(graphics_queue, 1, &subinf, frame.render_fence));
+	frame.submitted = true;
+	frame.submit_time = clock::now();
+	frame.input_time = frame_pacer.input_time;
 	// Present rendered image to the screen
 	VkPresentInfoKHR present_info={};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1133,19 +1997,55 @@ void VulkanEngine::draw() {
 	present_info.swapchainCount = 1;
 	present_info.pSwapchains = &swapchain;
 	present_info.waitSemaphoreCount = 1; // Waiting on the render command to complete to present to screen
-	present_info.pWaitSemaphores = &get_current_frame().render_semaphore;
+	present_info.pWaitSemaphores = &frame.render_semaphore;
 	present_info.pImageIndices = &swapchain_image_index;
-	VK_CHECK(vkQueuePresentKHR(graphics_queue, &present_info));
+	VkResult present_result = vkQueuePresentKHR(graphics_queue, &present_info);
+	if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR) {
+		swapchain_dirty = true;
+	} else {
+		VK_CHECK(present_result);
+	}
 
 	frameNumber++;
 }
+void VulkanEngine::apply_frame_settings() {
+	uint32_t requested = static_cast<uint32_t>(std::clamp(requested_frames_in_flight, 1, static_cast<int>(MAX_FRAMES_IN_FLIGHT)));
+	if (requested == frames_in_flight && !swapchain_dirty) {
+		return;
+	}
+	VK_CHECK(vkDeviceWaitIdle(device));
+	if (requested != frames_in_flight) {
+		// Every slot is idle now, including ones the new count will skip, so release what they still hold
+		for (FrameData& frame : frames) {
+			frame.deletion_queue.flush();
+			frame.frame_descriptors.clear_pools(device);
+			frame.submitted = false;
+		}
+		frames_in_flight = requested;
+	}
+	if (swapchain_dirty) {
+		recreate_swapchain();
+	}
+}
+void VulkanEngine::pace_frame() {
+	using clock = std::chrono::steady_clock;
+	if (frame_pacer.fps_limit > 0) {
+		std::this_thread::sleep_until(frame_pacer.last_frame_start + std::chrono::microseconds(1000000 / frame_pacer.fps_limit));
+	}
+	clock::time_point now = clock::now();
+	frame_pacer.cpu_frame_ms = std::chrono::duration<float, std::milli>(now - frame_pacer.last_frame_start).count();
+	frame_pacer.last_frame_start = now;
+}
 // Encloses the main loop which polls events and draws to framebuffer each iteration.
 void VulkanEngine::run() {
 	SDL_Event e;
 	bool bQuit = false;
 	//main loop
 	while (!bQuit) {
+		// Sleep before polling, so the input is as fresh as possible when the frame is built
+		pace_frame();
 		//Handle events on queue
+		frame_pacer.input_time = std::chrono::steady_clock::now();
 		while (SDL_PollEvent(&e) != 0) {
 			//close the window when user alt-f4s or clicks the X button			
 			switch (e.type) {
@@ -1161,6 +2061,12 @@ void VulkanEngine::run() {
 					stop_rendering = false;
 				}
 				break;
+			case SDL_MOUSEMOTION:
+				if ((e.motion.state & SDL_BUTTON_RMASK) && !ImGui::GetIO().WantCaptureMouse) {
+					camera_yaw += e.motion.xrel * 0.003f;
+					camera_pitch = std::clamp(camera_pitch - e.motion.yrel * 0.003f, -1.5f, 1.5f);
+				}
+				break;
 			case SDL_KEYDOWN:
 				switch (e.key.keysym.sym){
 				case SDLK_SPACE:
@@ -1225,6 +2131,301 @@ void VulkanEngine::run() {
 			ImGui::InputFloat4("data2",(float*)& selected.data.data2);
 			ImGui::InputFloat4("data3",(float*)& selected.data.data3);
 			ImGui::InputFloat4("data4",(float*)& selected.data.data4);
+			// Async compute can be switched off to compare against the single queue path
+			bool separate_compute = compute_queue_family != graphics_queue_family;
+			ImGui::BeginDisabled(!separate_compute);
+			ImGui::Checkbox("Async compute", &async_compute_enabled);
+			ImGui::EndDisabled();
+			if (!separate_compute) {
+				ImGui::Text("No separate compute queue, running on the graphics queue");
+			}
+			ImGui::Text("Graphics queue: %.3f ms", queue_timings.graphics_ms);
+			ImGui::Text("Compute queue: %.3f ms", queue_timings.compute_ms);
+			ImGui::Text("Overlap: %.3f ms", queue_timings.overlap_ms);
+		}
+		ImGui::End();
+
+		// Object counts should stay flat as more materials and textures reuse the same layouts and samplers
+		if (ImGui::Begin("caches")) {
+			ImGui::Text("Descriptor set layouts: %zu (hits %u, misses %u)", descriptor_layout_cache.size(), descriptor_layout_cache.hits, descriptor_layout_cache.misses);
+			ImGui::Text("Samplers: %zu (hits %u, misses %u)", sampler_cache.size(), sampler_cache.hits, sampler_cache.misses);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("frame pacing")) {
+			ImGui::SliderInt("Frames in flight", &requested_frames_in_flight, 1, MAX_FRAMES_IN_FLIGHT);
+			const VkPresentModeKHR present_modes[] = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR};
+			const char* present_mode_names[] = {"Mailbox", "Immediate", "FIFO relaxed", "FIFO"};
+			int present_mode_index = static_cast<int>(std::find(std::begin(present_modes), std::end(present_modes), preferred_present_mode) - std::begin(present_modes));
+			if (ImGui::Combo("Present mode", &present_mode_index, present_mode_names, IM_ARRAYSIZE(present_mode_names))) {
+				preferred_present_mode = present_modes[present_mode_index];
+				swapchain_dirty = true;
+			}
+			ImGui::Text("Using %s", string_VkPresentModeKHR(present_mode));
+			ImGui::SliderInt("FPS limit (0 = off)", &frame_pacer.fps_limit, 0, 240);
+			ImGui::Text("CPU frame: %.2f ms", frame_pacer.cpu_frame_ms);
+			ImGui::Text("Fence wait: %.2f ms, acquire wait: %.2f ms", frame_pacer.fence_wait_ms, frame_pacer.acquire_wait_ms);
+			ImGui::Text("Input to GPU done: %.2f ms", frame_pacer.latency_ms);
+			ImGui::Text("%s bound", frame_pacer.gpu_bound ? "GPU" : "CPU");
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("resolution")) {
+			ImGui::Checkbox("Dynamic resolution", &dynamic_resolution.enabled);
+			ImGui::SliderFloat("GPU budget (ms)", &dynamic_resolution.target_ms, 4.0f, 33.0f);
+			ImGui::SliderFloat("Min scale", &dynamic_resolution.min_scale, 0.25f, 1.0f);
+			ImGui::Text("Scale %.2f, rendering at %ux%u", dynamic_resolution.scale, draw_extent.width, draw_extent.height);
+			ImGui::Text("Smoothed GPU time: %.2f ms", dynamic_resolution.smoothed_ms);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("texture streaming")) {
+			int budget_mb = static_cast<int>(texture_streamer.budget >> 20);
+			if (ImGui::SliderInt("Budget (MB)", &budget_mb, 1, 1024)) {
+				texture_streamer.budget = static_cast<VkDeviceSize>(budget_mb) << 20;
+			}
+			ImGui::Text("Resident: %.1f MB", texture_streamer.committed_memory / (1024.0 * 1024.0));
+			ImGui::Text("Loads: %u, evictions: %u", texture_streamer.load_count, texture_streamer.eviction_count);
+			for (const StreamedTexture& texture : texture_streamer.textures) {
+				ImGui::Text("%s: level %u%s (base %u)", texture.name.c_str(), texture.resident_level, texture.loading ? " loading" : "", texture.base_level);
+			}
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("memory")) {
+			ImGui::Text(memory_budget_supported ? "Budgets from VK_EXT_memory_budget" : "Budgets estimated by VMA");
+			for (size_t i = 0; i < memory.heaps.size(); i++) {
+				bool device_local = memory.heaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+				ImGui::Text("Heap %zu%s: %.1f / %.1f MB, %.1f MB being freed", i, device_local ? " (device)" : "", memory.heap_budgets[i].usage / (1024.0 * 1024.0),
+					memory.heap_budgets[i].budget / (1024.0 * 1024.0), memory.pending_frees[i] / (1024.0 * 1024.0));
+			}
+			for (size_t c = 0; c < memory.categories.size(); c++) {
+				ImGui::Text("%s: %.1f MB in %u allocations", memory_category_name(static_cast<MemoryCategory>(c)), memory.categories[c].bytes / (1024.0 * 1024.0), memory.categories[c].count);
+			}
+			ImGui::SliderFloat("Pressure threshold", &memory.pressure_threshold, 0.5f, 1.0f);
+			ImGui::Text("Pressure events: %u, freed %.1f MB", memory.pressure_events, memory.pressure_freed / (1024.0 * 1024.0));
+			if (ImGui::Button("Write report")) {
+				memory.write_report("memory_report.json");
+			}
+			ImGui::Checkbox("Defragment mesh pool", &defragmentation.enabled);
+			ImGui::Text("Defragmentation %s: %u runs, %u moves, %.1f MB moved", defragmentation.context != VK_NULL_HANDLE ? "running" : "idle", defragmentation.runs, defragmentation.moves, defragmentation.bytes_moved / (1024.0 * 1024.0));
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("occlusion culling")) {
+			const GPUCullStats& cull_stats = occlusion_culler.stats;
+			uint32_t draws = std::max(occlusion_culler.draw_count, 1u);
+			ImGui::Checkbox("Depth pyramid test", &occlusion_culler.occlusion_enabled);
+			ImGui::Checkbox("Normal cone test", &occlusion_culler.cone_culling_enabled);
+			ImGui::Text("Meshlets: %u", occlusion_culler.draw_count);
+			if (occlusion_culler.dropped_meshlets > 0) {
+				ImGui::Text("Dropped, over the draw or batch limit: %u", occlusion_culler.dropped_meshlets);
+			}
+			ImGui::Text("Frustum culled: %u (%.1f%%)", cull_stats.frustum_culled, 100.0f * cull_stats.frustum_culled / draws);
+			ImGui::Text("Backface culled: %u (%.1f%%)", cull_stats.backface_culled, 100.0f * cull_stats.backface_culled / draws);
+			ImGui::Text("Occlusion culled: %u (%.1f%%)", cull_stats.occlusion_culled, 100.0f * cull_stats.occlusion_culled / draws);
+			ImGui::Text("Drawn early: %u, late: %u", cull_stats.drawn_early, cull_stats.drawn_late);
+			uint64_t triangles = std::max<uint64_t>(occlusion_culler.triangle_count, 1);
+			ImGui::Text("Triangles drawn: %u of %llu (%.1f%% saved)", cull_stats.triangles_drawn, static_cast<unsigned long long>(occlusion_culler.triangle_count),
+				100.0f - 100.0f * cull_stats.triangles_drawn / triangles);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("depth pre-pass")) {
+			ImGui::Checkbox("Enabled", &depth_prepass_enabled);
+			ImGui::Text("GPU time: %.2f ms", queue_timings.graphics_ms);
+			if (pipeline_statistics_supported) {
+				// With the pre-pass on, vertices are processed twice but each covered pixel should be shaded about once
+				double pixels = std::max(1.0, double(draw_extent.width) * draw_extent.height);
+				ImGui::Text("Primitives: %llu in, %llu clipped", static_cast<unsigned long long>(pipeline_statistics.input_primitives), static_cast<unsigned long long>(pipeline_statistics.clipping_primitives));
+				ImGui::Text("Vertex invocations: %llu", static_cast<unsigned long long>(pipeline_statistics.vertex_invocations));
+				ImGui::Text("Fragment invocations: %llu (%.2f per pixel)", static_cast<unsigned long long>(pipeline_statistics.fragment_invocations), pipeline_statistics.fragment_invocations / pixels);
+			} else {
+				ImGui::Text("Pipeline statistics queries are not supported");
+			}
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("transform hierarchy")) {
+			ImGui::Text("Nodes: %zu in %zu levels", scene_graph.node_count(), scene_graph.level_count());
+			ImGui::Text("Updated last frame: %u in %.3f ms on %u threads", scene_graph.updated_nodes, scene_graph.update_ms, jobs.worker_count() + 1);
+			if (hierarchy_test_roots.empty() && ImGui::Button("Add 111k test nodes")) {
+				// 1000 roots with 10 children each, and 10 grandchildren under each child. Every child draws a triangle,
+				// so moving roots goes through the entities and the dirty object uploads.
+				MeshHandle test_mesh = meshes.find("triangle"_sid);
+				MaterialHandle test_material = materials.find("default_mesh"_sid);
+				for (int i = 0; i < 1000; i++) {
+					NodeHandle root = scene_graph.create_node(scene_root, glm::vec3(i % 32, 0.0f, i / 32) * 4.0f);
+					hierarchy_test_roots.push_back(root);
+					for (int j = 0; j < 10; j++) {
+						NodeHandle child = scene_graph.create_node(root, glm::vec3(1.0f, 0.0f, 0.0f), glm::angleAxis(glm::radians(36.0f * j), glm::vec3(0.0f, 1.0f, 0.0f)));
+						// The world matrix and the proxy's place are filled in by the next update, like any moved node
+						Entity entity = registry.create(MeshRenderer{test_mesh, test_material}, WorldTransform{glm::mat4(1.0f)}, TransformNode{child});
+						registry.add(entity, SpatialProxy{spatial_tree.insert(world_bounds(test_mesh, glm::mat4(1.0f)), entity.index)});
+						scene_graph.set_payload(child, entity);
+						for (int k = 0; k < 10; k++) {
+							scene_graph.create_node(child, glm::vec3(0.0f, 0.2f * k, 0.5f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.5f));
+						}
+					}
+				}
+			}
+			ImGui::SliderInt("Moving roots", &moving_test_roots, 0, 1000);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("entities")) {
+			ImGui::Text("Entities: %zu in %zu archetypes", registry.entity_count(), registry.archetype_count());
+			ImGui::Text("Draw packets: %zu", renderables.size());
+			// Runs on its own registry, and stalls this frame for a few seconds
+			if (ImGui::Button("Benchmark 1M entities")) {
+				ecs_benchmark = run_ecs_benchmark(1000000);
+			}
+			if (ecs_benchmark.entity_count > 0) {
+				ImGui::Text("ns per entity at %u entities", ecs_benchmark.entity_count);
+				ImGui::Text("Create: %.1f, destroy: %.1f", ecs_benchmark.create_ns, ecs_benchmark.destroy_ns);
+				ImGui::Text("Iterate: %.2f (%.2f through pointers)", ecs_benchmark.iterate_ns, ecs_benchmark.iterate_pointer_ns);
+				ImGui::Text("Add component: %.1f, remove: %.1f", ecs_benchmark.add_component_ns, ecs_benchmark.remove_component_ns);
+			}
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("world streaming")) {
+			ImGui::Text("Camera: %.1f, %.1f, %.1f", camera_position.x, camera_position.y, camera_position.z);
+			ImGui::SliderFloat("Camera speed", &camera_speed, 1.0f, 100.0f);
+			uint32_t building = 0;
+			uint32_t uploading = 0;
+			for (const WorldChunk& chunk : chunk_streamer.chunks) {
+				building += chunk.state == ChunkState::Building ? 1 : 0;
+				uploading += chunk.state == ChunkState::Uploading ? 1 : 0;
+			}
+			ImGui::Text("Chunks: %u of %zu resident, %u building, %u uploading", chunk_streamer.resident_count, chunk_streamer.chunks.size(), building, uploading);
+			ImGui::Text("Loads: %u, unloads: %u", chunk_streamer.load_count, chunk_streamer.unload_count);
+			ImGui::SliderFloat("Load radius", &chunk_streamer.load_radius, chunk_streamer.chunk_size, 512.0f);
+			ImGui::SliderFloat("Hysteresis", &chunk_streamer.hysteresis, 0.0f, 128.0f);
+			int budget_mb = static_cast<int>(chunk_streamer.budget >> 20);
+			if (ImGui::SliderInt("Budget (MB)", &budget_mb, 1, 1024)) {
+				chunk_streamer.budget = static_cast<VkDeviceSize>(budget_mb) << 20;
+			}
+			ImGui::Text("Committed: %.1f MB", chunk_streamer.committed_memory / (1024.0 * 1024.0));
+			ImGui::Text("Load latency: %.1f ms last, %.1f ms average, %.1f ms max", chunk_streamer.last_latency_ms, chunk_streamer.average_latency_ms, chunk_streamer.max_latency_ms);
+			ImGui::Text("Main thread: %.3f ms, %.3f ms max", chunk_streamer.update_ms, chunk_streamer.max_update_ms);
+			ImGui::Text("Updates over %.1f ms: %u", chunk_streamer.slow_update_threshold_ms, chunk_streamer.slow_update_count);
+			ImGui::Text("Frames without the chunk under the camera: %u", chunk_streamer.missing_frames);
+			VoxelWorld& voxels = chunk_streamer.voxels;
+			if (!voxels.chunks.empty()) {
+				ImGui::Separator();
+				size_t voxel_memory = 0;
+				for (const auto& [key, chunk] : voxels.chunks) {
+					voxel_memory += chunk.memory_size();
+				}
+				ImGui::Text("Voxel chunks: %zu, %zu block types", voxels.chunks.size(), voxels.block_types.size() - 1);
+				ImGui::Text("Blocks: %.1f KB in palettes, %.1f KB unpacked", voxel_memory / 1024.0, voxels.chunks.size() * VoxelChunk::VOLUME * sizeof(BlockId) / 1024.0);
+				ImGui::Text("Triangles: %zu exported, %zu as block faces", voxels.source_triangles, voxels.voxelized_triangles);
+				ImGui::Text("Block faces meshed into %zu triangles, %.1fx fewer", voxels.voxel_triangles, voxels.voxelized_triangles / std::max(double(voxels.voxel_triangles), 1.0));
+				ImGui::Text("Last remesh: %zu chunks in %.2f ms, %u refreshed while resident", voxels.remeshed_chunks, voxels.remesh_ms, chunk_streamer.refresh_count);
+				// The block under the crosshair, found in the world's model space
+				glm::vec3 forward = -glm::vec3(glm::transpose(camera_data.view)[2]);
+				glm::ivec3 cell;
+				glm::ivec3 normal;
+				if (voxels.raycast(camera_position - chunk_streamer.world_origin(), forward, 64.0f, cell, normal)) {
+					ImGui::Text("Looking at block %d, %d, %d", cell.x, cell.y, cell.z);
+					if (ImGui::Button("Dig")) {
+						voxels.dig(cell);
+					}
+					ImGui::SameLine();
+					if (ImGui::Button("Place")) {
+						voxels.place(cell + normal, voxels.get_block(cell));
+					}
+				}
+			}
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("spatial queries")) {
+			ImGui::Text("Proxies: %zu, height %u, cost %.1f", spatial_tree.proxy_count(), spatial_tree.height(), spatial_tree.total_cost());
+			uint32_t in_view = 0;
+			spatial_tree.query_frustum(Frustum::from_matrix(camera_data.viewproj, false), [&](uint32_t) { in_view++; });
+			ImGui::Text("In view: %u", in_view);
+			// Whatever the camera looks at first, by its box
+			uint32_t picked = ~0u;
+			float picked_distance = camera_far;
+			glm::vec3 forward = -glm::vec3(glm::transpose(camera_data.view)[2]);
+			spatial_tree.raycast(camera_position, forward, camera_far, [&](uint32_t entity, float distance) {
+				picked = entity;
+				picked_distance = distance;
+				return distance;
+			});
+			if (picked != ~0u) {
+				ImGui::Text("Looking at entity %u, %.1f away", picked, picked_distance);
+			} else {
+				ImGui::Text("Looking at nothing");
+			}
+			// Synthetic boxes, not the scene. The 1M run stalls for several seconds.
+			if (ImGui::Button("Benchmark 10k-1M objects")) {
+				bvh_benchmarks.clear();
+				for (uint32_t count : {10000u, 100000u, 1000000u}) {
+					bvh_benchmarks.push_back(run_bvh_benchmark(count));
+				}
+			}
+			for (const BvhBenchmark& result : bvh_benchmarks) {
+				ImGui::Text("%u objects: build %.1f ms, insert %.1f ms, move 10%% %.2f ms", result.object_count, result.build_ms, result.insert_ms, result.move_ms);
+				ImGui::Text("  us per query, tree/brute force: frustum %.1f/%.1f, ray %.2f/%.1f, overlap %.2f/%.1f%s", result.frustum_us[0], result.frustum_us[1],
+					result.ray_us[0], result.ray_us[1], result.overlap_us[0], result.overlap_us[1], result.results_match ? "" : " (results differ)");
+			}
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("lighting")) {
+			int active = static_cast<int>(lighting.active_lights);
+			if (ImGui::SliderInt("Point lights", &active, 0, static_cast<int>(lighting.lights.size()))) {
+				lighting.active_lights = static_cast<uint32_t>(active);
+			}
+			ImGui::SliderFloat("Ambient", &ambient_strength, 0.0f, 1.0f);
+			ImGui::Text("GPU time: %.2f ms", queue_timings.graphics_ms);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("shadows")) {
+			ImGui::Checkbox("Enabled", &shadows.enabled);
+			ImGui::Checkbox("Cache far cascades", &shadows.caching_enabled);
+			int interval = static_cast<int>(shadows.cache_interval);
+			if (ImGui::SliderInt("Update every N frames", &interval, 1, 60)) {
+				shadows.cache_interval = static_cast<uint32_t>(interval);
+			}
+			ImGui::SliderFloat("Distance", &shadows.shadow_distance, 20.0f, camera_far);
+			if (ImGui::Button("Invalidate")) {
+				shadows.invalidate();
+			}
+			ImGui::Text("Cascades rendered: %u of %u", shadows.cascades_rendered, ShadowCascades::CASCADE_COUNT);
+			ImGui::Text("Meshlet draws: %u", shadows.draws_submitted);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("materials")) {
+			ImGui::Text("Pipelines: %zu (%u built in %.1f ms, %u reused)", pipeline_cache.size(), pipeline_cache.misses, pipeline_cache.build_ms, pipeline_cache.hits);
+			constexpr const char* feature_names[MATERIAL_FEATURE_COUNT] = {"Textured", "Atlas tiles", "Shadows", "Point lights", "Fog", "Glow"};
+			for (const char* name : {"default_mesh", "textured_mesh", "voxel_mesh"}) {
+				Material* material = materials.get(materials.find(hash_string(name)));
+				if (material && ImGui::TreeNode(name)) {
+					uint32_t features = material->features;
+					for (uint32_t i = 0; i < MATERIAL_FEATURE_COUNT; i++) {
+						ImGui::CheckboxFlags(feature_names[i], &features, 1u << i);
+					}
+					if (features != material->features) {
+						set_material_features(*material, features);
+					}
+					ImGui::Checkbox("Cone culling (closed meshes)", &material->cone_culling);
+					ImGui::TreePop();
+				}
+			}
+			ImGui::DragFloatRange2("Fog distance", &fog_distances.x, &fog_distances.y, 1.0f, 0.0f, camera_far);
+			ImGui::ColorEdit4("Fog color", &fog_color.x);
+		}
+		ImGui::End();
+
+		if (ImGui::Begin("render graph")) {
+			ImGui::Text("Culled passes: %u", render_graph.culled_pass_count);
+			ImGui::Text("Transient memory: %.1f MB (%.1f MB without aliasing)", render_graph.transient_memory / (1024.0 * 1024.0), render_graph.unaliased_memory / (1024.0 * 1024.0));
 		}
 		ImGui::End();
 
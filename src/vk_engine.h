@@ -6,6 +6,19 @@
 #include <vk_types.h>
 #include <vk_mesh.h>
 #include <vk_descriptors.h>
+#include <vk_render_graph.h>
+#include <vk_texture_streamer.h>
+#include <vk_memory.h>
+#include <vk_culling.h>
+#include <vk_lighting.h>
+#include <vk_shadows.h>
+#include <vk_jobs.h>
+#include <vk_scene.h>
+#include <vk_ecs.h>
+#include <vk_handles.h>
+#include <vk_bvh.h>
+#include <vk_world.h>
+#include <vk_pipeline.h>
 
 constexpr bool enable_validation_layers = true;
 
@@ -48,14 +61,42 @@ struct ComputeEffect {
 
 struct Material {
 	VkDescriptorSet texture_set{VK_NULL_HANDLE};
-	VkPipeline pipeline;
+	int streamed_texture{-1}; // TextureStreamer id. texture_set is then replaced whenever a different mip chain becomes resident.
+	VkImageView texture_set_view{VK_NULL_HANDLE}; // The streamed chain texture_set points at
+	VkSampler texture_sampler{VK_NULL_HANDLE};
+	uint32_t features{0}; // MaterialFeature bits, set through set_material_features
+	// Only for closed meshes. Meshlets facing away from the camera are culled, which would hide the back of open or single-sided geometry.
+	bool cone_culling{false};
+	// Both come from the pipeline cache the first time the material is drawn with them
+	VkPipeline pipeline{VK_NULL_HANDLE};
+	VkPipeline equal_depth_pipeline{VK_NULL_HANDLE}; // Same shading, but only passes depth equal to what the pre-pass wrote, and doesn't write it
 	VkPipelineLayout pipeline_layout;
 };
 
+using MeshHandle = Handle<Mesh>;
+using MaterialHandle = Handle<Material>;
+
+// Components of an entity that gets drawn
+struct MeshRenderer {
+	MeshHandle mesh;
+	MaterialHandle material;
+};
+struct WorldTransform {
+	glm::mat4 matrix; // Copied from the node's world matrix whenever it changes
+};
+struct TransformNode {
+	NodeHandle node;
+};
+struct SpatialProxy {
+	ProxyId proxy; // In the engine's spatial tree, which maps it back to the entity index
+};
+
+// Draw packet. Rebuilt every frame from the entities by extract_renderables, in archetype order.
+// The pointers are resolved from handles then, and only used until the next extraction.
 struct RenderObject {
 	Mesh* mesh;
 	Material* material;
-	glm::mat4 transform_matrix;
+	glm::mat4 transform_matrix; // World space
 };
 
 struct GPUCameraData {
@@ -69,19 +110,40 @@ struct FrameData {
 	VkFence render_fence;
 	VkCommandPool command_pool;
 	VkCommandBuffer command_buffer;
+	VkCommandPool compute_command_pool; // Allocated from the async compute family
+	VkCommandBuffer compute_command_buffer;
+	AllocatedImage background_image; // Written by the async compute queue, then copied into the draw image
+	VkDescriptorSet background_descriptor;
+	VkQueryPool timestamp_pool; // Start/end timestamps for the graphics and compute work of this frame
+	VkQueryPool statistics_pool{VK_NULL_HANDLE}; // Pipeline statistics of the early and late geometry passes
+	bool statistics_written{false};
+	bool graphics_timestamps_written{false};
+	bool compute_timestamps_written{false};
+	bool submitted{false}; // Whether render_fence guards work from this slot's last use
+	std::chrono::steady_clock::time_point input_time; // When the input this frame was built from was polled
+	std::chrono::steady_clock::time_point submit_time;
 	AllocatedBuffer camera_buffer; // Buffer that holds a single GPUCameraData to use when rendering
 	VkDescriptorSet global_descriptor;
 	AllocatedBuffer object_buffer; // Storage buffer
+	uint32_t object_capacity{0}; // GPUObjectData entries object_buffer holds. Grows with the number of draw packets.
+	std::vector<uint32_t> dirty_objects; // Render objects that moved since this slot's object buffer was last written
+	bool all_objects_dirty{true}; // Rewrite the whole object buffer instead
 	VkDescriptorSet object_descriptor;
+	DescriptorAllocatorGrowable frame_descriptors; // Reset at the start of the frame, for descriptor sets that only live for one frame
 	DeletionQueue deletion_queue;
 };
 
 struct GPUSceneData {
 	glm::vec4 fog_color;
 	glm::vec4 fog_distances;
-	glm::vec4 ambient_color;
-	glm::vec4 sunlight_color;
+	glm::vec4 ambient_color; // w scales the ambient term of lit textures
 	glm::vec4 sunlight_direction;
+	glm::vec4 sunlight_color; // w is the intensity
+	glm::vec4 cluster_scale; // Pixels per froxel in x and y, then the depth slice scale and bias
+	glm::uvec4 cluster_grid; // Froxels in x, y and z, and the most lights one froxel holds
+	glm::mat4 shadow_matrices[ShadowCascades::CASCADE_COUNT]; // World space to the clip space of each cascade
+	glm::vec4 cascade_splits; // View depth where each cascade ends
+	glm::vec4 cascade_texel_sizes; // World space size of a shadow map texel in each cascade
 };
 
 struct GPUObjectData {
@@ -94,17 +156,132 @@ struct UploadContext {
 	VkCommandBuffer command_buffer;
 };
 
+// An upload that has been submitted to the transfer queue but not yet handed over to the graphics queue
+struct PendingUpload {
+	uint64_t timeline_value; // Value the transfer timeline semaphore reaches when the copy is done
+	VkCommandBuffer command_buffer;
+	std::function<void(VkCommandBuffer cmd)> acquire; // Ownership acquire barriers, recorded on the graphics queue
+	std::function<void()> on_complete; // Runs once the resource can be used by the frame being recorded
+	VmaAllocation destination{VK_NULL_HANDLE}; // Buffer being written, which defragmentation must leave where it is until it's handed over
+};
+
+// Uploads are recorded on the transfer queue and signal a timeline semaphore that the graphics queue waits on,
+// so streaming data in doesn't serialize with rendering
+struct TransferContext {
+	VkCommandPool command_pool;
+	VkSemaphore timeline_semaphore;
+	uint64_t submitted_value{0}; // Last value signaled by an upload submit
+	std::deque<PendingUpload> in_flight; // In submission order, so they complete front to back
+};
+
+// GPU time spent on each queue, read back from timestamp queries once a frame's fence has signaled
+struct QueueTimings {
+	float graphics_ms{0};
+	float compute_ms{0};
+	float overlap_ms{0}; // How long the background compute ran alongside the previous frame's graphics work
+	uint64_t last_graphics_start{0}; // Raw graphics timestamps of the frame read before, to intersect with the next compute interval
+	uint64_t last_graphics_end{0};
+};
+
+// Counters from the pipeline statistics queries around the geometry passes. Comparing fragment invocations
+// with and without the depth pre-pass shows how much overdraw it saves.
+struct PipelineStatistics {
+	uint64_t input_primitives{0};
+	uint64_t vertex_invocations{0};
+	uint64_t clipping_primitives{0};
+	uint64_t fragment_invocations{0};
+};
+
+// Which pipelines draw_objects binds
+enum class GeometryPass {
+	Shaded, // Each material's pipeline, writing depth as it goes
+	DepthOnly, // The depth pre-pass pipeline for every material
+	ShadedEqual, // Each material's EQUAL pipeline, shading only what the pre-pass left in the depth buffer
+};
+
+// CPU side frame timing. Time blocked on the fence is time spent waiting for the GPU,
+// and time blocked in acquire is time spent waiting for the presentation engine.
+struct FramePacer {
+	std::chrono::steady_clock::time_point input_time; // When events were last polled
+	std::chrono::steady_clock::time_point last_frame_start;
+	float fence_wait_ms{0};
+	float acquire_wait_ms{0};
+	float cpu_frame_ms{0}; // One whole iteration of the main loop
+	float latency_ms{0}; // From polling input to the GPU finishing the frame built from it
+	bool gpu_bound{false};
+	int fps_limit{0}; // 0 leaves the frame rate uncapped. Capping lets input be polled later, which cuts latency.
+};
+
+// Scales the internal render resolution to hold the GPU frame time near a budget.
+// The draw image stays allocated at full size and only draw_extent shrinks.
+struct DynamicResolution {
+	bool enabled{true};
+	float target_ms{16.0f}; // GPU frame time budget
+	float min_scale{0.5f};
+	float max_scale{1.0f};
+	float scale{1.0f}; // Applied to both axes of the draw image
+	float smoothed_ms{0.0f};
+
+	void update(float gpu_ms) {
+		if (gpu_ms <= 0.0f) {
+			return;
+		}
+		smoothed_ms = smoothed_ms == 0.0f ? gpu_ms : glm::mix(smoothed_ms, gpu_ms, 0.1f);
+		if (!enabled) {
+			scale = max_scale;
+			return;
+		}
+		// Small errors are ignored so the resolution doesn't shimmer around the target
+		float error = smoothed_ms / target_ms;
+		if (error > 0.95f && error < 1.05f) {
+			return;
+		}
+		// GPU cost follows the pixel count, which goes with the square of the scale.
+		// Drop quickly when over budget, and climb back slowly.
+		float desired = scale / std::sqrt(error);
+		float rate = desired < scale ? 0.5f : 0.05f;
+		scale = std::clamp(scale + (desired - scale) * rate, min_scale, max_scale);
+	}
+};
+
+// Compacts the mesh pool a few buffers at a time. A pass copies the moved buffers at the start of a frame,
+// and the old buffers are released once that frame's fence has signaled, so no frame ever waits on it.
+struct Defragmentation {
+	bool enabled{true};
+	uint32_t check_interval{600}; // Frames between checks of how fragmented the pool is
+	VkDeviceSize max_bytes_per_pass{8ull << 20};
+	uint32_t max_moves_per_pass{16};
+	VmaDefragmentationContext context{VK_NULL_HANDLE}; // Set while a defragmentation is running
+	VmaDefragmentationPassMoveInfo pass{}; // Moves of the pass in flight
+	bool pass_in_flight{false};
+	int last_check_frame{0};
+
+	// Stats
+	uint32_t runs{0};
+	uint32_t moves{0};
+	VkDeviceSize bytes_moved{0};
+};
+
 struct Texture {
 	AllocatedImage image;
 	VkImageView image_view;
 };
+using TextureHandle = Handle<Texture>;
 
-constexpr unsigned int FRAME_OVERLAP = 2;
+// Mesh buffers hold the vertices and then the indices. They are copy sources too, so defragmentation can move them.
+constexpr VkBufferUsageFlags MESH_BUFFER_USAGE = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4; // Per-frame resources are created for this many. How many are used is chosen at runtime.
 
 class VulkanEngine {
 public:
 	bool isInitialized{false};
 	int frameNumber {0};
+	uint32_t frames_in_flight{2}; // Between 1 and MAX_FRAMES_IN_FLIGHT. More hides CPU spikes, fewer cuts latency.
+	int requested_frames_in_flight{2}; // Applied at the start of the next frame
+	VkPresentModeKHR preferred_present_mode{VK_PRESENT_MODE_MAILBOX_KHR};
+	VkPresentModeKHR present_mode; // What the swapchain actually uses after falling back
+	bool swapchain_dirty{false}; // Set when the swapchain has to be rebuilt before the next frame
+	FramePacer frame_pacer;
 	bool stop_rendering{false};
 	// Dimensions of the window extent
 	VkExtent2D windowExtent{ 1920 , 1080 };
@@ -114,6 +291,8 @@ public:
 	VkDebugUtilsMessengerEXT debug_messenger;
 	VkPhysicalDevice chosenGPU;
 	VkPhysicalDeviceProperties gpu_properties;
+	bool texture_compression_bc{false}; // BC1-7 formats can be sampled. KTX2 textures are decoded on the CPU otherwise.
+	bool memory_budget_supported{false}; // VK_EXT_memory_budget is enabled, so heap budgets come from the driver
 	VkDevice device;
 	VkSurfaceKHR surface;
 	// Swapchain structures
@@ -123,11 +302,32 @@ public:
 	std::vector<VkImageView> swapchain_image_views; // array of image views for swapchain images
 	VkExtent2D swapchain_extent;
 	AllocatedImage draw_image; // Image being drawn to before being copied to the swapchain image
-	VkExtent2D draw_extent; // Extent of the draw image
+	VkExtent2D draw_extent; // Part of the draw image rendered this frame, set by dynamic resolution
 	// Commands structures
 	VkQueue graphics_queue;
 	uint32_t graphics_queue_family;
-	FrameData frames[FRAME_OVERLAP];
+	VkQueue transfer_queue; // Same as the graphics queue when the GPU has no separate transfer family
+	uint32_t transfer_queue_family;
+	VkQueue compute_queue; // Same as the graphics queue when the GPU has no separate compute family
+	uint32_t compute_queue_family;
+	VkSemaphore compute_timeline_semaphore; // Signaled by async compute submits, waited on by the graphics queue
+	uint64_t compute_timeline_value{0};
+	bool async_compute_enabled{true}; // Runtime toggle. Only takes effect when a separate compute queue exists
+	bool compute_timestamps_supported{false};
+	QueueTimings queue_timings;
+	bool pipeline_statistics_supported{false};
+	PipelineStatistics pipeline_statistics;
+	DynamicResolution dynamic_resolution;
+	FrameData frames[MAX_FRAMES_IN_FLIGHT];
+	// Frame graph
+	RenderGraph render_graph; // Owns the draw and depth images
+	bool render_graph_async{false}; // Which background path the compiled graph was built for
+	RGImageHandle rg_draw_image;
+	RGImageHandle rg_depth_image;
+	RGImageHandle rg_swapchain_image;
+	RGImageHandle rg_background_image;
+	RGImageHandle rg_depth_pyramid;
+	RGImageHandle rg_shadow_map;
 	// Renderpass structures
 	VkRenderPass render_pass;
 	std::vector<VkFramebuffer> framebuffers;
@@ -135,9 +335,18 @@ public:
 	DeletionQueue main_deletion_queue;
 	// Object vma uses to allocate memory
 	VmaAllocator allocator;
+	MemoryTracker memory; // Per-category accounting and heap budgets for everything allocated through VMA
+	MemoryPools memory_pools;
+	Defragmentation defragmentation;
 	// Default pipeline and layout
 	VkPipelineLayout mesh_pipeline_layout;
-	VkPipeline mesh_pipeline;
+	// Every material permutation is mesh_lit.frag specialized with the material's features, on the layout with the texture set
+	PipelineCache pipeline_cache;
+	VkShaderModule mesh_vertex_shader;
+	VkShaderModule mesh_fragment_shader;
+	VkPipelineLayout material_pipeline_layout;
+	VkPipeline depth_prepass_pipeline; // Position only, no fragment shader and no color attachment
+	bool depth_prepass_enabled{false}; // Lays down depth before shading, so each pixel is shaded once. Pays off when overdraw is high.
 	// Compute pipelines
 	VkPipelineLayout gradient_pipeline_layout;
 	VkPipeline gradient_pipeline;
@@ -145,13 +354,47 @@ public:
 	// Depth Image objects
 	AllocatedImage depth_image;
 	// Render object management
-	std::vector<RenderObject> renderables; // default array of renderable objects
-	std::unordered_map<std::string,Material> materials;
-	std::unordered_map<std::string,Mesh> meshes;
-	std::unordered_map<std::string,Texture> loaded_textures;
+	EntityRegistry registry;
+	std::vector<RenderObject> renderables; // This frame's draw packets
+	std::vector<uint32_t> entity_packets; // Index of each entity's packet, by entity index
+	std::vector<Entity> moved_entities; // Entities whose transform changed since the last extraction
+	uint64_t extracted_structure_version{~0ull}; // Packet order is only stable while the registry's layout is
+	EcsBenchmark ecs_benchmark;
+	AabbTree spatial_tree; // World bounds of every entity with a SpatialProxy, for picking and proximity queries
+	std::vector<BvhBenchmark> bvh_benchmarks;
+	HandlePool<Material> materials;
+	HandlePool<Mesh> meshes;
+	HandlePool<Texture> loaded_textures;
+	TextureStreamer texture_streamer;
+	OcclusionCuller occlusion_culler;
+	ClusteredLighting lighting;
+	ShadowCascades shadows;
+	ChunkStreamer chunk_streamer;
+	JobSystem jobs;
+	TransformHierarchy scene_graph;
+	NodeHandle scene_root{INVALID_NODE};
+	std::vector<NodeHandle> hierarchy_test_roots; // Stress test roots. Their children carry drawn entities, their grandchildren are bare nodes.
+	int moving_test_roots{8}; // How many of them spin every frame
+	float ambient_strength{0.3f};
+	glm::vec4 fog_color{0.55f, 0.65f, 0.8f, 1.0f}; // For materials with MATERIAL_FOG. w is the most the fog covers.
+	glm::vec2 fog_distances{40.0f, 160.0f}; // View depth where the fog starts, and where it's thickest
+	// Camera, set up at the start of each frame. WASD flies it, and dragging with the right mouse button turns it.
+	glm::vec3 camera_position{0.0f, 6.0f, 10.0f};
+	float camera_yaw{0.0f}; // 0 looks down -Z
+	float camera_pitch{0.0f};
+	float camera_speed{10.0f}; // Units per second, four times that with shift held
+	float camera_fov{glm::radians(70.0f)}; // Vertical
+	float camera_near{0.1f};
+	float camera_far{200.0f};
+	GPUCameraData camera_data;
 	// Descriptor Sets
-	DescriptorAllocator global_descriptor_allocator;
+	DescriptorAllocatorGrowable global_descriptor_allocator;
+	std::vector<VkDescriptorSet> spare_texture_sets; // Streamed texture sets no frame in flight reads any more, ready to be rewritten
+	// 1x1 white. mesh_lit.frag declares the texture set whatever the features are, so materials without a texture get this one.
+	VkDescriptorSet default_texture_set{VK_NULL_HANDLE};
 	DescriptorAllocator compute_descriptor_allocator;
+	DescriptorLayoutCache descriptor_layout_cache; // Owns every descriptor set layout
+	SamplerCache sampler_cache; // Owns every sampler
 	VkDescriptorSetLayout global_set_layout;
 	VkDescriptorSetLayout object_set_layout;
 
@@ -162,7 +405,7 @@ public:
 	GPUSceneData scene_parameters;
 	AllocatedBuffer scene_parameter_buffer;
 	// To copy data to GPU memory
-	UploadContext upload_context;
+	TransferContext transfer_context;
 	// Texture descriptor set layout
 	VkDescriptorSetLayout single_texture_set_layout;
 	// Immediate Submit control structures
@@ -186,6 +429,7 @@ public:
 
 	// :::::::::::::::::::::::::: Utility Functions ::::::::::::::::::::::::::
 	FrameData& get_current_frame(); // Returns true if lhs < rhs
+	uint32_t current_frame_index() const { return frameNumber % frames_in_flight; }
 
 	// Function to compare renderable objects to be able to sort them (and thus reduce the number of bindings and load them in faster)
 	// TODO: Later when it will actually make a difference
@@ -195,14 +439,30 @@ public:
 	}
 	size_t pad_uniform_buffer_size(size_t original_size); // Pad the uniform buffer sizes to align them properly with the minimum alignment size
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function); // Immediately execute command
+	// Records copies on the transfer queue and returns without waiting. acquire is recorded on the graphics queue once the copy is done,
+	// and is only needed when the transfer queue is a different family. on_complete runs at the same time.
+	void upload_submit(std::function<void(VkCommandBuffer cmd)>&& record, std::function<void(VkCommandBuffer cmd)>&& acquire, std::function<void()>&& on_complete, VmaAllocation destination = VK_NULL_HANDLE);
+	void wait_for_uploads(); // Blocks until every submitted upload has finished on the transfer queue
+	bool has_dedicated_transfer_queue() const { return transfer_queue_family != graphics_queue_family; }
+	bool use_async_compute() const { return async_compute_enabled && compute_queue_family != graphics_queue_family; }
 
 	// :::::::::::::::::::::::::: Create Functions ::::::::::::::::::::::::::
-	AllocatedBuffer create_buffer(size_t alloc_size, VkBufferUsageFlags usage_flags, VmaMemoryUsage memory_usage); // Create and allocate a buffer
+	AllocatedBuffer create_buffer(size_t alloc_size, VkBufferUsageFlags usage_flags, VmaMemoryUsage memory_usage, MemoryCategory category); // Create and allocate a buffer
+	AllocatedImage create_image(const VkImageCreateInfo& image_info, MemoryCategory category); // Create and allocate an image. No view is made.
+	void destroy_buffer(const AllocatedBuffer& buffer); // Frees the buffer and stops accounting for its memory
+	void destroy_image(const AllocatedImage& image); // Same for images. Views are destroyed separately.
+	// Loads a mesh to a CPU buffer then transfers to GPU memory. on_uploaded runs once the copy has landed.
+	void upload_mesh(Mesh& mesh, std::function<void()>&& on_uploaded = nullptr);
 
 private:
 // :::::::::::::::::::::::::: Initialization Functions ::::::::::::::::::::::::::
 	void init_vulkan();
 	void init_swapchain();
+	void create_swapchain(VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
+	void recreate_swapchain();
+	VkPresentModeKHR choose_present_mode(VkPresentModeKHR preferred); // Falls back to the closest supported mode
+	void apply_frame_settings(); // Applies frames in flight and present mode changes between frames
+	void pace_frame(); // Sleeps off what is left of the frame rate cap, then marks the start of the frame
 	void init_commands();
 	void init_default_renderpass();
 	void init_framebuffers();
@@ -212,18 +472,35 @@ private:
 	void init_compute_pipelines();
 	void init_descriptors();
 	void init_imgui();
+	void init_async_compute();
+	void init_render_graph();
 
 	// :::::::::::::::::::::::::: Loading Functions ::::::::::::::::::::::::::
 	void load_meshes();
 	void load_images();
-	void upload_mesh(Mesh& mesh); // Loads a mesh to a CPU buffer then transfers to GPU memory
+	uint64_t acquire_uploads(VkCommandBuffer cmd); // Records acquires for finished uploads. Returns the timeline value to wait on, or 0
+	void finish_uploads(); // Releases whatever is still in flight during cleanup
+	void update_defragmentation(VkCommandBuffer cmd); // Starts or continues compacting the mesh pool. Records the copies into cmd.
+	void end_defragmentation();
 
 	// :::::::::::::::::::::::::: Scene-Related Functions ::::::::::::::::::::::::::
-	void draw_objects(VkCommandBuffer cmd, RenderObject* first, int count);
-	void draw_background(VkCommandBuffer cmd, VkClearValue* clear);
+	void update_camera();
+	void update_texture_streaming(); // Requests the mip each streamed texture needs for its size on screen
+	void update_transforms(); // Updates the world matrices of whatever moved and copies them to the entities
+	void extract_renderables(); // Walks the entities with a mesh and writes their draw packets
+	Aabb world_bounds(MeshHandle mesh, const glm::mat4& transform); // Box around the mesh's bounding sphere
+	void upload_frame_data(); // Writes the camera, scene and object buffers of the current frame
+	void resize_object_buffer(FrameData& frame, uint32_t capacity); // Only while the GPU isn't using the slot
+	void draw_objects(VkCommandBuffer cmd, bool late, GeometryPass pass); // Draws the batches of one culling phase from the commands it wrote
+	void draw_geometry(VkCommandBuffer cmd, bool late); // One culling phase, with the depth pre-pass when enabled
+	void draw_background(VkCommandBuffer cmd, VkDescriptorSet target_set);
+	uint64_t submit_background_compute(); // Runs the background effect on the compute queue. Returns the timeline value to wait on
+	bool read_queue_timings(FrameData& frame); // Returns false when the frame has no timestamps to read yet
+	void read_pipeline_statistics(FrameData& frame);
+	void build_render_graph(bool async_background); // Declares this frame's passes and compiles the graph
 	void draw_imgui(VkCommandBuffer cmd, VkImageView target_imageview);
 	void init_scene();
-	Material* create_material(VkPipeline pipeline, VkPipelineLayout layout, const std::string& name); // Create materials and add them to the materials unordered_map
-	Material* get_material(const std::string& name); // Returns nullptr if not found
-	Mesh* get_mesh(const std::string& name); // Returns nullptr if not found
+	MaterialHandle create_material(uint32_t features, StringId name); // Create materials and add them to the materials pool
+	void set_material_features(Material& material, uint32_t features);
+	VkPipeline get_material_pipeline(Material& material, bool equal_depth); // Builds the permutation on first use
 };
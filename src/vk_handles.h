@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <string_view>
+
+// 64-bit FNV-1a of a name. Literals written as "name"_sid are hashed by the compiler, so lookups only compare integers.
+struct StringId {
+    uint64_t hash{0};
+    bool operator==(const StringId&) const = default;
+};
+
+constexpr StringId hash_string(std::string_view name) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return StringId{hash};
+}
+
+consteval StringId operator""_sid(const char* name, size_t length) {
+    return hash_string(std::string_view(name, length));
+}
+
+// Low bits pick a slot, high bits are the slot's generation when the handle was made.
+// Generations start at 1, so a zero handle is never valid.
+template <typename T>
+struct Handle {
+    static constexpr uint32_t INDEX_BITS = 20;
+    static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static constexpr uint32_t GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+
+    uint32_t value{0};
+
+    uint32_t index() const { return value & INDEX_MASK; }
+    uint32_t generation() const { return value >> INDEX_BITS; }
+    explicit operator bool() const { return value != 0; }
+    bool operator==(const Handle&) const = default;
+};
+
+// Owns the values in one packed array. Removing one moves the last value into its place, so anything holding a pointer
+// has to re-resolve its handle after the pool changes, while handles themselves stay valid until their value is removed.
+template <typename T>
+class HandlePool {
+public:
+    Handle<T> add(T value, StringId name = StringId{}) {
+        uint32_t slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            slot = static_cast<uint32_t>(slots.size());
+            if (slot > Handle<T>::INDEX_MASK) {
+                std::cout << "Handle pool is full" << std::endl;
+                abort();
+            }
+            slots.push_back(Slot{});
+        }
+        slots[slot].dense = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        dense_slots.push_back(slot);
+        Handle<T> handle{(slots[slot].generation << Handle<T>::INDEX_BITS) | slot};
+        if (name.hash != 0) {
+            names[name.hash] = handle;
+        }
+        return handle;
+    }
+
+    void remove(Handle<T> handle) {
+        if (!valid(handle)) {
+            return;
+        }
+        Slot& slot = slots[handle.index()];
+        uint32_t last = static_cast<uint32_t>(values.size() - 1);
+        if (slot.dense != last) {
+            values[slot.dense] = std::move(values[last]);
+            dense_slots[slot.dense] = dense_slots[last];
+            slots[dense_slots[slot.dense]].dense = slot.dense;
+        }
+        values.pop_back();
+        dense_slots.pop_back();
+        // Wrapping back to 0 would make a zero handle valid
+        slot.generation = (slot.generation % Handle<T>::GENERATION_MASK) + 1;
+        free_slots.push_back(handle.index());
+        std::erase_if(names, [&](const auto& entry) { return entry.second == handle; });
+    }
+
+    bool valid(Handle<T> handle) const { return handle && handle.index() < slots.size() && slots[handle.index()].generation == handle.generation(); }
+    T* get(Handle<T> handle) { return valid(handle) ? &values[slots[handle.index()].dense] : nullptr; } // nullptr for stale handles
+    const T* get(Handle<T> handle) const { return valid(handle) ? &values[slots[handle.index()].dense] : nullptr; }
+    // The handle a name was added with, or a zero handle
+    Handle<T> find(StringId name) const {
+        auto it = names.find(name.hash);
+        return it == names.end() ? Handle<T>{} : it->second;
+    }
+
+    size_t size() const { return values.size(); }
+    // Every live value, in no particular order
+    auto begin() { return values.begin(); }
+    auto end() { return values.end(); }
+
+private:
+    struct Slot {
+        uint32_t dense{0}; // Where the value is in values
+        uint32_t generation{1};
+    };
+
+    std::vector<T> values;
+    std::vector<uint32_t> dense_slots; // Slot of each value, to fix up a slot when its value is moved
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::unordered_map<uint64_t, Handle<T>> names;
+};
@@ -0,0 +1,80 @@
+#include <vk_jobs.h>
+
+void JobSystem::init(uint32_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+void JobSystem::cleanup() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitting = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void JobSystem::parallel_for(uint32_t count, uint32_t min_batch, const RangeFunction& function) {
+    if (count == 0) {
+        return;
+    }
+    min_batch = std::max(min_batch, 1u);
+    if (workers.empty() || count <= min_batch) {
+        function(0, count);
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // A worker that woke late for the last loop may still be on its way out
+        done.wait(lock, [this]() { return active_workers == 0; });
+        // A few batches per thread, so uneven batches balance out
+        uint32_t threads = worker_count() + 1;
+        this->function = &function;
+        this->count = count;
+        batch_size = std::max(min_batch, (count + threads * 4 - 1) / (threads * 4));
+        batch_count = (count + batch_size - 1) / batch_size;
+        next_batch = 0;
+        remaining_batches = batch_count;
+        generation++;
+    }
+    wake.notify_all();
+    run_batches();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return remaining_batches == 0 && active_workers == 0; });
+}
+
+void JobSystem::worker_loop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&]() { return quitting || generation != seen; });
+        if (quitting) {
+            return;
+        }
+        seen = generation;
+        active_workers++;
+        lock.unlock();
+        run_batches();
+        lock.lock();
+        active_workers--;
+        done.notify_all();
+    }
+}
+
+void JobSystem::run_batches() {
+    for (uint32_t batch = next_batch++; batch < batch_count; batch = next_batch++) {
+        uint32_t begin = batch * batch_size;
+        (*function)(begin, std::min(begin + batch_size, count));
+        if (--remaining_batches == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
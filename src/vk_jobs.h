@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// A fixed pool of worker threads for data-parallel loops on the CPU. One loop runs at a time, and the thread
+// that starts it works on it too, so parallel_for returns as soon as every batch is done.
+class JobSystem {
+public:
+    using RangeFunction = std::function<void(uint32_t begin, uint32_t end)>;
+
+    void init(uint32_t thread_count = 0); // 0 picks one less than the hardware threads
+    void cleanup();
+    // Splits [0, count) into batches of at least min_batch items and runs them across the workers.
+    // Small loops run inline, since waking the workers would cost more than the work.
+    void parallel_for(uint32_t count, uint32_t min_batch, const RangeFunction& function);
+    uint32_t worker_count() const { return static_cast<uint32_t>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake; // Workers wait here for the next loop
+    std::condition_variable done; // The caller waits here for the workers to finish
+    uint64_t generation{0}; // Bumped for every loop, so a worker runs each one at most once
+    uint32_t active_workers{0};
+    bool quitting{false};
+
+    // The loop being run. Only written while no worker is active.
+    const RangeFunction* function{nullptr};
+    uint32_t count{0};
+    uint32_t batch_size{0};
+    uint32_t batch_count{0};
+    std::atomic<uint32_t> next_batch{0};
+    std::atomic<uint32_t> remaining_batches{0};
+
+    void worker_loop();
+    void run_batches();
+};
@@ -0,0 +1,241 @@
+#include <vk_ktx.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    const uint8_t identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+    // Sizes of the fixed parts of the file
+    constexpr size_t header_size = 12 + 9 * 4; // Identifier, then vkFormat through supercompressionScheme
+    constexpr size_t index_size = 4 * 4 + 2 * 8; // DFD, key/value and supercompression global data ranges
+    constexpr size_t level_index_entry_size = 3 * 8; // byteOffset, byteLength, uncompressedByteLength
+
+    // Data format descriptor values from the Khronos data format spec
+    constexpr uint8_t model_rgbsda = 1;
+    constexpr uint8_t model_bc1a = 128;
+    constexpr uint8_t model_bc3 = 130;
+    constexpr uint8_t model_bc7 = 134;
+    constexpr uint8_t channel_alpha = 15;
+    constexpr uint8_t sample_linear = 0x10;
+
+    struct FormatInfo {
+        VkFormat format;
+        bool srgb;
+        uint8_t color_model;
+        uint32_t block_bytes; // Bytes per 4x4 block, or per pixel for RGBA8
+    };
+
+    const FormatInfo formats[] = {
+        {VK_FORMAT_BC1_RGBA_UNORM_BLOCK, false, model_bc1a, 8},
+        {VK_FORMAT_BC1_RGBA_SRGB_BLOCK, true, model_bc1a, 8},
+        {VK_FORMAT_BC3_UNORM_BLOCK, false, model_bc3, 16},
+        {VK_FORMAT_BC3_SRGB_BLOCK, true, model_bc3, 16},
+        {VK_FORMAT_BC7_UNORM_BLOCK, false, model_bc7, 16},
+        {VK_FORMAT_BC7_SRGB_BLOCK, true, model_bc7, 16},
+        {VK_FORMAT_R8G8B8A8_UNORM, false, model_rgbsda, 4},
+        {VK_FORMAT_R8G8B8A8_SRGB, true, model_rgbsda, 4},
+    };
+
+    const FormatInfo* find_format(VkFormat format) {
+        for (const FormatInfo& info : formats) {
+            if (info.format == format) {
+                return &info;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t level_size(const FormatInfo& info, uint32_t width, uint32_t height) {
+        if (info.color_model == model_rgbsda) {
+            return static_cast<size_t>(width) * height * info.block_bytes;
+        }
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * info.block_bytes;
+    }
+
+    template<typename T>
+    T read_value(const std::vector<uint8_t>& bytes, size_t offset) {
+        T value;
+        memcpy(&value, bytes.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template<typename T>
+    void write_value(std::vector<uint8_t>& bytes, size_t offset, T value) {
+        memcpy(bytes.data() + offset, &value, sizeof(T));
+    }
+
+    struct Sample {
+        uint16_t bit_offset;
+        uint8_t bit_length;
+        uint8_t channel;
+        uint32_t upper;
+    };
+
+    // A basic data format descriptor block, which is all a KTX2 file needs to describe these formats
+    std::vector<uint8_t> build_dfd(const FormatInfo& info) {
+        std::vector<Sample> samples;
+        switch (info.color_model) {
+        case model_bc1a:
+            samples.push_back({0, 63, 1, UINT32_MAX}); // Channel 1 is BC1 with alpha present
+            break;
+        case model_bc3:
+            samples.push_back({0, 63, channel_alpha, UINT32_MAX});
+            samples.push_back({64, 63, 0, UINT32_MAX});
+            break;
+        case model_bc7:
+            samples.push_back({0, 127, 0, UINT32_MAX});
+            break;
+        default:
+            samples.push_back({0, 7, 0, 255});
+            samples.push_back({8, 7, 1, 255});
+            samples.push_back({16, 7, 2, 255});
+            samples.push_back({24, 7, channel_alpha, 255});
+            break;
+        }
+        bool block_compressed = info.color_model != model_rgbsda;
+        uint16_t block_size = static_cast<uint16_t>(24 + 16 * samples.size());
+        std::vector<uint8_t> dfd(4 + block_size, 0);
+        write_value<uint32_t>(dfd, 0, static_cast<uint32_t>(dfd.size()));
+        write_value<uint32_t>(dfd, 4, 0); // Khronos vendor, basic descriptor type
+        write_value<uint16_t>(dfd, 8, 2); // Version 1.3 of the data format spec
+        write_value<uint16_t>(dfd, 10, block_size);
+        dfd[12] = info.color_model;
+        dfd[13] = 1; // BT.709 primaries
+        dfd[14] = info.srgb ? 2 : 1; // sRGB or linear transfer
+        dfd[15] = 0; // Straight alpha
+        dfd[16] = block_compressed ? 3 : 0; // Texel block dimensions minus one
+        dfd[17] = block_compressed ? 3 : 0;
+        dfd[20] = static_cast<uint8_t>(info.block_bytes); // Bytes in plane 0
+        for (size_t s = 0; s < samples.size(); s++) {
+            size_t offset = 28 + s * 16;
+            uint8_t channel = samples[s].channel;
+            // Alpha stays linear in sRGB formats
+            if (info.srgb && channel == channel_alpha) {
+                channel |= sample_linear;
+            }
+            write_value<uint16_t>(dfd, offset, samples[s].bit_offset);
+            dfd[offset + 2] = samples[s].bit_length;
+            dfd[offset + 3] = channel;
+            write_value<uint32_t>(dfd, offset + 8, 0);
+            write_value<uint32_t>(dfd, offset + 12, samples[s].upper);
+        }
+        return dfd;
+    }
+
+    size_t align_up(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+bool ktx::is_supported_format(VkFormat format) {
+    return find_format(format) != nullptr;
+}
+
+bool ktx::read_file(const char* file, Texture& out_texture) {
+    std::ifstream stream(file, std::ios::binary | std::ios::ate);
+    if (!stream.is_open()) {
+        std::cout << "Failed to open KTX2 file " << file << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> bytes(static_cast<size_t>(stream.tellg()));
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+
+    if (bytes.size() < header_size + index_size || memcmp(bytes.data(), identifier, sizeof(identifier)) != 0) {
+        std::cout << file << " is not a KTX2 file" << std::endl;
+        return false;
+    }
+    VkFormat format = static_cast<VkFormat>(read_value<uint32_t>(bytes, 12));
+    uint32_t width = read_value<uint32_t>(bytes, 20);
+    uint32_t height = read_value<uint32_t>(bytes, 24);
+    uint32_t depth = read_value<uint32_t>(bytes, 28);
+    uint32_t layer_count = read_value<uint32_t>(bytes, 32);
+    uint32_t face_count = read_value<uint32_t>(bytes, 36);
+    uint32_t level_count = std::max(read_value<uint32_t>(bytes, 40), 1u); // Zero asks the loader to generate mips
+    uint32_t supercompression = read_value<uint32_t>(bytes, 44);
+    const FormatInfo* info = find_format(format);
+    if (!info || width == 0 || height == 0 || depth > 1 || layer_count > 1 || face_count != 1 || supercompression != 0) {
+        std::cout << file << " uses an unsupported KTX2 layout (format " << format << ", supercompression " << supercompression << ")" << std::endl;
+        return false;
+    }
+    // A full chain ends at 1x1, which also keeps the shifts below the width of the sizes
+    if (level_count > static_cast<uint32_t>(std::bit_width(std::max(width, height)))) {
+        std::cout << file << " has more levels than a full mip chain (" << level_count << ")" << std::endl;
+        return false;
+    }
+    if (bytes.size() < header_size + index_size + level_count * level_index_entry_size) {
+        std::cout << file << " is truncated" << std::endl;
+        return false;
+    }
+
+    out_texture.format = format;
+    out_texture.width = width;
+    out_texture.height = height;
+    out_texture.levels.resize(level_count);
+    for (uint32_t level = 0; level < level_count; level++) {
+        size_t entry = header_size + index_size + level * level_index_entry_size;
+        uint64_t offset = read_value<uint64_t>(bytes, entry);
+        uint64_t length = read_value<uint64_t>(bytes, entry + 8);
+        size_t expected = level_size(*info, std::max(1u, width >> level), std::max(1u, height >> level));
+        if (length != expected || offset > bytes.size() || length > bytes.size() - offset) {
+            std::cout << file << " has a bad level " << level << std::endl;
+            return false;
+        }
+        out_texture.levels[level].assign(bytes.begin() + offset, bytes.begin() + offset + length);
+    }
+    return true;
+}
+
+bool ktx::write_file(const char* file, const Texture& texture) {
+    const FormatInfo* info = find_format(texture.format);
+    if (!info || texture.levels.empty()) {
+        return false;
+    }
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size());
+    std::vector<uint8_t> dfd = build_dfd(*info);
+    size_t dfd_offset = header_size + index_size + level_count * level_index_entry_size;
+
+    // Levels are stored smallest first, each aligned to the texel block size (and at least 4 bytes)
+    size_t alignment = info->color_model == model_rgbsda ? 4 : info->block_bytes;
+    std::vector<size_t> level_offsets(level_count);
+    size_t end = dfd_offset + dfd.size();
+    for (int level = static_cast<int>(level_count) - 1; level >= 0; level--) {
+        level_offsets[level] = align_up(end, alignment);
+        end = level_offsets[level] + texture.levels[level].size();
+    }
+
+    std::vector<uint8_t> bytes(end, 0);
+    memcpy(bytes.data(), identifier, sizeof(identifier));
+    write_value<uint32_t>(bytes, 12, texture.format);
+    write_value<uint32_t>(bytes, 16, 1); // typeSize
+    write_value<uint32_t>(bytes, 20, texture.width);
+    write_value<uint32_t>(bytes, 24, texture.height);
+    write_value<uint32_t>(bytes, 28, 0); // pixelDepth, 0 for 2D
+    write_value<uint32_t>(bytes, 32, 0); // layerCount, 0 for a non-array texture
+    write_value<uint32_t>(bytes, 36, 1); // faceCount
+    write_value<uint32_t>(bytes, 40, level_count);
+    write_value<uint32_t>(bytes, 44, 0); // No supercompression
+    write_value<uint32_t>(bytes, 48, static_cast<uint32_t>(dfd_offset));
+    write_value<uint32_t>(bytes, 52, static_cast<uint32_t>(dfd.size()));
+    // No key/value data or supercompression global data, so those ranges stay zero
+    for (uint32_t level = 0; level < level_count; level++) {
+        size_t entry = header_size + index_size + level * level_index_entry_size;
+        write_value<uint64_t>(bytes, entry, level_offsets[level]);
+        write_value<uint64_t>(bytes, entry + 8, texture.levels[level].size());
+        write_value<uint64_t>(bytes, entry + 16, texture.levels[level].size());
+        memcpy(bytes.data() + level_offsets[level], texture.levels[level].data(), texture.levels[level].size());
+    }
+    memcpy(bytes.data() + dfd_offset, dfd.data(), dfd.size());
+
+    std::ofstream stream(file, std::ios::binary);
+    if (!stream.is_open()) {
+        std::cout << "Failed to write KTX2 file " << file << std::endl;
+        return false;
+    }
+    stream.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return stream.good();
+}
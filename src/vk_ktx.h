@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// KTX2 container. Covers what the texture converter writes: a single 2D image with a mip chain,
+// in BC1/BC3/BC7 or RGBA8, without supercompression.
+namespace ktx {
+    struct Texture {
+        VkFormat format{VK_FORMAT_UNDEFINED};
+        uint32_t width{0};
+        uint32_t height{0};
+        std::vector<std::vector<uint8_t>> levels; // Level 0 (full size) first, each tightly packed
+    };
+
+    bool is_supported_format(VkFormat format);
+    bool read_file(const char* file, Texture& out_texture);
+    bool write_file(const char* file, const Texture& texture);
+}
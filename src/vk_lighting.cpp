@@ -0,0 +1,152 @@
+#include <vk_lighting.h>
+
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_pipeline.h>
+
+#include <cmath>
+#include <random>
+#include <gtc/constants.hpp>
+
+namespace {
+    // Matches the push constants of light_cull.comp
+    struct LightCullPushConstants {
+        glm::mat4 view;
+        glm::vec4 projection; // P00, P11, near and far
+        glm::uvec4 grid; // Froxels in x, y and z, and the light count
+    };
+}
+
+void ClusteredLighting::init(VulkanEngine* engine) {
+    static_assert(std::extent_v<decltype(frames)> == MAX_FRAMES_IN_FLIGHT);
+    this->engine = engine;
+    VkDevice device = engine->device;
+
+    cluster_counts = engine->create_buffer(CLUSTER_COUNT * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Other);
+    cluster_lights = engine->create_buffer(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Other);
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Lights
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Froxel light counts
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT); // Froxel light lists
+    cull_set_layout = builder.build(engine->descriptor_layout_cache);
+    std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> sizes = {
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
+    };
+    descriptors.init(device, 4, sizes);
+
+    VkPushConstantRange range{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LightCullPushConstants)};
+    VkPipelineLayoutCreateInfo plci{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .setLayoutCount = 1,
+        .pSetLayouts = &cull_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &range,
+    };
+    VK_CHECK(vkCreatePipelineLayout(device, &plci, nullptr, &cull_pipeline_layout));
+    // The list size is a specialization constant, so it only lives here. The fragment shaders get it through the scene data.
+    uint32_t max_lights_per_cluster = MAX_LIGHTS_PER_CLUSTER;
+    VkSpecializationMapEntry entry{0, 0, sizeof(uint32_t)};
+    VkSpecializationInfo specialization{1, &entry, sizeof(uint32_t), &max_lights_per_cluster};
+    cull_pipeline = vkutil::create_compute_pipeline(device, "../shaders/light_cull.comp.spv", cull_pipeline_layout, &specialization);
+
+    VkDescriptorBufferInfo count_info{cluster_counts.buffer, 0, VK_WHOLE_SIZE};
+    VkDescriptorBufferInfo list_info{cluster_lights.buffer, 0, VK_WHOLE_SIZE};
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        FrameResources& frame = frames[i];
+        frame.light_buffer = engine->create_buffer(MAX_LIGHTS * sizeof(GPUPointLight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
+        VkDescriptorBufferInfo light_info{frame.light_buffer.buffer, 0, VK_WHOLE_SIZE};
+
+        cull_sets[i] = descriptors.allocate(device, cull_set_layout);
+        // The fragment shaders read the same buffers through bindings 2 to 4 of the global set
+        VkDescriptorSet global_set = engine->frames[i].global_descriptor;
+        VkWriteDescriptorSet writes[] = {
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cull_sets[i], &light_info, 0),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cull_sets[i], &count_info, 1),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cull_sets[i], &list_info, 2),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, global_set, &light_info, 2),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, global_set, &count_info, 3),
+            vkinit::write_descriptorset_buffer(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, global_set, &list_info, 4),
+        };
+        vkUpdateDescriptorSets(device, 6, writes, 0, nullptr);
+    }
+}
+
+void ClusteredLighting::cleanup() {
+    VkDevice device = engine->device;
+    for (FrameResources& frame : frames) {
+        engine->destroy_buffer(frame.light_buffer);
+    }
+    engine->destroy_buffer(cluster_counts);
+    engine->destroy_buffer(cluster_lights);
+    descriptors.destroy_pools(device);
+    vkDestroyPipeline(device, cull_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, cull_pipeline_layout, nullptr);
+}
+
+void ClusteredLighting::spawn_lights(uint32_t count, glm::vec3 min_corner, glm::vec3 max_corner) {
+    std::mt19937 rng(1337); // Same lights every run, so timings can be compared
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lights.clear();
+    count = std::min(count, MAX_LIGHTS);
+    for (uint32_t i = 0; i < count; i++) {
+        PointLight light;
+        light.anchor = glm::mix(min_corner, max_corner, glm::vec3(unit(rng), unit(rng), unit(rng)));
+        light.radius = glm::mix(2.0f, 6.0f, unit(rng));
+        // Saturated colors, so overlapping lights are easy to tell apart
+        light.color = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.05f));
+        light.intensity = glm::mix(1.0f, 4.0f, unit(rng));
+        light.phase = unit(rng) * glm::two_pi<float>();
+        light.speed = glm::mix(0.5f, 2.0f, unit(rng));
+        lights.push_back(light);
+    }
+    active_lights = std::min(active_lights, count);
+}
+
+void ClusteredLighting::update(float time) {
+    FrameResources& frame = frames[engine->current_frame_index()];
+    frame.light_count = std::min({active_lights, static_cast<uint32_t>(lights.size()), MAX_LIGHTS});
+    void* data;
+    vmaMapMemory(engine->allocator, frame.light_buffer.allocation, &data);
+    GPUPointLight* gpu_lights = static_cast<GPUPointLight*>(data);
+    for (uint32_t i = 0; i < frame.light_count; i++) {
+        const PointLight& light = lights[i];
+        float t = time * light.speed + light.phase;
+        glm::vec3 position = light.anchor + glm::vec3(std::sin(t), std::sin(t * 1.3f) * 0.5f, std::cos(t)) * 1.5f;
+        gpu_lights[i].position_radius = glm::vec4(position, light.radius);
+        gpu_lights[i].color_intensity = glm::vec4(light.color, light.intensity);
+    }
+    vmaUnmapMemory(engine->allocator, frame.light_buffer.allocation);
+}
+
+void ClusteredLighting::cull(VkCommandBuffer cmd) {
+    uint32_t index = engine->current_frame_index();
+    // The last frame's fragment shaders may still be reading the froxel lists
+    VkMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2};
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .memoryBarrierCount = 1, .pMemoryBarriers = &barrier};
+    vkCmdPipelineBarrier2(cmd, &depinfo);
+
+    const glm::mat4& proj = engine->camera_data.proj;
+    LightCullPushConstants constants;
+    constants.view = engine->camera_data.view;
+    constants.projection = glm::vec4(proj[0][0], std::abs(proj[1][1]), engine->camera_near, engine->camera_far);
+    constants.grid = glm::uvec4(GRID_X, GRID_Y, GRID_Z, frames[index].light_count);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline_layout, 0, 1, &cull_sets[index], 0, nullptr);
+    vkCmdPushConstants(cmd, cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LightCullPushConstants), &constants);
+    vkCmdDispatch(cmd, GRID_X, GRID_Y, GRID_Z); // One workgroup per froxel
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+    vkCmdPipelineBarrier2(cmd, &depinfo);
+}
+
+glm::vec2 ClusteredLighting::slice_scale_bias(float znear, float zfar) const {
+    float log_range = std::log(zfar / znear);
+    return glm::vec2(GRID_Z / log_range, -GRID_Z * std::log(znear) / log_range);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_descriptors.h>
+
+class VulkanEngine;
+
+// Matches PointLight in the lit fragment shaders and light_cull.comp
+struct GPUPointLight {
+    glm::vec4 position_radius; // World space position, and the distance where the light fades to nothing
+    glm::vec4 color_intensity;
+};
+
+// A light and how it drifts around its anchor
+struct PointLight {
+    glm::vec3 anchor;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+    float phase;
+    float speed;
+};
+
+// Clustered forward lighting. The view frustum is cut into a grid of froxels, screen tiles split into slices that grow
+// exponentially with depth. A compute pass lists the lights that touch each froxel, and fragments only loop over the
+// list of the froxel they fall in, so their cost follows how many lights overlap them rather than the total count.
+class ClusteredLighting {
+public:
+    static constexpr uint32_t GRID_X = 16;
+    static constexpr uint32_t GRID_Y = 9;
+    static constexpr uint32_t GRID_Z = 24;
+    static constexpr uint32_t CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+    static constexpr uint32_t MAX_LIGHTS = 16384;
+    static constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128; // Lights past this in one froxel are dropped
+
+    void init(VulkanEngine* engine); // Writes the light bindings of every frame's global descriptor set
+    void cleanup();
+    void spawn_lights(uint32_t count, glm::vec3 min_corner, glm::vec3 max_corner); // Scatters random lights through a box
+    void update(float time); // Moves the lights and uploads the ones in use for the current frame
+    void cull(VkCommandBuffer cmd); // Bins the current frame's lights into the froxels
+    // Depth slice parameters for the scene data: slice = log(view depth) * scale + bias
+    glm::vec2 slice_scale_bias(float znear, float zfar) const;
+
+    std::vector<PointLight> lights;
+    uint32_t active_lights{4096}; // How many of the lights are uploaded and culled
+
+private:
+    struct FrameResources {
+        AllocatedBuffer light_buffer;
+        uint32_t light_count{0};
+    };
+
+    VulkanEngine* engine{nullptr};
+    FrameResources frames[4]; // One per frame in flight
+    AllocatedBuffer cluster_counts; // Lights in each froxel
+    AllocatedBuffer cluster_lights; // MAX_LIGHTS_PER_CLUSTER light indices per froxel
+    DescriptorAllocatorGrowable descriptors;
+    VkDescriptorSetLayout cull_set_layout;
+    VkDescriptorSet cull_sets[4];
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline cull_pipeline;
+};
@@ -0,0 +1,204 @@
+#include <vk_memory.h>
+
+#include <fstream>
+#include <sstream>
+
+const char* memory_category_name(MemoryCategory category) {
+    switch (category) {
+    case MemoryCategory::Meshes: return "meshes";
+    case MemoryCategory::Textures: return "textures";
+    case MemoryCategory::RenderTargets: return "render_targets";
+    case MemoryCategory::FrameBuffers: return "frame_buffers";
+    case MemoryCategory::Staging: return "staging";
+    default: return "other";
+    }
+}
+
+void MemoryTracker::init(VmaAllocator allocator, VkPhysicalDevice gpu, bool budget_extension) {
+    this->allocator = allocator;
+    this->budget_extension = budget_extension;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(gpu, &memory_properties);
+    heaps.assign(memory_properties.memoryHeaps, memory_properties.memoryHeaps + memory_properties.memoryHeapCount);
+    heap_budgets.resize(heaps.size());
+    pending_frees.assign(heaps.size(), 0);
+    pending_frames.assign(heaps.size(), 0);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        memory_type_heaps.push_back(memory_properties.memoryTypes[i].heapIndex);
+    }
+}
+
+void MemoryTracker::track(VmaAllocation allocation, MemoryCategory category) {
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(allocator, allocation, &info);
+    vmaSetAllocationName(allocator, allocation, memory_category_name(category)); // Shows up in VMA's own JSON dumps
+    allocations[allocation] = Entry{category, info.size, memory_type_heaps[info.memoryType]};
+    CategoryStats& stats = categories[static_cast<size_t>(category)];
+    stats.bytes += info.size;
+    stats.count++;
+}
+
+void MemoryTracker::untrack(VmaAllocation allocation) {
+    auto it = allocations.find(allocation);
+    if (it == allocations.end()) {
+        return;
+    }
+    CategoryStats& stats = categories[static_cast<size_t>(it->second.category)];
+    stats.bytes -= it->second.size;
+    stats.count--;
+    VkDeviceSize& pending = pending_frees[it->second.heap];
+    pending -= std::min(pending, it->second.size);
+    allocations.erase(it);
+}
+
+void MemoryTracker::add_pressure_callback(PressureCallback&& callback) {
+    pressure_callbacks.push_back(std::move(callback));
+}
+
+// Pressure is handled a frame ahead of allocations failing. The callbacks run in the order they were added
+// until enough has been freed, so cheaper caches should register first.
+void MemoryTracker::update(uint32_t frame) {
+    vmaSetCurrentFrameIndex(allocator, frame); // Lets VMA refresh the budgets from the driver
+    vmaGetHeapBudgets(allocator, heap_budgets.data());
+    for (size_t i = 0; i < heaps.size(); i++) {
+        if (!(heaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) {
+            continue;
+        }
+        if (frame - pending_frames[i] > pending_timeout) {
+            pending_frees[i] = 0;
+        }
+        VkDeviceSize limit = static_cast<VkDeviceSize>(heap_budgets[i].budget * pressure_threshold);
+        if (heap_budgets[i].usage <= limit + pending_frees[i]) {
+            continue;
+        }
+        pressure_events++;
+        VkDeviceSize wanted = heap_budgets[i].usage - limit - pending_frees[i];
+        VkDeviceSize freed = 0;
+        for (PressureCallback& callback : pressure_callbacks) {
+            if (freed >= wanted) {
+                break;
+            }
+            freed += callback(wanted - freed);
+        }
+        pressure_freed += freed;
+        pending_frees[i] += freed;
+        pending_frames[i] = frame;
+    }
+}
+
+VkDeviceSize MemoryTracker::device_headroom() const {
+    VkDeviceSize headroom = 0;
+    for (size_t i = 0; i < heaps.size(); i++) {
+        if (heaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            VkDeviceSize limit = static_cast<VkDeviceSize>(heap_budgets[i].budget * pressure_threshold);
+            headroom = std::max(headroom, limit > heap_budgets[i].usage ? limit - heap_budgets[i].usage : 0);
+        }
+    }
+    return headroom;
+}
+
+std::string MemoryTracker::build_report() const {
+    VmaTotalStatistics total;
+    vmaCalculateStatistics(allocator, &total);
+    auto write_statistics = [](std::ostringstream& out, const VmaDetailedStatistics& stats) {
+        out << "\"block_count\": " << stats.statistics.blockCount << ", \"block_bytes\": " << stats.statistics.blockBytes
+            << ", \"allocation_count\": " << stats.statistics.allocationCount << ", \"allocation_bytes\": " << stats.statistics.allocationBytes
+            << ", \"unused_range_count\": " << stats.unusedRangeCount;
+    };
+
+    std::ostringstream out;
+    out << "{\n  \"budget_extension\": " << (budget_extension ? "true" : "false") << ",\n";
+    out << "  \"total\": {";
+    write_statistics(out, total.total);
+    out << "},\n  \"heaps\": [\n";
+    for (size_t i = 0; i < heaps.size(); i++) {
+        out << "    {\"index\": " << i << ", \"size\": " << heaps[i].size
+            << ", \"device_local\": " << ((heaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false")
+            << ", \"budget\": " << heap_budgets[i].budget << ", \"usage\": " << heap_budgets[i].usage << ", ";
+        write_statistics(out, total.memoryHeap[i]);
+        out << "}" << (i + 1 < heaps.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"categories\": {\n";
+    for (size_t c = 0; c < categories.size(); c++) {
+        out << "    \"" << memory_category_name(static_cast<MemoryCategory>(c)) << "\": {\"bytes\": " << categories[c].bytes
+            << ", \"count\": " << categories[c].count << "}" << (c + 1 < categories.size() ? "," : "") << "\n";
+    }
+    out << "  },\n  \"pressure_events\": " << pressure_events << ",\n  \"pressure_freed\": " << pressure_freed << "\n}\n";
+    return out.str();
+}
+
+bool MemoryTracker::write_report(const char* file) const {
+    std::ofstream stream(file);
+    if (!stream.is_open()) {
+        std::cout << "Failed to write memory report " << file << std::endl;
+        return false;
+    }
+    stream << build_report();
+    return stream.good();
+}
+
+void MemoryPools::init(VmaAllocator allocator) {
+    this->allocator = allocator;
+    // Memory types are picked from representative create infos. Every mesh buffer can be a copy source for defragmentation.
+    VkBufferCreateInfo buffer_info{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .size = 1024};
+    buffer_info.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    create_pool(MemoryCategory::Meshes, &buffer_info, nullptr, VMA_MEMORY_USAGE_GPU_ONLY, 64ull << 20);
+
+    VkImageCreateInfo image_info{.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_SRGB;
+    image_info.extent = {1024, 1024, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    create_pool(MemoryCategory::Textures, nullptr, &image_info, VMA_MEMORY_USAGE_GPU_ONLY, 128ull << 20);
+
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    create_pool(MemoryCategory::FrameBuffers, &buffer_info, nullptr, VMA_MEMORY_USAGE_CPU_TO_GPU, 16ull << 20);
+
+    // Staging buffers are freed roughly in the order they were made, as uploads complete, so a single block
+    // with the linear algorithm works as a ring buffer. Anything that doesn't fit falls back to the default pools.
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    create_pool(MemoryCategory::Staging, &buffer_info, nullptr, VMA_MEMORY_USAGE_CPU_ONLY, 64ull << 20, VMA_POOL_CREATE_LINEAR_ALGORITHM_BIT, 1);
+}
+
+void MemoryPools::create_pool(MemoryCategory category, const VkBufferCreateInfo* buffer_info, const VkImageCreateInfo* image_info, VmaMemoryUsage usage, VkDeviceSize block_size, VmaPoolCreateFlags flags, size_t max_block_count) {
+    VmaAllocationCreateInfo alloc_info{};
+    alloc_info.usage = usage;
+    uint32_t memory_type;
+    VkResult result = buffer_info ? vmaFindMemoryTypeIndexForBufferInfo(allocator, buffer_info, &alloc_info, &memory_type)
+                                  : vmaFindMemoryTypeIndexForImageInfo(allocator, image_info, &alloc_info, &memory_type);
+    if (result != VK_SUCCESS) {
+        std::cout << "No memory type for the " << memory_category_name(category) << " pool, using the default pools" << std::endl;
+        return;
+    }
+    VmaPoolCreateInfo pool_info{};
+    pool_info.memoryTypeIndex = memory_type;
+    pool_info.flags = flags;
+    pool_info.blockSize = block_size;
+    pool_info.maxBlockCount = max_block_count;
+    size_t index = static_cast<size_t>(category);
+    VK_CHECK(vmaCreatePool(allocator, &pool_info, &pools[index]));
+    vmaSetPoolName(allocator, pools[index], memory_category_name(category));
+    block_sizes[index] = block_size;
+}
+
+void MemoryPools::cleanup() {
+    for (VmaPool& pool : pools) {
+        if (pool != VK_NULL_HANDLE) {
+            vmaDestroyPool(allocator, pool);
+            pool = VK_NULL_HANDLE;
+        }
+    }
+}
+
+VmaPool MemoryPools::get(MemoryCategory category, VkDeviceSize size) const {
+    size_t index = static_cast<size_t>(category);
+    if (size > block_sizes[index] / 2) {
+        return VK_NULL_HANDLE;
+    }
+    return pools[index];
+}
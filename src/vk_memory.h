@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vk_types.h>
+
+// What an allocation is for, so memory use can be broken down by subsystem
+enum class MemoryCategory {
+    Meshes,
+    Textures,
+    RenderTargets,
+    FrameBuffers, // Per-frame uniform and storage buffers
+    Staging,
+    Other,
+    Count,
+};
+
+const char* memory_category_name(MemoryCategory category);
+
+// Accounts every VMA allocation to a category and polls how close each heap is to its budget.
+// With VK_EXT_memory_budget the budgets come from the driver and include other processes, otherwise VMA estimates them.
+class MemoryTracker {
+public:
+    // Called when a device local heap is getting full. Frees what it can and returns how many bytes it gave up.
+    using PressureCallback = std::function<VkDeviceSize(VkDeviceSize wanted)>;
+
+    struct CategoryStats {
+        VkDeviceSize bytes{0};
+        uint32_t count{0};
+    };
+
+    void init(VmaAllocator allocator, VkPhysicalDevice gpu, bool budget_extension);
+    void track(VmaAllocation allocation, MemoryCategory category);
+    void untrack(VmaAllocation allocation);
+    void add_pressure_callback(PressureCallback&& callback);
+    void update(uint32_t frame); // Polls the heap budgets and relieves pressure. Call once per frame.
+    VkDeviceSize device_headroom() const; // How much more device local memory fits under the pressure threshold
+
+    std::string build_report() const; // JSON, from vmaCalculateStatistics plus the category totals
+    bool write_report(const char* file) const;
+
+    float pressure_threshold{0.9f}; // Fraction of a heap's budget past which the pressure callbacks run
+    bool budget_extension{false};
+    std::array<CategoryStats, static_cast<size_t>(MemoryCategory::Count)> categories;
+    std::vector<VkMemoryHeap> heaps;
+    std::vector<VmaBudget> heap_budgets; // From the last update
+    uint32_t pressure_events{0};
+    VkDeviceSize pressure_freed{0};
+    // Callbacks mostly queue their frees, and the memory only goes once the frames using it are done. Until then those
+    // bytes count as already gone, so the same overage doesn't evict again every frame. Per heap, paid off as allocations are freed.
+    std::vector<VkDeviceSize> pending_frees;
+    uint32_t pending_timeout{60}; // Frames after the last pressure event before whatever is still pending is forgotten
+
+private:
+    struct Entry {
+        MemoryCategory category;
+        VkDeviceSize size;
+        uint32_t heap;
+    };
+
+    std::unordered_map<VmaAllocation, Entry> allocations;
+    std::vector<PressureCallback> pressure_callbacks;
+    std::vector<uint32_t> memory_type_heaps;
+    std::vector<uint32_t> pending_frames; // Frame of the last pressure event on each heap
+    VmaAllocator allocator;
+};
+
+// Dedicated VMA pools, so allocations with similar lifetimes share blocks. Long lived geometry and textures
+// don't get stuck between short lived staging buffers, and the geometry pool can be defragmented on its own.
+// Categories without a pool (render targets, other) use VMA's default pools.
+class MemoryPools {
+public:
+    void init(VmaAllocator allocator);
+    void cleanup(); // Every allocation in the pools must be freed first
+    // Pool for an allocation of this size, or VK_NULL_HANDLE when it should use the default pools.
+    // Allocations larger than half a block go to the default pools so they don't waste most of a block.
+    VmaPool get(MemoryCategory category, VkDeviceSize size = 0) const;
+    VkDeviceSize block_size(MemoryCategory category) const { return block_sizes[static_cast<size_t>(category)]; }
+
+private:
+    void create_pool(MemoryCategory category, const VkBufferCreateInfo* buffer_info, const VkImageCreateInfo* image_info, VmaMemoryUsage usage, VkDeviceSize block_size, VmaPoolCreateFlags flags = 0, size_t max_block_count = 0);
+
+    std::array<VmaPool, static_cast<size_t>(MemoryCategory::Count)> pools{};
+    std::array<VkDeviceSize, static_cast<size_t>(MemoryCategory::Count)> block_sizes{};
+    VmaAllocator allocator;
+};
@@ -1,6 +1,8 @@
 #include <vk_mesh.h>
 #include <tiny_obj_loader.h>
 #include <iostream>
+#include <algorithm>
+#include <string_view>
 
 VertexInputDescription Vertex::get_vertex_description() {
     VertexInputDescription description;
@@ -49,6 +51,23 @@ VertexInputDescription Vertex::get_vertex_description() {
 	return description;
 }
 
+VertexInputDescription Vertex::get_position_description() {
+    VertexInputDescription description;
+    VkVertexInputBindingDescription mainBinding = {};
+    mainBinding.binding = 0;
+    mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    mainBinding.stride = sizeof(Vertex);
+    description.bindings.push_back(mainBinding);
+
+    VkVertexInputAttributeDescription positionAttribute = {};
+    positionAttribute.binding = 0;
+    positionAttribute.location = 0;
+    positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+    positionAttribute.offset = offsetof(Vertex, position);
+    description.attributes.push_back(positionAttribute);
+    return description;
+}
+
 bool Mesh::load_from_obj(const char* filename) {
 	
 	tinyobj::attrib_t attrib; // contains the vertex arrays of the file
@@ -103,6 +122,163 @@ bool Mesh::load_from_obj(const char* filename) {
 			index_offset += fv;
 		}
 	}
+	compute_bounds();
 
 	return true;
-}
\ No newline at end of file
+}
+
+void Mesh::compute_bounds() {
+    if (vertices.empty()) {
+        return;
+    }
+    glm::vec3 min_corner = vertices[0].position;
+    glm::vec3 max_corner = vertices[0].position;
+    for (const Vertex& vertex : vertices) {
+        min_corner = glm::min(min_corner, vertex.position);
+        max_corner = glm::max(max_corner, vertex.position);
+    }
+    bounds_center = (min_corner + max_corner) * 0.5f;
+    bounds_radius = 0.0f;
+    for (const Vertex& vertex : vertices) {
+        bounds_radius = std::max(bounds_radius, glm::length(vertex.position - bounds_center));
+    }
+    // Compare the area each triangle covers in UV space with its area in model space
+    double model_area = 0.0;
+    double uv_area = 0.0;
+    for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        glm::vec3 edge1 = vertices[i + 1].position - vertices[i].position;
+        glm::vec3 edge2 = vertices[i + 2].position - vertices[i].position;
+        glm::vec2 uv_edge1 = vertices[i + 1].uv - vertices[i].uv;
+        glm::vec2 uv_edge2 = vertices[i + 2].uv - vertices[i].uv;
+        model_area += 0.5 * glm::length(glm::cross(edge1, edge2));
+        uv_area += 0.5 * std::abs(uv_edge1.x * uv_edge2.y - uv_edge1.y * uv_edge2.x);
+    }
+    if (model_area > 0.0 && uv_area > 0.0) {
+        uv_density = static_cast<float>(std::sqrt(uv_area / model_area));
+    }
+}
+void Mesh::build_meshlets() {
+    meshlets.clear();
+    // OBJ files are loaded as one vertex per corner, so weld the corners that are identical
+    if (indices.empty()) {
+        std::unordered_map<std::string_view, uint32_t> unique;
+        std::vector<Vertex> welded;
+        welded.reserve(vertices.size());
+        indices.reserve(vertices.size());
+        for (const Vertex& vertex : vertices) {
+            std::string_view key(reinterpret_cast<const char*>(&vertex), sizeof(Vertex));
+            auto [it, inserted] = unique.try_emplace(key, static_cast<uint32_t>(welded.size()));
+            if (inserted) {
+                welded.push_back(vertex);
+            }
+            indices.push_back(it->second);
+        }
+        // The keys point into the old vertices, so they are only swapped out once the map is done with them
+        unique.clear();
+        vertices = std::move(welded);
+    }
+    uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+    indices.resize(triangle_count * 3); // Drops any trailing indices that don't make a whole triangle
+    if (triangle_count == 0) {
+        return;
+    }
+
+    // Walk the triangles along a Morton curve through the mesh bounds, so each meshlet stays compact
+    glm::vec3 min_corner = vertices[0].position;
+    glm::vec3 max_corner = min_corner;
+    for (const Vertex& vertex : vertices) {
+        min_corner = glm::min(min_corner, vertex.position);
+        max_corner = glm::max(max_corner, vertex.position);
+    }
+    glm::vec3 scale = 1023.0f / glm::max(max_corner - min_corner, glm::vec3(1e-6f));
+    auto spread_bits = [](uint32_t v) {
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    };
+    std::vector<std::pair<uint32_t, uint32_t>> order(triangle_count);
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        glm::vec3 centroid = (vertices[indices[t * 3]].position + vertices[indices[t * 3 + 1]].position + vertices[indices[t * 3 + 2]].position) / 3.0f;
+        glm::uvec3 cell = glm::uvec3((centroid - min_corner) * scale);
+        order[t] = {spread_bits(cell.x) | (spread_bits(cell.y) << 1) | (spread_bits(cell.z) << 2), t};
+    }
+    std::sort(order.begin(), order.end());
+
+    // Fill each meshlet until the next triangle would take it past the vertex or triangle limit.
+    // last_meshlet remembers which meshlet last counted a vertex, so counting unique vertices needs no clearing.
+    std::vector<uint32_t> sorted;
+    sorted.reserve(indices.size());
+    std::vector<uint32_t> last_meshlet(vertices.size(), UINT32_MAX);
+    uint32_t meshlet_vertices = 0;
+    for (const auto& [code, t] : order) {
+        const uint32_t* triangle = &indices[t * 3];
+        uint32_t current = static_cast<uint32_t>(meshlets.size()) - 1;
+        uint32_t new_vertices = 0;
+        if (!meshlets.empty()) {
+            for (int c = 0; c < 3; c++) {
+                new_vertices += last_meshlet[triangle[c]] != current;
+            }
+        }
+        if (meshlets.empty() || meshlet_vertices + new_vertices > MESHLET_MAX_VERTICES || meshlets.back().index_count == MESHLET_MAX_TRIANGLES * 3) {
+            meshlets.push_back(Meshlet{static_cast<uint32_t>(sorted.size()), 0});
+            current = static_cast<uint32_t>(meshlets.size()) - 1;
+            meshlet_vertices = 0;
+        }
+        for (int c = 0; c < 3; c++) {
+            if (last_meshlet[triangle[c]] != current) {
+                last_meshlet[triangle[c]] = current;
+                meshlet_vertices++;
+            }
+            sorted.push_back(triangle[c]);
+        }
+        meshlets.back().index_count += 3;
+    }
+    indices = std::move(sorted);
+
+    for (Meshlet& meshlet : meshlets) {
+        const uint32_t* first = &indices[meshlet.first_index];
+        glm::vec3 low = vertices[first[0]].position;
+        glm::vec3 high = low;
+        for (uint32_t i = 0; i < meshlet.index_count; i++) {
+            low = glm::min(low, vertices[first[i]].position);
+            high = glm::max(high, vertices[first[i]].position);
+        }
+        meshlet.bounds_center = (low + high) * 0.5f;
+        meshlet.bounds_radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.index_count; i++) {
+            meshlet.bounds_radius = std::max(meshlet.bounds_radius, glm::length(vertices[first[i]].position - meshlet.bounds_center));
+        }
+
+        // The cone axis is the average facing, and its width is set by the triangle that strays furthest from it.
+        // Front faces wind counter-clockwise in model space.
+        std::vector<glm::vec3> normals;
+        glm::vec3 average(0.0f);
+        for (uint32_t i = 0; i < meshlet.index_count; i += 3) {
+            glm::vec3 a = vertices[first[i]].position;
+            glm::vec3 normal = glm::cross(vertices[first[i + 1]].position - a, vertices[first[i + 2]].position - a);
+            float length = glm::length(normal);
+            if (length > 0.0f) {
+                normals.push_back(normal / length);
+                average += normals.back();
+            }
+        }
+        meshlet.cone_axis = glm::vec3(0.0f);
+        meshlet.cone_cutoff = 1.0f;
+        float average_length = glm::length(average);
+        if (average_length < 1e-6f) {
+            continue;
+        }
+        glm::vec3 axis = average / average_length;
+        float min_dot = 1.0f;
+        for (const glm::vec3& normal : normals) {
+            min_dot = std::min(min_dot, glm::dot(normal, axis));
+        }
+        // Past about 84 degrees the cone would almost never cull, so don't bother testing it
+        if (min_dot > 0.1f) {
+            meshlet.cone_axis = axis;
+            meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+        }
+    }
+}
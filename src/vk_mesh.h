@@ -14,11 +14,38 @@ struct Vertex {
     glm::vec3 color;
     glm::vec2 uv;
     static VertexInputDescription get_vertex_description();
+    static VertexInputDescription get_position_description(); // Just the position, for depth-only pipelines
+};
+
+// A cluster of nearby triangles small enough to be culled on its own
+struct Meshlet {
+    uint32_t first_index;
+    uint32_t index_count;
+    glm::vec3 bounds_center; // Bounding sphere in model space
+    float bounds_radius;
+    // Normal cone. Every triangle faces away from a viewer looking along the axis from within the cone.
+    glm::vec3 cone_axis;
+    float cone_cutoff; // Sine of the cone's half angle. 1 when the normals spread too far for the cone to cull anything.
 };
 
 struct Mesh {
+    static constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+    static constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
     std::vector<Vertex> vertices;
-    AllocatedBuffer vertex_buffer;
+    std::vector<uint32_t> indices;
+    std::vector<Meshlet> meshlets;
+    AllocatedBuffer vertex_buffer; // The vertices, followed by the indices at index_offset
+    VkDeviceSize index_offset{0};
+    // Bounding sphere in model space, and how many UV units one unit of model space covers on average.
+    // Together they estimate how finely the mesh's texture is sampled on screen.
+    glm::vec3 bounds_center{0.0f};
+    float bounds_radius{0.0f};
+    float uv_density{1.0f};
 
     bool load_from_obj(const char* filename);
+    void compute_bounds();
+    // Welds identical vertices into an index buffer, then splits the triangles into meshlets in spatial order
+    void build_meshlets();
+    size_t buffer_size() const { return vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t); }
 };
@@ -4,7 +4,25 @@
 
 #include <fstream>
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device) { //VkRenderPass pass) {
+namespace {
+
+// Vulkan handles are pointers on 64-bit platforms and integers elsewhere
+template <typename T>
+uint64_t handle_bits(T handle) {
+    uint64_t bits = 0;
+    memcpy(&bits, &handle, sizeof(handle));
+    return bits;
+}
+
+uint64_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(value));
+    return bits;
+}
+
+} // namespace
+
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache) { //VkRenderPass pass) {
     // Make viewport state from stored viewport and scissor. Could add support for multiple viewports in the future
     VkPipelineViewportStateCreateInfo viewport_state={};
     viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -18,7 +36,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device) { //VkRenderPass pas
     color_blending.pNext = nullptr;
     color_blending.logicOpEnable = VK_FALSE;
     color_blending.logicOp = VK_LOGIC_OP_COPY;
-    color_blending.attachmentCount = 1;
+    color_blending.attachmentCount = rendering_info.colorAttachmentCount; // 0 for depth-only pipelines
     color_blending.pAttachments = &color_blend_attachment;
 
     // Inititalize to zero since it won't be used
@@ -27,10 +45,30 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device) { //VkRenderPass pas
 
     // Build the actual pipeline.
     // All of the initializers of pipeline objects come into play
+    // One boolean constant per feature bit. Stages without a constant of that id ignore it.
+    VkSpecializationMapEntry feature_entries[MATERIAL_FEATURE_COUNT];
+    VkBool32 feature_values[MATERIAL_FEATURE_COUNT];
+    for (uint32_t i = 0; i < MATERIAL_FEATURE_COUNT; i++) {
+        feature_entries[i] = {.constantID = i, .offset = static_cast<uint32_t>(i * sizeof(VkBool32)), .size = sizeof(VkBool32)};
+        feature_values[i] = (features >> i) & 1 ? VK_TRUE : VK_FALSE;
+    }
+    VkSpecializationInfo specialization_info{
+        .mapEntryCount = MATERIAL_FEATURE_COUNT,
+        .pMapEntries = feature_entries,
+        .dataSize = sizeof(feature_values),
+        .pData = feature_values
+    };
+    std::vector<VkPipelineShaderStageCreateInfo> stages = shader_stages;
+    if (features != 0) {
+        for (VkPipelineShaderStageCreateInfo& stage : stages) {
+            stage.pSpecializationInfo = &specialization_info;
+        }
+    }
+
     VkGraphicsPipelineCreateInfo pipeline_info={.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
     pipeline_info.pNext = &rendering_info;
-    pipeline_info.stageCount = shader_stages.size();
-    pipeline_info.pStages = shader_stages.data(); // Shader stages contain shader programs
+    pipeline_info.stageCount = stages.size();
+    pipeline_info.pStages = stages.data(); // Shader stages contain shader programs
     pipeline_info.pVertexInputState = &vertex_input_info;
     pipeline_info.pInputAssemblyState = &input_assembly;
     pipeline_info.pViewportState = &viewport_state;
@@ -49,7 +87,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device) { //VkRenderPass pas
     pipeline_info.pDynamicState = &dynamic_info;
 
     VkPipeline new_pipeline;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &new_pipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info, nullptr, &new_pipeline) != VK_SUCCESS) {
         std::cout << "Failed to create pipeline" << std::endl;
         return VK_NULL_HANDLE;
     } else {
@@ -59,6 +97,89 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device) { //VkRenderPass pas
     VkPipeline pipeline;
     return pipeline;
 }
+PipelineBuilder::Key PipelineBuilder::key() const {
+    Key key;
+    key.reserve(64);
+    key.push_back(shader_stages.size());
+    for (const VkPipelineShaderStageCreateInfo& stage : shader_stages) {
+        key.push_back(stage.stage);
+        key.push_back(handle_bits(stage.module));
+        key.push_back(hash_string(stage.pName).hash); // The entry point
+    }
+    key.push_back(handle_bits(pipeline_layout));
+    key.push_back(features);
+
+    key.push_back(vertex_input_info.vertexBindingDescriptionCount);
+    for (uint32_t i = 0; i < vertex_input_info.vertexBindingDescriptionCount; i++) {
+        const VkVertexInputBindingDescription& binding = vertex_input_info.pVertexBindingDescriptions[i];
+        key.push_back(binding.binding | (static_cast<uint64_t>(binding.inputRate) << 32));
+        key.push_back(binding.stride);
+    }
+    key.push_back(vertex_input_info.vertexAttributeDescriptionCount);
+    for (uint32_t i = 0; i < vertex_input_info.vertexAttributeDescriptionCount; i++) {
+        const VkVertexInputAttributeDescription& attribute = vertex_input_info.pVertexAttributeDescriptions[i];
+        key.push_back(attribute.location | (static_cast<uint64_t>(attribute.binding) << 32));
+        key.push_back(attribute.format | (static_cast<uint64_t>(attribute.offset) << 32));
+    }
+    key.push_back(input_assembly.topology | (static_cast<uint64_t>(input_assembly.primitiveRestartEnable) << 32));
+
+    key.push_back(rasterizer.depthClampEnable | (rasterizer.rasterizerDiscardEnable << 1) | (rasterizer.depthBiasEnable << 2));
+    key.push_back(rasterizer.polygonMode | (static_cast<uint64_t>(rasterizer.cullMode) << 32));
+    key.push_back(rasterizer.frontFace | (float_bits(rasterizer.lineWidth) << 32));
+    key.push_back(float_bits(rasterizer.depthBiasConstantFactor) | (float_bits(rasterizer.depthBiasSlopeFactor) << 32));
+    key.push_back(float_bits(rasterizer.depthBiasClamp));
+
+    key.push_back(multisampling.rasterizationSamples | (float_bits(multisampling.minSampleShading) << 32));
+    key.push_back(multisampling.sampleShadingEnable | (multisampling.alphaToCoverageEnable << 1) | (multisampling.alphaToOneEnable << 2));
+
+    key.push_back(depth_stencil.depthTestEnable | (depth_stencil.depthWriteEnable << 1) | (depth_stencil.depthBoundsTestEnable << 2)
+        | (depth_stencil.stencilTestEnable << 3) | (static_cast<uint64_t>(depth_stencil.depthCompareOp) << 32));
+    key.push_back(float_bits(depth_stencil.minDepthBounds) | (float_bits(depth_stencil.maxDepthBounds) << 32));
+    for (const VkStencilOpState& op : {depth_stencil.front, depth_stencil.back}) {
+        key.push_back(op.failOp | (op.passOp << 8) | (op.depthFailOp << 16) | (op.compareOp << 24) | (static_cast<uint64_t>(op.reference) << 32));
+        key.push_back(op.compareMask | (static_cast<uint64_t>(op.writeMask) << 32));
+    }
+
+    // Blending and the color format only matter when there's a color attachment
+    key.push_back(rendering_info.viewMask | (static_cast<uint64_t>(rendering_info.colorAttachmentCount) << 32));
+    if (rendering_info.colorAttachmentCount > 0) {
+        const VkPipelineColorBlendAttachmentState& blend = color_blend_attachment;
+        key.push_back(color_attachment_format | (static_cast<uint64_t>(blend.colorWriteMask) << 32));
+        key.push_back(blend.blendEnable);
+        key.push_back(blend.colorBlendOp | (static_cast<uint64_t>(blend.alphaBlendOp) << 32));
+        key.push_back(blend.srcColorBlendFactor | (blend.dstColorBlendFactor << 8) | (blend.srcAlphaBlendFactor << 16) | (blend.dstAlphaBlendFactor << 24));
+    }
+    key.push_back(rendering_info.depthAttachmentFormat | (static_cast<uint64_t>(rendering_info.stencilAttachmentFormat) << 32));
+    return key;
+}
+void PipelineCache::init(VkDevice device) {
+    this->device = device;
+    VkPipelineCacheCreateInfo info{.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    VK_CHECK(vkCreatePipelineCache(device, &info, nullptr, &cache));
+}
+void PipelineCache::cleanup() {
+    for (auto& [key, pipeline] : pipelines) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    pipelines.clear();
+    vkDestroyPipelineCache(device, cache, nullptr);
+}
+VkPipeline PipelineCache::get(PipelineBuilder& builder, uint32_t features) {
+    builder.features = features;
+    PipelineBuilder::Key key = builder.key();
+    auto it = pipelines.find(key);
+    if (it != pipelines.end()) {
+        hits++;
+        return it->second;
+    }
+    auto start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = builder.build_pipeline(device, cache);
+    build_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    misses++;
+    // Failures are kept too, so a broken permutation is reported once instead of on every draw
+    pipelines.emplace(key, pipeline);
+    return pipeline;
+}
 // Clears all values from the PipelineBuilder to be able to safely reuse the object.
 void PipelineBuilder::clear() {
     input_assembly = {.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
@@ -68,6 +189,8 @@ void PipelineBuilder::clear() {
     pipeline_layout = {};
     depth_stencil = {.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
     rendering_info = {.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO};
+    vertex_input_info = {.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    features = 0;
     shader_stages.clear();
 }
 // Loads a shader module from a SPIR-V file. Returns false if there are errors.
@@ -102,11 +225,40 @@ bool vkutil::load_shader_module(const char* filepath, VkDevice device, VkShaderM
     std::cout << "Shader successfully loaded: " << filepath << std::endl;
 	return true;
 }
+VkPipeline vkutil::create_compute_pipeline(VkDevice device, const char* filepath, VkPipelineLayout layout, const VkSpecializationInfo* specialization) {
+    VkShaderModule shader;
+    if (!vkutil::load_shader_module(filepath, device, &shader)) {
+        std::cout << "Error building the compute shader module " << filepath << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    VkPipelineShaderStageCreateInfo pssci{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .pNext = nullptr,
+        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+        .module = shader,
+        .pName = "main",
+        .pSpecializationInfo = specialization
+    };
+    VkComputePipelineCreateInfo cpci{
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = nullptr,
+        .stage = pssci,
+        .layout = layout
+    };
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &cpci, nullptr, &pipeline));
+    vkDestroyShaderModule(device, shader, nullptr);
+    return pipeline;
+}
 void PipelineBuilder::set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader) {
     shader_stages.clear();
     shader_stages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader));
     shader_stages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader));
 }
+void PipelineBuilder::set_vertex_shader_only(VkShaderModule vertex_shader) {
+    shader_stages.clear();
+    shader_stages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertex_shader));
+}
 void PipelineBuilder::set_input_topology(VkPrimitiveTopology topology) {
     input_assembly.topology = topology;
     input_assembly.primitiveRestartEnable = VK_FALSE; // Not using for now
@@ -120,6 +272,12 @@ void PipelineBuilder::set_cull_mode(VkCullModeFlags cull_mode, VkFrontFace front
     rasterizer.cullMode = cull_mode;
     rasterizer.frontFace = front_face;
 }
+void PipelineBuilder::set_depth_bias(float constant_factor, float slope_factor) {
+    rasterizer.depthBiasEnable = VK_TRUE;
+    rasterizer.depthBiasConstantFactor = constant_factor;
+    rasterizer.depthBiasSlopeFactor = slope_factor;
+    rasterizer.depthBiasClamp = 0.0f;
+}
 void PipelineBuilder::set_multisampling_none() {
     multisampling.sampleShadingEnable = VK_FALSE;
     multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT; // no multisampling: 1 sample per pixel
@@ -137,6 +295,10 @@ void PipelineBuilder::set_color_attachment_format(VkFormat format) {
     rendering_info.colorAttachmentCount = 1;
     rendering_info.pColorAttachmentFormats = &color_attachment_format;
 }
+void PipelineBuilder::disable_color_attachment() {
+    rendering_info.colorAttachmentCount = 0;
+    rendering_info.pColorAttachmentFormats = nullptr;
+}
 void PipelineBuilder::set_depth_format(VkFormat format) {
     rendering_info.depthAttachmentFormat = format;
 }
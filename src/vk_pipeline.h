@@ -1,9 +1,26 @@
+#pragma once
 
-#include "vk_engine.h"
+#include <vk_types.h>
 
+#include <map>
+
+// Feature bits of a material, for mesh_lit.frag. Bit i is its boolean specialization constant i, so each pipeline only
+// keeps the code of the features its material has, without a shader file for every combination.
+enum MaterialFeature : uint32_t {
+	MATERIAL_TEXTURED = 1 << 0, // Base color from the texture in set 2 instead of the vertex color
+	MATERIAL_ATLAS_TILES = 1 << 1, // Texture coordinates count blocks across greedy merged voxel faces
+	MATERIAL_SHADOWS = 1 << 2, // Sun shadows from the cascades
+	MATERIAL_POINT_LIGHTS = 1 << 3, // The clustered point lights
+	MATERIAL_FOG = 1 << 4, // Fades into the fog color with view depth
+	MATERIAL_GLOW = 1 << 5, // The base color also shows unlit, over a tinted ambient, the old look of untextured meshes
+};
+constexpr uint32_t MATERIAL_FEATURE_COUNT = 6;
 
 class PipelineBuilder {
 public:
+	// Identifies the pipeline build_pipeline would make: every field of the builder's state that it reads, one value each
+	using Key = std::vector<uint64_t>;
+
 	std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
 	
 	// TODO: DELETE THIS LATER
@@ -17,25 +34,52 @@ public:
 	VkPipelineLayout pipeline_layout;
 	VkPipelineRenderingCreateInfo rendering_info;
 	VkFormat color_attachment_format;
+	uint32_t features; // Material features, passed to every stage as specialization constants
 
 	PipelineBuilder() {
 		clear();
 	}
 
 	void clear();
-	VkPipeline build_pipeline(VkDevice device);
+	VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
+	Key key() const;
 	void set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader);
+	void set_vertex_shader_only(VkShaderModule vertex_shader); // For depth-only pipelines
 	void set_input_topology(VkPrimitiveTopology topology);
 	void set_polygon_mode(VkPolygonMode mode);
 	void set_cull_mode(VkCullModeFlags cull_mode, VkFrontFace front_face);
+	void set_depth_bias(float constant_factor, float slope_factor); // For shadow maps
 	void set_multisampling_none();
 	void disable_blending();
 	void set_color_attachment_format(VkFormat format);
+	void disable_color_attachment();
 	void set_depth_format(VkFormat format);
 	void disable_depth_test();
 	void enable_depth_test(VkCompareOp compareOp);
 };
 
+// Pipelines built the first time they're asked for, one per key. Materials can pick any combination of features,
+// and only the ones something draws with ever get compiled.
+class PipelineCache {
+public:
+	void init(VkDevice device);
+	void cleanup(); // Destroys every pipeline it built
+	// The pipeline for the builder's state with these features
+	VkPipeline get(PipelineBuilder& builder, uint32_t features);
+
+	// Stats
+	size_t size() const { return pipelines.size(); }
+	uint32_t hits{0};
+	uint32_t misses{0};
+	float build_ms{0.0f}; // Spent building pipelines, in total
+
+private:
+	VkDevice device{VK_NULL_HANDLE};
+	VkPipelineCache cache{VK_NULL_HANDLE}; // Lets the driver reuse what it compiled for one permutation in the next
+	std::map<PipelineBuilder::Key, VkPipeline> pipelines;
+};
+
 namespace vkutil {
 	bool load_shader_module(const char* filepath, VkDevice device, VkShaderModule* out_shader_module);
+	VkPipeline create_compute_pipeline(VkDevice device, const char* filepath, VkPipelineLayout layout, const VkSpecializationInfo* specialization = nullptr); // VK_NULL_HANDLE if the shader can't be loaded
 }
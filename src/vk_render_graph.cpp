@@ -0,0 +1,256 @@
+#include <vk_render_graph.h>
+
+#include <vk_initializers.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+static bool is_write(vkutil::ImageUsage usage) {
+    switch (usage) {
+    case vkutil::ImageUsage::ComputeWrite:
+    case vkutil::ImageUsage::ColorAttachment:
+    case vkutil::ImageUsage::DepthAttachment:
+    case vkutil::ImageUsage::TransferDst:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void RenderGraph::init(VkDevice device, VmaAllocator allocator, MemoryTracker* memory) {
+    this->device = device;
+    this->allocator = allocator;
+    this->memory = memory;
+}
+
+void RenderGraph::reset() {
+    destroy_transients();
+    images.clear();
+    passes.clear();
+    live_passes.clear();
+    pass_transitions.clear();
+    final_transitions.clear();
+}
+
+RGImageHandle RenderGraph::import_image(const std::string& name, vkutil::ImageUsage initial_usage, vkutil::ImageUsage final_usage, bool discard_initial) {
+    ImageResource resource{.name = name, .desc = {}, .imported = true};
+    resource.initial_usage = initial_usage;
+    resource.final_usage = final_usage;
+    resource.discard_initial = discard_initial;
+    images.push_back(resource);
+    return static_cast<RGImageHandle>(images.size() - 1);
+}
+
+void RenderGraph::set_imported_image(RGImageHandle handle, VkImage image, VkImageView view) {
+    images[handle].image = image;
+    images[handle].view = view;
+}
+
+RGImageHandle RenderGraph::create_image(const std::string& name, const RGImageDesc& desc) {
+    images.push_back(ImageResource{.name = name, .desc = desc, .imported = false});
+    return static_cast<RGImageHandle>(images.size() - 1);
+}
+
+void RenderGraph::add_pass(const std::string& name, std::vector<RGImageAccess> accesses, ExecuteFunction&& execute, bool side_effects) {
+    passes.push_back(Pass{.name = name, .accesses = std::move(accesses), .execute = std::move(execute), .side_effects = side_effects});
+}
+
+void RenderGraph::compile() {
+    destroy_transients();
+    cull_passes();
+    allocate_transients();
+    build_transitions();
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd) {
+    auto record = [&](const std::vector<Transition>& transitions) {
+        for (const Transition& t : transitions) {
+            barriers.add(images[t.image].image, t.src_usage, t.dst_usage, t.discard);
+        }
+        barriers.flush(cmd);
+    };
+    for (size_t i = 0; i < live_passes.size(); i++) {
+        record(pass_transitions[i]);
+        passes[live_passes[i]].execute(cmd);
+    }
+    record(final_transitions);
+}
+
+// Walks the passes backwards from the imported images. A pass survives if something later uses what it writes.
+// Writes keep the image needed as well, since attachments are loaded rather than cleared.
+void RenderGraph::cull_passes() {
+    std::unordered_set<RGImageHandle> needed;
+    for (RGImageHandle i = 0; i < images.size(); i++) {
+        if (images[i].imported) {
+            needed.insert(i);
+        }
+    }
+    culled_pass_count = 0;
+    for (int p = static_cast<int>(passes.size()) - 1; p >= 0; p--) {
+        Pass& pass = passes[p];
+        bool live = pass.side_effects;
+        for (const RGImageAccess& access : pass.accesses) {
+            live = live || (is_write(access.usage) && needed.count(access.image));
+        }
+        pass.culled = !live;
+        if (!live) {
+            culled_pass_count++;
+            continue;
+        }
+        for (const RGImageAccess& access : pass.accesses) {
+            needed.insert(access.image);
+        }
+    }
+
+    live_passes.clear();
+    for (ImageResource& image : images) {
+        image.first_pass = -1;
+        image.last_pass = -1;
+    }
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        if (passes[p].culled) {
+            continue;
+        }
+        int live_index = static_cast<int>(live_passes.size());
+        live_passes.push_back(p);
+        for (const RGImageAccess& access : passes[p].accesses) {
+            ImageResource& image = images[access.image];
+            if (image.first_pass < 0) {
+                image.first_pass = live_index;
+            }
+            image.last_pass = live_index;
+        }
+    }
+}
+
+// Transient images are placed greedily in order of first use. An image reuses a slot whose last occupant is done
+// before it starts, so memory is only shared between images that are never alive at the same time.
+void RenderGraph::allocate_transients() {
+    std::vector<RGImageHandle> order;
+    for (RGImageHandle i = 0; i < images.size(); i++) {
+        if (!images[i].imported && images[i].first_pass >= 0) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](RGImageHandle a, RGImageHandle b) { return images[a].first_pass < images[b].first_pass; });
+
+    unaliased_memory = 0;
+    transient_memory = 0;
+    for (RGImageHandle handle : order) {
+        ImageResource& image = images[handle];
+        VkImageCreateInfo img_info = vkinit::image_create_info(image.desc.format, image.desc.usage, image.desc.extent);
+        VK_CHECK(vkCreateImage(device, &img_info, nullptr, &image.image));
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, image.image, &requirements);
+        unaliased_memory += requirements.size;
+
+        for (int s = 0; s < static_cast<int>(memory_slots.size()); s++) {
+            MemorySlot& slot = memory_slots[s];
+            const ImageResource& last = images[slot.occupants.back()];
+            if (last.last_pass < image.first_pass && (slot.requirements.memoryTypeBits & requirements.memoryTypeBits)) {
+                image.memory_slot = s;
+                break;
+            }
+        }
+        if (image.memory_slot < 0) {
+            image.memory_slot = static_cast<int>(memory_slots.size());
+            memory_slots.push_back(MemorySlot{.requirements = requirements});
+        }
+        MemorySlot& slot = memory_slots[image.memory_slot];
+        slot.requirements.size = std::max(slot.requirements.size, requirements.size);
+        slot.requirements.alignment = std::max(slot.requirements.alignment, requirements.alignment);
+        slot.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+        slot.occupants.push_back(handle);
+    }
+
+    VmaAllocationCreateInfo alloc_info{};
+    alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    alloc_info.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (MemorySlot& slot : memory_slots) {
+        VK_CHECK(vmaAllocateMemory(allocator, &slot.requirements, &alloc_info, &slot.allocation, nullptr));
+        if (memory) {
+            memory->track(slot.allocation, MemoryCategory::RenderTargets);
+        }
+        transient_memory += slot.requirements.size;
+        for (RGImageHandle handle : slot.occupants) {
+            ImageResource& image = images[handle];
+            VK_CHECK(vmaBindImageMemory(allocator, slot.allocation, image.image));
+            VkImageAspectFlags aspect = (image.desc.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+            VkImageViewCreateInfo view_info = vkinit::imageview_create_info(image.desc.format, image.image, aspect);
+            VK_CHECK(vkCreateImageView(device, &view_info, nullptr, &image.view));
+        }
+    }
+}
+
+// Barriers are worked out once here, so executing only has to look up the current image handles
+void RenderGraph::build_transitions() {
+    std::vector<vkutil::ImageUsage> current(images.size());
+    std::vector<bool> discard(images.size());
+    for (RGImageHandle i = 0; i < images.size(); i++) {
+        ImageResource& image = images[i];
+        if (image.imported) {
+            current[i] = image.initial_usage;
+            discard[i] = image.discard_initial;
+            continue;
+        }
+        if (image.memory_slot < 0) {
+            continue;
+        }
+        // A transient image's contents are always discarded, but its first use still has to wait for whatever used the memory last.
+        // For the first image in a slot, that is the last image in it from the previous frame.
+        const std::vector<RGImageHandle>& occupants = memory_slots[image.memory_slot].occupants;
+        auto it = std::find(occupants.begin(), occupants.end(), i);
+        RGImageHandle previous = it == occupants.begin() ? occupants.back() : *(it - 1);
+        current[i] = vkutil::ImageUsage::Undefined;
+        for (uint32_t p : live_passes) {
+            for (const RGImageAccess& access : passes[p].accesses) {
+                if (access.image == previous) {
+                    current[i] = access.usage;
+                }
+            }
+        }
+        discard[i] = true;
+    }
+
+    pass_transitions.assign(live_passes.size(), {});
+    for (size_t i = 0; i < live_passes.size(); i++) {
+        for (const RGImageAccess& access : passes[live_passes[i]].accesses) {
+            RGImageHandle handle = access.image;
+            // Back to back reads in the same layout need nothing
+            if (current[handle] == access.usage && !is_write(access.usage) && !discard[handle]) {
+                continue;
+            }
+            pass_transitions[i].push_back(Transition{handle, current[handle], access.usage, discard[handle]});
+            current[handle] = access.usage;
+            discard[handle] = false;
+        }
+    }
+
+    final_transitions.clear();
+    for (RGImageHandle i = 0; i < images.size(); i++) {
+        const ImageResource& image = images[i];
+        if (image.imported && image.final_usage != vkutil::ImageUsage::Undefined && image.final_usage != current[i]) {
+            final_transitions.push_back(Transition{i, current[i], image.final_usage, discard[i]});
+        }
+    }
+}
+
+void RenderGraph::destroy_transients() {
+    for (ImageResource& image : images) {
+        if (image.imported || image.image == VK_NULL_HANDLE) {
+            continue;
+        }
+        vkDestroyImageView(device, image.view, nullptr);
+        vkDestroyImage(device, image.image, nullptr);
+        image.image = VK_NULL_HANDLE;
+        image.view = VK_NULL_HANDLE;
+        image.memory_slot = -1;
+    }
+    for (MemorySlot& slot : memory_slots) {
+        if (memory) {
+            memory->untrack(slot.allocation);
+        }
+        vmaFreeMemory(allocator, slot.allocation);
+    }
+    memory_slots.clear();
+}
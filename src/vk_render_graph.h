@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_texture.h>
+#include <vk_memory.h>
+
+// Index of an image declared in a RenderGraph
+using RGImageHandle = uint32_t;
+
+struct RGImageDesc {
+    VkFormat format;
+    VkExtent3D extent;
+    VkImageUsageFlags usage;
+};
+
+struct RGImageAccess {
+    RGImageHandle image;
+    vkutil::ImageUsage usage;
+};
+
+// Passes declare which images they touch and how. Compiling the graph culls passes whose output is never used,
+// works out every layout transition, and lets transient images whose lifetimes don't overlap share memory.
+// Compile once, then execute every frame. Imported images can be swapped between executions.
+class RenderGraph {
+public:
+    using ExecuteFunction = std::function<void(VkCommandBuffer cmd)>;
+
+    void init(VkDevice device, VmaAllocator allocator, MemoryTracker* memory = nullptr); // Transient memory is tracked as render targets when given a tracker
+    void reset(); // Destroys transient images and forgets every pass. The GPU must be done with the graph.
+
+    // Images owned outside the graph, like the swapchain. initial_usage is how the image was last used before the graph runs,
+    // and the graph transitions it to final_usage at the end unless that is Undefined.
+    RGImageHandle import_image(const std::string& name, vkutil::ImageUsage initial_usage, vkutil::ImageUsage final_usage, bool discard_initial = false);
+    void set_imported_image(RGImageHandle handle, VkImage image, VkImageView view);
+    // Images created by the graph. Their contents don't survive between frames.
+    RGImageHandle create_image(const std::string& name, const RGImageDesc& desc);
+
+    void add_pass(const std::string& name, std::vector<RGImageAccess> accesses, ExecuteFunction&& execute, bool side_effects = false);
+
+    void compile();
+    void execute(VkCommandBuffer cmd);
+
+    VkImage get_image(RGImageHandle handle) const { return images[handle].image; }
+    VkImageView get_image_view(RGImageHandle handle) const { return images[handle].view; }
+
+    // Stats from the last compile
+    uint32_t culled_pass_count{0};
+    VkDeviceSize transient_memory{0}; // What the transient images actually use
+    VkDeviceSize unaliased_memory{0}; // What they would use with one allocation each
+
+private:
+    struct ImageResource {
+        std::string name;
+        RGImageDesc desc;
+        bool imported;
+        vkutil::ImageUsage initial_usage{vkutil::ImageUsage::Undefined};
+        vkutil::ImageUsage final_usage{vkutil::ImageUsage::Undefined};
+        bool discard_initial{false};
+        VkImage image{VK_NULL_HANDLE};
+        VkImageView view{VK_NULL_HANDLE};
+        int first_pass{-1}; // Lifetime in live pass indices
+        int last_pass{-1};
+        int memory_slot{-1};
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<RGImageAccess> accesses;
+        ExecuteFunction execute;
+        bool side_effects;
+        bool culled{false};
+    };
+
+    struct Transition {
+        RGImageHandle image;
+        vkutil::ImageUsage src_usage;
+        vkutil::ImageUsage dst_usage;
+        bool discard;
+    };
+
+    // One allocation shared by every transient image placed in it
+    struct MemorySlot {
+        VkMemoryRequirements requirements;
+        VmaAllocation allocation{VK_NULL_HANDLE};
+        std::vector<RGImageHandle> occupants; // In order of first use
+    };
+
+    void cull_passes();
+    void allocate_transients();
+    void build_transitions();
+    void destroy_transients();
+
+    std::vector<ImageResource> images;
+    std::vector<Pass> passes;
+    std::vector<uint32_t> live_passes;
+    std::vector<MemorySlot> memory_slots;
+    std::vector<std::vector<Transition>> pass_transitions; // Recorded before each live pass
+    std::vector<Transition> final_transitions;
+    vkutil::ImageBarrierBatch barriers;
+
+    VkDevice device;
+    VmaAllocator allocator;
+    MemoryTracker* memory{nullptr};
+};
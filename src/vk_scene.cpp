@@ -0,0 +1,179 @@
+#include <vk_scene.h>
+
+#include <vk_jobs.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VK_SCENE_SSE 1
+#endif
+
+namespace {
+    // Below this many nodes in a level, the level is updated on the calling thread
+    constexpr uint32_t MIN_NODES_PER_BATCH = 2048;
+
+    glm::mat4 compose(glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+        glm::mat3 basis = glm::mat3_cast(rotation);
+        return glm::mat4(glm::vec4(basis[0] * scale.x, 0.0f), glm::vec4(basis[1] * scale.y, 0.0f), glm::vec4(basis[2] * scale.z, 0.0f), glm::vec4(position, 1.0f));
+    }
+
+    // parent * local, one column of the result per four-wide multiply-add chain
+    void multiply(const glm::mat4& parent, const glm::mat4& local, glm::mat4& out) {
+#ifdef VK_SCENE_SSE
+        __m128 p0 = _mm_loadu_ps(&parent[0][0]);
+        __m128 p1 = _mm_loadu_ps(&parent[1][0]);
+        __m128 p2 = _mm_loadu_ps(&parent[2][0]);
+        __m128 p3 = _mm_loadu_ps(&parent[3][0]);
+        for (int column = 0; column < 4; column++) {
+            __m128 result = _mm_mul_ps(p0, _mm_set1_ps(local[column][0]));
+            result = _mm_add_ps(result, _mm_mul_ps(p1, _mm_set1_ps(local[column][1])));
+            result = _mm_add_ps(result, _mm_mul_ps(p2, _mm_set1_ps(local[column][2])));
+            result = _mm_add_ps(result, _mm_mul_ps(p3, _mm_set1_ps(local[column][3])));
+            _mm_storeu_ps(&out[column][0], result);
+        }
+#else
+        out = parent * local;
+#endif
+    }
+}
+
+NodeHandle TransformHierarchy::create_node(NodeHandle parent, glm::vec3 position, glm::quat rotation, glm::vec3 scale) {
+    uint32_t index = static_cast<uint32_t>(parents.size());
+    uint32_t parent_index = parent == INVALID_NODE ? INVALID_NODE : handle_to_index[parent];
+    uint32_t depth = parent == INVALID_NODE ? 0 : depths[parent_index] + 1;
+    NodeHandle handle = static_cast<NodeHandle>(handle_to_index.size());
+    needs_sort = true;
+
+    positions.push_back(position);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    parents.push_back(parent_index);
+    depths.push_back(depth);
+    world_matrices.push_back(glm::mat4(1.0f));
+    dirty.push_back(0);
+    payloads.push_back(NULL_ENTITY);
+    index_to_handle.push_back(handle);
+    handle_to_index.push_back(index);
+    mark_dirty(index);
+    return handle;
+}
+
+void TransformHierarchy::set_position(NodeHandle node, glm::vec3 position) {
+    uint32_t index = handle_to_index[node];
+    positions[index] = position;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::set_rotation(NodeHandle node, glm::quat rotation) {
+    uint32_t index = handle_to_index[node];
+    rotations[index] = rotation;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::set_scale(NodeHandle node, glm::vec3 scale) {
+    uint32_t index = handle_to_index[node];
+    scales[index] = scale;
+    mark_dirty(index);
+}
+
+void TransformHierarchy::mark_dirty(uint32_t index) {
+    dirty[index] = 1;
+    min_dirty_depth = std::min(min_dirty_depth, depths[index]);
+}
+
+void TransformHierarchy::update(JobSystem& jobs) {
+    auto start = std::chrono::steady_clock::now();
+    changed_indices.clear();
+    changed_payload_list.clear();
+    updated_nodes = 0;
+    if (needs_sort) {
+        sort_by_depth();
+    }
+    if (min_dirty_depth == ~0u) {
+        update_ms = 0.0f;
+        return;
+    }
+
+    for (uint32_t level = min_dirty_depth; level < level_count(); level++) {
+        uint32_t first = level_offsets[level];
+        uint32_t count = level_offsets[level + 1] - first;
+        jobs.parallel_for(count, MIN_NODES_PER_BATCH, [&, first](uint32_t begin, uint32_t end) {
+            std::vector<uint32_t> updated;
+            for (uint32_t i = first + begin; i < first + end; i++) {
+                uint32_t parent = parents[i];
+                // The parent's level is finished, so its flag already says whether it moved
+                if (!dirty[i] && (parent == INVALID_NODE || !dirty[parent])) {
+                    continue;
+                }
+                dirty[i] = 1;
+                glm::mat4 local = compose(positions[i], rotations[i], scales[i]);
+                if (parent == INVALID_NODE) {
+                    world_matrices[i] = local;
+                } else {
+                    multiply(world_matrices[parent], local, world_matrices[i]);
+                }
+                updated.push_back(i);
+            }
+            if (!updated.empty()) {
+                std::lock_guard<std::mutex> lock(changed_mutex);
+                changed_indices.insert(changed_indices.end(), updated.begin(), updated.end());
+            }
+        });
+    }
+
+    for (uint32_t i : changed_indices) {
+        dirty[i] = 0;
+        if (payloads[i] != NULL_ENTITY) {
+            changed_payload_list.push_back(payloads[i]);
+        }
+    }
+    updated_nodes = static_cast<uint32_t>(changed_indices.size());
+    min_dirty_depth = ~0u;
+    update_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Stable counting sort on depth. Handles are remapped, so only indices change.
+void TransformHierarchy::sort_by_depth() {
+    uint32_t node_total = static_cast<uint32_t>(parents.size());
+    uint32_t max_depth = 0;
+    for (uint32_t depth : depths) {
+        max_depth = std::max(max_depth, depth);
+    }
+    level_offsets.assign(max_depth + 2, 0);
+    for (uint32_t depth : depths) {
+        level_offsets[depth + 1]++;
+    }
+    for (uint32_t level = 1; level < level_offsets.size(); level++) {
+        level_offsets[level] += level_offsets[level - 1];
+    }
+    std::vector<uint32_t> new_index(node_total);
+    std::vector<uint32_t> cursor(level_offsets.begin(), level_offsets.end() - 1);
+    for (uint32_t i = 0; i < node_total; i++) {
+        new_index[i] = cursor[depths[i]]++;
+    }
+
+    auto permute = [&](auto& values) {
+        std::remove_reference_t<decltype(values)> sorted(values.size());
+        for (uint32_t i = 0; i < node_total; i++) {
+            sorted[new_index[i]] = values[i];
+        }
+        values.swap(sorted);
+    };
+    permute(positions);
+    permute(rotations);
+    permute(scales);
+    permute(depths);
+    permute(world_matrices);
+    permute(dirty);
+    permute(payloads);
+    permute(index_to_handle);
+    permute(parents);
+    for (uint32_t& parent : parents) {
+        if (parent != INVALID_NODE) {
+            parent = new_index[parent];
+        }
+    }
+    for (uint32_t i = 0; i < node_total; i++) {
+        handle_to_index[index_to_handle[i]] = i;
+    }
+    needs_sort = false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_ecs.h>
+#include <gtc/quaternion.hpp>
+
+#include <mutex>
+
+class JobSystem;
+
+// Stable id of a node. Indices into the arrays change when they are re-sorted, handles don't.
+using NodeHandle = uint32_t;
+constexpr NodeHandle INVALID_NODE = ~0u;
+
+// Parent/child transforms stored as flat arrays, one per field, sorted so every parent comes before its children
+// and each depth is one contiguous range. Changing a node only marks it dirty. update() then walks the levels in order,
+// and each level is split across the job system, since no node in a level depends on another in the same level.
+// Only dirty nodes and their descendants have their world matrix recomputed.
+class TransformHierarchy {
+public:
+    NodeHandle create_node(NodeHandle parent, glm::vec3 position = glm::vec3(0.0f), glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3 scale = glm::vec3(1.0f));
+    void set_position(NodeHandle node, glm::vec3 position);
+    void set_rotation(NodeHandle node, glm::quat rotation);
+    void set_scale(NodeHandle node, glm::vec3 scale);
+    glm::vec3 position(NodeHandle node) const { return positions[handle_to_index[node]]; }
+    glm::quat rotation(NodeHandle node) const { return rotations[handle_to_index[node]]; }
+    const glm::mat4& world_matrix(NodeHandle node) const { return world_matrices[handle_to_index[node]]; }
+    // The entity that follows the node's world matrix. It comes back from changed_payloads even after it was destroyed,
+    // so check that it's still alive before using it.
+    void set_payload(NodeHandle node, Entity entity) { payloads[handle_to_index[node]] = entity; }
+
+    void update(JobSystem& jobs); // Recomputes the world matrices of dirty subtrees
+    // Payloads of the nodes whose world matrix changed in the last update, if they have one
+    const std::vector<Entity>& changed_payloads() const { return changed_payload_list; }
+
+    size_t node_count() const { return parents.size(); }
+    size_t level_count() const { return level_offsets.empty() ? 0 : level_offsets.size() - 1; }
+
+    // Stats from the last update
+    uint32_t updated_nodes{0};
+    float update_ms{0.0f};
+
+private:
+    // Local transform
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    // Structure
+    std::vector<uint32_t> parents; // Index of the parent, or INVALID_NODE for roots
+    std::vector<uint32_t> depths;
+    std::vector<uint32_t> level_offsets; // Where each depth starts, with the node count at the end
+    // Results
+    std::vector<glm::mat4> world_matrices;
+    std::vector<uint8_t> dirty; // Set on change, and on every node recomputed in the current update
+    std::vector<Entity> payloads;
+    std::vector<NodeHandle> index_to_handle;
+    std::vector<uint32_t> handle_to_index;
+
+    bool needs_sort{false}; // Nodes were added since the last update, so the levels have to be rebuilt
+    uint32_t min_dirty_depth{~0u}; // Levels above this one have nothing to do
+    std::vector<uint32_t> changed_indices;
+    std::vector<Entity> changed_payload_list;
+    std::mutex changed_mutex; // Batches add what they recomputed
+
+    void mark_dirty(uint32_t index);
+    void sort_by_depth();
+};
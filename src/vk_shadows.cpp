@@ -0,0 +1,301 @@
+#include <vk_shadows.h>
+
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_pipeline.h>
+#include <vk_texture.h>
+
+#include <cmath>
+
+namespace {
+    // Matches the push constants of shadow.vert
+    struct ShadowPushConstants {
+        glm::mat4 view_proj;
+    };
+
+    void hash_combine(size_t& seed, size_t value) {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+}
+
+void ShadowCascades::init(VulkanEngine* engine) {
+    static_assert(std::extent_v<decltype(frames)> == MAX_FRAMES_IN_FLIGHT);
+    this->engine = engine;
+    VkDevice device = engine->device;
+
+    VkImageCreateInfo ici = vkinit::image_create_info(FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VkExtent3D{MAP_SIZE, MAP_SIZE, 1});
+    ici.arrayLayers = CASCADE_COUNT;
+    map = engine->create_image(ici, MemoryCategory::RenderTargets);
+    VkImageViewCreateInfo ivci = vkinit::imageview_create_info(FORMAT, map.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        ivci.subresourceRange.baseArrayLayer = i;
+        VK_CHECK(vkCreateImageView(device, &ivci, nullptr, &cascades[i].layer_view));
+    }
+    ivci.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    ivci.subresourceRange.baseArrayLayer = 0;
+    ivci.subresourceRange.layerCount = CASCADE_COUNT;
+    VK_CHECK(vkCreateImageView(device, &ivci, nullptr, &map_view));
+    // The render graph expects the map the way the lit passes left it
+    engine->immediate_submit([&](VkCommandBuffer cmd) {
+        vkutil::transition_image(cmd, map.image, vkutil::ImageUsage::Undefined, vkutil::ImageUsage::DepthAttachment);
+        vkutil::transition_image(cmd, map.image, vkutil::ImageUsage::DepthAttachment, vkutil::ImageUsage::Sampled);
+    });
+
+    // Outside the map counts as lit
+    VkSamplerCreateInfo si = vkinit::sampler_create_info(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER);
+    si.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    si.compareEnable = VK_TRUE;
+    si.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    compare_sampler = engine->sampler_cache.get_sampler(si);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        frames[i].command_buffer = engine->create_buffer(MAX_DRAWS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::FrameBuffers);
+        // The lit fragment shaders sample the map through binding 5 of the global set
+        VkDescriptorImageInfo map_info{compare_sampler, map_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        VkWriteDescriptorSet write = vkinit::write_descriptor_image(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, engine->frames[i].global_descriptor, &map_info, 5);
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    }
+
+    // Positions only, transformed by the cascade's matrix. The object buffer is the only set.
+    VkPushConstantRange range{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants)};
+    VkPipelineLayoutCreateInfo plci = vkinit::pipeline_layout_create_info();
+    plci.setLayoutCount = 1;
+    plci.pSetLayouts = &engine->object_set_layout;
+    plci.pushConstantRangeCount = 1;
+    plci.pPushConstantRanges = &range;
+    VK_CHECK(vkCreatePipelineLayout(device, &plci, nullptr, &pipeline_layout));
+
+    VkShaderModule vertex_shader;
+    vkutil::load_shader_module("../shaders/shadow.vert.spv", device, &vertex_shader);
+    PipelineBuilder builder;
+    builder.pipeline_layout = pipeline_layout;
+    builder.vertex_input_info = vkinit::vertex_input_state_create_info();
+    VertexInputDescription position_description = Vertex::get_position_description();
+    builder.vertex_input_info.vertexAttributeDescriptionCount = position_description.attributes.size();
+    builder.vertex_input_info.pVertexAttributeDescriptions = position_description.attributes.data();
+    builder.vertex_input_info.vertexBindingDescriptionCount = position_description.bindings.size();
+    builder.vertex_input_info.pVertexBindingDescriptions = position_description.bindings.data();
+    builder.set_vertex_shader_only(vertex_shader);
+    builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    // Pushes the stored depth back along steep slopes, where a texel covers the widest range of depths
+    builder.set_depth_bias(1.25f, 1.75f);
+    builder.set_multisampling_none();
+    builder.disable_blending();
+    builder.disable_color_attachment();
+    builder.depth_stencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+    builder.set_depth_format(FORMAT);
+    pipeline = builder.build_pipeline(device);
+    vkDestroyShaderModule(device, vertex_shader, nullptr);
+}
+
+void ShadowCascades::cleanup() {
+    VkDevice device = engine->device;
+    for (FrameResources& frame : frames) {
+        engine->destroy_buffer(frame.command_buffer);
+    }
+    for (Cascade& cascade : cascades) {
+        vkDestroyImageView(device, cascade.layer_view, nullptr);
+    }
+    vkDestroyImageView(device, map_view, nullptr);
+    engine->destroy_image(map);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+}
+
+void ShadowCascades::update(const std::vector<RenderObject>& renderables, glm::vec3 light_direction) {
+    FrameResources& frame = frames[engine->current_frame_index()];
+    cascades_rendered = 0;
+    draws_submitted = 0;
+    for (Cascade& cascade : cascades) {
+        cascade.render_this_frame = false;
+    }
+    if (!enabled) {
+        return;
+    }
+
+    void* data;
+    vmaMapMemory(engine->allocator, frame.command_buffer.allocation, &data);
+    VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(data);
+    float range = shadow_distance / engine->camera_near;
+    float split_near = engine->camera_near;
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        Cascade& cascade = cascades[i];
+        // Practical split scheme: logarithmic splits keep texel density even, uniform ones keep the near cascades from getting tiny
+        float t = float(i + 1) / CASCADE_COUNT;
+        float log_split = engine->camera_near * std::pow(range, t);
+        float uniform_split = engine->camera_near + (shadow_distance - engine->camera_near) * t;
+        float split_far = glm::mix(uniform_split, log_split, split_lambda);
+        glm::vec3 center;
+        float radius;
+        slice_bounds(split_near, split_far, center, radius);
+        cascade.split_far = split_far;
+        split_near = split_far;
+
+        bool cached = caching_enabled && i >= first_cached_cascade;
+        bool render = force_render || !cascade.valid || !cached;
+        // Staggered, so the cached cascades don't all come due on the same frame
+        render = render || (engine->frameNumber + i) % std::max(cache_interval, 1u) == 0;
+        render = render || glm::dot(cascade.light_direction, light_direction) < 0.99999f;
+        render = render || glm::length(center - cascade.center) + radius > cascade.radius;
+        render = render || hash_casters(cascade, renderables) != cascade.caster_hash;
+        if (!render) {
+            continue;
+        }
+        place(cascade, center, cached ? radius * (1.0f + cache_slack) : radius, light_direction);
+        cascade.valid = true;
+        cascade.caster_hash = hash_casters(cascade, renderables);
+        cascade.last_rendered_frame = engine->frameNumber;
+        cascade.render_this_frame = true;
+        draws_submitted += cull(cascade, renderables, commands, draws_submitted);
+        cascades_rendered++;
+    }
+    vmaUnmapMemory(engine->allocator, frame.command_buffer.allocation);
+    force_render = false;
+}
+
+void ShadowCascades::render(VkCommandBuffer cmd) {
+    FrameResources& frame = frames[engine->current_frame_index()];
+    VkClearValue depth_clear;
+    depth_clear.depthStencil.depth = 1.0f;
+    VkViewport viewport{0.0f, 0.0f, float(MAP_SIZE), float(MAP_SIZE), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, {MAP_SIZE, MAP_SIZE}};
+    for (Cascade& cascade : cascades) {
+        if (!cascade.render_this_frame) {
+            continue;
+        }
+        VkRenderingAttachmentInfoKHR depth_attachment = vkinit::attachment_info(cascade.layer_view, &depth_clear, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        VkRenderingInfoKHR render_info = vkinit::rendering_info(VkExtent2D{MAP_SIZE, MAP_SIZE}, 0, nullptr, &depth_attachment);
+        vkCmdBeginRendering(cmd, &render_info);
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &engine->get_current_frame().object_descriptor, 0, nullptr);
+        ShadowPushConstants constants{cascade.view_proj};
+        vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ShadowPushConstants), &constants);
+        for (const ShadowDraw& draw : cascade.draws) {
+            VkDeviceSize offset = 0;
+            vkCmdBindVertexBuffers(cmd, 0, 1, &draw.mesh->vertex_buffer.buffer, &offset);
+            vkCmdBindIndexBuffer(cmd, draw.mesh->vertex_buffer.buffer, draw.mesh->index_offset, VK_INDEX_TYPE_UINT32);
+            vkCmdDrawIndexedIndirect(cmd, frame.command_buffer.buffer, draw.first_command * sizeof(VkDrawIndexedIndirectCommand), draw.command_count, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        vkCmdEndRendering(cmd);
+    }
+}
+
+glm::vec4 ShadowCascades::split_distances() const {
+    if (!enabled) {
+        return glm::vec4(0.0f);
+    }
+    return glm::vec4(cascades[0].split_far, cascades[1].split_far, cascades[2].split_far, cascades[3].split_far);
+}
+
+glm::vec4 ShadowCascades::texel_sizes() const {
+    glm::vec4 sizes;
+    for (uint32_t i = 0; i < CASCADE_COUNT; i++) {
+        sizes[i] = 2.0f * cascades[i].radius / MAP_SIZE;
+    }
+    return sizes;
+}
+
+void ShadowCascades::slice_bounds(float split_near, float split_far, glm::vec3& center, float& radius) const {
+    const glm::mat4& proj = engine->camera_data.proj;
+    glm::vec2 tan_half_fov = glm::vec2(1.0f / proj[0][0], 1.0f / std::abs(proj[1][1]));
+    glm::mat4 inverse_view = glm::inverse(engine->camera_data.view);
+    glm::vec3 corners[8];
+    for (uint32_t i = 0; i < 8; i++) {
+        float depth = i < 4 ? split_near : split_far;
+        glm::vec2 sign = glm::vec2((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+        corners[i] = glm::vec3(inverse_view * glm::vec4(sign * tan_half_fov * depth, -depth, 1.0f));
+    }
+    center = glm::vec3(0.0f);
+    for (const glm::vec3& corner : corners) {
+        center += corner / 8.0f;
+    }
+    radius = 0.0f;
+    for (const glm::vec3& corner : corners) {
+        radius = std::max(radius, glm::length(corner - center));
+    }
+    // The sphere only depends on the projection and the split, but rounding keeps float noise from changing its size
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+}
+
+void ShadowCascades::place(Cascade& cascade, glm::vec3 center, float radius, glm::vec3 light_direction) const {
+    glm::vec3 up = std::abs(light_direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 eye = center - light_direction * (radius + caster_margin);
+    glm::mat4 view = glm::lookAt(eye, center, up);
+    glm::mat4 proj = glm::orthoRH_ZO(-radius, radius, -radius, radius, 0.0f, 2.0f * radius + caster_margin);
+    // Move the projection so the world origin lands on a texel corner. The whole grid then moves in whole texels.
+    glm::vec4 origin = proj * view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    glm::vec2 texel = glm::vec2(origin) * (MAP_SIZE * 0.5f);
+    glm::vec2 offset = (glm::round(texel) - texel) / (MAP_SIZE * 0.5f);
+    proj[3][0] += offset.x;
+    proj[3][1] += offset.y;
+    cascade.view_proj = proj * view;
+    cascade.center = center;
+    cascade.radius = radius;
+    cascade.light_direction = light_direction;
+}
+
+bool ShadowCascades::overlaps(const Cascade& cascade, glm::vec3 center, float radius) const {
+    glm::vec4 clip = cascade.view_proj * glm::vec4(center, 1.0f);
+    // Orthographic, so a sphere keeps its size in clip space
+    float xy_radius = radius / cascade.radius;
+    float z_radius = radius / (2.0f * cascade.radius + caster_margin);
+    return std::abs(clip.x) - xy_radius <= 1.0f && std::abs(clip.y) - xy_radius <= 1.0f && clip.z + z_radius >= 0.0f && clip.z - z_radius <= 1.0f;
+}
+
+size_t ShadowCascades::hash_casters(const Cascade& cascade, const std::vector<RenderObject>& renderables) const {
+    size_t seed = 0;
+    if (!cascade.valid) {
+        return seed;
+    }
+    for (size_t i = 0; i < renderables.size(); i++) {
+        const RenderObject& object = renderables[i];
+        glm::mat3 axes = glm::mat3(object.transform_matrix);
+        float scale = std::max({glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2])});
+        glm::vec3 center = glm::vec3(object.transform_matrix * glm::vec4(object.mesh->bounds_center, 1.0f));
+        if (!overlaps(cascade, center, object.mesh->bounds_radius * scale)) {
+            continue;
+        }
+        hash_combine(seed, i);
+        hash_combine(seed, std::hash<const Mesh*>{}(object.mesh));
+        for (int column = 0; column < 4; column++) {
+            for (int row = 0; row < 4; row++) {
+                hash_combine(seed, std::hash<float>{}(object.transform_matrix[column][row]));
+            }
+        }
+    }
+    return seed;
+}
+
+uint32_t ShadowCascades::cull(Cascade& cascade, const std::vector<RenderObject>& renderables, VkDrawIndexedIndirectCommand* commands, uint32_t first_command) {
+    cascade.draws.clear();
+    uint32_t count = first_command;
+    for (uint32_t i = 0; i < renderables.size(); i++) {
+        const RenderObject& object = renderables[i];
+        glm::mat3 axes = glm::mat3(object.transform_matrix);
+        float scale = std::max({glm::length(axes[0]), glm::length(axes[1]), glm::length(axes[2])});
+        glm::vec3 object_center = glm::vec3(object.transform_matrix * glm::vec4(object.mesh->bounds_center, 1.0f));
+        if (!overlaps(cascade, object_center, object.mesh->bounds_radius * scale)) {
+            continue;
+        }
+        for (const Meshlet& meshlet : object.mesh->meshlets) {
+            if (count == MAX_DRAWS) {
+                return count - first_command;
+            }
+            glm::vec3 center = glm::vec3(object.transform_matrix * glm::vec4(meshlet.bounds_center, 1.0f));
+            if (!overlaps(cascade, center, meshlet.bounds_radius * scale)) {
+                continue;
+            }
+            if (cascade.draws.empty() || cascade.draws.back().mesh != object.mesh) {
+                cascade.draws.push_back(ShadowDraw{object.mesh, count, 0});
+            }
+            commands[count] = VkDrawIndexedIndirectCommand{meshlet.index_count, 1, meshlet.first_index, 0, i};
+            cascade.draws.back().command_count++;
+            count++;
+        }
+    }
+    return count - first_command;
+}
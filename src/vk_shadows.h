@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vk_types.h>
+
+class VulkanEngine;
+struct RenderObject;
+struct Mesh;
+
+// Cascaded shadow maps for the sun. The camera frustum is split into slices, and each slice gets an orthographic
+// shadow map fitted around its bounding sphere. Fitting to a sphere keeps the size of a cascade constant as the camera turns,
+// and snapping it to whole texels keeps the edges from crawling as the camera moves.
+// The far cascades are fitted with some slack and reused for several frames. They are only re-rendered on their turn,
+// or as soon as the sun moves, the casters inside them change, or the camera leaves the area they cover.
+class ShadowCascades {
+public:
+    static constexpr uint32_t CASCADE_COUNT = 4;
+    static constexpr uint32_t MAP_SIZE = 2048;
+    static constexpr uint32_t MAX_DRAWS = 65536; // Meshlet draws across every cascade rendered in a frame
+    static constexpr VkFormat FORMAT = VK_FORMAT_D32_SFLOAT;
+
+    void init(VulkanEngine* engine);
+    void cleanup();
+    // Fits the cascades to this frame's camera, decides which ones to render, and culls the casters of those
+    void update(const std::vector<RenderObject>& renderables, glm::vec3 light_direction);
+    void render(VkCommandBuffer cmd); // Draws the cascades picked by update into their layers
+    void invalidate() { force_render = true; } // Re-renders every cascade next frame
+
+    // What the shaders need to sample the cascades, as of the last update
+    glm::mat4 shadow_matrix(uint32_t cascade) const { return cascades[cascade].view_proj; }
+    glm::vec4 split_distances() const; // View depth where each cascade ends. Zero everywhere when shadows are off.
+    glm::vec4 texel_sizes() const; // World space size of a texel in each cascade
+
+    bool enabled{true};
+    bool caching_enabled{true};
+    uint32_t first_cached_cascade{2}; // Cascades before this one are rendered every frame
+    uint32_t cache_interval{8}; // Frames between routine updates of a cached cascade
+    float shadow_distance{120.0f}; // Past this, nothing is shadowed
+    float split_lambda{0.75f}; // Blend between uniform (0) and logarithmic (1) split distances
+    float caster_margin{50.0f}; // How far toward the sun past a cascade's bounds casters are still drawn
+    float cache_slack{0.25f}; // Cached cascades cover this much more radius, so the camera can move before they must be redrawn
+
+    AllocatedImage map{};
+    VkImageView map_view{VK_NULL_HANDLE}; // Every layer, for sampling
+    VkSampler compare_sampler{VK_NULL_HANDLE}; // Depth comparison with bilinear filtering
+
+    // Stats for the last frame
+    uint32_t cascades_rendered{0};
+    uint32_t draws_submitted{0};
+
+private:
+    // Meshlets of one mesh drawn for one cascade, as consecutive indirect commands
+    struct ShadowDraw {
+        Mesh* mesh;
+        uint32_t first_command;
+        uint32_t command_count;
+    };
+
+    struct Cascade {
+        glm::mat4 view_proj{1.0f}; // Of the last render, which is what the layer holds
+        glm::vec3 center{0.0f}; // Bounding sphere the layer covers
+        float radius{0.0f};
+        float split_far{0.0f}; // Updated every frame, even when the layer is reused
+        glm::vec3 light_direction{0.0f};
+        size_t caster_hash{0};
+        int last_rendered_frame{-1};
+        bool valid{false};
+        bool render_this_frame{false};
+        std::vector<ShadowDraw> draws;
+        VkImageView layer_view{VK_NULL_HANDLE};
+    };
+
+    struct FrameResources {
+        AllocatedBuffer command_buffer; // Indirect commands written by the CPU
+    };
+
+    VulkanEngine* engine{nullptr};
+    Cascade cascades[CASCADE_COUNT];
+    FrameResources frames[4]; // One per frame in flight
+    bool force_render{true};
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+
+    void slice_bounds(float split_near, float split_far, glm::vec3& center, float& radius) const; // Bounding sphere of a slice of the camera frustum
+    void place(Cascade& cascade, glm::vec3 center, float radius, glm::vec3 light_direction) const; // Builds the snapped shadow matrix
+    bool overlaps(const Cascade& cascade, glm::vec3 center, float radius) const; // Whether a sphere can cast into the layer
+    // Objects whose bounds reach into the cascade, hashed with their transforms so a change to any of them is noticed
+    size_t hash_casters(const Cascade& cascade, const std::vector<RenderObject>& renderables) const;
+    uint32_t cull(Cascade& cascade, const std::vector<RenderObject>& renderables, VkDrawIndexedIndirectCommand* commands, uint32_t first_command);
+};
@@ -1,116 +1,334 @@
 #include <vk_texture.h>
 #include <iostream>
+#include <cmath>
 
 #include <vk_initializers.h>
+#include <vk_engine.h>
+#include <vk_bc.h>
+#include <vk_ktx.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& out_image) {
-    int texW, texH, texChannels;
-    // Load the texture directly into an array of pixels
-    stbi_uc* pixels = stbi_load(file, &texW, &texH, &texChannels, STBI_rgb_alpha); // STBI_rgb_alpha will load pixels as RGBA 4 channels, which will match Vulkan format
-    if (!pixels) {
-        std::cout << "Failed to load texture file " << file << std::endl;
-        return false;
+static bool can_sample(VulkanEngine& engine, VkFormat format, VkFormatFeatureFlags features) {
+    VkFormatProperties format_properties;
+    vkGetPhysicalDeviceFormatProperties(engine.chosenGPU, format, &format_properties);
+    return (format_properties.optimalTilingFeatures & features) == features;
+}
+
+// Maps a BC image format to the codec that can decode it on the CPU
+static bool block_format(VkFormat format, bc::Format& out_format, bool& out_srgb) {
+    switch (format) {
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: out_format = bc::Format::BC1; out_srgb = false; return true;
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: out_format = bc::Format::BC1; out_srgb = true; return true;
+    case VK_FORMAT_BC3_UNORM_BLOCK: out_format = bc::Format::BC3; out_srgb = false; return true;
+    case VK_FORMAT_BC3_SRGB_BLOCK: out_format = bc::Format::BC3; out_srgb = true; return true;
+    case VK_FORMAT_BC7_UNORM_BLOCK: out_format = bc::Format::BC7; out_srgb = false; return true;
+    case VK_FORMAT_BC7_SRGB_BLOCK: out_format = bc::Format::BC7; out_srgb = true; return true;
+    default: return false;
     }
+}
 
-    // Create a staging buffer to load the pixels into
-    void* pixel_ptr = pixels;
-    VkDeviceSize image_size = texH * texW * 4; // 4 bytes per pixel times the # of pixels
-    // R8G8B8A8 format matches exactly with the pixels loaded from stb
-    VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
-    AllocatedBuffer staging_buffer = engine.create_buffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+AllocatedImage vkutil::upload_image(VulkanEngine& engine, VkFormat format, VkExtent3D extent, uint32_t mip_levels, const std::vector<std::span<const uint8_t>>& levels, std::function<void()>&& on_ready) {
+    // Level offsets are kept 16 byte aligned, which satisfies both the texel block size and the copy alignment
+    std::vector<VkBufferImageCopy> regions(levels.size());
+    VkDeviceSize staging_size = 0;
+    for (uint32_t level = 0; level < levels.size(); level++) {
+        VkBufferImageCopy& bic = regions[level];
+        bic = {};
+        bic.bufferOffset = staging_size;
+        bic.bufferRowLength = 0;
+        bic.bufferImageHeight = 0;
+        bic.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        bic.imageSubresource.mipLevel = level;
+        bic.imageSubresource.baseArrayLayer = 0;
+        bic.imageSubresource.layerCount = 1;
+        bic.imageExtent = {std::max(1u, extent.width >> level), std::max(1u, extent.height >> level), 1};
+        staging_size += (levels[level].size() + 15) & ~VkDeviceSize(15);
+    }
+    AllocatedBuffer staging_buffer = engine.create_buffer(staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
     // copy pixel data to buffer
     void* data;
     vmaMapMemory(engine.allocator, staging_buffer.allocation, &data);
-    memcpy(data, pixel_ptr, static_cast<size_t>(image_size));
+    for (uint32_t level = 0; level < levels.size(); level++) {
+        memcpy(static_cast<uint8_t*>(data) + regions[level].bufferOffset, levels[level].data(), levels[level].size());
+    }
     vmaUnmapMemory(engine.allocator, staging_buffer.allocation);
-    // We no longer need the loaded data, since it is in the staging buffer
-    stbi_image_free(pixels);
 
-    // Now create the image
-    VkExtent3D extent;
-    extent.width = static_cast<uint32_t>(texW);
-    extent.height = static_cast<uint32_t>(texH);
-    extent.depth = 1;
+    bool generate_mips = levels.size() < mip_levels;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (generate_mips) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; // Each level is blitted from the one above it
+    }
     // VK_IMAGE_USAGE_SAMPLED_BIT specifies that the image can occupy a descriptor set slot and be sampled bu a shader
-    VkImageCreateInfo ici = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, extent);
-    AllocatedImage new_image;
-    VmaAllocationCreateInfo aci = {};
-    aci.flags = VMA_MEMORY_USAGE_GPU_ONLY;
+    VkImageCreateInfo ici = vkinit::image_create_info(format, usage, extent);
+    ici.mipLevels = mip_levels;
     // Allocate and create image
-    vmaCreateImage(engine.allocator, &ici, &aci, &new_image.image, &new_image.allocation, nullptr);
+    AllocatedImage new_image = engine.create_image(ici, MemoryCategory::Textures);
 
     // Now we can copy the texture from the buffer to the image
     // You can't just copy data from a buffer to an image, since the image requires a layout. 
     // Thus we will do a layout transition to Linear, which is the best for copying buffer -> image
-    engine.immediate_submit([&](VkCommandBuffer cmd) {
-        VkImageSubresourceRange range;
-        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        range.baseMipLevel = 0;
-        range.levelCount = 1;
-        range.baseArrayLayer = 0;
-        range.layerCount = 1;
+    VkImageSubresourceRange range;
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = mip_levels;
+    range.baseArrayLayer = 0;
+    range.layerCount = 1;
+    // Blits need a graphics queue, so the mips are generated wherever the graphics family first owns the image.
+    // With a dedicated transfer queue, every level is released in TRANSFER_DST and the graphics queue acquires it, then blits.
+    bool dedicated = engine.has_dedicated_transfer_queue();
+    VkImageMemoryBarrier2 release_barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+    release_barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    release_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    release_barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    release_barrier.dstAccessMask = VK_ACCESS_2_NONE;
+    release_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    release_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    release_barrier.srcQueueFamilyIndex = engine.transfer_queue_family;
+    release_barrier.dstQueueFamilyIndex = engine.graphics_queue_family;
+    release_barrier.image = new_image.image;
+    release_barrier.subresourceRange = range;
+    VkExtent2D mip0_extent{extent.width, extent.height};
+    // Levels that came with the file only need to become shader readable
+    auto finish = [=](VkCommandBuffer cmd) {
+        if (generate_mips) {
+            vkutil::generate_mipmaps(cmd, new_image.image, mip0_extent, mip_levels);
+        } else {
+            vkutil::transition_image(cmd, new_image.image, vkutil::ImageUsage::TransferDst, vkutil::ImageUsage::Sampled);
+        }
+    };
+
+    engine.upload_submit([=](VkCommandBuffer cmd) {
         // If you do a pipeline barrier with an image barrier, you can transform the image to the correct format and layout
-        VkImageMemoryBarrier image_barrier_totransfer = {};
-        image_barrier_totransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        VkImageMemoryBarrier2 image_barrier_totransfer = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
+        image_barrier_totransfer.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        image_barrier_totransfer.srcAccessMask = VK_ACCESS_2_NONE;
+        image_barrier_totransfer.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        image_barrier_totransfer.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
         image_barrier_totransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         image_barrier_totransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_barrier_totransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier_totransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
         image_barrier_totransfer.image = new_image.image;
         image_barrier_totransfer.subresourceRange = range;
-        image_barrier_totransfer.srcAccessMask = 0;
-        image_barrier_totransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
         // Barrier the image to the transfer-receive layout
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_totransfer);
+        VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &image_barrier_totransfer};
+        vkCmdPipelineBarrier2(cmd, &depinfo);
 
-        // Now the image is ready to receive buffer data, so lets copy
-        VkBufferImageCopy bic = {};
-        bic.bufferOffset = 0;
-        bic.bufferRowLength = 0;
-        bic.bufferImageHeight = 0;
-        bic.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        bic.imageSubresource.mipLevel = 0;
-        bic.imageSubresource.baseArrayLayer = 0;
-        bic.imageSubresource.layerCount = 1;
-        bic.imageExtent = extent;
-        vkCmdCopyBufferToImage(cmd, staging_buffer.buffer, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bic);
-
-        // The image has the correct pixel data, now change its layout to a shader-readable one
-        VkImageMemoryBarrier image_barrier_toreadable = image_barrier_totransfer;
-        image_barrier_toreadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        image_barrier_toreadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        image_barrier_toreadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        image_barrier_toreadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier_toreadable);
+        // Now the image is ready to receive buffer data, so lets copy every level in one go
+        vkCmdCopyBufferToImage(cmd, staging_buffer.buffer, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+        if (dedicated) {
+            depinfo.pImageMemoryBarriers = &release_barrier;
+            vkCmdPipelineBarrier2(cmd, &depinfo);
+        } else {
+            // The upload queue is the graphics queue, so the chain can be finished right away
+            finish(cmd);
+        }
+    }, [=](VkCommandBuffer cmd) {
+        VkImageMemoryBarrier2 acquire_barrier = release_barrier;
+        acquire_barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        acquire_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        acquire_barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        acquire_barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        VkDependencyInfo depinfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .imageMemoryBarrierCount = 1, .pImageMemoryBarriers = &acquire_barrier};
+        vkCmdPipelineBarrier2(cmd, &depinfo);
+        finish(cmd);
+    }, [=, &engine, on_ready = std::move(on_ready)]() {
+        engine.destroy_buffer(staging_buffer);
+        if (on_ready) {
+            on_ready();
+        }
     });
-    engine.main_deletion_queue.push_function([=]() {
-        vmaDestroyImage(engine.allocator, new_image.image, new_image.allocation);
+    return new_image;
+}
+
+bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& out_image) {
+    int texW, texH, texChannels;
+    // Load the texture directly into an array of pixels
+    stbi_uc* pixels = stbi_load(file, &texW, &texH, &texChannels, STBI_rgb_alpha); // STBI_rgb_alpha will load pixels as RGBA 4 channels, which will match Vulkan format
+    if (!pixels) {
+        std::cout << "Failed to load texture file " << file << std::endl;
+        return false;
+    }
+    size_t image_size = static_cast<size_t>(texH) * texW * 4; // 4 bytes per pixel times the # of pixels
+    // R8G8B8A8 format matches exactly with the pixels loaded from stb
+    VkFormat image_format = VK_FORMAT_R8G8B8A8_SRGB;
+    VkExtent3D extent;
+    extent.width = static_cast<uint32_t>(texW);
+    extent.height = static_cast<uint32_t>(texH);
+    extent.depth = 1;
+    // A full mip chain is generated with blits, which needs linear filtering support for the format.
+    // Without it the texture keeps a single level.
+    bool can_blit = can_sample(engine, image_format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+    uint32_t mip_levels = can_blit ? mip_level_count(VkExtent2D{extent.width, extent.height}) : 1;
+    AllocatedImage new_image = upload_image(engine, image_format, extent, mip_levels, {std::span<const uint8_t>(pixels, image_size)});
+    // We no longer need the loaded data, since it is in the staging buffer
+    stbi_image_free(pixels);
+    engine.main_deletion_queue.push_function([=, &engine]() {
+        engine.destroy_image(new_image);
+    });
+    out_image = new_image;
+    std::cout << "Texture loaded successfully: " << file << std::endl;
+    return true;
+}
+
+bool vkutil::make_sampleable(VulkanEngine& engine, ktx::Texture& texture) {
+    bc::Format bc_format;
+    bool srgb;
+    if (!block_format(texture.format, bc_format, srgb) || (engine.texture_compression_bc && can_sample(engine, texture.format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))) {
+        return true;
+    }
+    for (uint32_t level = 0; level < texture.levels.size(); level++) {
+        uint32_t width = std::max(1u, texture.width >> level);
+        uint32_t height = std::max(1u, texture.height >> level);
+        std::vector<uint8_t> decoded(static_cast<size_t>(width) * height * 4);
+        if (!bc::decode_image(bc_format, texture.levels[level].data(), width, height, decoded.data())) {
+            return false;
+        }
+        texture.levels[level] = std::move(decoded);
+    }
+    texture.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    return true;
+}
+
+// The file's levels go straight into the staging buffer, unless the GPU can't sample them and they had to be decoded
+bool vkutil::load_ktx2_from_file(VulkanEngine& engine, const char* file, AllocatedImage& out_image) {
+    ktx::Texture texture;
+    if (!ktx::read_file(file, texture)) {
+        return false;
+    }
+    if (!make_sampleable(engine, texture)) {
+        std::cout << "Failed to decode " << file << " on the CPU" << std::endl;
+        return false;
+    }
+    VkExtent3D extent{texture.width, texture.height, 1};
+    std::vector<std::span<const uint8_t>> levels(texture.levels.begin(), texture.levels.end());
+    AllocatedImage new_image = upload_image(engine, texture.format, extent, static_cast<uint32_t>(levels.size()), levels);
+    engine.main_deletion_queue.push_function([=, &engine]() {
+        engine.destroy_image(new_image);
     });
-    vmaDestroyBuffer(engine.allocator, staging_buffer.buffer, staging_buffer.allocation);
     std::cout << "Texture loaded successfully: " << file << std::endl;
     out_image = new_image;
     return true;
 }
 
-void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout current_layout, VkImageLayout new_layout) {
+vkutil::ImageUsageInfo vkutil::image_usage_info(ImageUsage usage) {
+    switch (usage) {
+    case ImageUsage::ComputeWrite:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL};
+    case ImageUsage::ColorAttachment:
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    case ImageUsage::DepthAttachment:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL};
+    case ImageUsage::TransferSrc:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+    case ImageUsage::TransferDst:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+    case ImageUsage::Sampled:
+        return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    case ImageUsage::ComputeSampled:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    case ImageUsage::Present:
+        // The present semaphore carries the dependency, so the barrier itself waits on nothing
+        return {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+    case ImageUsage::Undefined:
+    default:
+        return {VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED};
+    }
+}
+
+VkImageMemoryBarrier2 vkutil::image_barrier(VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents) {
+    ImageUsageInfo src = image_usage_info(src_usage);
+    ImageUsageInfo dst = image_usage_info(dst_usage);
     VkImageMemoryBarrier2 image_barrier = {.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2};
     image_barrier.pNext = nullptr;
-    image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-    image_barrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
-    image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
-    image_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
-    image_barrier.oldLayout = current_layout;
-    image_barrier.newLayout = new_layout;
-    VkImageAspectFlags aspect_mask = (new_layout == VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    image_barrier.subresourceRange = vkinit::image_subresource_range(aspect_mask);
+    image_barrier.srcStageMask = src.stage;
+    // Only writes need to be made available. A read before the barrier just needs the execution dependency.
+    image_barrier.srcAccessMask = src.access & (VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+                                                VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    image_barrier.dstStageMask = dst.stage;
+    image_barrier.dstAccessMask = dst.access;
+    image_barrier.oldLayout = discard_contents ? VK_IMAGE_LAYOUT_UNDEFINED : src.layout;
+    image_barrier.newLayout = dst.layout;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bool depth = src_usage == ImageUsage::DepthAttachment || dst_usage == ImageUsage::DepthAttachment;
+    image_barrier.subresourceRange = vkinit::image_subresource_range(depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT);
     image_barrier.image = image;
+    return image_barrier;
+}
+
+void vkutil::ImageBarrierBatch::add(VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents) {
+    barriers.push_back(image_barrier(image, src_usage, dst_usage, discard_contents));
+}
+
+void vkutil::ImageBarrierBatch::flush(VkCommandBuffer cmd) {
+    if (barriers.empty()) {
+        return;
+    }
     VkDependencyInfo depinfo{};
     depinfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
     depinfo.pNext = nullptr;
-    depinfo.imageMemoryBarrierCount = 1;
-    depinfo.pImageMemoryBarriers = &image_barrier;
-    vkCmdPipelineBarrier2(cmd,&depinfo);
+    depinfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+    depinfo.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &depinfo);
+    barriers.clear();
+}
+
+void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents) {
+    ImageBarrierBatch batch;
+    batch.add(image, src_usage, dst_usage, discard_contents);
+    batch.flush(cmd);
+}
+
+uint32_t vkutil::mip_level_count(VkExtent2D size) {
+    return static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+}
+
+// Expects every level in TRANSFER_DST with level 0 filled in. Each level is blitted from the one above it,
+// and the whole chain ends up shader readable.
+void vkutil::generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mip_levels) {
+    ImageBarrierBatch barriers;
+    for (uint32_t level = 1; level < mip_levels; level++) {
+        VkImageMemoryBarrier2 to_src = image_barrier(image, ImageUsage::TransferDst, ImageUsage::TransferSrc);
+        to_src.subresourceRange.baseMipLevel = level - 1;
+        to_src.subresourceRange.levelCount = 1;
+        barriers.barriers.push_back(to_src);
+        barriers.flush(cmd);
+
+        VkExtent2D half_size{std::max(1u, size.width / 2), std::max(1u, size.height / 2)};
+        VkImageBlit2 blit_region{.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2, .pNext = nullptr};
+        blit_region.srcOffsets[1] = {static_cast<int32_t>(size.width), static_cast<int32_t>(size.height), 1};
+        blit_region.dstOffsets[1] = {static_cast<int32_t>(half_size.width), static_cast<int32_t>(half_size.height), 1};
+        blit_region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        blit_region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+
+        VkBlitImageInfo2 blitinfo{.sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2, .pNext = nullptr};
+        blitinfo.srcImage = image;
+        blitinfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        blitinfo.dstImage = image;
+        blitinfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        blitinfo.filter = VK_FILTER_LINEAR;
+        blitinfo.regionCount = 1;
+        blitinfo.pRegions = &blit_region;
+        vkCmdBlitImage2(cmd, &blitinfo);
+        size = half_size;
+    }
+
+    // Every level but the last was a blit source
+    if (mip_levels > 1) {
+        VkImageMemoryBarrier2 sources = image_barrier(image, ImageUsage::TransferSrc, ImageUsage::Sampled);
+        sources.subresourceRange.levelCount = mip_levels - 1;
+        barriers.barriers.push_back(sources);
+    }
+    VkImageMemoryBarrier2 last = image_barrier(image, ImageUsage::TransferDst, ImageUsage::Sampled);
+    last.subresourceRange.baseMipLevel = mip_levels - 1;
+    last.subresourceRange.levelCount = 1;
+    barriers.barriers.push_back(last);
+    barriers.flush(cmd);
 }
 
 void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage src, VkExtent2D src_size, VkImage dst, VkExtent2D dst_size) {
@@ -1,10 +1,53 @@
 #pragma once
 
 #include <vk_types.h>
-#include <vk_engine.h>
+#include <vk_ktx.h>
+
+class VulkanEngine;
 
 namespace vkutil {
+    // How an image is accessed on one side of a barrier. Each usage maps to a layout and the narrowest stage/access masks.
+    enum class ImageUsage {
+        Undefined,       // Nothing has touched the image yet
+        ComputeWrite,    // Storage image written by a compute shader
+        ColorAttachment, // Loaded and stored by dynamic rendering
+        DepthAttachment,
+        TransferSrc,     // Source of a copy or blit
+        TransferDst,     // Destination of a copy or blit
+        Sampled,         // Read through a sampler in the fragment shader
+        ComputeSampled,  // Read through a sampler in a compute shader
+        Present,
+    };
+
+    struct ImageUsageInfo {
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+        VkImageLayout layout;
+    };
+
+    ImageUsageInfo image_usage_info(ImageUsage usage);
+    // discard_contents keeps the execution dependency on src_usage but transitions from UNDEFINED, so the old contents need not be preserved
+    VkImageMemoryBarrier2 image_barrier(VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents = false);
+
+    // Collects image barriers so that several transitions go out in one vkCmdPipelineBarrier2
+    struct ImageBarrierBatch {
+        std::vector<VkImageMemoryBarrier2> barriers;
+
+        void add(VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents = false);
+        void flush(VkCommandBuffer cmd);
+    };
+
     bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& out_image);
-    void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout current_layout, VkImageLayout new_layout);
+    bool load_ktx2_from_file(VulkanEngine& engine, const char* file, AllocatedImage& out_image); // BC1/BC3/BC7 or RGBA8 with its mip chain
+    // Without GPU support for its BC format, decodes every level to RGBA8 in place. Returns false if that isn't possible.
+    bool make_sampleable(VulkanEngine& engine, ktx::Texture& texture);
+    // Creates a sampled image and copies the given levels into it through one staging buffer. If fewer levels are given than
+    // mip_levels, the rest of the chain is generated with blits from level 0. on_ready runs once the frame being recorded can
+    // sample the image. The caller owns the image.
+    AllocatedImage upload_image(VulkanEngine& engine, VkFormat format, VkExtent3D extent, uint32_t mip_levels,
+                                const std::vector<std::span<const uint8_t>>& levels, std::function<void()>&& on_ready = nullptr);
+    void transition_image(VkCommandBuffer cmd, VkImage image, ImageUsage src_usage, ImageUsage dst_usage, bool discard_contents = false);
+    uint32_t mip_level_count(VkExtent2D size); // Levels in a full chain down to 1x1
+    void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D size, uint32_t mip_levels);
     void copy_image_to_image(VkCommandBuffer cmd, VkImage src, VkExtent2D src_size, VkImage dst, VkExtent2D dst_size);
 }
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include <vk_texture_streamer.h>
+
+#include <vk_engine.h>
+#include <vk_initializers.h>
+#include <vk_texture.h>
+
+void TextureStreamer::init(VulkanEngine* engine) {
+    this->engine = engine;
+}
+
+// Uploads still in flight have already been swapped in by VulkanEngine::finish_uploads
+void TextureStreamer::cleanup() {
+    for (StreamedTexture& texture : textures) {
+        if (texture.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(engine->device, texture.view, nullptr);
+            engine->destroy_image(texture.image);
+        }
+    }
+    textures.clear();
+    committed_memory = 0;
+}
+
+int TextureStreamer::add_texture(const std::string& name, ktx::Texture&& source) {
+    StreamedTexture texture;
+    texture.name = name;
+    texture.source = std::move(source);
+    uint32_t level_count = static_cast<uint32_t>(texture.source.levels.size());
+    texture.base_level = level_count - 1;
+    for (uint32_t level = 0; level < level_count; level++) {
+        if (std::max(texture.source.width >> level, texture.source.height >> level) <= base_size) {
+            texture.base_level = level;
+            break;
+        }
+    }
+    texture.resident_level = texture.base_level;
+    textures.push_back(std::move(texture));
+    int index = static_cast<int>(textures.size() - 1);
+    committed_memory += chain_size(textures[index], textures[index].base_level);
+    load_levels(index, textures[index].base_level);
+    return index;
+}
+
+int TextureStreamer::find(const std::string& name) const {
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (textures[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void TextureStreamer::request(int texture, uint32_t level, uint64_t frame) {
+    StreamedTexture& streamed = textures[texture];
+    streamed.requested_level = std::min(streamed.requested_level, level);
+    streamed.last_used_frame = frame;
+}
+
+void TextureStreamer::update(uint64_t frame) {
+    // Stay under the VRAM budget as well, which shrinks when other allocations or other processes need the memory
+    VkDeviceSize limit = std::min(budget, committed_memory + engine->memory.device_headroom());
+
+    // Textures missing the most levels load first
+    std::vector<int> wanted;
+    for (int i = 0; i < static_cast<int>(textures.size()); i++) {
+        const StreamedTexture& texture = textures[i];
+        if (texture.last_used_frame == frame && !texture.loading && std::min(texture.requested_level, texture.base_level) < texture.resident_level) {
+            wanted.push_back(i);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end(), [&](int a, int b) {
+        return textures[a].resident_level - textures[a].requested_level > textures[b].resident_level - textures[b].requested_level;
+    });
+
+    uint32_t loads = 0;
+    for (int index : wanted) {
+        if (loads == max_loads_per_frame) {
+            break;
+        }
+        StreamedTexture& texture = textures[index];
+        VkDeviceSize resident_size = chain_size(texture, texture.resident_level);
+        // Settle for a coarser level when the finest one can't be made to fit
+        uint32_t level = std::min(texture.requested_level, texture.base_level);
+        for (; level < texture.resident_level; level++) {
+            VkDeviceSize needed = committed_memory + chain_size(texture, level) - resident_size;
+            if (needed <= limit) {
+                break;
+            }
+            std::vector<Eviction> evictions = find_evictions(index, frame);
+            VkDeviceSize reclaimable = 0;
+            for (const Eviction& eviction : evictions) {
+                reclaimable += eviction.freed;
+            }
+            if (needed - limit <= reclaimable) {
+                evict(evictions, needed - limit);
+                break;
+            }
+        }
+        if (level == texture.resident_level) {
+            continue;
+        }
+        committed_memory += chain_size(texture, level) - resident_size;
+        load_levels(index, level);
+        load_count++;
+        loads++;
+    }
+
+    // The budget can also be lowered at runtime
+    if (committed_memory > budget) {
+        evict(find_evictions(-1, frame), committed_memory - budget);
+    }
+    for (StreamedTexture& texture : textures) {
+        texture.requested_level = UINT32_MAX;
+    }
+}
+
+// Every texture drops to its base levels, least recently used first, until enough is freed.
+// The memory comes back once the smaller chains land and the old images are destroyed.
+VkDeviceSize TextureStreamer::release(VkDeviceSize wanted) {
+    return evict(find_evictions(-1, UINT64_MAX), wanted);
+}
+
+VkDeviceSize TextureStreamer::chain_size(const StreamedTexture& texture, uint32_t level) const {
+    VkDeviceSize size = 0;
+    for (uint32_t l = level; l < texture.source.levels.size(); l++) {
+        size += texture.source.levels[l].size();
+    }
+    return size;
+}
+
+// Every level change re-uploads the whole chain from system memory. The small levels are cheap next to the
+// new top level, and it keeps each image a complete chain that can replace the old one in a single swap.
+void TextureStreamer::load_levels(int index, uint32_t level) {
+    StreamedTexture& texture = textures[index];
+    std::vector<std::span<const uint8_t>> levels(texture.source.levels.begin() + level, texture.source.levels.end());
+    VkExtent3D extent{std::max(1u, texture.source.width >> level), std::max(1u, texture.source.height >> level), 1};
+    texture.loading = true;
+    texture.target_level = level;
+    texture.pending_image = vkutil::upload_image(*engine, texture.source.format, extent, static_cast<uint32_t>(levels.size()), levels, [this, index, level]() {
+        StreamedTexture& texture = textures[index];
+        VkImageViewCreateInfo ivci = vkinit::imageview_create_info(texture.pending_image.format, texture.pending_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        ivci.subresourceRange.levelCount = texture.pending_image.mip_levels;
+        VkImageView view;
+        VK_CHECK(vkCreateImageView(engine->device, &ivci, nullptr, &view));
+        // Frames still in flight may be sampling the old chain. Fences signal in submission order,
+        // so once the frame being recorded is done, all of them are.
+        if (texture.view != VK_NULL_HANDLE) {
+            VulkanEngine* engine = this->engine;
+            AllocatedImage old_image = texture.image;
+            VkImageView old_view = texture.view;
+            engine->get_current_frame().deletion_queue.push_function([=]() {
+                vkDestroyImageView(engine->device, old_view, nullptr);
+                engine->destroy_image(old_image);
+            });
+        }
+        texture.image = texture.pending_image;
+        texture.view = view;
+        texture.pending_image = {};
+        texture.resident_level = level;
+        texture.loading = false;
+    });
+}
+
+// A texture that wasn't used this frame can drop to its base levels. One that was used can still give up
+// levels finer than it asked for.
+std::vector<TextureStreamer::Eviction> TextureStreamer::find_evictions(int keep, uint64_t frame) const {
+    std::vector<Eviction> evictions;
+    for (int i = 0; i < static_cast<int>(textures.size()); i++) {
+        const StreamedTexture& texture = textures[i];
+        if (i == keep || texture.loading) {
+            continue;
+        }
+        uint32_t level = texture.last_used_frame == frame ? std::min(texture.requested_level, texture.base_level) : texture.base_level;
+        if (level <= texture.resident_level) {
+            continue;
+        }
+        evictions.push_back(Eviction{i, level, chain_size(texture, texture.resident_level) - chain_size(texture, level), texture.last_used_frame});
+    }
+    std::sort(evictions.begin(), evictions.end(), [](const Eviction& a, const Eviction& b) { return a.last_used_frame < b.last_used_frame; });
+    return evictions;
+}
+
+VkDeviceSize TextureStreamer::evict(const std::vector<Eviction>& evictions, VkDeviceSize needed) {
+    VkDeviceSize freed = 0;
+    for (const Eviction& eviction : evictions) {
+        if (freed >= needed) {
+            break;
+        }
+        committed_memory -= eviction.freed;
+        freed += eviction.freed;
+        load_levels(eviction.texture, eviction.level);
+        eviction_count++;
+    }
+    return freed;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_ktx.h>
+
+class VulkanEngine;
+
+struct StreamedTexture {
+    std::string name;
+    ktx::Texture source; // Every level, kept in system memory so mips can be dropped and loaded again
+    AllocatedImage image{}; // Holds levels [resident_level, end) of the source
+    VkImageView view{VK_NULL_HANDLE};
+    AllocatedImage pending_image{}; // Upload in flight, swapped in once it lands
+    uint32_t resident_level{0}; // Finest level on the GPU
+    uint32_t target_level{0}; // What resident_level will be once the upload in flight lands
+    uint32_t base_level{0}; // Coarsest chain, which always stays resident
+    uint32_t requested_level{UINT32_MAX}; // Finest level asked for this frame
+    uint64_t last_used_frame{0};
+    bool loading{false};
+};
+
+// Keeps only the mips that are actually visible on the GPU. Every texture starts out with just its small levels.
+// Each frame, feedback requests the level that is needed, and finer levels are loaded while they fit in the budget.
+// When they don't, textures that were used least recently drop back to their base levels.
+// A level change uploads a new image and swaps it in between frames, so a frame only ever sees a complete chain.
+class TextureStreamer {
+public:
+    void init(VulkanEngine* engine);
+    void cleanup();
+
+    int add_texture(const std::string& name, ktx::Texture&& source); // Starts loading the base levels. Returns the texture's id.
+    int find(const std::string& name) const; // -1 when the texture isn't streamed
+    void request(int texture, uint32_t level, uint64_t frame); // Feedback for one use of the texture this frame
+    void update(uint64_t frame); // Evicts and starts loads. Call once per frame, after all the requests.
+    VkImageView get_view(int texture) const { return textures[texture].view; }
+    VkDeviceSize release(VkDeviceSize wanted); // Drops mips from the least recently used textures. Returns how much was freed.
+
+    VkDeviceSize budget{256ull * 1024 * 1024};
+    uint32_t max_loads_per_frame{2}; // Spreads the upload cost over several frames
+    uint32_t base_size{64}; // Levels this size and smaller are loaded up front and never evicted
+
+    // Stats
+    VkDeviceSize committed_memory{0}; // What every texture uses once the uploads in flight land
+    uint32_t load_count{0};
+    uint32_t eviction_count{0};
+    std::vector<StreamedTexture> textures;
+
+private:
+    struct Eviction {
+        int texture;
+        uint32_t level; // Level to drop back to
+        VkDeviceSize freed;
+        uint64_t last_used_frame;
+    };
+
+    VkDeviceSize chain_size(const StreamedTexture& texture, uint32_t level) const; // Bytes in levels [level, end)
+    void load_levels(int texture, uint32_t level);
+    std::vector<Eviction> find_evictions(int keep, uint64_t frame) const; // Least recently used first
+    VkDeviceSize evict(const std::vector<Eviction>& evictions, VkDeviceSize needed); // Returns how much was freed
+
+    VulkanEngine* engine{nullptr};
+};
@@ -11,8 +11,10 @@
 #include <array>
 #include <functional>
 #include <deque>
+#include <algorithm>
 #include <unordered_map>
 #include <iostream>
+#include <chrono>
 
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
@@ -46,4 +48,5 @@ struct AllocatedImage {
     VmaAllocation allocation;
 	VkExtent3D extent;
 	VkFormat format;
+	uint32_t mip_levels{1};
 };
\ No newline at end of file
@@ -0,0 +1,464 @@
+#include <vk_voxel.h>
+
+namespace {
+
+constexpr float POSITION_EPSILON = 1e-3f;
+constexpr float UV_EPSILON = 1e-5f;
+
+// The two axes across a face along axis, ordered so that u x v points along +axis
+glm::ivec2 tangent_axes(int axis) {
+    return {(axis + 1) % 3, (axis + 2) % 3};
+}
+
+bool near_integer(float value) {
+    return std::abs(value - std::round(value)) < POSITION_EPSILON;
+}
+
+// 20 bits per coordinate and 3 for the direction, for cells within half a million blocks of the origin
+uint64_t face_key(glm::ivec3 cell, int direction) {
+    auto field = [](int32_t value) { return static_cast<uint64_t>(value + (1 << 19)) & 0xfffff; };
+    return (field(cell.x) << 43) | (field(cell.y) << 23) | (field(cell.z) << 3) | static_cast<uint64_t>(direction);
+}
+
+// Two triangles on the same unit square of the grid, gathered before deciding whether they make a block face
+struct PendingFace {
+    glm::ivec3 cell; // The block behind the face
+    int direction;
+    glm::vec2 corner_uvs[4]; // Indexed by u + 2 * v
+    uint32_t corners{0}; // One bit per corner seen
+    uint32_t triangles{0};
+    float area{0.0f};
+    bool rejected{false}; // Corners that disagree on their texture coordinates
+    bool accepted{false};
+};
+
+} // namespace
+
+VoxelChunk::VoxelChunk() : palette{0}, counts{VOLUME} {}
+
+BlockId VoxelChunk::get(uint32_t index) const {
+    if (bits_per_block == 0) {
+        return palette[0];
+    }
+    uint32_t bit = index * bits_per_block;
+    uint64_t entry = (words[bit >> 6] >> (bit & 63)) & ((1ull << bits_per_block) - 1);
+    return palette[entry];
+}
+
+void VoxelChunk::set(uint32_t index, BlockId block) {
+    uint32_t bit = index * bits_per_block;
+    uint32_t old_entry = bits_per_block == 0 ? 0 : static_cast<uint32_t>((words[bit >> 6] >> (bit & 63)) & ((1ull << bits_per_block) - 1));
+    if (palette[old_entry] == block) {
+        return;
+    }
+    uint32_t entry = static_cast<uint32_t>(std::find(palette.begin(), palette.end(), block) - palette.begin());
+    if (entry == palette.size()) {
+        // Reuse an entry no block points at anymore before growing the palette
+        entry = 1;
+        while (entry < palette.size() && counts[entry] != 0) {
+            entry++;
+        }
+        if (entry == palette.size()) {
+            palette.push_back(block);
+            counts.push_back(0);
+            if (palette.size() > (1ull << bits_per_block)) {
+                repack(bits_per_block == 0 ? 1 : bits_per_block * 2);
+                bit = index * bits_per_block;
+            }
+        } else {
+            palette[entry] = block;
+        }
+    }
+    counts[old_entry]--;
+    counts[entry]++;
+    // Power of two widths never straddle two words
+    uint64_t mask = ((1ull << bits_per_block) - 1) << (bit & 63);
+    words[bit >> 6] = (words[bit >> 6] & ~mask) | (static_cast<uint64_t>(entry) << (bit & 63));
+}
+
+void VoxelChunk::repack(uint32_t bits) {
+    std::vector<uint64_t> packed(VOLUME * bits / 64, 0);
+    for (uint32_t i = 0; i < VOLUME; i++) {
+        uint64_t entry = 0;
+        if (bits_per_block != 0) {
+            uint32_t old_bit = i * bits_per_block;
+            entry = (words[old_bit >> 6] >> (old_bit & 63)) & ((1ull << bits_per_block) - 1);
+        }
+        uint32_t bit = i * bits;
+        packed[bit >> 6] |= entry << (bit & 63);
+    }
+    words = std::move(packed);
+    bits_per_block = bits;
+}
+
+uint64_t VoxelWorld::chunk_key(glm::ivec3 coord) {
+    auto field = [](int32_t value) { return static_cast<uint64_t>(static_cast<uint32_t>(value) & 0x1fffff); };
+    return (field(coord.x) << 42) | (field(coord.y) << 21) | field(coord.z);
+}
+
+VoxelChunk& VoxelWorld::chunk_at(glm::ivec3 coord) {
+    auto [it, inserted] = chunks.try_emplace(chunk_key(coord));
+    if (inserted) {
+        it->second.coord = coord;
+    }
+    return it->second;
+}
+
+const VoxelChunk* VoxelWorld::find_chunk(glm::ivec3 coord) const {
+    auto it = chunks.find(chunk_key(coord));
+    return it == chunks.end() ? nullptr : &it->second;
+}
+
+BlockId VoxelWorld::get_block(glm::ivec3 cell) const {
+    const VoxelChunk* chunk = find_chunk(cell >> 5);
+    return chunk ? chunk->get(VoxelChunk::index(cell & (VoxelChunk::SIZE - 1))) : 0;
+}
+
+void VoxelWorld::set_block(glm::ivec3 cell, BlockId block) {
+    glm::ivec3 coord = cell >> 5;
+    glm::ivec3 local = cell & (VoxelChunk::SIZE - 1);
+    VoxelChunk& chunk = chunk_at(coord);
+    if (chunk.get(VoxelChunk::index(local)) == block) {
+        return;
+    }
+    chunk.set(VoxelChunk::index(local), block);
+    auto mark = [&](glm::ivec3 dirty_coord) {
+        auto it = chunks.find(chunk_key(dirty_coord));
+        if (it != chunks.end() && !it->second.dirty) {
+            it->second.dirty = true;
+            dirty_chunks.push_back(it->first);
+        }
+    };
+    mark(coord);
+    // A block on the chunk's edge hides or shows a face in the neighbour
+    for (int axis = 0; axis < 3; axis++) {
+        glm::ivec3 step(0);
+        step[axis] = 1;
+        if (local[axis] == 0) {
+            mark(coord - step);
+        } else if (local[axis] == VoxelChunk::SIZE - 1) {
+            mark(coord + step);
+        }
+    }
+}
+
+uint16_t VoxelWorld::add_face_texture(const FaceTexture& face) {
+    auto quantize = [](float value) { return static_cast<int32_t>(std::lround(value * 1048576.0f)); };
+    std::array<int32_t, 10> key = {quantize(face.tile_min.x), quantize(face.tile_min.y), quantize(face.tile_size.x), quantize(face.tile_size.y),
+                                   quantize(face.origin.x),   quantize(face.origin.y),   quantize(face.axis_u.x),    quantize(face.axis_u.y),
+                                   quantize(face.axis_v.x),   quantize(face.axis_v.y)};
+    auto [it, inserted] = face_texture_ids.try_emplace(key, static_cast<uint16_t>(face_textures.size()));
+    if (inserted) {
+        face_textures.push_back(face);
+    }
+    return it->second;
+}
+
+BlockId VoxelWorld::add_block_type(const std::array<uint16_t, 6>& faces) {
+    auto [it, inserted] = block_type_ids.try_emplace(faces, static_cast<BlockId>(block_types.size()));
+    if (inserted) {
+        block_types.push_back(faces);
+    }
+    return it->second;
+}
+
+BlockId VoxelWorld::filled_type(BlockId block) {
+    const std::array<uint16_t, 6>& faces = block_types[block];
+    // Sides before the top and bottom, which tend to have their own textures
+    uint16_t fallback = 0;
+    for (int direction : {0, 1, 4, 5, 2, 3}) {
+        if (faces[direction] != 0) {
+            fallback = faces[direction];
+            break;
+        }
+    }
+    std::array<uint16_t, 6> filled = faces;
+    for (int direction = 0; direction < 6; direction++) {
+        if (filled[direction] == 0) {
+            filled[direction] = faces[direction ^ 1] != 0 ? faces[direction ^ 1] : fallback;
+        }
+    }
+    return add_block_type(filled);
+}
+
+void VoxelWorld::voxelize(std::span<const Vertex> triangles, std::vector<Vertex>& leftovers) {
+    // Every triangle that lies on a grid plane within one unit square joins the face of that square
+    std::unordered_map<uint64_t, PendingFace> faces;
+    std::vector<PendingFace*> triangle_faces(triangles.size() / 3, nullptr);
+    for (size_t t = 0; t < triangle_faces.size(); t++) {
+        const Vertex* vertices = &triangles[t * 3];
+        glm::vec3 normal = vertices[0].normal;
+        int axis = std::abs(normal.x) > std::abs(normal.y) ? (std::abs(normal.x) > std::abs(normal.z) ? 0 : 2) : (std::abs(normal.y) > std::abs(normal.z) ? 1 : 2);
+        float plane = vertices[0].position[axis];
+        if (std::abs(normal[axis]) < 1.0f - POSITION_EPSILON || !near_integer(plane)) {
+            continue;
+        }
+        glm::ivec2 tangents = tangent_axes(axis);
+        glm::vec3 centroid = (vertices[0].position + vertices[1].position + vertices[2].position) / 3.0f;
+        // The block is on the side the face points away from
+        glm::ivec3 cell;
+        cell[axis] = static_cast<int32_t>(std::lround(plane)) - (normal[axis] > 0.0f ? 1 : 0);
+        cell[tangents.x] = static_cast<int32_t>(std::floor(centroid[tangents.x]));
+        cell[tangents.y] = static_cast<int32_t>(std::floor(centroid[tangents.y]));
+        int corners[3];
+        bool on_grid = true;
+        for (int v = 0; v < 3; v++) {
+            float u_local = vertices[v].position[tangents.x] - cell[tangents.x];
+            float v_local = vertices[v].position[tangents.y] - cell[tangents.y];
+            on_grid = on_grid && std::abs(vertices[v].position[axis] - plane) < POSITION_EPSILON && near_integer(u_local) && near_integer(v_local)
+                      && u_local > -0.5f && u_local < 1.5f && v_local > -0.5f && v_local < 1.5f;
+            corners[v] = static_cast<int>(std::lround(u_local)) + 2 * static_cast<int>(std::lround(v_local));
+        }
+        if (!on_grid) {
+            continue;
+        }
+        int direction = axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+        PendingFace& face = faces[face_key(cell, direction)];
+        face.cell = cell;
+        face.direction = direction;
+        for (int v = 0; v < 3; v++) {
+            uint32_t bit = 1u << corners[v];
+            if ((face.corners & bit) && glm::any(glm::greaterThan(glm::abs(face.corner_uvs[corners[v]] - vertices[v].uv), glm::vec2(UV_EPSILON)))) {
+                face.rejected = true;
+            }
+            face.corner_uvs[corners[v]] = vertices[v].uv;
+            face.corners |= bit;
+        }
+        face.triangles++;
+        face.area += 0.5f * glm::length(glm::cross(vertices[1].position - vertices[0].position, vertices[2].position - vertices[0].position));
+        triangle_faces[t] = &face;
+    }
+
+    // Whole squares with an unstretched tile on them become block faces
+    std::unordered_map<uint64_t, std::pair<glm::ivec3, std::array<uint16_t, 6>>> cells;
+    float tile_aspect = 0.0f; // The shader works out a tile's height from its width, so they all need the same shape
+    double uv_area = 0.0;
+    size_t face_count = 0;
+    for (auto& [key, face] : faces) {
+        if (face.rejected || face.triangles != 2 || face.corners != 0xf || std::abs(face.area - 1.0f) > POSITION_EPSILON) {
+            continue;
+        }
+        glm::vec2 uv00 = face.corner_uvs[0];
+        glm::vec2 du = face.corner_uvs[1] - uv00;
+        glm::vec2 dv = face.corner_uvs[2] - uv00;
+        // A parallelogram, with edges along the atlas axes, one along each
+        bool parallelogram = glm::all(glm::lessThan(glm::abs(face.corner_uvs[3] - (uv00 + du + dv)), glm::vec2(UV_EPSILON)));
+        bool du_along_x = std::abs(du.y) < UV_EPSILON && std::abs(du.x) > UV_EPSILON;
+        bool du_along_y = std::abs(du.x) < UV_EPSILON && std::abs(du.y) > UV_EPSILON;
+        bool dv_along_x = std::abs(dv.y) < UV_EPSILON && std::abs(dv.x) > UV_EPSILON;
+        bool dv_along_y = std::abs(dv.x) < UV_EPSILON && std::abs(dv.y) > UV_EPSILON;
+        if (!parallelogram || !((du_along_x && dv_along_y) || (du_along_y && dv_along_x))) {
+            continue;
+        }
+        FaceTexture texture;
+        texture.tile_size = glm::abs(du + dv);
+        float aspect = texture.tile_size.y / texture.tile_size.x;
+        if (tile_aspect == 0.0f) {
+            tile_aspect = aspect;
+        } else if (std::abs(aspect / tile_aspect - 1.0f) > POSITION_EPSILON) {
+            continue;
+        }
+        texture.tile_min = glm::min(glm::min(face.corner_uvs[0], face.corner_uvs[1]), glm::min(face.corner_uvs[2], face.corner_uvs[3]));
+        texture.origin = glm::round((uv00 - texture.tile_min) / texture.tile_size);
+        texture.axis_u = glm::round(du / texture.tile_size);
+        texture.axis_v = glm::round(dv / texture.tile_size);
+
+        auto& [cell, block_faces] = cells[face_key(face.cell, 0)];
+        cell = face.cell;
+        block_faces[face.direction] = add_face_texture(texture);
+        face.accepted = true;
+        uv_area += texture.tile_size.x * texture.tile_size.y;
+        face_count++;
+    }
+    for (auto& [key, block] : cells) {
+        set_block(block.first, add_block_type(block.second));
+    }
+    if (face_count > 0) {
+        uv_density = static_cast<float>(std::sqrt(uv_area / face_count));
+    }
+
+    for (size_t t = 0; t < triangle_faces.size(); t++) {
+        if (triangle_faces[t] && triangle_faces[t]->accepted) {
+            voxelized_triangles++;
+        } else {
+            // The loader stores the normal in the color, which the voxel shading would read as an atlas tile whenever z is positive.
+            // A zero color marks the triangle as ordinary texture coordinates.
+            for (size_t v = t * 3; v < t * 3 + 3; v++) {
+                leftovers.push_back(triangles[v]);
+                leftovers.back().color = glm::vec3(0.0f);
+            }
+        }
+    }
+    source_triangles += triangle_faces.size();
+}
+
+void VoxelWorld::remesh(JobSystem& jobs, std::vector<glm::ivec3>& remeshed) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<VoxelChunk*> work;
+    size_t old_triangles = 0;
+    for (uint64_t key : dirty_chunks) {
+        VoxelChunk& chunk = chunks.find(key)->second;
+        old_triangles += chunk.vertices.size() / 3;
+        work.push_back(&chunk);
+    }
+    // Each chunk only writes its own mesh and reads its neighbours' blocks, which nothing edits meanwhile
+    jobs.parallel_for(static_cast<uint32_t>(work.size()), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            mesh_chunk(*work[i]);
+        }
+    });
+    size_t new_triangles = 0;
+    for (VoxelChunk* chunk : work) {
+        new_triangles += chunk->vertices.size() / 3;
+        chunk->dirty = false;
+        remeshed.push_back(chunk->coord);
+    }
+    voxel_triangles = voxel_triangles - old_triangles + new_triangles;
+    dirty_chunks.clear();
+    remeshed_chunks = work.size();
+    remesh_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void VoxelWorld::mesh_chunk(VoxelChunk& chunk) const {
+    // Unpack the chunk with a one block border from its neighbours, so the face tests don't care where the chunk ends
+    constexpr int32_t PADDED = VoxelChunk::SIZE + 2;
+    auto padded_index = [](glm::ivec3 p) { return (p.x + 1) + PADDED * ((p.y + 1) + PADDED * (p.z + 1)); };
+    std::vector<BlockId> blocks(PADDED * PADDED * PADDED);
+    glm::ivec3 base = chunk.coord * VoxelChunk::SIZE;
+    for (int32_t z = -1; z <= VoxelChunk::SIZE; z++) {
+        for (int32_t y = -1; y <= VoxelChunk::SIZE; y++) {
+            for (int32_t x = -1; x <= VoxelChunk::SIZE; x++) {
+                glm::ivec3 p(x, y, z);
+                bool inside = glm::all(glm::greaterThanEqual(p, glm::ivec3(0))) && glm::all(glm::lessThan(p, glm::ivec3(VoxelChunk::SIZE)));
+                blocks[padded_index(p)] = inside ? chunk.get(VoxelChunk::index(p)) : get_block(base + p);
+            }
+        }
+    }
+
+    chunk.vertices.clear();
+    uint16_t mask[VoxelChunk::SIZE * VoxelChunk::SIZE];
+    for (int direction = 0; direction < 6; direction++) {
+        int axis = direction / 2;
+        glm::ivec3 normal = FACE_NORMALS[direction];
+        glm::ivec2 tangents = tangent_axes(axis);
+        for (int32_t slice = 0; slice < VoxelChunk::SIZE; slice++) {
+            // The texture of every face in this slice that looks out into air
+            for (int32_t v = 0; v < VoxelChunk::SIZE; v++) {
+                for (int32_t u = 0; u < VoxelChunk::SIZE; u++) {
+                    glm::ivec3 p;
+                    p[axis] = slice;
+                    p[tangents.x] = u;
+                    p[tangents.y] = v;
+                    BlockId block = blocks[padded_index(p)];
+                    mask[u + v * VoxelChunk::SIZE] = block != 0 && blocks[padded_index(p + normal)] == 0 ? block_types[block][direction] : 0;
+                }
+            }
+            // Grow each face along u as far as the texture stays the same, then along v as far as whole rows match
+            for (int32_t v = 0; v < VoxelChunk::SIZE; v++) {
+                for (int32_t u = 0; u < VoxelChunk::SIZE;) {
+                    uint16_t face = mask[u + v * VoxelChunk::SIZE];
+                    if (face == 0) {
+                        u++;
+                        continue;
+                    }
+                    int32_t width = 1;
+                    while (u + width < VoxelChunk::SIZE && mask[u + width + v * VoxelChunk::SIZE] == face) {
+                        width++;
+                    }
+                    int32_t height = 1;
+                    for (; v + height < VoxelChunk::SIZE; height++) {
+                        const uint16_t* row = &mask[u + (v + height) * VoxelChunk::SIZE];
+                        if (std::any_of(row, row + width, [&](uint16_t other) { return other != face; })) {
+                            break;
+                        }
+                    }
+                    for (int32_t row = v; row < v + height; row++) {
+                        std::fill_n(&mask[u + row * VoxelChunk::SIZE], width, uint16_t{0});
+                    }
+
+                    const FaceTexture& texture = face_textures[face];
+                    Vertex corners[4];
+                    const glm::ivec2 offsets[4] = {{0, 0}, {width, 0}, {width, height}, {0, height}};
+                    for (int c = 0; c < 4; c++) {
+                        glm::vec3 position;
+                        position[axis] = static_cast<float>(slice + (direction % 2 == 0 ? 1 : 0));
+                        position[tangents.x] = static_cast<float>(u + offsets[c].x);
+                        position[tangents.y] = static_cast<float>(v + offsets[c].y);
+                        corners[c].position = glm::vec3(base) + position;
+                        corners[c].normal = glm::vec3(normal);
+                        corners[c].color = glm::vec3(texture.tile_min, texture.tile_size.x);
+                        corners[c].uv = texture.origin + texture.axis_u * static_cast<float>(offsets[c].x) + texture.axis_v * static_cast<float>(offsets[c].y);
+                    }
+                    // Counter-clockwise seen from outside the block
+                    static constexpr int positive_order[6] = {0, 1, 2, 0, 2, 3};
+                    static constexpr int negative_order[6] = {0, 2, 1, 0, 3, 2};
+                    for (int corner : direction % 2 == 0 ? positive_order : negative_order) {
+                        chunk.vertices.push_back(corners[corner]);
+                    }
+                    u += width;
+                }
+            }
+        }
+    }
+}
+
+void VoxelWorld::dig(glm::ivec3 cell) {
+    BlockId block = get_block(cell);
+    if (block == 0) {
+        return;
+    }
+    std::array<uint16_t, 6> faces = block_types[block];
+    std::array<uint16_t, 6> filled = block_types[filled_type(block)];
+    set_block(cell, 0);
+    for (int direction = 0; direction < 6; direction++) {
+        glm::ivec3 neighbour = cell + FACE_NORMALS[direction];
+        int facing = direction ^ 1; // The neighbour's face towards the hole
+        BlockId other = get_block(neighbour);
+        if (other == 0) {
+            // A face the export left out means there was a block behind it, which the export left out as well
+            if (faces[direction] == 0) {
+                std::array<uint16_t, 6> hidden{};
+                hidden[facing] = filled[direction];
+                set_block(neighbour, add_block_type(hidden));
+            }
+        } else if (block_types[other][facing] == 0) {
+            std::array<uint16_t, 6> other_faces = block_types[other];
+            other_faces[facing] = block_types[filled_type(other)][facing];
+            set_block(neighbour, add_block_type(other_faces));
+        }
+    }
+}
+
+void VoxelWorld::place(glm::ivec3 cell, BlockId like) {
+    if (like == 0 || get_block(cell) != 0) {
+        return;
+    }
+    set_block(cell, filled_type(like));
+}
+
+bool VoxelWorld::raycast(glm::vec3 origin, glm::vec3 direction, float max_distance, glm::ivec3& cell, glm::ivec3& normal) const {
+    // Step from cell to cell through whichever boundary the ray crosses next
+    glm::ivec3 current = glm::ivec3(glm::floor(origin));
+    glm::ivec3 step = glm::ivec3(glm::sign(direction));
+    glm::vec3 delta = glm::abs(1.0f / direction);
+    glm::vec3 next;
+    for (int axis = 0; axis < 3; axis++) {
+        float boundary = static_cast<float>(current[axis] + (step[axis] > 0 ? 1 : 0));
+        next[axis] = step[axis] == 0 ? std::numeric_limits<float>::max() : (boundary - origin[axis]) / direction[axis];
+    }
+    normal = glm::ivec3(0);
+    float distance = 0.0f;
+    while (distance <= max_distance) {
+        if (get_block(current) != 0) {
+            cell = current;
+            return true;
+        }
+        int axis = next.x < next.y ? (next.x < next.z ? 0 : 2) : (next.y < next.z ? 1 : 2);
+        distance = next[axis];
+        current[axis] += step[axis];
+        next[axis] += delta[axis];
+        normal = glm::ivec3(0);
+        normal[axis] = -step[axis];
+    }
+    return false;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_mesh.h>
+#include <vk_jobs.h>
+
+#include <map>
+
+using BlockId = uint16_t; // 0 is air
+
+// How one face of a block samples the texture atlas. Within a block, the face's two tangent axes run from 0 to 1,
+// and texture coordinate origin + axis_u * u + axis_v * v, also from 0 to 1, picks the spot in the tile.
+// The axes are unit vectors along x or y, so the tile can be turned or mirrored, but not stretched.
+struct FaceTexture {
+    glm::vec2 tile_min;
+    glm::vec2 tile_size;
+    glm::vec2 origin;
+    glm::vec2 axis_u;
+    glm::vec2 axis_v;
+};
+
+// A 32^3 block of the world. Blocks are indices into a palette of the few block types the chunk holds, bit-packed
+// at the smallest power of two width that fits the palette, so a chunk of a single type takes no space at all.
+class VoxelChunk {
+public:
+    static constexpr int32_t SIZE = 32;
+    static constexpr uint32_t VOLUME = SIZE * SIZE * SIZE;
+
+    static uint32_t index(glm::ivec3 local) { return local.x + SIZE * (local.y + SIZE * local.z); }
+
+    VoxelChunk();
+    BlockId get(uint32_t index) const;
+    void set(uint32_t index, BlockId block);
+    size_t memory_size() const { return words.size() * sizeof(uint64_t) + palette.size() * (sizeof(BlockId) + sizeof(uint32_t)); }
+    uint32_t bits() const { return bits_per_block; }
+
+    glm::ivec3 coord{0}; // In chunks
+    bool dirty{false}; // Edited since it was last meshed
+    std::vector<Vertex> vertices; // Triangle list in model space, from the last meshing
+
+private:
+    std::vector<BlockId> palette; // palette[0] is air
+    std::vector<uint32_t> counts; // Blocks using each palette entry, so entries no block uses get reused
+    std::vector<uint64_t> words;
+    uint32_t bits_per_block{0};
+
+    void repack(uint32_t bits);
+};
+
+// A block world built from a triangle soup where every block face is its own pair of triangles, meshed back into
+// as few triangles as it can. Faces are only drawn where a block meets air, and runs of faces with the same texture
+// merge into one quad that repeats the tile across it. Texture coordinates count blocks across each quad, and the
+// tile goes in the vertex color, which mesh_lit.frag turns back into atlas coordinates
+// for materials with MATERIAL_ATLAS_TILES.
+class VoxelWorld {
+public:
+    // Turns the faces that lie on the block grid into blocks, and appends every other triangle to leftovers, with its color zeroed
+    void voxelize(std::span<const Vertex> triangles, std::vector<Vertex>& leftovers);
+    // Meshes every edited chunk across the workers, and appends their coordinates to remeshed
+    void remesh(JobSystem& jobs, std::vector<glm::ivec3>& remeshed);
+
+    BlockId get_block(glm::ivec3 cell) const;
+    void set_block(glm::ivec3 cell, BlockId block); // Marks the chunk, and the neighbours it shares a face with, for meshing
+    // Removes a block. The export leaves out blocks nobody can see, so where the removed block had no face, whatever
+    // was behind it gets that side textured like the removed block, to close the hole.
+    void dig(glm::ivec3 cell);
+    void place(glm::ivec3 cell, BlockId like); // Fills an empty cell with a block textured like another on every side
+    // Walks the grid from origin in model space, and returns the first block hit and the normal of the face it entered by
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float max_distance, glm::ivec3& cell, glm::ivec3& normal) const;
+
+    const VoxelChunk* find_chunk(glm::ivec3 coord) const;
+    bool has_edits() const { return !dirty_chunks.empty(); }
+
+    // Stats
+    std::unordered_map<uint64_t, VoxelChunk> chunks;
+    std::vector<FaceTexture> face_textures{FaceTexture{}}; // 0 is no texture, for faces the export never showed
+    std::vector<std::array<uint16_t, 6>> block_types{{}}; // Face textures in +x, -x, +y, -y, +z, -z order, 0 is air
+    float uv_density{0.0f}; // Atlas units per model unit on the voxel faces, since the block counting coordinates say nothing about it
+    size_t source_triangles{0};
+    size_t voxelized_triangles{0}; // Source triangles that became block faces
+    size_t voxel_triangles{0}; // Drawn for all the chunks, after merging
+    size_t remeshed_chunks{0}; // In the last remesh
+    float remesh_ms{0.0f};
+
+private:
+    std::map<std::array<int32_t, 10>, uint16_t> face_texture_ids;
+    std::map<std::array<uint16_t, 6>, BlockId> block_type_ids;
+    std::vector<uint64_t> dirty_chunks;
+
+    static uint64_t chunk_key(glm::ivec3 coord);
+    VoxelChunk& chunk_at(glm::ivec3 coord);
+    uint16_t add_face_texture(const FaceTexture& face);
+    BlockId add_block_type(const std::array<uint16_t, 6>& faces);
+    BlockId filled_type(BlockId block); // The same block with every face the export left out textured like a neighbouring face
+    void mesh_chunk(VoxelChunk& chunk) const;
+};
+
+// Face directions, as indexed in block types
+constexpr glm::ivec3 FACE_NORMALS[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
@@ -0,0 +1,353 @@
+#include <vk_world.h>
+
+#include <vk_engine.h>
+
+namespace {
+
+uint64_t cell_key(glm::ivec2 cell) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cell.x)) << 32) | static_cast<uint32_t>(cell.y);
+}
+
+// Grid cells and voxel chunks both start at the model space origin, so with the default sizes they line up one to one
+glm::ivec2 voxel_chunk_cell(glm::ivec3 coord, float chunk_size) {
+    glm::vec2 center = (glm::vec2(coord.x, coord.z) + 0.5f) * static_cast<float>(VoxelChunk::SIZE);
+    return glm::ivec2(glm::floor(center / chunk_size));
+}
+
+} // namespace
+
+void ChunkStreamer::init(VulkanEngine* engine) {
+    this->engine = engine;
+    loader = std::thread([this]() { loader_loop(); });
+}
+
+// Resident meshes are still in the engine's mesh pool, which frees them with the rest
+void ChunkStreamer::cleanup() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quitting = true;
+    }
+    wake.notify_all();
+    loader.join();
+    built.clear();
+    build_queue.clear();
+}
+
+bool ChunkStreamer::load_world(const char* filename, Handle<Material> material, glm::vec3 origin, bool voxelize) {
+    Mesh world;
+    if (!world.load_from_obj(filename)) {
+        return false;
+    }
+    this->origin = origin;
+    voxelized = voxelize;
+    std::vector<Vertex> triangles;
+    if (voxelize) {
+        voxels.voxelize(world.vertices, triangles);
+    } else {
+        triangles = std::move(world.vertices);
+    }
+    // Each triangle goes to the cell its centroid falls in, so chunks overlap a little at their edges but never share a triangle
+    for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+        glm::vec3 centroid = (triangles[i].position + triangles[i + 1].position + triangles[i + 2].position) / 3.0f;
+        WorldChunk& chunk = chunks[find_or_add_chunk(glm::ivec2(glm::floor(glm::vec2(centroid.x, centroid.z) / chunk_size)), material)];
+        for (size_t v = i; v < i + 3; v++) {
+            (voxelize ? chunk.leftovers : chunk.source).push_back(triangles[v]);
+            chunk.bounds.grow(triangles[v].position + origin);
+        }
+    }
+    if (voxelize) {
+        std::vector<glm::ivec3> meshed;
+        voxels.remesh(engine->jobs, meshed);
+        for (glm::ivec3 coord : meshed) {
+            chunks[find_or_add_chunk(voxel_chunk_cell(coord, chunk_size), material)].voxel_chunks.push_back(coord);
+        }
+        for (uint32_t i = 0; i < chunks.size(); i++) {
+            rebuild_source(i);
+        }
+    }
+    for (WorldChunk& chunk : chunks) {
+        // Welding only shrinks it, so this never underestimates
+        chunk.gpu_size = chunk.source.size() * (sizeof(Vertex) + sizeof(uint32_t));
+        bounds.grow(chunk.bounds);
+    }
+    return true;
+}
+
+uint32_t ChunkStreamer::find_or_add_chunk(glm::ivec2 cell, Handle<Material> material) {
+    auto [it, inserted] = cell_chunks.try_emplace(cell_key(cell), static_cast<uint32_t>(chunks.size()));
+    if (inserted) {
+        WorldChunk chunk;
+        chunk.cell = cell;
+        chunk.material = material;
+        chunks.push_back(std::move(chunk));
+    }
+    return it->second;
+}
+
+// Only edits chunks that exist, since the loader thread reads from the chunk array
+void ChunkStreamer::apply_edits() {
+    std::vector<glm::ivec3> meshed;
+    voxels.remesh(engine->jobs, meshed);
+    for (glm::ivec3 coord : meshed) {
+        auto it = cell_chunks.find(cell_key(voxel_chunk_cell(coord, chunk_size)));
+        if (it == cell_chunks.end()) {
+            continue;
+        }
+        WorldChunk& chunk = chunks[it->second];
+        if (std::find(chunk.voxel_chunks.begin(), chunk.voxel_chunks.end(), coord) == chunk.voxel_chunks.end()) {
+            chunk.voxel_chunks.push_back(coord);
+        }
+        chunk.edited = true;
+    }
+}
+
+void ChunkStreamer::rebuild_source(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    chunk.source = chunk.leftovers;
+    for (glm::ivec3 coord : chunk.voxel_chunks) {
+        if (const VoxelChunk* voxel_chunk = voxels.find_chunk(coord)) {
+            chunk.source.insert(chunk.source.end(), voxel_chunk->vertices.begin(), voxel_chunk->vertices.end());
+        }
+    }
+    chunk.bounds = Aabb{};
+    for (const Vertex& vertex : chunk.source) {
+        chunk.bounds.grow(vertex.position + origin);
+    }
+    bounds.grow(chunk.bounds);
+    chunk.edited = false;
+    if (chunk.state == ChunkState::Unloaded) {
+        chunk.gpu_size = chunk.source.size() * (sizeof(Vertex) + sizeof(uint32_t));
+    } else {
+        chunk.outdated = true;
+    }
+}
+
+void ChunkStreamer::loader_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&]() { return quitting || !build_queue.empty(); });
+        if (quitting) {
+            return;
+        }
+        uint32_t chunk = build_queue.front();
+        build_queue.erase(build_queue.begin());
+        lock.unlock();
+        Mesh mesh;
+        mesh.vertices = chunks[chunk].source;
+        mesh.compute_bounds();
+        if (voxelized) {
+            mesh.uv_density = voxels.uv_density;
+        }
+        mesh.build_meshlets();
+        lock.lock();
+        built.push_back(BuiltMesh{chunk, std::move(mesh)});
+    }
+}
+
+void ChunkStreamer::update(glm::vec3 camera_position) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<BuiltMesh> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.swap(built);
+    }
+    for (BuiltMesh& result : finished) {
+        finish_build(result.chunk, std::move(result.mesh));
+    }
+    if (voxels.has_edits()) {
+        apply_edits();
+    }
+
+    bool camera_chunk_missing = false;
+    for (uint32_t i = 0; i < chunks.size(); i++) {
+        WorldChunk& chunk = chunks[i];
+        // Ground plane distance to the chunk's box, 0 when the camera is above or below it
+        glm::vec2 position(camera_position.x, camera_position.z);
+        glm::vec2 nearest = glm::clamp(position, glm::vec2(chunk.bounds.min.x, chunk.bounds.min.z), glm::vec2(chunk.bounds.max.x, chunk.bounds.max.z));
+        chunk.distance = glm::length(position - nearest);
+        if (chunk.edited && !source_in_use(chunk)) {
+            rebuild_source(i);
+        }
+        if (chunk.state == ChunkState::Uploading && chunk.uploaded) {
+            make_resident(i);
+        }
+        if (chunk.state == ChunkState::Resident && chunk.next_mesh && chunk.next_uploaded && can_unload()) {
+            swap_mesh(i); // Frees the old mesh, so it waits out a defragmentation pass with next_mesh pending
+        }
+        if (chunk.state == ChunkState::Resident && chunk.outdated && !chunk.refreshing) {
+            if (!chunk.source.empty()) {
+                start_refresh(i);
+            } else if (can_unload()) {
+                unload(i); // Everything in it was dug away
+            }
+        }
+        if (chunk.state == ChunkState::Resident && !chunk.refreshing && chunk.distance > load_radius + hysteresis && can_unload()) {
+            unload(i);
+        }
+        camera_chunk_missing = camera_chunk_missing || (chunk.distance == 0.0f && chunk.state != ChunkState::Resident);
+    }
+    if (camera_chunk_missing) {
+        missing_frames++;
+    }
+
+    // Nearest first. Stay under the VRAM budget as well, which shrinks when other allocations or other processes need the memory.
+    VkDeviceSize limit = std::min(budget, committed_memory + engine->memory.device_headroom());
+    std::vector<uint32_t> wanted;
+    std::vector<uint32_t> resident;
+    for (uint32_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].state == ChunkState::Unloaded && chunks[i].distance <= load_radius && !chunks[i].source.empty()) {
+            wanted.push_back(i);
+        } else if (chunks[i].state == ChunkState::Resident && !chunks[i].refreshing) {
+            resident.push_back(i);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end(), [&](uint32_t a, uint32_t b) { return chunks[a].distance < chunks[b].distance; });
+    std::sort(resident.begin(), resident.end(), [&](uint32_t a, uint32_t b) { return chunks[a].distance > chunks[b].distance; });
+    size_t next_eviction = 0;
+    for (uint32_t index : wanted) {
+        if (in_flight >= max_loads_in_flight) {
+            break;
+        }
+        WorldChunk& chunk = chunks[index];
+        // Only chunks farther out than this one make room for it, so the evicted ones can't push it back out in turn
+        while (committed_memory + chunk.gpu_size > limit && next_eviction < resident.size() && can_unload()
+               && chunks[resident[next_eviction]].distance > chunk.distance) {
+            unload(resident[next_eviction++]);
+        }
+        if (committed_memory + chunk.gpu_size > limit) {
+            break;
+        }
+        start_load(index);
+    }
+
+    update_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    max_update_ms = std::max(max_update_ms, update_ms);
+    if (update_ms > slow_update_threshold_ms) {
+        slow_update_count++;
+    }
+}
+
+void ChunkStreamer::start_load(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    chunk.state = ChunkState::Building;
+    chunk.requested_time = std::chrono::steady_clock::now();
+    committed_memory += chunk.gpu_size;
+    in_flight++;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        build_queue.push_back(index);
+    }
+    wake.notify_one();
+}
+
+void ChunkStreamer::finish_build(uint32_t index, Mesh&& mesh) {
+    WorldChunk& chunk = chunks[index];
+    // The rebuilt mesh of a resident chunk uploads next to the one still drawn
+    if (chunk.refreshing) {
+        chunk.next_mesh = engine->meshes.add(std::move(mesh));
+        committed_memory += engine->meshes.get(chunk.next_mesh)->buffer_size();
+        engine->upload_mesh(*engine->meshes.get(chunk.next_mesh), [this, index]() { chunks[index].next_uploaded = true; });
+        return;
+    }
+    committed_memory -= chunk.gpu_size;
+    // The camera may have moved on while it was building
+    if (chunk.distance > load_radius + hysteresis) {
+        chunk.state = ChunkState::Unloaded;
+        in_flight--;
+        return;
+    }
+    chunk.gpu_size = mesh.buffer_size();
+    committed_memory += chunk.gpu_size;
+    chunk.mesh = engine->meshes.add(std::move(mesh));
+    chunk.uploaded = false;
+    chunk.state = ChunkState::Uploading;
+    engine->upload_mesh(*engine->meshes.get(chunk.mesh), [this, index]() { chunks[index].uploaded = true; });
+}
+
+void ChunkStreamer::make_resident(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    chunk.entity = engine->registry.create(MeshRenderer{chunk.mesh, chunk.material}, WorldTransform{glm::translate(glm::mat4(1.0f), origin)});
+    engine->registry.add(chunk.entity, SpatialProxy{engine->spatial_tree.insert(chunk.bounds, chunk.entity.index)});
+    chunk.state = ChunkState::Resident;
+    in_flight--;
+    resident_count++;
+    load_count++;
+
+    last_latency_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - chunk.requested_time).count();
+    max_latency_ms = std::max(max_latency_ms, last_latency_ms);
+    average_latency_ms += (last_latency_ms - average_latency_ms) / load_count;
+}
+
+// Runs before this frame's draw packets are extracted, so nothing holds a pointer to the mesh
+void ChunkStreamer::unload(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    engine->spatial_tree.remove(engine->registry.get<SpatialProxy>(chunk.entity)->proxy);
+    engine->registry.destroy(chunk.entity);
+    chunk.entity = NULL_ENTITY;
+    free_mesh(chunk.mesh);
+    chunk.mesh = Handle<Mesh>{};
+    chunk.state = ChunkState::Unloaded;
+    chunk.outdated = false;
+    committed_memory -= chunk.gpu_size;
+    chunk.gpu_size = chunk.source.size() * (sizeof(Vertex) + sizeof(uint32_t));
+    resident_count--;
+    unload_count++;
+}
+
+// Frames in flight may still draw from the buffer, which is freed once this frame slot comes around again
+void ChunkStreamer::free_mesh(Handle<Mesh> mesh) {
+    AllocatedBuffer buffer = engine->meshes.get(mesh)->vertex_buffer;
+    VulkanEngine* engine = this->engine;
+    engine->get_current_frame().deletion_queue.push_function([engine, buffer]() { engine->destroy_buffer(buffer); });
+    engine->meshes.remove(mesh);
+}
+
+void ChunkStreamer::start_refresh(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    chunk.refreshing = true;
+    chunk.outdated = false;
+    chunk.next_uploaded = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        build_queue.push_back(index);
+    }
+    wake.notify_one();
+}
+
+// The entity stays put and only its mesh changes, so the draw packets pick up the new one on this frame's extraction
+void ChunkStreamer::swap_mesh(uint32_t index) {
+    WorldChunk& chunk = chunks[index];
+    engine->registry.get<MeshRenderer>(chunk.entity)->mesh = chunk.next_mesh;
+    free_mesh(chunk.mesh);
+    committed_memory -= chunk.gpu_size;
+    chunk.mesh = chunk.next_mesh;
+    chunk.gpu_size = engine->meshes.get(chunk.mesh)->buffer_size();
+    chunk.next_mesh = Handle<Mesh>{};
+    chunk.refreshing = false;
+    engine->spatial_tree.move(engine->registry.get<SpatialProxy>(chunk.entity)->proxy, chunk.bounds);
+    refresh_count++;
+}
+
+bool ChunkStreamer::can_unload() const {
+    return engine->defragmentation.context == VK_NULL_HANDLE;
+}
+
+VkDeviceSize ChunkStreamer::release(VkDeviceSize wanted) {
+    std::vector<uint32_t> resident;
+    for (uint32_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].state == ChunkState::Resident && !chunks[i].refreshing) {
+            resident.push_back(i);
+        }
+    }
+    std::sort(resident.begin(), resident.end(), [&](uint32_t a, uint32_t b) { return chunks[a].distance > chunks[b].distance; });
+    VkDeviceSize freed = 0;
+    for (uint32_t index : resident) {
+        if (freed >= wanted || !can_unload()) {
+            break;
+        }
+        freed += chunks[index].gpu_size;
+        unload(index);
+    }
+    return freed;
+}
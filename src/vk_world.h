@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_mesh.h>
+#include <vk_bvh.h>
+#include <vk_ecs.h>
+#include <vk_handles.h>
+#include <vk_voxel.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class VulkanEngine;
+struct Material;
+
+enum class ChunkState {
+    Unloaded,
+    Building, // Welding and meshlets on the loader thread
+    Uploading, // On the transfer queue
+    Resident, // Drawn, through its entity
+};
+
+// One cell of the world grid. The triangles stay in system memory, standing in for the chunk's file on disk.
+struct WorldChunk {
+    glm::ivec2 cell;
+    Aabb bounds; // World space
+    // Triangle list in model space. Only rewritten while the loader thread isn't building from it.
+    std::vector<Vertex> source;
+    // In a voxel world, the source is the meshes of these voxel chunks followed by the triangles that aren't blocks
+    std::vector<glm::ivec3> voxel_chunks;
+    std::vector<Vertex> leftovers;
+    bool edited{false}; // Its voxels changed since the source was put together
+    bool outdated{false}; // The source changed after the mesh on its way was built from it
+    // A resident chunk keeps drawing its old mesh until the rebuilt one lands
+    bool refreshing{false};
+    Handle<Mesh> next_mesh;
+    bool next_uploaded{false};
+    Handle<Material> material;
+    ChunkState state{ChunkState::Unloaded};
+    Handle<Mesh> mesh;
+    Entity entity{NULL_ENTITY};
+    VkDeviceSize gpu_size{0}; // Estimated from the source until the mesh is built
+    bool uploaded{false}; // Set when the upload lands
+    std::chrono::steady_clock::time_point requested_time;
+    float distance{0.0f}; // From the camera on the ground plane, as of the last update
+};
+
+// Splits a world model into square chunks on the ground plane and keeps the ones around the camera on the GPU.
+// Chunks within load_radius load nearest first, building their meshes on a loader thread and uploading on the transfer queue.
+// They only unload once they are hysteresis further out, so moving back and forth across the edge doesn't reload them.
+// When the budget is full, a nearer chunk takes the place of the farthest resident one.
+// A voxelized world can be edited. The edited voxel chunks are re-meshed, and the grid chunks they're in rebuild their meshes.
+class ChunkStreamer {
+public:
+    void init(VulkanEngine* engine);
+    void cleanup();
+    // Returns false when the file can't be read. Chunks are placed with their model space origin at origin.
+    // With voxelize, block faces become voxels, and the material has to understand voxel vertices, like one with MATERIAL_ATLAS_TILES.
+    bool load_world(const char* filename, Handle<Material> material, glm::vec3 origin, bool voxelize = false);
+    void update(glm::vec3 camera_position); // Once per frame, before the renderables are extracted
+    glm::vec3 world_origin() const { return origin; }
+    VkDeviceSize release(VkDeviceSize wanted); // Unloads the farthest chunks. Returns how much was freed.
+    const Aabb& world_bounds() const { return bounds; }
+
+    float chunk_size{32.0f};
+    float load_radius{96.0f};
+    float hysteresis{24.0f};
+    VkDeviceSize budget{128ull * 1024 * 1024};
+    uint32_t max_loads_in_flight{4};
+    float slow_update_threshold_ms{2.0f}; // Calls to update that take longer count as slow. Only the streamer's own time, not the whole frame
+    VoxelWorld voxels; // Empty unless the world was voxelized. Edits show up on the next update.
+
+    // Stats
+    std::vector<WorldChunk> chunks;
+    VkDeviceSize committed_memory{0}; // Resident chunks plus the ones on their way
+    uint32_t resident_count{0};
+    uint32_t load_count{0};
+    uint32_t unload_count{0};
+    float last_latency_ms{0.0f}; // From deciding to load a chunk to its first frame on screen
+    float average_latency_ms{0.0f};
+    float max_latency_ms{0.0f};
+    float update_ms{0.0f};
+    float max_update_ms{0.0f};
+    uint32_t slow_update_count{0};
+    uint32_t missing_frames{0}; // Frames where the chunk under the camera wasn't resident yet
+    uint32_t refresh_count{0}; // Edited chunks whose mesh was swapped while resident
+
+private:
+    struct BuiltMesh {
+        uint32_t chunk;
+        Mesh mesh;
+    };
+
+    void loader_loop();
+    void start_load(uint32_t chunk);
+    void finish_build(uint32_t chunk, Mesh&& mesh);
+    void make_resident(uint32_t chunk);
+    void unload(uint32_t chunk);
+    bool can_unload() const; // Not while defragmentation may be moving the mesh buffers
+    uint32_t find_or_add_chunk(glm::ivec2 cell, Handle<Material> material);
+    void apply_edits();
+    void rebuild_source(uint32_t chunk);
+    bool source_in_use(const WorldChunk& chunk) const { return chunk.state == ChunkState::Building || (chunk.refreshing && !chunk.next_mesh); }
+    void start_refresh(uint32_t chunk);
+    void swap_mesh(uint32_t chunk);
+    void free_mesh(Handle<Mesh> mesh);
+
+    VulkanEngine* engine{nullptr};
+    Aabb bounds;
+    glm::vec3 origin{0.0f};
+    uint32_t in_flight{0};
+    bool voxelized{false};
+    std::unordered_map<uint64_t, uint32_t> cell_chunks;
+
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quitting{false};
+    std::vector<uint32_t> build_queue; // Guarded by mutex
+    std::vector<BuiltMesh> built; // Guarded by mutex
+};
@@ -0,0 +1,130 @@
+#include <vk_bc.h>
+#include <vk_ktx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+// Converts a PNG (or anything stb_image reads) into a block compressed KTX2 file with a full mip chain.
+// Usage: texture_converter <input> <output.ktx2> [--format bc1|bc3|bc7|rgba8] [--linear]
+
+static float srgb_to_linear(uint8_t value) {
+    float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linear_to_srgb(float c) {
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::clamp(std::lround(c * 255.0f), 0l, 255l));
+}
+
+// Halves the image with a box filter. Color is averaged in linear space for sRGB textures, otherwise mips darken.
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height, bool srgb) {
+    uint32_t half_width = std::max(1u, width / 2);
+    uint32_t half_height = std::max(1u, height / 2);
+    std::vector<uint8_t> result(static_cast<size_t>(half_width) * half_height * 4);
+    for (uint32_t y = 0; y < half_height; y++) {
+        for (uint32_t x = 0; x < half_width; x++) {
+            float sum[4] = {};
+            for (uint32_t dy = 0; dy < 2; dy++) {
+                for (uint32_t dx = 0; dx < 2; dx++) {
+                    uint32_t sx = std::min(x * 2 + dx, width - 1);
+                    uint32_t sy = std::min(y * 2 + dy, height - 1);
+                    const uint8_t* pixel = &rgba[(static_cast<size_t>(sy) * width + sx) * 4];
+                    for (int c = 0; c < 4; c++) {
+                        sum[c] += (srgb && c < 3) ? srgb_to_linear(pixel[c]) : pixel[c] / 255.0f;
+                    }
+                }
+            }
+            uint8_t* out = &result[(static_cast<size_t>(y) * half_width + x) * 4];
+            for (int c = 0; c < 4; c++) {
+                float average = sum[c] / 4.0f;
+                out[c] = (srgb && c < 3) ? linear_to_srgb(average) : static_cast<uint8_t>(std::lround(average * 255.0f));
+            }
+        }
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: texture_converter <input> <output.ktx2> [--format bc1|bc3|bc7|rgba8] [--linear]" << std::endl;
+        return 1;
+    }
+    const char* input = argv[1];
+    const char* output = argv[2];
+    std::string format_name = "bc7";
+    bool srgb = true;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format_name = argv[++i];
+        } else if (strcmp(argv[i], "--linear") == 0) {
+            srgb = false; // Normal maps and other data textures
+        } else {
+            std::cout << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    bc::Format bc_format = bc::Format::BC7;
+    ktx::Texture texture;
+    if (format_name == "bc1") {
+        bc_format = bc::Format::BC1;
+        texture.format = srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    } else if (format_name == "bc3") {
+        bc_format = bc::Format::BC3;
+        texture.format = srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+    } else if (format_name == "bc7") {
+        texture.format = srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+    } else if (format_name == "rgba8") {
+        texture.format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    } else {
+        std::cout << "Unknown format " << format_name << std::endl;
+        return 1;
+    }
+
+    int texW, texH, texChannels;
+    stbi_uc* pixels = stbi_load(input, &texW, &texH, &texChannels, STBI_rgb_alpha);
+    if (!pixels) {
+        std::cout << "Failed to load texture file " << input << std::endl;
+        return 1;
+    }
+    texture.width = static_cast<uint32_t>(texW);
+    texture.height = static_cast<uint32_t>(texH);
+    std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(texW) * texH * 4);
+    stbi_image_free(pixels);
+
+    // Same chain length the engine builds for PNGs, down to 1x1
+    uint32_t width = texture.width;
+    uint32_t height = texture.height;
+    size_t uncompressed_size = 0;
+    size_t compressed_size = 0;
+    while (true) {
+        if (format_name == "rgba8") {
+            texture.levels.push_back(level);
+        } else {
+            texture.levels.push_back(bc::encode_image(bc_format, level.data(), width, height));
+        }
+        uncompressed_size += level.size();
+        compressed_size += texture.levels.back().size();
+        if (width == 1 && height == 1) {
+            break;
+        }
+        level = downsample(level, width, height, srgb);
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+
+    if (!ktx::write_file(output, texture)) {
+        std::cout << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << output << ": " << texture.width << "x" << texture.height << ", " << texture.levels.size() << " levels, "
+              << compressed_size / 1024 << " KiB (" << uncompressed_size / 1024 << " KiB as RGBA8)" << std::endl;
+    return 0;
+}